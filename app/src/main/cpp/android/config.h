@@ -5,3 +5,8 @@
 #define HAVE_GL 0
 
 #define HAVE_GLES 1
+
+#define ENABLE_TRACE 0
+
+// 0 off, 1 sampled, 2 per frame, 3 per call, see gl-stats.h
+#define GL_ERROR_CHECK 2
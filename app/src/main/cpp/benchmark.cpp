@@ -0,0 +1,544 @@
+/* Benchmarks of the CPU side of the pipeline, no GPU needed.
+ *
+ *   tonemap-benchmark [options] [low.jpg high.jpg]
+ *     --sizes=640x480,1920x1080   synthetic image sizes
+ *     --threads=1,4               worker counts of the threaded kernels, the
+ *                                   conversions run split over as many threads
+ *     --warmup=3 --reps=10        runs before measuring, measured runs
+ *     --filter=<substring>        only benchmarks whose name contains it
+ *     --save=<file>               write the medians as a baseline
+ *     --compare=<file>            compare with a baseline, exit 1 when a
+ *     --threshold=10                benchmark got slower by more percent
+ *
+ * Image files, when given, add decode and merge of real content.
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "buffer-pool.h"
+#include "etc2-encoder.h"
+#include "image_decoder.h"
+#include "image_merge.h"
+#include "perf-monitor.h"
+#include "pixel-convert.h"
+
+using namespace quink;
+
+struct Options {
+    std::vector<std::pair<int, int>> mSizes = {{640, 480}, {1920, 1080}};
+    std::vector<int> mThreads;
+    int mWarmup = 3;
+    int mReps = 10;
+    std::string mFilter;
+    std::string mSave;
+    std::string mCompare;
+    double mThreshold = 10.0;
+    std::vector<std::string> mFiles;
+};
+
+struct Result {
+    std::string mName;
+    double mMedianNs = 0;
+    double mMinNs = 0;
+    double mStddevNs = 0;
+    double mCycles = -1;    // median, -1 when no counter is available
+    double mPixels = 0;
+    double mBytes = 0;
+    double mOps = 0;
+};
+
+/* CPU cycles from the kernel's hardware counter, falling back to the time
+ * stamp counter on x86, which ticks at a constant rate close to nominal
+ * frequency.
+ */
+class CycleCounter {
+public:
+    CycleCounter() {
+#if defined(__linux__)
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1;
+        mFd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    ~CycleCounter() {
+        if (mFd >= 0)
+            close(mFd);
+    }
+
+    const char *Source() const {
+        if (mFd >= 0)
+            return "perf cycles";
+#if defined(__x86_64__) || defined(__i386__)
+        return "tsc";
+#else
+        return nullptr;
+#endif
+    }
+
+    long long Read() const {
+        if (mFd >= 0) {
+            long long value = 0;
+            if (read(mFd, &value, sizeof(value)) == sizeof(value))
+                return value;
+            return -1;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        return (long long)__rdtsc();
+#else
+        return -1;
+#endif
+    }
+
+private:
+    int mFd = -1;
+};
+
+static std::vector<std::string> Split(const std::string &s, char sep) {
+    std::vector<std::string> out;
+    std::stringstream ss(s);
+    for (std::string item; std::getline(ss, item, sep);) {
+        if (!item.empty())
+            out.push_back(item);
+    }
+    return out;
+}
+
+// -1 with a message unless text is a number of type T in [min, max]
+template <typename T>
+static int ParseNumber(const char *name, const std::string &text, T min, T max, T &value) {
+    char *end = nullptr;
+    errno = 0;
+    const double number = strtod(text.c_str(), &end);
+    if (text.empty() || *end || errno || !(number >= min && number <= max) ||
+            (std::is_integral<T>::value && number != floor(number))) {
+        fprintf(stderr, "bad %s '%s', expect a%s number in [%g, %g]\n", name, text.c_str(),
+                std::is_integral<T>::value ? "n integer" : "", (double)min, (double)max);
+        return -1;
+    }
+    value = static_cast<T>(number);
+    return 0;
+}
+
+static int ParseArgs(int argc, char *argv[], Options &opt) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0) {
+            opt.mFiles.push_back(arg);
+            continue;
+        }
+        auto pos = arg.find('=');
+        if (pos == std::string::npos) {
+            fprintf(stderr, "option %s needs a value\n", arg.c_str());
+            return -1;
+        }
+        std::string key = arg.substr(2, pos - 2);
+        std::string value = arg.substr(pos + 1);
+        if (key == "sizes") {
+            opt.mSizes.clear();
+            for (auto &size : Split(value, ',')) {
+                auto x = size.find('x');
+                int w = 0, h = 0;
+                if (x == std::string::npos) {
+                    fprintf(stderr, "bad size %s, expect <width>x<height>\n", size.c_str());
+                    return -1;
+                }
+                if (ParseNumber("--sizes width", size.substr(0, x), 1, 1 << 15, w) ||
+                        ParseNumber("--sizes height", size.substr(x + 1), 1, 1 << 15, h))
+                    return -1;
+                opt.mSizes.emplace_back(w, h);
+            }
+            if (opt.mSizes.empty()) {
+                fprintf(stderr, "--sizes needs at least one size\n");
+                return -1;
+            }
+        } else if (key == "threads") {
+            opt.mThreads.clear();
+            for (auto &n : Split(value, ',')) {
+                int threads = 0;
+                if (ParseNumber("--threads", n, 1, 256, threads))
+                    return -1;
+                opt.mThreads.push_back(threads);
+            }
+            if (opt.mThreads.empty()) {
+                fprintf(stderr, "--threads needs at least one count\n");
+                return -1;
+            }
+        } else if (key == "warmup") {
+            if (ParseNumber("--warmup", value, 0, 1000, opt.mWarmup))
+                return -1;
+        } else if (key == "reps") {
+            if (ParseNumber("--reps", value, 1, 100000, opt.mReps))
+                return -1;
+        } else if (key == "filter") {
+            opt.mFilter = value;
+        } else if (key == "save") {
+            opt.mSave = value;
+        } else if (key == "compare") {
+            opt.mCompare = value;
+        } else if (key == "threshold") {
+            if (ParseNumber("--threshold", value, 0.0, 10000.0, opt.mThreshold))
+                return -1;
+        } else {
+            fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return -1;
+        }
+    }
+    if (opt.mThreads.empty()) {
+        opt.mThreads.push_back(1);
+        int cores = (int)std::thread::hardware_concurrency();
+        if (cores > 1)
+            opt.mThreads.push_back(cores);
+    }
+    return 0;
+}
+
+class Suite {
+public:
+    Suite(const Options &opt) : mOpt(opt) { }
+
+    /* f() is one measured run processing the given amount of work; ops
+     * counts operations for kernels where pixels do not apply.
+     */
+    template <typename F>
+    void Run(const std::string &name, double pixels, double bytes, double ops, F f) {
+        if (!mOpt.mFilter.empty() && name.find(mOpt.mFilter) == std::string::npos)
+            return;
+        for (int i = 0; i < mOpt.mWarmup; i++)
+            f();
+
+        std::vector<double> times(mOpt.mReps);
+        std::vector<double> cycles;
+        for (int i = 0; i < mOpt.mReps; i++) {
+            long long c1 = mCycles.Read();
+            auto t1 = std::chrono::steady_clock::now();
+            f();
+            auto t2 = std::chrono::steady_clock::now();
+            long long c2 = mCycles.Read();
+            times[i] = std::chrono::duration<double, std::nano>(t2 - t1).count();
+            if (c1 >= 0 && c2 >= c1)
+                cycles.push_back((double)(c2 - c1));
+        }
+
+        Result r;
+        r.mName = name;
+        r.mPixels = pixels;
+        r.mBytes = bytes;
+        r.mOps = ops;
+        r.mMedianNs = Median(times);
+        r.mMinNs = *std::min_element(times.begin(), times.end());
+        double mean = 0;
+        for (double t : times)
+            mean += t;
+        mean /= times.size();
+        for (double t : times)
+            r.mStddevNs += (t - mean) * (t - mean);
+        r.mStddevNs = sqrt(r.mStddevNs / times.size());
+        if (cycles.size() == times.size())
+            r.mCycles = Median(cycles);
+        Print(r);
+        mResults.push_back(r);
+    }
+
+    const std::vector<Result> &Results() const { return mResults; }
+    const char *CycleSource() const { return mCycles.Source(); }
+
+private:
+    static double Median(std::vector<double> v) {
+        std::sort(v.begin(), v.end());
+        size_t n = v.size();
+        return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+    }
+
+    static void Print(const Result &r) {
+        printf("%-36s %10.3f ms (min %10.3f) +-%5.1f%%", r.mName.c_str(), r.mMedianNs / 1e6,
+                r.mMinNs / 1e6, r.mMedianNs > 0 ? r.mStddevNs / r.mMedianNs * 100 : 0.0);
+        if (r.mPixels > 0)
+            printf(" %9.1f MP/s", r.mPixels / r.mMedianNs * 1e3);
+        if (r.mBytes > 0)
+            printf(" %7.2f GB/s", r.mBytes / r.mMedianNs);
+        if (r.mOps > 0)
+            printf(" %9.2f ns/op", r.mMedianNs / r.mOps);
+        if (r.mCycles >= 0 && r.mPixels > 0)
+            printf(" %8.2f cyc/px", r.mCycles / r.mPixels);
+        else if (r.mCycles >= 0 && r.mOps > 0)
+            printf(" %8.2f cyc/op", r.mCycles / r.mOps);
+        printf("\n");
+        fflush(stdout);
+    }
+
+    const Options &mOpt;
+    CycleCounter mCycles;
+    std::vector<Result> mResults;
+};
+
+static std::shared_ptr<Image<uint8_t>> SyntheticImage(int width, int height, int seed) {
+    auto img = std::make_shared<Image<uint8_t>>(width, height);
+    uint32_t state = seed * 2654435761u + 1;
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = img->mData.get() + (size_t)y * width * 3;
+        for (int x = 0; x < width; x++) {
+            state = state * 1664525u + 1013904223u;
+            row[x * 3] = (uint8_t)((x * 255 / width + seed * 40) & 255);
+            row[x * 3 + 1] = (uint8_t)(y * 255 / height);
+            row[x * 3 + 2] = (uint8_t)(state >> 24);
+        }
+    }
+    return img;
+}
+
+static std::shared_ptr<Image<float>> SyntheticHdr(int width, int height) {
+    auto img = std::make_shared<Image<float>>(width, height);
+    const size_t values = (size_t)width * height * 3;
+    for (size_t i = 0; i < values; i++)
+        img->mData[i] = (float)((i * 2654435761u) % 16000) / 1000.0f;
+    return img;
+}
+
+static std::string SizeName(int width, int height) {
+    return std::to_string(width) + "x" + std::to_string(height);
+}
+
+/* f(first, last) over [0, count) split in contiguous ranges, one thread
+ * each, so the memory bound kernels show how far they scale with cores.
+ */
+template <typename F>
+static void ForEachRange(size_t count, int threads, F f) {
+    threads = (int)std::min<size_t>(threads, count);
+    if (threads <= 1) {
+        f(0, count);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threads; i++)
+        workers.emplace_back([=, &f]() { f(count * i / threads, count * (i + 1) / threads); });
+    f(0, count / threads);
+    for (auto &t : workers)
+        t.join();
+}
+
+static void RunKernels(Suite &suite, const Options &opt) {
+    for (auto &size : opt.mSizes) {
+        const int w = size.first;
+        const int h = size.second;
+        const double pixels = (double)w * h;
+        const std::string dim = SizeName(w, h);
+        auto low = SyntheticImage(w, h, 0);
+        auto high = SyntheticImage(w, h, 1);
+
+        auto hdr = SyntheticHdr(w, h);
+        auto rgba = BufferPool::Instance().Acquire((size_t)pixels * 4);
+        auto halfs = BufferPool::Instance().Acquire((size_t)pixels * 4 * sizeof(uint16_t));
+        auto packed = BufferPool::Instance().Acquire((size_t)pixels * sizeof(uint32_t));
+        const uint8_t *rgb = low->mData.get();
+        const float *rgbFloat = hdr->mData.get();
+        suite.Run("rgb-to-rgba/scalar/" + dim, pixels, pixels * 7, 0, [&]() {
+            PixelConvert::RGBToRGBAScalar(rgb, rgba.As<uint8_t>(), (size_t)pixels);
+        });
+        suite.Run("float-to-half/scalar/" + dim, pixels, pixels * 3 * 6, 0, [&]() {
+            PixelConvert::FloatToHalfScalar(rgbFloat, halfs.As<uint16_t>(), (size_t)pixels * 3);
+        });
+        suite.Run("rgb-float-to-rgba-half/scalar/" + dim, pixels, pixels * 20, 0, [&]() {
+            PixelConvert::RGBFloatToRGBAHalfScalar(rgbFloat, halfs.As<uint16_t>(), (size_t)pixels);
+        });
+        for (int threads : opt.mThreads) {
+            const std::string suffix = "/t" + std::to_string(threads) + "/" + dim;
+            suite.Run("rgb-to-rgba/simd" + suffix, pixels, pixels * 7, 0, [&]() {
+                ForEachRange((size_t)pixels, threads, [&](size_t first, size_t last) {
+                    PixelConvert::RGBToRGBA(rgb + first * 3, rgba.As<uint8_t>() + first * 4,
+                            last - first);
+                });
+            });
+            suite.Run("float-to-half/simd" + suffix, pixels, pixels * 3 * 6, 0, [&]() {
+                ForEachRange((size_t)pixels, threads, [&](size_t first, size_t last) {
+                    PixelConvert::FloatToHalf(rgbFloat + first * 3,
+                            halfs.As<uint16_t>() + first * 3, (last - first) * 3);
+                });
+            });
+            suite.Run("rgb-float-to-rgba-half/simd" + suffix, pixels, pixels * 20, 0, [&]() {
+                ForEachRange((size_t)pixels, threads, [&](size_t first, size_t last) {
+                    PixelConvert::RGBFloatToRGBAHalf(rgbFloat + first * 3,
+                            halfs.As<uint16_t>() + first * 4, last - first);
+                });
+            });
+            suite.Run("rgb-float-to-r11g11b10f" + suffix, pixels, pixels * 16, 0, [&]() {
+                ForEachRange((size_t)pixels, threads, [&](size_t first, size_t last) {
+                    PixelConvert::RGBFloatToR11G11B10F(rgbFloat + first * 3,
+                            packed.As<uint32_t>() + first, last - first);
+                });
+            });
+            suite.Run("rgb-float-to-rgb9e5" + suffix, pixels, pixels * 16, 0, [&]() {
+                ForEachRange((size_t)pixels, threads, [&](size_t first, size_t last) {
+                    PixelConvert::RGBFloatToRGB9E5(rgbFloat + first * 3,
+                            packed.As<uint32_t>() + first, last - first);
+                });
+            });
+            suite.Run("etc2-rgb" + suffix, pixels, pixels * 3, 0, [&]() {
+                Etc2Encoder::Encode(*low, threads);
+            });
+            suite.Run("etc2-rgbm" + suffix, pixels, pixels * 12, 0, [&]() {
+                Etc2Encoder::EncodeRGBM(*hdr, threads);
+            });
+        }
+        rgba.Reset();
+        halfs.Reset();
+        packed.Reset();
+
+        // two 8-bit exposures in, one image out
+        suite.Run("merge/uint8/" + dim, pixels, pixels * (6 + 3), 0, [&]() {
+            ImageMerge::Merge<uint8_t>(low, high);
+        });
+        suite.Run("merge/float/" + dim, pixels, pixels * (6 + 12), 0, [&]() {
+            ImageMerge::Merge<float>(low, high);
+        });
+    }
+
+    const int kOps = 1000000;
+    PerfMonitor perf(100, [](long long) { });
+    auto now = std::chrono::high_resolution_clock::now();
+    suite.Run("perf-monitor/update-duration", 0, 0, kOps, [&]() {
+        for (int i = 0; i < kOps; i++)
+            perf.Update(std::chrono::high_resolution_clock::duration(i));
+    });
+    suite.Run("perf-monitor/update-time-point", 0, 0, kOps, [&]() {
+        for (int i = 0; i < kOps; i++)
+            perf.Update(now + std::chrono::microseconds(i));
+    });
+    PerfMonitor counter(100, [](long long) { });
+    suite.Run("perf-monitor/update-value", 0, 0, kOps, [&]() {
+        for (int i = 0; i < kOps; i++)
+            counter.Update((long long)i);
+    });
+
+    const int kAcquires = 100000;
+    suite.Run("buffer-pool/acquire-8MB", 0, 0, kAcquires, [&]() {
+        for (int i = 0; i < kAcquires; i++)
+            BufferPool::Instance().Acquire(8 << 20);
+    });
+}
+
+static void RunFiles(Suite &suite, const Options &opt) {
+    std::vector<std::shared_ptr<Image<uint8_t>>> imgs;
+    for (auto &file : opt.mFiles) {
+        auto wrapper = ImageLoader::LoadImage(file);
+        if (wrapper.Empty()) {
+            fprintf(stderr, "cannot decode %s\n", file.c_str());
+            continue;
+        }
+        auto img = wrapper.GetImg<uint8_t>();
+        imgs.push_back(img);
+        const double pixels = (double)img->mWidth * img->mHeight;
+        std::string base = file.substr(file.rfind('/') + 1);
+        suite.Run("decode/" + base, pixels, pixels * 3, 0, [&]() {
+            ImageLoader::LoadImage(file);
+        });
+    }
+    if (imgs.size() >= 2 && imgs[0]->mWidth == imgs[1]->mWidth &&
+            imgs[0]->mHeight == imgs[1]->mHeight) {
+        const double pixels = (double)imgs[0]->mWidth * imgs[0]->mHeight;
+        suite.Run("merge/uint8/files", pixels, pixels * (6 + 3), 0, [&]() {
+            ImageMerge::Merge<uint8_t>(imgs[0], imgs[1]);
+        });
+        suite.Run("merge/float/files", pixels, pixels * (6 + 12), 0, [&]() {
+            ImageMerge::Merge<float>(imgs[0], imgs[1]);
+        });
+    }
+}
+
+static int Save(const std::string &path, const std::vector<Result> &results) {
+    std::ofstream out(path);
+    if (!out) {
+        fprintf(stderr, "cannot write %s\n", path.c_str());
+        return -1;
+    }
+    out << "# benchmark median_ns\n";
+    for (auto &r : results)
+        out << r.mName << " " << (long long)r.mMedianNs << "\n";
+    return out ? 0 : -1;
+}
+
+// 1 when something regressed beyond the threshold
+static int Compare(const std::string &path, const std::vector<Result> &results, double threshold) {
+    std::ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "cannot read %s\n", path.c_str());
+        return -1;
+    }
+    std::map<std::string, double> baseline;
+    for (std::string line; std::getline(in, line);) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream ss(line);
+        std::string name;
+        double ns;
+        if (ss >> name >> ns)
+            baseline[name] = ns;
+    }
+
+    int regressions = 0;
+    printf("\n%-36s %12s %12s %8s\n", "benchmark", "baseline ms", "current ms", "change");
+    for (auto &r : results) {
+        auto it = baseline.find(r.mName);
+        if (it == baseline.end() || it->second <= 0)
+            continue;
+        double change = (r.mMedianNs - it->second) / it->second * 100;
+        bool regressed = change > threshold;
+        regressions += regressed;
+        printf("%-36s %12.3f %12.3f %+7.1f%%%s\n", r.mName.c_str(), it->second / 1e6,
+                r.mMedianNs / 1e6, change, regressed ? "  REGRESSION" : "");
+    }
+    printf("%d regression(s) over %.1f%%\n", regressions, threshold);
+    return regressions ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt;
+    if (ParseArgs(argc, argv, opt))
+        return 2;
+
+    Suite suite(opt);
+    printf("warmup %d, reps %d, cycles from %s\n", opt.mWarmup, opt.mReps,
+            suite.CycleSource() ? suite.CycleSource() : "nowhere");
+    RunKernels(suite, opt);
+    RunFiles(suite, opt);
+
+    if (!opt.mSave.empty() && Save(opt.mSave, suite.Results()))
+        return 2;
+    if (!opt.mCompare.empty()) {
+        int ret = Compare(opt.mCompare, suite.Results(), opt.mThreshold);
+        return ret < 0 ? 2 : ret;
+    }
+    return 0;
+}
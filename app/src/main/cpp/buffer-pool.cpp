@@ -0,0 +1,368 @@
+#include "buffer-pool.h"
+
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <utility>
+
+#include "log.h"
+
+namespace quink {
+
+BufferPool::Buffer::Buffer(BufferPool *pool, void *data, size_t size, size_t capacity) :
+    mPool(pool),
+    mData(data),
+    mSize(size),
+    mCapacity(capacity) {
+}
+
+BufferPool::Buffer::Buffer(Buffer &&other) :
+    mPool(other.mPool),
+    mData(other.mData),
+    mSize(other.mSize),
+    mCapacity(other.mCapacity) {
+    other.mPool = nullptr;
+    other.mData = nullptr;
+    other.mSize = other.mCapacity = 0;
+}
+
+BufferPool::Buffer &BufferPool::Buffer::operator=(Buffer &&other) {
+    if (this != &other) {
+        Reset();
+        std::swap(mPool, other.mPool);
+        std::swap(mData, other.mData);
+        std::swap(mSize, other.mSize);
+        std::swap(mCapacity, other.mCapacity);
+    }
+    return *this;
+}
+
+BufferPool::Buffer::~Buffer() {
+    Reset();
+}
+
+void BufferPool::Buffer::Reset() {
+    if (mData)
+        mPool->Release(mData, mCapacity);
+    mPool = nullptr;
+    mData = nullptr;
+    mSize = mCapacity = 0;
+}
+
+BufferPool &BufferPool::Instance() {
+    static BufferPool pool;
+    return pool;
+}
+
+BufferPool::~BufferPool() {
+    Trim();
+}
+
+void BufferPool::SetLimit(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mLimit = bytes;
+    TrimLocked(0);
+}
+
+void BufferPool::SetHugePages(bool enable) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mHugePages = enable;
+}
+
+size_t BufferPool::SizeClass(size_t bytes) {
+    if (bytes <= kAlignment)
+        return kAlignment;
+
+    // four classes per power of two: 1, 1.25, 1.5 and 1.75 times
+    size_t power = 1;
+    while (power <= bytes / 2)
+        power *= 2;
+    size_t step = power / 4;
+    size_t size = (bytes + step - 1) / step * step;
+
+    size_t align = kAlignment;
+    if (size > kSmallLimit)
+        align = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return (size + align - 1) / align * align;
+}
+
+void *BufferPool::Allocate(size_t capacity) {
+    void *data = nullptr;
+    if (capacity <= kSmallLimit) {
+        if (posix_memalign(&data, kAlignment, capacity))
+            return nullptr;
+        return data;
+    }
+
+    data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+        return nullptr;
+#ifdef MADV_HUGEPAGE
+    if (mHugePages)
+        madvise(data, capacity, MADV_HUGEPAGE);
+#endif
+    return data;
+}
+
+void BufferPool::Free(void *data, size_t capacity) {
+    if (capacity <= kSmallLimit)
+        free(data);
+    else
+        munmap(data, capacity);
+}
+
+bool BufferPool::TrimLocked(size_t needed) {
+    if (!mLimit)
+        return true;
+    // largest classes first, they give back the most per call
+    for (auto it = mFree.rbegin(); it != mFree.rend(); ++it) {
+        auto &list = it->second;
+        while (!list.empty() && mStats.mCurrentBytes + needed > mLimit) {
+            Free(list.back(), it->first);
+            list.pop_back();
+            mStats.mCurrentBytes -= it->first;
+            mStats.mCachedBytes -= it->first;
+        }
+    }
+    return mStats.mCurrentBytes + needed <= mLimit;
+}
+
+BufferPool::Buffer BufferPool::Acquire(size_t bytes) {
+    if (!bytes)
+        return Buffer();
+
+    const size_t capacity = SizeClass(bytes);
+    std::lock_guard<std::mutex> lock(mLock);
+
+    auto it = mFree.find(capacity);
+    if (it != mFree.end() && !it->second.empty()) {
+        void *data = it->second.back();
+        it->second.pop_back();
+        mStats.mCachedBytes -= capacity;
+        mStats.mReuses++;
+        return Buffer(this, data, bytes, capacity);
+    }
+
+    if (!TrimLocked(capacity)) {
+        mStats.mFailures++;
+        ALOGE("buffer pool limit %zu reached, cannot allocate %zu bytes", mLimit, bytes);
+        return Buffer();
+    }
+    void *data = Allocate(capacity);
+    if (!data) {
+        mStats.mFailures++;
+        ALOGE("allocate %zu bytes failed", capacity);
+        return Buffer();
+    }
+    mStats.mAllocations++;
+    mStats.mCurrentBytes += capacity;
+    if (mStats.mCurrentBytes > mStats.mPeakBytes)
+        mStats.mPeakBytes = mStats.mCurrentBytes;
+    return Buffer(this, data, bytes, capacity);
+}
+
+void BufferPool::Release(void *data, size_t capacity) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mFree[capacity].push_back(data);
+    mStats.mCachedBytes += capacity;
+}
+
+void BufferPool::Trim() {
+    std::lock_guard<std::mutex> lock(mLock);
+    for (auto &item : mFree) {
+        for (void *data : item.second) {
+            Free(data, item.first);
+            mStats.mCurrentBytes -= item.first;
+            mStats.mCachedBytes -= item.first;
+        }
+        item.second.clear();
+    }
+}
+
+BufferPool::Stats BufferPool::GetStats() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mStats;
+}
+
+}
+
+#ifdef TEST_BUFFER_POOL
+/* Frames as main.cpp draws them, with the images streamed so every frame
+ * goes through the CPU upload path, must not allocate once warmed up:
+ *   g++ -DTEST_BUFFER_POOL buffer-pool.cpp render.cpp opengl-helper.cpp
+ *       gl-state.cpp gl-stats.cpp gl-caps.cpp texture-pool.cpp texture-cache.cpp
+ *       pixel-convert.cpp etc2-encoder.cpp frame-capture.cpp frame-pacer.cpp
+ *       hud.cpp perf-monitor.cpp residency.cpp trace.cpp -lEGL -lGLESv2 -lpthread
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include <array>
+#include <atomic>
+#include <new>
+
+#include "frame-pacer.h"
+#include "gl-stats.h"
+#include "hud.h"
+#include "opengl-helper.h"
+#include "perf-monitor.h"
+#include "residency.h"
+#include "texture-pool.h"
+
+using namespace quink;
+
+// count every operator new, the steady state frames must not do any
+static std::atomic<long> gNewCount(0);
+
+// out of line, inlined ones make the compiler warn about free() on memory
+// from operator new
+__attribute__((noinline)) void *operator new(size_t size) {
+    gNewCount++;
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+static HostImage CreateImages(int width, int height, bool hdr) {
+    HostImage host;
+    if (hdr) {
+        host.mImageFloat = std::make_shared<Image<float>>(width, height);
+        for (size_t i = 0; i < (size_t)width * height * 3; i++)
+            host.mImageFloat->mData[i] = (i % 1021) / 256.0f;
+    } else {
+        host.mImage8 = std::make_shared<Image<uint8_t>>(width, height);
+        for (size_t i = 0; i < (size_t)width * height * 3; i++)
+            host.mImage8->mData[i] = (uint8_t)(i * 7);
+    }
+    return host;
+}
+
+int main()
+{
+    const int width = 640;
+    const int height = 360;
+    if (OpenGL_Helper::CreatePbufferContext(width, height)) {
+        printf("no GL context\n");
+        return 1;
+    }
+    BufferPool &pool = BufferPool::Instance();
+    pool.SetHugePages(true);
+
+    // the preview first, as main.cpp shows it while the full images decode
+    std::array<std::unique_ptr<ResidentImage>, 2> images;
+    std::array<std::unique_ptr<Render>, 2> renders;
+    for (size_t i = 0; i < images.size(); i++) {
+        images[i].reset(new ResidentImage(i ? "hdr" : "ldr", nullptr,
+                CreateImages(width / 4, height / 4, i == 1)));
+        renders[i].reset(Render::Create("Plain"));
+        if (renders[i]->Init()) {
+            printf("FAIL: init\n");
+            return 1;
+        }
+    }
+    Residency::Instance().SetPolicy(Residency::Policy::Stream);
+
+    Hud hud;
+    if (hud.Init()) {
+        printf("FAIL: hud\n");
+        return 1;
+    }
+    std::array<int, 4> stages = {
+        hud.AddStage("[1] upload"), hud.AddStage("[1] draw"),
+        hud.AddStage("[2] upload"), hud.AddStage("[2] draw"),
+    };
+    PerfMonitor perf[] = {
+        { 100, [](long long) {} }, { 100, [](long long) {} },
+        { 100, [](long long) {} }, { 100, [](long long) {} },
+    };
+    FramePacer pacer;
+
+    long newBefore = 0;
+    BufferPool::Stats statsBefore;
+    for (int frame = 0; frame < 80; frame++) {
+        if (frame == 10) {
+            // the full images replace the preview, its buffers go
+            for (size_t i = 0; i < images.size(); i++)
+                images[i]->Replace(CreateImages(width, height, i == 1));
+            const size_t cached = pool.GetStats().mCachedBytes;
+            pool.Trim();
+            if (!cached || pool.GetStats().mCachedBytes) {
+                printf("FAIL: preview buffers, %zu bytes cached before the trim, %zu after\n",
+                        cached, pool.GetStats().mCachedBytes);
+                return 1;
+            }
+        }
+        // the first frames are warm up: size classes, free lists and the
+        // hud counters get created
+        if (frame == 20) {
+            newBefore = gNewCount.load();
+            statsBefore = pool.GetStats();
+        }
+
+        pacer.BeginFrame();
+        glClear(GL_COLOR_BUFFER_BIT);
+        for (size_t i = 0; i < images.size(); i++) {
+            auto t1 = std::chrono::high_resolution_clock::now();
+            {
+                Hud::Scope scope(&hud, stages[i * 2]);
+                if (images[i]->Upload(*renders[i])) {
+                    printf("FAIL: upload\n");
+                    return 1;
+                }
+            }
+            auto t2 = std::chrono::high_resolution_clock::now();
+            {
+                Hud::Scope scope(&hud, stages[i * 2 + 1]);
+                renders[i]->Draw();
+            }
+            perf[i * 2].Update(t2 - t1);
+            perf[i * 2 + 1].Update(std::chrono::high_resolution_clock::now() - t2);
+        }
+        hud.Draw(width, height);
+        pacer.EndFrame();
+        auto counters = GLStats::EndFrame();
+        hud.EndFrame(16.0f);
+        hud.SetCounter("GL CALLS", counters.mCalls);
+        hud.SetCounter("DRAWS", counters.mDraws);
+        hud.SetCounter("TEXTURES", TexturePool::Instance().GetStats().mCurrentBytes / 1024, "KB");
+        hud.SetCounter("HOST IMAGES", Residency::Instance().GetStats().mHostBytes / 1024, "KB");
+        hud.SetCounter("LATENCY", std::max(pacer.GetLatencyMs(), 0.0f), "MS", 2);
+    }
+    pacer.Drain();
+
+    long newCount = gNewCount.load() - newBefore;
+    BufferPool::Stats stats = pool.GetStats();
+    printf("steady state: operator new %ld, system allocations %llu, reuses %llu, peak %zu KB\n",
+            newCount, (unsigned long long)(stats.mAllocations - statsBefore.mAllocations),
+            (unsigned long long)(stats.mReuses - statsBefore.mReuses), stats.mPeakBytes >> 10);
+    if (stats.mReuses == statsBefore.mReuses) {
+        printf("FAIL: the frames didn't go through the pool\n");
+        return 1;
+    }
+    if (newCount || stats.mAllocations != statsBefore.mAllocations) {
+        printf("FAIL: heap allocations in steady state\n");
+        return 1;
+    }
+
+    // the cap must hold
+    pool.SetLimit(16 << 20);
+    auto big = pool.Acquire(32 << 20);
+    if (!big.Empty()) {
+        printf("FAIL: limit not enforced\n");
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
+
+#endif
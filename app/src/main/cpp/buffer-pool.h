@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace quink {
+
+/* Recycler for large CPU pixel buffers.
+ *
+ * Requests are rounded up to a size class (four classes per power of two)
+ * and served from that class' free list when possible, so a steady stream of
+ * same sized images does no heap allocation after the first frame. Buffers
+ * up to kSmallLimit come from posix_memalign with SIMD alignment, larger ones
+ * are page aligned anonymous mappings which may be backed by transparent
+ * huge pages. The total held by the pool, in use and cached, never exceeds
+ * the limit: cached buffers are released first, then Acquire() fails.
+ *
+ * The renders take the staging buffers of every upload that is converted on
+ * the CPU from here, the RGBA repack of 8-bit images and the HDR formats.
+ * The apps Trim() the pool once the full images replace the preview, whose
+ * size classes aren't used again.
+ */
+class BufferPool {
+public:
+    static const size_t kAlignment = 64;
+    static const size_t kSmallLimit = 256 * 1024;
+
+    class Buffer {
+    public:
+        Buffer() = default;
+        Buffer(Buffer &&other);
+        Buffer &operator=(Buffer &&other);
+        ~Buffer();
+
+        Buffer(const Buffer &) = delete;
+        Buffer &operator=(const Buffer &) = delete;
+
+        void *Data() const { return mData; }
+        template <typename T>
+        T *As() const { return static_cast<T *>(mData); }
+        size_t Size() const { return mSize; }
+        bool Empty() const { return mData == nullptr; }
+        void Reset();
+
+    private:
+        friend class BufferPool;
+        Buffer(BufferPool *pool, void *data, size_t size, size_t capacity);
+
+        BufferPool *mPool = nullptr;
+        void *mData = nullptr;
+        size_t mSize = 0;
+        size_t mCapacity = 0;
+    };
+
+    struct Stats {
+        size_t mCurrentBytes = 0;   // in use and cached
+        size_t mPeakBytes = 0;
+        size_t mCachedBytes = 0;
+        uint64_t mAllocations = 0;  // buffers obtained from the system
+        uint64_t mReuses = 0;
+        uint64_t mFailures = 0;
+    };
+
+    static BufferPool &Instance();
+
+    BufferPool() = default;
+    ~BufferPool();
+
+    // 0 disables the limit
+    void SetLimit(size_t bytes);
+    void SetHugePages(bool enable);
+
+    Buffer Acquire(size_t bytes);
+    // return every cached buffer to the system
+    void Trim();
+
+    Stats GetStats();
+
+    static size_t SizeClass(size_t bytes);
+
+private:
+    void Release(void *data, size_t capacity);
+    void *Allocate(size_t capacity);
+    void Free(void *data, size_t capacity);
+    bool TrimLocked(size_t needed);
+
+    std::mutex mLock;
+    size_t mLimit = 0;
+    bool mHugePages = false;
+    std::map<size_t, std::vector<void *>> mFree;
+    Stats mStats;
+};
+
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+namespace quink {
+
+// block compressed texture data, the counterpart of Image<T> for upload
+struct CompressedImage {
+    int mWidth = 0;
+    int mHeight = 0;
+    uint32_t mFormat = 0;       // GL compressed internal format
+    float mGamma = 2.2f;        // same meaning as Image<T>::mGamma
+    float mRange = 0.0f;        // RGBM scale, 0 when alpha is not a multiplier
+    std::vector<uint8_t> mData;
+
+    int BlocksX() const { return (mWidth + 3) / 4; }
+    int BlocksY() const { return (mHeight + 3) / 4; }
+};
+
+}
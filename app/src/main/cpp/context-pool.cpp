@@ -0,0 +1,407 @@
+#include "context-pool.h"
+
+#if HAVE_GLES
+#   include <GLES3/gl3.h>
+#else
+#   define GLFW_INCLUDE_GLCOREARB
+#   define GL_GLEXT_PROTOTYPES
+#   define GLFW_INCLUDE_GLEXT
+#   include <GLFW/glfw3.h>
+#endif
+
+#include <future>
+
+#include "log.h"
+#include "trace.h"
+
+#if HAVE_EGL
+
+#ifndef EGL_CONTEXT_MAJOR_VERSION_KHR
+#define EGL_CONTEXT_MAJOR_VERSION_KHR           0x3098
+#endif
+#ifndef EGL_CONTEXT_MINOR_VERSION_KHR
+#define EGL_CONTEXT_MINOR_VERSION_KHR           0x30FB
+#endif
+#ifndef EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR
+#define EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR     0x30FD
+#endif
+#ifndef EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR
+#define EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR 0x00000001
+#endif
+
+namespace quink {
+
+ContextPool *ContextPool::Create(int workers) {
+    return Create(eglGetCurrentDisplay(), eglGetCurrentContext(), workers);
+}
+
+ContextPool *ContextPool::Create(EGLDisplay display, EGLContext share, int workers) {
+    if (display == EGL_NO_DISPLAY || share == EGL_NO_CONTEXT || workers <= 0) {
+        ALOGE("context pool needs a display, a parent context and workers");
+        return nullptr;
+    }
+
+    ContextPool *pool = new ContextPool(display);
+    if (pool->Init(share, workers)) {
+        delete pool;
+        return nullptr;
+    }
+    return pool;
+}
+
+ContextPool::ContextPool(EGLDisplay display) :
+    mDisplay(display),
+    mQueued(0),
+    mPending(0),
+    mNext(0),
+    mStop(false) {
+}
+
+int ContextPool::Init(EGLContext share, int workers) {
+    EGLint configId = 0;
+    if (!eglQueryContext(mDisplay, share, EGL_CONFIG_ID, &configId)) {
+        ALOGE("query parent context config failed: 0x%x", eglGetError());
+        return -1;
+    }
+    const EGLint configAttribs[] = { EGL_CONFIG_ID, configId, EGL_NONE };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(mDisplay, configAttribs, &config, 1, &numConfigs) || numConfigs < 1) {
+        ALOGE("cannot find config %d", configId);
+        return -1;
+    }
+    EGLint surfaceType = 0;
+    eglGetConfigAttrib(mDisplay, config, EGL_SURFACE_TYPE, &surfaceType);
+
+    // the bound API is per thread, workers have to use the same as the parent
+    const EGLenum api = eglQueryAPI();
+    std::vector<EGLint> contextAttribs;
+    if (api == EGL_OPENGL_ES_API) {
+        EGLint version = 3;
+        eglQueryContext(mDisplay, share, EGL_CONTEXT_CLIENT_VERSION, &version);
+        contextAttribs = { EGL_CONTEXT_CLIENT_VERSION, version, EGL_NONE };
+    } else {
+        contextAttribs = {
+            EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+            EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+            EGL_NONE
+        };
+    }
+
+    for (int i = 0; i < workers; i++) {
+        std::unique_ptr<Worker> worker(new Worker());
+        worker->mContext = eglCreateContext(mDisplay, config, share, contextAttribs.data());
+        if (worker->mContext == EGL_NO_CONTEXT) {
+            ALOGE("create shared context %d failed: 0x%x", i, eglGetError());
+            return -1;
+        }
+        if (surfaceType & EGL_PBUFFER_BIT) {
+            const EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+            worker->mSurface = eglCreatePbufferSurface(mDisplay, config, pbufferAttribs);
+        }
+        // EGL_NO_SURFACE relies on EGL_KHR_surfaceless_context
+        mWorkers.push_back(std::move(worker));
+    }
+
+    std::vector<std::future<bool>> started;
+    for (int i = 0; i < workers; i++) {
+        auto promise = std::make_shared<std::promise<bool>>();
+        started.push_back(promise->get_future());
+        mWorkers[i]->mThread = std::thread([this, i, api, promise]() {
+            Worker *worker = mWorkers[i].get();
+            TRACE_THREAD_NAME("context pool worker");
+            eglBindAPI(api);
+            bool ok = eglMakeCurrent(mDisplay, worker->mSurface, worker->mSurface,
+                    worker->mContext);
+            if (!ok)
+                ALOGE("worker %d make current failed: 0x%x", i, eglGetError());
+            promise->set_value(ok);
+            if (ok)
+                Run(i);
+            eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglReleaseThread();
+        });
+    }
+
+    int ret = 0;
+    for (auto &f : started) {
+        if (!f.get())
+            ret = -1;
+    }
+    ALOGD("context pool with %d workers %s", workers, ret ? "failed" : "ready");
+    return ret;
+}
+
+ContextPool::~ContextPool() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mStop = true;
+    }
+    mWakeup.notify_all();
+
+    for (auto &worker : mWorkers) {
+        if (worker->mThread.joinable())
+            worker->mThread.join();
+        if (worker->mSurface != EGL_NO_SURFACE)
+            eglDestroySurface(mDisplay, worker->mSurface);
+        if (worker->mContext != EGL_NO_CONTEXT)
+            eglDestroyContext(mDisplay, worker->mContext);
+    }
+}
+
+void ContextPool::Submit(Job job) {
+    Worker *worker = mWorkers[mNext++ % mWorkers.size()].get();
+    // counted before a worker can pop it, so mQueued never goes below zero
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mQueued++;
+        mPending++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(worker->mLock);
+        worker->mJobs.push_back(std::move(job));
+    }
+    mWakeup.notify_one();
+}
+
+void ContextPool::Wait() {
+    std::unique_lock<std::mutex> lock(mLock);
+    mIdle.wait(lock, [this]() { return mPending == 0; });
+}
+
+bool ContextPool::PopJob(int index, Job &job) {
+    {
+        Worker *self = mWorkers[index].get();
+        std::lock_guard<std::mutex> lock(self->mLock);
+        if (!self->mJobs.empty()) {
+            job = std::move(self->mJobs.back());
+            self->mJobs.pop_back();
+            return true;
+        }
+    }
+
+    const int n = Size();
+    for (int i = 1; i < n; i++) {
+        Worker *victim = mWorkers[(index + i) % n].get();
+        std::lock_guard<std::mutex> lock(victim->mLock);
+        if (!victim->mJobs.empty()) {
+            job = std::move(victim->mJobs.front());
+            victim->mJobs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ContextPool::Run(int index) {
+    while (true) {
+        Job job;
+        if (PopJob(index, job)) {
+            mQueued--;
+            {
+                TRACE_GL_SCOPE("ContextPool job");
+                job(index);
+                glFlush();
+            }
+
+            std::lock_guard<std::mutex> lock(mLock);
+            if (--mPending == 0)
+                mIdle.notify_all();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mLock);
+        mWakeup.wait(lock, [this]() { return mStop || mQueued > 0; });
+        if (mStop && mQueued == 0)
+            break;
+    }
+}
+
+}
+
+#endif
+
+#ifdef TEST_CONTEXT_POOL
+#include <EGL/eglext.h>
+
+#include <chrono>
+#include <string>
+
+#include "opengl-helper.h"
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+static const int kJobs = 64;
+static const int kSize = 512;
+
+static const char *kVertexSrc =
+R"(#version 300 es
+layout(location = 0) in vec2 position;
+out vec2 o_uv;
+void main()
+{
+    gl_Position = vec4(position, 0.0, 1.0);
+    o_uv = position * 0.5 + 0.5;
+}
+)";
+
+static const char *kFragSrc =
+R"(#version 300 es
+precision mediump float;
+uniform sampler2D source;
+uniform sampler2D lut;
+in vec2 o_uv;
+out vec4 out_color;
+void main()
+{
+    vec4 color = texture(source, o_uv);
+    out_color = vec4(texture(lut, vec2(color.r, 0.5)).r,
+                     texture(lut, vec2(color.g, 0.5)).r,
+                     texture(lut, vec2(color.b, 0.5)).r, 1.0);
+}
+)";
+
+static EGLDisplay OpenDisplay() {
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+        eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLDisplay display = EGL_NO_DISPLAY;
+    if (getPlatformDisplay)
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (!eglInitialize(display, nullptr, nullptr))
+            return EGL_NO_DISPLAY;
+    }
+    return display;
+}
+
+int main(int argc, char *argv[])
+{
+    int maxWorkers = argc > 1 ? std::stoi(argv[1]) : std::thread::hardware_concurrency();
+
+    EGLDisplay display = OpenDisplay();
+    if (display == EGL_NO_DISPLAY)
+        return 1;
+    eglBindAPI(EGL_OPENGL_ES_API);
+    const EGLint configAttribs[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT,
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    eglChooseConfig(display, configAttribs, &config, 1, &numConfigs);
+    if (numConfigs < 1)
+        return 1;
+    const EGLint contextAttribs[] = { EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE };
+    EGLContext root = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+    const EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+    EGLSurface surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+    eglMakeCurrent(display, surface, surface, root);
+    OpenGL_Helper::PrintGLString("Renderer", GL_RENDERER);
+
+    // objects shared by the whole group
+    GLuint program = OpenGL_Helper::CreateProgram(kVertexSrc, kFragSrc);
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "source"), 0);
+    glUniform1i(glGetUniformLocation(program, "lut"), 1);
+    std::vector<uint8_t> lutData(256);
+    for (int i = 0; i < 256; i++)
+        lutData[i] = 255 - i;
+    GLuint lut;
+    glGenTextures(1, &lut);
+    glBindTexture(GL_TEXTURE_2D, lut);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, 256, 1, 0, GL_RED, GL_UNSIGNED_BYTE, lutData.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFinish();
+
+    std::vector<uint8_t> input(kSize * kSize * 4);
+    for (size_t i = 0; i < input.size(); i++)
+        input[i] = i * 31;
+
+    double base = 0;
+    for (int n = 1; n <= maxWorkers; n++) {
+        std::unique_ptr<quink::ContextPool> pool(quink::ContextPool::Create(display, root, n));
+        if (!pool)
+            return 1;
+
+        // per worker objects: textures are shared but FBOs and VAOs are not,
+        // they go away with the worker contexts
+        struct Target { GLuint mFbo, mVao, mSrc, mDst; };
+        std::vector<Target> targets(n, Target{0, 0, 0, 0});
+        std::vector<std::vector<uint8_t>> outputs(n, std::vector<uint8_t>(input.size()));
+        auto setup = [&](Target &t) {
+            glGenTextures(1, &t.mSrc);
+            glBindTexture(GL_TEXTURE_2D, t.mSrc);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, kSize, kSize);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glGenTextures(1, &t.mDst);
+            glBindTexture(GL_TEXTURE_2D, t.mDst);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, kSize, kSize);
+            glGenFramebuffers(1, &t.mFbo);
+            glBindFramebuffer(GL_FRAMEBUFFER, t.mFbo);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, t.mDst, 0);
+            glGenVertexArrays(1, &t.mVao);
+            glViewport(0, 0, kSize, kSize);
+        };
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int j = 0; j < kJobs; j++) {
+            pool->Submit([&](int w) {
+                Target &t = targets[w];
+                if (!t.mFbo)
+                    setup(t);
+                glActiveTexture(GL_TEXTURE1);
+                glBindTexture(GL_TEXTURE_2D, lut);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, t.mSrc);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, kSize, kSize, GL_RGBA,
+                        GL_UNSIGNED_BYTE, input.data());
+                glUseProgram(program);
+                glBindVertexArray(t.mVao);
+                const float quad[] = { -1, -1, 1, -1, -1, 1, 1, 1 };
+                GLuint vbo;
+                glGenBuffers(1, &vbo);
+                glBindBuffer(GL_ARRAY_BUFFER, vbo);
+                glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STREAM_DRAW);
+                glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+                glEnableVertexAttribArray(0);
+                glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+                glDeleteBuffers(1, &vbo);
+                glReadPixels(0, 0, kSize, kSize, GL_RGBA, GL_UNSIGNED_BYTE, outputs[w].data());
+            });
+        }
+        pool->Wait();
+        auto end = std::chrono::high_resolution_clock::now();
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        double rate = kJobs / seconds;
+        if (n == 1)
+            base = rate;
+        printf("workers %2d: %8.1f images/s, speedup %.2f\n", n, rate, rate / base);
+
+        pool.reset();
+        for (int i = 0; i < n; i++) {
+            if (!targets[i].mFbo)
+                continue;
+            if (outputs[i][0] != 255 - input[0]) {
+                printf("unexpected output %d from worker %d\n", outputs[i][0], i);
+                return 1;
+            }
+            glDeleteTextures(1, &targets[i].mSrc);
+            glDeleteTextures(1, &targets[i].mDst);
+        }
+    }
+
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroySurface(display, surface);
+    eglDestroyContext(display, root);
+    eglTerminate(display);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "config.h"
+#if HAVE_EGL
+#include <EGL/egl.h>
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace quink {
+
+#if HAVE_EGL
+
+/* A group of offscreen EGL contexts in the share group of a parent context,
+ * each one pinned to its own worker thread.
+ *
+ * Programs, textures and buffers created on the parent (or on any worker)
+ * are visible to every context of the pool. Container objects (VAO, FBO)
+ * are not shared, so jobs have to create those per worker. A program may be
+ * used by several workers at once as long as its uniforms are not modified
+ * concurrently.
+ *
+ * Jobs are distributed round-robin into per-worker deques. A worker pops its
+ * own deque from the back and steals from the front of the others when it
+ * runs dry.
+ */
+class ContextPool {
+public:
+    // job receives the index of the worker it runs on
+    using Job = std::function<void(int)>;
+
+    // share with the context current on the calling thread
+    static ContextPool *Create(int workers);
+    static ContextPool *Create(EGLDisplay display, EGLContext share, int workers);
+
+    ~ContextPool();
+
+    void Submit(Job job);
+    // block until every submitted job has run; GL commands issued by the
+    // jobs are flushed but not finished
+    void Wait();
+
+    int Size() const { return static_cast<int>(mWorkers.size()); }
+
+private:
+    struct Worker {
+        EGLContext mContext = EGL_NO_CONTEXT;
+        EGLSurface mSurface = EGL_NO_SURFACE;
+        std::mutex mLock;
+        std::deque<Job> mJobs;
+        std::thread mThread;
+    };
+
+    ContextPool(EGLDisplay display);
+
+    int Init(EGLContext share, int workers);
+    bool PopJob(int index, Job &job);
+    void Run(int index);
+
+    EGLDisplay mDisplay;
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+
+    std::mutex mLock;
+    std::condition_variable mWakeup;
+    std::condition_variable mIdle;
+    std::atomic<int> mQueued;
+    int mPending;
+    std::atomic<unsigned> mNext;
+    bool mStop;
+};
+
+#endif
+
+}
@@ -0,0 +1,525 @@
+#include "etc2-encoder.h"
+
+#include <limits.h>
+#include <math.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "trace.h"
+
+namespace quink {
+
+const uint32_t Etc2Encoder::kFormatRGB8;
+const uint32_t Etc2Encoder::kFormatSRGB8;
+const uint32_t Etc2Encoder::kFormatRGBA8;
+const uint32_t Etc2Encoder::kVersion;
+
+// intensity modifiers of ETC1/ETC2 RGB blocks, index 0..3 is +a, +b, -a, -b
+static const int kEtcModifiers[8][2] = {
+    {2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183},
+};
+
+static const int kEacModifiers[16][8] = {
+    {-3, -6, -9, -15, 2, 5, 8, 14},
+    {-3, -7, -10, -13, 2, 6, 9, 12},
+    {-2, -5, -8, -13, 1, 4, 7, 12},
+    {-2, -4, -6, -13, 1, 3, 5, 12},
+    {-3, -6, -8, -12, 2, 5, 7, 11},
+    {-3, -7, -9, -11, 2, 6, 8, 10},
+    {-4, -7, -8, -11, 3, 6, 7, 10},
+    {-3, -5, -8, -11, 2, 4, 7, 10},
+    {-2, -6, -8, -10, 1, 5, 7, 9},
+    {-2, -5, -8, -10, 1, 4, 7, 9},
+    {-2, -4, -8, -10, 1, 3, 7, 9},
+    {-2, -5, -7, -10, 1, 4, 6, 9},
+    {-3, -4, -7, -10, 2, 3, 6, 9},
+    {-1, -2, -3, -10, 0, 1, 2, 9},
+    {-4, -6, -8, -9, 3, 5, 7, 8},
+    {-3, -5, -7, -9, 2, 4, 6, 8},
+};
+
+static inline int Clamp(int v, int lo, int hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static inline int EtcModifier(int table, int index) {
+    int m = kEtcModifiers[table][index & 1];
+    return index & 2 ? -m : m;
+}
+
+static void StoreBigEndian(uint64_t bits, uint8_t out[8]) {
+    for (int i = 0; i < 8; i++)
+        out[i] = static_cast<uint8_t>(bits >> (56 - i * 8));
+}
+
+// block pixel p (row major) to its bit position, blocks are stored column major
+static inline int PixelBit(int p) {
+    return (p & 3) * 4 + (p >> 2);
+}
+
+// choose the table and per pixel indices for half a block with a fixed base
+static int FitHalf(const uint8_t rgb[16][3], const int pixels[8], const int base[3],
+        int &bestTable, uint8_t bestIndex[8]) {
+    int bestErr = INT_MAX;
+    for (int table = 0; table < 8; table++) {
+        int err = 0;
+        uint8_t index[8];
+        for (int i = 0; i < 8 && err < bestErr; i++) {
+            const uint8_t *px = rgb[pixels[i]];
+            int pixelErr = INT_MAX;
+            for (int k = 0; k < 4; k++) {
+                int m = EtcModifier(table, k);
+                int dr = Clamp(base[0] + m, 0, 255) - px[0];
+                int dg = Clamp(base[1] + m, 0, 255) - px[1];
+                int db = Clamp(base[2] + m, 0, 255) - px[2];
+                int e = dr * dr + dg * dg + db * db;
+                if (e < pixelErr) {
+                    pixelErr = e;
+                    index[i] = static_cast<uint8_t>(k);
+                }
+            }
+            err += pixelErr;
+        }
+        if (err < bestErr) {
+            bestErr = err;
+            bestTable = table;
+            std::copy(index, index + 8, bestIndex);
+        }
+    }
+    return bestErr;
+}
+
+void Etc2Encoder::EncodeBlockRGB(const uint8_t rgb[16][3], uint8_t out[8]) {
+    uint64_t bestBits = 0;
+    int bestErr = INT_MAX;
+
+    for (int flip = 0; flip < 2; flip++) {
+        // flip 0 splits into left and right 2x4, flip 1 into top and bottom 4x2
+        int pixels[2][8];
+        int count[2] = {0, 0};
+        for (int p = 0; p < 16; p++) {
+            int half = flip ? (p >> 2) >= 2 : (p & 3) >= 2;
+            pixels[half][count[half]++] = p;
+        }
+        float avg[2][3] = {};
+        for (int h = 0; h < 2; h++) {
+            for (int i = 0; i < 8; i++)
+                for (int c = 0; c < 3; c++)
+                    avg[h][c] += rgb[pixels[h][i]][c];
+            for (int c = 0; c < 3; c++)
+                avg[h][c] /= 8.0f;
+        }
+
+        int q4[2][3], q5[2][3];
+        for (int h = 0; h < 2; h++) {
+            for (int c = 0; c < 3; c++) {
+                q4[h][c] = Clamp((int)lroundf(avg[h][c] * 15.0f / 255.0f), 0, 15);
+                q5[h][c] = Clamp((int)lroundf(avg[h][c] * 31.0f / 255.0f), 0, 31);
+            }
+        }
+        bool differential = true;
+        for (int c = 0; c < 3; c++) {
+            int d = q5[1][c] - q5[0][c];
+            if (d < -4 || d > 3)
+                differential = false;
+        }
+
+        for (int mode = 0; mode < 2; mode++) {
+            if (mode == 1 && !differential)
+                break;
+            int base[2][3];
+            for (int h = 0; h < 2; h++) {
+                for (int c = 0; c < 3; c++) {
+                    if (mode == 0)
+                        base[h][c] = q4[h][c] * 17;
+                    else
+                        base[h][c] = (q5[h][c] << 3) | (q5[h][c] >> 2);
+                }
+            }
+
+            int table[2];
+            uint8_t index[2][8];
+            int err = FitHalf(rgb, pixels[0], base[0], table[0], index[0]);
+            if (err >= bestErr)
+                continue;
+            err += FitHalf(rgb, pixels[1], base[1], table[1], index[1]);
+            if (err >= bestErr)
+                continue;
+
+            uint64_t bits = 0;
+            if (mode == 0) {
+                for (int c = 0; c < 3; c++) {
+                    bits |= (uint64_t)q4[0][c] << (60 - c * 8);
+                    bits |= (uint64_t)q4[1][c] << (56 - c * 8);
+                }
+            } else {
+                for (int c = 0; c < 3; c++) {
+                    bits |= (uint64_t)q5[0][c] << (59 - c * 8);
+                    bits |= (uint64_t)((q5[1][c] - q5[0][c]) & 7) << (56 - c * 8);
+                }
+                bits |= 1ull << 33;
+            }
+            bits |= (uint64_t)table[0] << 37;
+            bits |= (uint64_t)table[1] << 34;
+            bits |= (uint64_t)flip << 32;
+            for (int h = 0; h < 2; h++) {
+                for (int i = 0; i < 8; i++) {
+                    int bit = PixelBit(pixels[h][i]);
+                    bits |= (uint64_t)(index[h][i] >> 1) << (16 + bit);
+                    bits |= (uint64_t)(index[h][i] & 1) << bit;
+                }
+            }
+            bestErr = err;
+            bestBits = bits;
+        }
+    }
+    StoreBigEndian(bestBits, out);
+}
+
+void Etc2Encoder::EncodeBlockAlpha(const uint8_t alpha[16], uint8_t out[8]) {
+    int lo = 255, hi = 0;
+    for (int p = 0; p < 16; p++) {
+        lo = std::min(lo, (int)alpha[p]);
+        hi = std::max(hi, (int)alpha[p]);
+    }
+
+    // table 13 has a zero modifier, exact for flat blocks
+    int bestBase = lo, bestMul = 1, bestTable = 13;
+    uint8_t bestIndex[16];
+    std::fill(bestIndex, bestIndex + 16, 4);
+    int bestErr = lo == hi ? 0 : INT_MAX;
+
+    for (int table = 0; table < 16 && bestErr > 0; table++) {
+        const int *mods = kEacModifiers[table];
+        const int span = mods[7] - mods[3];
+        const int estimate = (hi - lo + span - 1) / span;
+        for (int mul = std::max(estimate - 1, 1); mul <= std::min(estimate + 1, 15); mul++) {
+            int base = Clamp((int)lroundf((lo + hi - (mods[7] + mods[3]) * mul) / 2.0f), 0, 255);
+            int err = 0;
+            uint8_t index[16];
+            for (int p = 0; p < 16 && err < bestErr; p++) {
+                int pixelErr = INT_MAX;
+                for (int k = 0; k < 8; k++) {
+                    int d = Clamp(base + mods[k] * mul, 0, 255) - alpha[p];
+                    if (d * d < pixelErr) {
+                        pixelErr = d * d;
+                        index[p] = static_cast<uint8_t>(k);
+                    }
+                }
+                err += pixelErr;
+            }
+            if (err < bestErr) {
+                bestErr = err;
+                bestBase = base;
+                bestMul = mul;
+                bestTable = table;
+                std::copy(index, index + 16, bestIndex);
+            }
+        }
+    }
+
+    uint64_t bits = (uint64_t)bestBase << 56 | (uint64_t)bestMul << 52 | (uint64_t)bestTable << 48;
+    for (int p = 0; p < 16; p++)
+        bits |= (uint64_t)bestIndex[p] << (45 - PixelBit(p) * 3);
+    StoreBigEndian(bits, out);
+}
+
+// run f(firstRow, lastRow) over rows of blocks on several threads
+template <typename F>
+static void ForEachBlockRow(int rows, int workers, F f) {
+    if (workers <= 0)
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    workers = std::min(workers, rows);
+    if (workers <= 1) {
+        f(0, rows);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < workers; i++) {
+        int first = rows * i / workers;
+        int last = rows * (i + 1) / workers;
+        threads.emplace_back([first, last, &f]() {
+            TRACE_THREAD_NAME("etc2-encoder");
+            f(first, last);
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+}
+
+std::shared_ptr<CompressedImage> Etc2Encoder::Encode(const Image<uint8_t> &img, int workers) {
+    TRACE_SCOPE("Etc2Encoder::Encode");
+    auto out = std::make_shared<CompressedImage>();
+    out->mWidth = img.mWidth;
+    out->mHeight = img.mHeight;
+    out->mFormat = kFormatRGB8;
+    out->mGamma = img.mGamma;
+    const int blocksX = out->BlocksX();
+    out->mData.resize((size_t)blocksX * out->BlocksY() * 8);
+
+    ForEachBlockRow(out->BlocksY(), workers, [&](int first, int last) {
+        TRACE_SCOPE("Etc2Encoder rows");
+        uint8_t rgb[16][3];
+        for (int by = first; by < last; by++) {
+            for (int bx = 0; bx < blocksX; bx++) {
+                // edge blocks repeat the last row and column
+                for (int p = 0; p < 16; p++) {
+                    int x = std::min(bx * 4 + (p & 3), img.mWidth - 1);
+                    int y = std::min(by * 4 + (p >> 2), img.mHeight - 1);
+                    const uint8_t *src = img.mData.get() + ((size_t)y * img.mWidth + x) * 3;
+                    rgb[p][0] = src[0];
+                    rgb[p][1] = src[1];
+                    rgb[p][2] = src[2];
+                }
+                EncodeBlockRGB(rgb, &out->mData[((size_t)by * blocksX + bx) * 8]);
+            }
+        }
+    });
+    return out;
+}
+
+std::shared_ptr<CompressedImage> Etc2Encoder::EncodeRGBM(const Image<float> &img, int workers) {
+    TRACE_SCOPE("Etc2Encoder::EncodeRGBM");
+    auto out = std::make_shared<CompressedImage>();
+    out->mWidth = img.mWidth;
+    out->mHeight = img.mHeight;
+    out->mFormat = kFormatRGBA8;
+    out->mGamma = img.mGamma;
+    const int blocksX = out->BlocksX();
+    out->mData.resize((size_t)blocksX * out->BlocksY() * 16);
+
+    // the multiplier covers [0, range], keep it tight to save precision
+    const size_t values = (size_t)img.mWidth * img.mHeight * 3;
+    float peak = 0.0f;
+    for (size_t i = 0; i < values; i++)
+        peak = std::max(peak, img.mData[i]);
+    const float range = std::min(std::max(peak, 1.0f), 64.0f);
+    out->mRange = range;
+
+    ForEachBlockRow(out->BlocksY(), workers, [&](int first, int last) {
+        TRACE_SCOPE("Etc2Encoder rows");
+        uint8_t rgb[16][3];
+        uint8_t alpha[16];
+        for (int by = first; by < last; by++) {
+            for (int bx = 0; bx < blocksX; bx++) {
+                for (int p = 0; p < 16; p++) {
+                    int x = std::min(bx * 4 + (p & 3), img.mWidth - 1);
+                    int y = std::min(by * 4 + (p >> 2), img.mHeight - 1);
+                    const float *src = img.mData.get() + ((size_t)y * img.mWidth + x) * 3;
+                    float r = std::max(src[0], 0.0f);
+                    float g = std::max(src[1], 0.0f);
+                    float b = std::max(src[2], 0.0f);
+                    float m = std::min(std::max(std::max(r, g), b) / range, 1.0f);
+                    int a = Clamp((int)ceilf(m * 255.0f), 1, 255);
+                    float scale = 255.0f * 255.0f / (a * range);
+                    alpha[p] = static_cast<uint8_t>(a);
+                    rgb[p][0] = static_cast<uint8_t>(Clamp((int)lroundf(r * scale), 0, 255));
+                    rgb[p][1] = static_cast<uint8_t>(Clamp((int)lroundf(g * scale), 0, 255));
+                    rgb[p][2] = static_cast<uint8_t>(Clamp((int)lroundf(b * scale), 0, 255));
+                }
+                uint8_t *block = &out->mData[((size_t)by * blocksX + bx) * 16];
+                EncodeBlockAlpha(alpha, block);
+                EncodeBlockRGB(rgb, block + 8);
+            }
+        }
+    });
+    return out;
+}
+
+}
+
+#ifdef TEST_ETC2_ENCODER
+/* Round trip through a reference decoder, then through the GL driver with
+ * the Plain render:
+ *   g++ -DTEST_ETC2_ENCODER etc2-encoder.cpp render.cpp opengl-helper.cpp
+ *       gl-state.cpp gl-stats.cpp texture-pool.cpp buffer-pool.cpp
+ *       pixel-convert.cpp trace.cpp -lEGL -lGLESv2 -lpthread
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+
+#include "config.h"
+#if HAVE_EGL
+#include <GLES3/gl3.h>
+#include "opengl-helper.h"
+#include "render.h"
+#endif
+
+using namespace quink;
+
+static uint64_t LoadBigEndian(const uint8_t in[8]) {
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; i++)
+        bits = bits << 8 | in[i];
+    return bits;
+}
+
+static void DecodeBlockRGB(const uint8_t in[8], uint8_t rgb[16][3]) {
+    const uint64_t bits = LoadBigEndian(in);
+    const bool differential = bits >> 33 & 1;
+    const bool flip = bits >> 32 & 1;
+    int base[2][3];
+    for (int c = 0; c < 3; c++) {
+        if (differential) {
+            int b1 = bits >> (59 - c * 8) & 31;
+            int d = bits >> (56 - c * 8) & 7;
+            int b2 = b1 + (d >= 4 ? d - 8 : d);
+            base[0][c] = (b1 << 3) | (b1 >> 2);
+            base[1][c] = (b2 << 3) | (b2 >> 2);
+        } else {
+            base[0][c] = (bits >> (60 - c * 8) & 15) * 17;
+            base[1][c] = (bits >> (56 - c * 8) & 15) * 17;
+        }
+    }
+    const int table[2] = { (int)(bits >> 37 & 7), (int)(bits >> 34 & 7) };
+    for (int p = 0; p < 16; p++) {
+        int half = flip ? (p >> 2) >= 2 : (p & 3) >= 2;
+        int bit = PixelBit(p);
+        int index = (int)(bits >> (16 + bit) & 1) << 1 | (int)(bits >> bit & 1);
+        for (int c = 0; c < 3; c++)
+            rgb[p][c] = (uint8_t)Clamp(base[half][c] + EtcModifier(table[half], index), 0, 255);
+    }
+}
+
+static void DecodeBlockAlpha(const uint8_t in[8], uint8_t alpha[16]) {
+    const uint64_t bits = LoadBigEndian(in);
+    const int base = bits >> 56 & 255;
+    const int mul = bits >> 52 & 15;
+    const int *mods = kEacModifiers[bits >> 48 & 15];
+    for (int p = 0; p < 16; p++)
+        alpha[p] = (uint8_t)Clamp(base + mods[bits >> (45 - PixelBit(p) * 3) & 7] * mul, 0, 255);
+}
+
+// decode to interleaved RGB, RGBM images are expanded to the float values
+template <typename T>
+static std::vector<T> Decode(const CompressedImage &img) {
+    const int blockSize = img.mFormat == Etc2Encoder::kFormatRGBA8 ? 16 : 8;
+    std::vector<T> out((size_t)img.mWidth * img.mHeight * 3);
+    for (int by = 0; by < img.BlocksY(); by++) {
+        for (int bx = 0; bx < img.BlocksX(); bx++) {
+            const uint8_t *block = &img.mData[((size_t)by * img.BlocksX() + bx) * blockSize];
+            uint8_t rgb[16][3];
+            uint8_t alpha[16];
+            std::fill(alpha, alpha + 16, 255);
+            if (blockSize == 16) {
+                DecodeBlockAlpha(block, alpha);
+                block += 8;
+            }
+            DecodeBlockRGB(block, rgb);
+            for (int p = 0; p < 16; p++) {
+                int x = bx * 4 + (p & 3);
+                int y = by * 4 + (p >> 2);
+                if (x >= img.mWidth || y >= img.mHeight)
+                    continue;
+                for (int c = 0; c < 3; c++) {
+                    float v = rgb[p][c];
+                    if (img.mRange > 0.0f)
+                        v = v / 255.0f * alpha[p] / 255.0f * img.mRange;
+                    out[((size_t)y * img.mWidth + x) * 3 + c] = (T)v;
+                }
+            }
+        }
+    }
+    return out;
+}
+
+int main()
+{
+    // gradients, edges and noise, sizes not a multiple of the block size
+    const int width = 1023;
+    const int height = 767;
+    auto img = std::make_shared<Image<uint8_t>>(width, height);
+    auto hdr = std::make_shared<Image<float>>(width, height);
+    srand(1);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint8_t *px = img->mData.get() + ((size_t)y * width + x) * 3;
+            float *hpx = hdr->mData.get() + ((size_t)y * width + x) * 3;
+            px[0] = (uint8_t)(x * 255 / width);
+            px[1] = (uint8_t)(((x / 64 + y / 64) & 1) ? 200 : 40);
+            px[2] = (uint8_t)(y * 255 / height / 2 + rand() % 32);
+            for (int c = 0; c < 3; c++)
+                hpx[c] = px[c] / 255.0f * (1.0f + 15.0f * x / width);
+        }
+    }
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    auto etc = Etc2Encoder::Encode(*img, 1);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    auto etcParallel = Etc2Encoder::Encode(*img);
+    auto t3 = std::chrono::high_resolution_clock::now();
+    auto rgbm = Etc2Encoder::EncodeRGBM(*hdr);
+    auto t4 = std::chrono::high_resolution_clock::now();
+    auto ms = [](std::chrono::high_resolution_clock::duration d) {
+        return std::chrono::duration<double, std::milli>(d).count();
+    };
+    printf("encode %dx%d: 1 worker %.1f ms, %u workers %.1f ms, RGBM %.1f ms\n", width, height,
+            ms(t2 - t1), std::thread::hardware_concurrency(), ms(t3 - t2), ms(t4 - t3));
+    if (etc->mData != etcParallel->mData) {
+        printf("FAIL: parallel encoding differs\n");
+        return 1;
+    }
+
+    auto decoded = Decode<uint8_t>(*etc);
+    double mse = 0;
+    for (size_t i = 0; i < decoded.size(); i++) {
+        double d = (double)decoded[i] - img->mData[i];
+        mse += d * d;
+    }
+    mse /= decoded.size();
+    double psnr = 10 * log10(255.0 * 255.0 / mse);
+    printf("ETC2 RGB8 %zu KB (raw %zu KB), PSNR %.2f dB\n", etc->mData.size() / 1024,
+            decoded.size() / 1024, psnr);
+
+    auto hdrDecoded = Decode<float>(*rgbm);
+    double relErr = 0;
+    for (size_t i = 0; i < hdrDecoded.size(); i++)
+        relErr += fabs(hdrDecoded[i] - hdr->mData[i]) / (hdr->mData[i] + 0.05);
+    relErr /= hdrDecoded.size();
+    printf("RGBM ETC2+EAC range %.2f, %zu KB (raw %zu KB), mean relative error %.4f\n",
+            rgbm->mRange, rgbm->mData.size() / 1024, hdrDecoded.size() * sizeof(float) / 1024,
+            relErr);
+    if (psnr < 30.0 || relErr > 0.1) {
+        printf("FAIL: quality too low\n");
+        return 1;
+    }
+
+#if HAVE_EGL
+    if (OpenGL_Helper::CreatePbufferContext(width, height)) {
+        printf("no GL context, skip driver check\n");
+        return 0;
+    }
+    // gamma 2.2 source with the Plain render samples without any correction
+    std::unique_ptr<Render> render(Render::Create("Plain"));
+    if (render->Init() || render->UploadTexture(etc) || render->Draw()) {
+        printf("FAIL: render the compressed image\n");
+        return 1;
+    }
+    std::vector<uint8_t> pixels((size_t)width * height * 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    int maxDiff = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const uint8_t *gl = &pixels[((size_t)(height - 1 - y) * width + x) * 4];
+            const uint8_t *ref = &decoded[((size_t)y * width + x) * 3];
+            for (int c = 0; c < 3; c++)
+                maxDiff = std::max(maxDiff, abs(gl[c] - ref[c]));
+        }
+    }
+    printf("GL (%s) vs reference decoder: max difference %d\n",
+            (const char *)glGetString(GL_RENDERER), maxDiff);
+    if (maxDiff > 1) {
+        printf("FAIL: driver decodes differently\n");
+        return 1;
+    }
+#endif
+    printf("PASS\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+
+#include "compressed-image.h"
+#include "image.h"
+
+namespace quink {
+
+/* CPU encoder for the block formats every OpenGL ES 3.0 device samples.
+ *
+ * 8-bit images become ETC2 RGB8 using the ETC1 compatible individual and
+ * differential modes, which is plenty for photographs. Float images are
+ * stored as RGBM in ETC2 RGBA8 + EAC: rgb * alpha * mRange gives back the
+ * linear value, the shader does the multiply. Rows of blocks are split
+ * over worker threads; workers <= 0 uses every core.
+ */
+class Etc2Encoder {
+public:
+    static const uint32_t kFormatRGB8 = 0x9274;         // GL_COMPRESSED_RGB8_ETC2
+    static const uint32_t kFormatSRGB8 = 0x9275;        // GL_COMPRESSED_SRGB8_ETC2
+    static const uint32_t kFormatRGBA8 = 0x9278;        // GL_COMPRESSED_RGBA8_ETC2_EAC
+    // bumped whenever the output of the encoder changes, part of cache keys
+    static const uint32_t kVersion = 1;
+
+    static std::shared_ptr<CompressedImage> Encode(const Image<uint8_t> &img, int workers = 0);
+    static std::shared_ptr<CompressedImage> EncodeRGBM(const Image<float> &img, int workers = 0);
+
+    // one 4x4 block, pixels in row major order
+    static void EncodeBlockRGB(const uint8_t rgb[16][3], uint8_t out[8]);
+    static void EncodeBlockAlpha(const uint8_t alpha[16], uint8_t out[8]);
+};
+
+}
@@ -0,0 +1,874 @@
+#include "frame-capture.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "gl-stats.h"
+#include "log.h"
+
+namespace quink {
+
+namespace {
+
+// what a key of the setup bookkeeping refers to
+enum Kind : uint64_t {
+    kActiveUnit = 1,
+    kTexture,
+    kBuffer,
+    kProgram,
+    kVertexArray,
+    kFramebuffer,
+    kViewport,
+    kClearColor,
+    kPixelStore,
+    kUniform,
+    kTexParameter,
+    kTexLevel,
+    kBufferData,
+    kCapability,
+    kBlendFunc,
+};
+
+}
+
+static uint64_t Key(Kind kind, uint32_t a = 0, uint32_t b = 0) {
+    return (static_cast<uint64_t>(kind) << 56) | (static_cast<uint64_t>(a & 0xFFFFFF) << 32) | b;
+}
+
+static uint32_t Word(float f) {
+    uint32_t w;
+    memcpy(&w, &f, sizeof(w));
+    return w;
+}
+
+static uint32_t Word(const void *offset) {
+    return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(offset));
+}
+
+static bool IsDraw(FrameCapture::Op op) {
+    switch (op) {
+        case FrameCapture::Op::DrawArrays:
+        case FrameCapture::Op::DrawElements:
+        case FrameCapture::Op::DrawArraysInstanced:
+        case FrameCapture::Op::DrawElementsInstanced:
+        case FrameCapture::Op::BlitFramebuffer:
+        case FrameCapture::Op::Clear:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// finds payloads written before, a match is confirmed against the file
+static uint64_t Hash(const uint8_t *data, size_t size) {
+    uint64_t h = 0xcbf29ce484222325ull ^ size;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t v;
+        memcpy(&v, data + i, sizeof(v));
+        h = (h ^ v) * 0x100000001b3ull;
+        h ^= h >> 29;
+    }
+    for (; i < size; i++)
+        h = (h ^ data[i]) * 0x100000001b3ull;
+    return h;
+}
+
+std::atomic<bool> FrameCapture::sRecording(false);
+std::atomic<std::thread::id> FrameCapture::sThread;
+const char FrameCapture::kMagic[4] = { 'Q', 'G', 'L', 'C' };
+const uint32_t FrameCapture::kVersion;
+
+FrameCapture &FrameCapture::Instance() {
+    static FrameCapture capture;
+    return capture;
+}
+
+int FrameCapture::ParseSpec(const std::string &spec, std::string &path, uint64_t &first,
+        uint64_t &count) {
+    path = spec;
+    first = 0;
+    count = 1;
+    // numbers are taken from the end, the path may have colons of its own
+    std::vector<uint64_t> numbers;
+    while (numbers.size() < 2) {
+        size_t pos = path.rfind(':');
+        if (pos == std::string::npos)
+            break;
+        std::string tail = path.substr(pos + 1);
+        if (tail.empty() || tail.find_first_not_of("0123456789") != std::string::npos)
+            break;
+        numbers.insert(numbers.begin(), strtoull(tail.c_str(), nullptr, 10));
+        path.erase(pos);
+    }
+    if (numbers.size() > 0)
+        first = numbers[0];
+    if (numbers.size() > 1)
+        count = numbers[1];
+    return path.empty() || count == 0 ? -1 : 0;
+}
+
+const char *FrameCapture::OpName(Op op) {
+    static const char *names[] = {
+        "Blob", "SetupEnd", "FrameEnd",
+        "DrawArrays", "DrawElements", "DrawArraysInstanced", "DrawElementsInstanced",
+        "BlitFramebuffer", "Clear", "ClearColor",
+        "TexImage2D", "TexSubImage2D", "CompressedTexImage2D", "CompressedTexSubImage2D",
+        "TexStorage2D", "TexParameteri", "BufferData", "BufferSubData",
+        "UseProgram", "BindVertexArray", "BindBuffer", "BindTexture", "ActiveTexture",
+        "BindFramebuffer", "FramebufferTexture2D", "Viewport", "PixelStorei",
+        "VertexAttribPointer", "EnableVertexAttribArray",
+        "Uniform1f", "Uniform1i", "Uniform3fv", "UniformMatrix3fv",
+        "GenTextures", "GenBuffers", "GenVertexArrays", "GenFramebuffers",
+        "DeleteTextures", "DeleteBuffers", "DeleteVertexArrays", "DeleteFramebuffers",
+        "CreateShader", "ShaderSource", "CompileShader", "DeleteShader",
+        "CreateProgram", "AttachShader", "LinkProgram", "DeleteProgram",
+        "GetUniformLocation", "Uniform2f", "VertexAttribDivisor",
+        "Enable", "Disable", "BlendFuncSeparate",
+    };
+    static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(Op::Count),
+            "op names out of date");
+    size_t i = static_cast<size_t>(op);
+    return i < sizeof(names) / sizeof(names[0]) ? names[i] : "unknown";
+}
+
+int FrameCapture::Arm(const std::string &path, uint64_t first, uint64_t count) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (sRecording.load(std::memory_order_relaxed) || mFile) {
+        ALOGE("frame capture is armed already");
+        return -1;
+    }
+    mPath = path;
+    mFirst = first;
+    mCount = count;
+    mFrame = 0;
+    mWritten = 0;
+    sThread.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    sRecording.store(true, std::memory_order_relaxed);
+    ALOGD("frame capture of %llu frames from frame %llu to %s",
+            (unsigned long long)count, (unsigned long long)first, path.c_str());
+    if (first == 0) {
+        Begin();
+        return mFile ? 0 : -1;
+    }
+    return 0;
+}
+
+void FrameCapture::EndFrame() {
+    if (!IsRecording())
+        return;
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mFile) {
+        WriteRecord(Op::FrameEnd, nullptr, 0, 0);
+        if (++mWritten == mCount)
+            Finish();
+    }
+    mFrame++;
+    if (IsRecording() && !mFile && mFrame == mFirst)
+        Begin();
+}
+
+void FrameCapture::Stop() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mFile) {
+        Finish();
+    } else if (sRecording.load(std::memory_order_relaxed)) {
+        ALOGD("frame capture stopped at frame %llu, before the range", (unsigned long long)mFrame);
+        sRecording.store(false, std::memory_order_relaxed);
+        mSetup.clear();
+    }
+}
+
+FrameCapture::Command FrameCapture::Make(Op op, std::initializer_list<uint32_t> args) {
+    Command cmd;
+    cmd.mOp = op;
+    cmd.mArgs = args;
+    return cmd;
+}
+
+void FrameCapture::SetPayload(Command &cmd, const void *data, size_t size) {
+    if (!data || !size)
+        return;
+    cmd.mSize = size;
+    if (mFile) {
+        cmd.mPayload = data;
+    } else {
+        const uint8_t *p = static_cast<const uint8_t *>(data);
+        cmd.mCopy.assign(p, p + size);
+    }
+}
+
+uint64_t FrameCapture::Add(Command &&cmd) {
+    if (mFile) {
+        Write(cmd);
+        return 0;
+    }
+    // only the state matters before the range
+    if (IsDraw(cmd.mOp))
+        return 0;
+    uint64_t seq = mNextSeq++;
+    mSetup.emplace(seq, std::move(cmd));
+    return seq;
+}
+
+void FrameCapture::Bind(uint64_t key, uint64_t seq) {
+    if (!seq)
+        return;
+    Binding &binding = mBindings[key];
+    if (binding.mSeq && !binding.mConsumed)
+        mSetup.erase(binding.mSeq);
+    binding.mSeq = seq;
+    binding.mConsumed = false;
+}
+
+void FrameCapture::Consume(uint64_t key) {
+    if (mFile)
+        return;
+    auto it = mBindings.find(key);
+    if (it != mBindings.end())
+        it->second.mConsumed = true;
+}
+
+void FrameCapture::Replace(uint64_t key, uint64_t seq) {
+    if (!seq)
+        return;
+    uint64_t &value = mValues[key];
+    if (value)
+        mSetup.erase(value);
+    value = seq;
+}
+
+void FrameCapture::Update(uint64_t key, uint64_t seq, bool full) {
+    if (!seq)
+        return;
+    std::vector<uint64_t> &updates = mContents[key];
+    if (full) {
+        for (uint64_t earlier : updates)
+            mSetup.erase(earlier);
+        updates.clear();
+    }
+    updates.push_back(seq);
+}
+
+void FrameCapture::Drop(uint64_t key) {
+    auto it = mContents.find(key);
+    if (it == mContents.end())
+        return;
+    for (uint64_t seq : it->second)
+        mSetup.erase(seq);
+    mContents.erase(it);
+}
+
+void FrameCapture::ConsumeUpload(GLenum target) {
+    Consume(Key(kActiveUnit));
+    Consume(Key(kTexture, mActiveUnit, target));
+    Consume(Key(kBuffer, 0, GL_PIXEL_UNPACK_BUFFER));
+    Consume(Key(kPixelStore, 0, GL_UNPACK_ALIGNMENT));
+    Consume(Key(kPixelStore, 0, GL_UNPACK_ROW_LENGTH));
+    Consume(Key(kPixelStore, 0, GL_UNPACK_SKIP_ROWS));
+    Consume(Key(kPixelStore, 0, GL_UNPACK_SKIP_PIXELS));
+}
+
+size_t FrameCapture::UnpackSize(GLsizei width, GLsizei height, GLenum format,
+        GLenum type) const {
+    if (width <= 0 || height <= 0)
+        return 0;
+    size_t pixel = GLStats::PixelSize(format, type);
+    size_t row = (mUnpackRowLength > 0 ? mUnpackRowLength : width) * pixel;
+    size_t alignment = mUnpackAlignment > 0 ? mUnpackAlignment : 1;
+    size_t stride = (row + alignment - 1) / alignment * alignment;
+    // the skipped part is kept, the same unpack state is replayed
+    return (mUnpackSkipRows + height - 1) * stride + (mUnpackSkipPixels + width) * pixel;
+}
+
+GLuint FrameCapture::BoundTexture(GLenum target) const {
+    auto it = mTextures.find(std::make_pair(mActiveUnit, target));
+    return it == mTextures.end() ? 0 : it->second;
+}
+
+void FrameCapture::Begin() {
+    // read back to compare payloads of the same hash
+    mFile = fopen(mPath.c_str(), "w+b");
+    if (!mFile) {
+        ALOGE("open %s for frame capture failed", mPath.c_str());
+        sRecording.store(false, std::memory_order_relaxed);
+        mSetup.clear();
+        return;
+    }
+    // the header is completed by Finish()
+    FileHeader header = {};
+    fwrite(&header, sizeof(header), 1, mFile);
+
+    size_t count = mSetup.size();
+    for (const auto &it : mSetup)
+        Write(it.second);
+    WriteRecord(Op::SetupEnd, nullptr, 0, 0);
+    ALOGD("frame capture starts at frame %llu, %zu setup commands, %zu KB of payloads",
+            (unsigned long long)mFrame, count, mBlobBytes / 1024);
+
+    mSetup.clear();
+    mBindings.clear();
+    mValues.clear();
+    mContents.clear();
+}
+
+void FrameCapture::Write(const Command &cmd) {
+    uint32_t blob = 0;
+    if (cmd.mSize) {
+        const uint8_t *data = cmd.mCopy.empty() ?
+                static_cast<const uint8_t *>(cmd.mPayload) : cmd.mCopy.data();
+        uint64_t hash = Hash(data, cmd.mSize);
+        auto range = mBlobs.equal_range(hash);
+        for (auto it = range.first; it != range.second && !blob; ++it) {
+            if (IsWritten(it->second, data, cmd.mSize))
+                blob = it->second.mId;
+        }
+        if (!blob) {
+            blob = mNextBlob++;
+            const uint32_t args[] = { blob, static_cast<uint32_t>(cmd.mSize) };
+            WriteRecord(Op::Blob, args, 2, 0);
+            mBlobs.emplace(hash, Blob { blob, cmd.mSize, ftell(mFile) });
+            fwrite(data, 1, cmd.mSize, mFile);
+            static const uint8_t padding[4] = {};
+            fwrite(padding, 1, (4 - cmd.mSize % 4) % 4, mFile);
+            mBlobBytes += cmd.mSize;
+        }
+    }
+    WriteRecord(cmd.mOp, cmd.mArgs.data(), cmd.mArgs.size(), blob);
+}
+
+bool FrameCapture::IsWritten(const Blob &blob, const uint8_t *data, size_t size) {
+    if (blob.mSize != size || fseek(mFile, blob.mOffset, SEEK_SET))
+        return false;
+    uint8_t buffer[4096];
+    size_t done = 0;
+    while (done < size) {
+        size_t n = std::min(size - done, sizeof(buffer));
+        if (fread(buffer, 1, n, mFile) != n || memcmp(buffer, data + done, n))
+            break;
+        done += n;
+    }
+    // back to appending, stdio needs a seek between reading and writing
+    fseek(mFile, 0, SEEK_END);
+    return done == size;
+}
+
+void FrameCapture::WriteRecord(Op op, const uint32_t *args, size_t count, uint32_t blob) {
+    RecordHeader header;
+    header.mOp = static_cast<uint16_t>(op);
+    header.mArgs = static_cast<uint16_t>(count);
+    header.mBlob = blob;
+    fwrite(&header, sizeof(header), 1, mFile);
+    if (count)
+        fwrite(args, sizeof(uint32_t), count, mFile);
+}
+
+void FrameCapture::Finish() {
+    FileHeader header = {};
+    memcpy(header.mMagic, kMagic, sizeof(header.mMagic));
+    header.mVersion = kVersion;
+    header.mWidth = mWidth;
+    header.mHeight = mHeight;
+    header.mFrames = static_cast<uint32_t>(mWritten);
+    long size = ftell(mFile);
+    fseek(mFile, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, mFile);
+    bool failed = ferror(mFile) != 0;
+    failed |= fclose(mFile) != 0;
+    mFile = nullptr;
+    sRecording.store(false, std::memory_order_relaxed);
+
+    if (failed)
+        ALOGE("write frame capture %s failed", mPath.c_str());
+    else
+        ALOGD("captured %llu frames of %ux%u to %s, %ld KB, %u payloads",
+                (unsigned long long)mWritten, mWidth, mHeight, mPath.c_str(), size / 1024,
+                mNextBlob - 1);
+    mBlobs.clear();
+}
+
+void FrameCapture::DrawArrays(GLenum mode, GLint first, GLsizei count) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Add(Make(Op::DrawArrays, { mode, (uint32_t)first, (uint32_t)count }));
+}
+
+void FrameCapture::DrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Add(Make(Op::DrawElements, { mode, (uint32_t)count, type, Word(indices) }));
+}
+
+void FrameCapture::DrawArraysInstanced(GLenum mode, GLint first, GLsizei count,
+        GLsizei instances) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Add(Make(Op::DrawArraysInstanced,
+            { mode, (uint32_t)first, (uint32_t)count, (uint32_t)instances }));
+}
+
+void FrameCapture::DrawElementsInstanced(GLenum mode, GLsizei count, GLenum type,
+        const void *indices, GLsizei instances) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Add(Make(Op::DrawElementsInstanced,
+            { mode, (uint32_t)count, type, Word(indices), (uint32_t)instances }));
+}
+
+void FrameCapture::BlitFramebuffer(GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1,
+        GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Add(Make(Op::BlitFramebuffer, {
+            (uint32_t)srcX0, (uint32_t)srcY0, (uint32_t)srcX1, (uint32_t)srcY1,
+            (uint32_t)dstX0, (uint32_t)dstY0, (uint32_t)dstX1, (uint32_t)dstY1, mask, filter }));
+}
+
+void FrameCapture::Clear(GLbitfield mask) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Add(Make(Op::Clear, { mask }));
+}
+
+void FrameCapture::ClearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Bind(Key(kClearColor), Add(Make(Op::ClearColor, { Word(r), Word(g), Word(b), Word(a) })));
+}
+
+void FrameCapture::TexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width,
+        GLsizei height, GLint border, GLenum format, GLenum type, const void *pixels) {
+    std::lock_guard<std::mutex> lock(mLock);
+    GLuint texture = BoundTexture(target);
+    if (level == 0)
+        mTextureSizes[texture] = std::make_pair(width, height);
+    bool unpackBuffer = mBuffers[GL_PIXEL_UNPACK_BUFFER] != 0;
+    Command cmd = Make(Op::TexImage2D, { target, (uint32_t)level, (uint32_t)internalFormat,
+            (uint32_t)width, (uint32_t)height, (uint32_t)border, format, type,
+            unpackBuffer ? Word(pixels) : 0 });
+    if (!unpackBuffer)
+        SetPayload(cmd, pixels, UnpackSize(width, height, format, type));
+    ConsumeUpload(target);
+    Update(Key(kTexLevel, level, texture), Add(std::move(cmd)), true);
+}
+
+void FrameCapture::TexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset,
+        GLsizei width, GLsizei height, GLenum format, GLenum type, const void *pixels) {
+    std::lock_guard<std::mutex> lock(mLock);
+    GLuint texture = BoundTexture(target);
+    const auto &size = mTextureSizes[texture];
+    bool full = xoffset == 0 && yoffset == 0 &&
+            width == std::max(1, size.first >> level) && height == std::max(1, size.second >> level);
+    bool unpackBuffer = mBuffers[GL_PIXEL_UNPACK_BUFFER] != 0;
+    Command cmd = Make(Op::TexSubImage2D, { target, (uint32_t)level, (uint32_t)xoffset,
+            (uint32_t)yoffset, (uint32_t)width, (uint32_t)height, format, type,
+            unpackBuffer ? Word(pixels) : 0 });
+    if (!unpackBuffer)
+        SetPayload(cmd, pixels, UnpackSize(width, height, format, type));
+    ConsumeUpload(target);
+    Update(Key(kTexLevel, level, texture), Add(std::move(cmd)), full);
+}
+
+void FrameCapture::CompressedTexImage2D(GLenum target, GLint level, GLenum internalFormat,
+        GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const void *data) {
+    std::lock_guard<std::mutex> lock(mLock);
+    GLuint texture = BoundTexture(target);
+    if (level == 0)
+        mTextureSizes[texture] = std::make_pair(width, height);
+    bool unpackBuffer = mBuffers[GL_PIXEL_UNPACK_BUFFER] != 0;
+    Command cmd = Make(Op::CompressedTexImage2D, { target, (uint32_t)level, internalFormat,
+            (uint32_t)width, (uint32_t)height, (uint32_t)border, (uint32_t)imageSize,
+            unpackBuffer ? Word(data) : 0 });
+    if (!unpackBuffer)
+        SetPayload(cmd, data, imageSize);
+    ConsumeUpload(target);
+    Update(Key(kTexLevel, level, texture), Add(std::move(cmd)), true);
+}
+
+void FrameCapture::CompressedTexSubImage2D(GLenum target, GLint level, GLint xoffset,
+        GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLsizei imageSize,
+        const void *data) {
+    std::lock_guard<std::mutex> lock(mLock);
+    GLuint texture = BoundTexture(target);
+    const auto &size = mTextureSizes[texture];
+    // the size may be rounded up to whole blocks
+    bool full = xoffset == 0 && yoffset == 0 &&
+            width >= std::max(1, size.first >> level) && height >= std::max(1, size.second >> level);
+    bool unpackBuffer = mBuffers[GL_PIXEL_UNPACK_BUFFER] != 0;
+    Command cmd = Make(Op::CompressedTexSubImage2D, { target, (uint32_t)level, (uint32_t)xoffset,
+            (uint32_t)yoffset, (uint32_t)width, (uint32_t)height, format, (uint32_t)imageSize,
+            unpackBuffer ? Word(data) : 0 });
+    if (!unpackBuffer)
+        SetPayload(cmd, data, imageSize);
+    ConsumeUpload(target);
+    Update(Key(kTexLevel, level, texture), Add(std::move(cmd)), full);
+}
+
+void FrameCapture::TexStorage2D(GLenum target, GLsizei levels, GLenum internalFormat,
+        GLsizei width, GLsizei height) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mTextureSizes[BoundTexture(target)] = std::make_pair(width, height);
+    Consume(Key(kActiveUnit));
+    Consume(Key(kTexture, mActiveUnit, target));
+    Add(Make(Op::TexStorage2D,
+            { target, (uint32_t)levels, internalFormat, (uint32_t)width, (uint32_t)height }));
+}
+
+void FrameCapture::TexParameteri(GLenum target, GLenum pname, GLint param) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Consume(Key(kActiveUnit));
+    Consume(Key(kTexture, mActiveUnit, target));
+    Replace(Key(kTexParameter, pname, BoundTexture(target)),
+            Add(Make(Op::TexParameteri, { target, pname, (uint32_t)param })));
+}
+
+void FrameCapture::BufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage) {
+    std::lock_guard<std::mutex> lock(mLock);
+    GLuint buffer = mBuffers[target];
+    mBufferSizes[buffer] = size;
+    Command cmd = Make(Op::BufferData, { target, (uint32_t)size, usage });
+    SetPayload(cmd, data, size);
+    Consume(Key(kBuffer, 0, target));
+    if (target == GL_ELEMENT_ARRAY_BUFFER)
+        Consume(Key(kVertexArray));
+    Update(Key(kBufferData, 0, buffer), Add(std::move(cmd)), true);
+}
+
+void FrameCapture::BufferSubData(GLenum target, GLintptr offset, GLsizeiptr size,
+        const void *data) {
+    std::lock_guard<std::mutex> lock(mLock);
+    GLuint buffer = mBuffers[target];
+    bool full = offset == 0 && size == mBufferSizes[buffer];
+    Command cmd = Make(Op::BufferSubData, { target, (uint32_t)offset, (uint32_t)size });
+    SetPayload(cmd, data, size);
+    Consume(Key(kBuffer, 0, target));
+    if (target == GL_ELEMENT_ARRAY_BUFFER)
+        Consume(Key(kVertexArray));
+    Update(Key(kBufferData, 0, buffer), Add(std::move(cmd)), full);
+}
+
+void FrameCapture::MapBufferRange(void *pointer, GLenum target, GLintptr offset,
+        GLsizeiptr length, GLbitfield access) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (!pointer || !(access & GL_MAP_WRITE_BIT))
+        return;
+    Mapping mapping = { pointer, offset, length };
+    mMappings[target] = mapping;
+}
+
+void FrameCapture::UnmapBuffer(GLenum target) {
+    std::lock_guard<std::mutex> lock(mLock);
+    auto it = mMappings.find(target);
+    if (it == mMappings.end())
+        return;
+    Mapping mapping = it->second;
+    mMappings.erase(it);
+    GLuint buffer = mBuffers[target];
+    bool full = mapping.mOffset == 0 && mapping.mLength == mBufferSizes[buffer];
+    Command cmd = Make(Op::BufferSubData,
+            { target, (uint32_t)mapping.mOffset, (uint32_t)mapping.mLength });
+    SetPayload(cmd, mapping.mPointer, mapping.mLength);
+    Consume(Key(kBuffer, 0, target));
+    if (target == GL_ELEMENT_ARRAY_BUFFER)
+        Consume(Key(kVertexArray));
+    Update(Key(kBufferData, 0, buffer), Add(std::move(cmd)), full);
+}
+
+void FrameCapture::UseProgram(GLuint program) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mProgram = program;
+    Bind(Key(kProgram), Add(Make(Op::UseProgram, { program })));
+}
+
+void FrameCapture::BindVertexArray(GLuint vao) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Bind(Key(kVertexArray), Add(Make(Op::BindVertexArray, { vao })));
+}
+
+void FrameCapture::BindBuffer(GLenum target, GLuint buffer) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mBuffers[target] = buffer;
+    uint64_t seq = Add(Make(Op::BindBuffer, { target, buffer }));
+    if (target == GL_ELEMENT_ARRAY_BUFFER) {
+        // part of the vertex array, never superseded
+        Consume(Key(kVertexArray));
+    } else {
+        Bind(Key(kBuffer, 0, target), seq);
+    }
+}
+
+void FrameCapture::BindTexture(GLenum target, GLuint texture) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mTextures[std::make_pair(mActiveUnit, target)] = texture;
+    Consume(Key(kActiveUnit));
+    Bind(Key(kTexture, mActiveUnit, target), Add(Make(Op::BindTexture, { target, texture })));
+}
+
+void FrameCapture::ActiveTexture(GLenum unit) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mActiveUnit = unit - GL_TEXTURE0;
+    Bind(Key(kActiveUnit), Add(Make(Op::ActiveTexture, { unit })));
+}
+
+void FrameCapture::BindFramebuffer(GLenum target, GLuint framebuffer) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (target != GL_READ_FRAMEBUFFER)
+        mDrawFramebuffer = framebuffer;
+    Bind(Key(kFramebuffer, 0, target), Add(Make(Op::BindFramebuffer, { target, framebuffer })));
+}
+
+void FrameCapture::FramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget,
+        GLuint texture, GLint level) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Consume(Key(kFramebuffer, 0, GL_FRAMEBUFFER));
+    Consume(Key(kFramebuffer, 0, GL_DRAW_FRAMEBUFFER));
+    Consume(Key(kFramebuffer, 0, GL_READ_FRAMEBUFFER));
+    Add(Make(Op::FramebufferTexture2D, { target, attachment, textarget, texture, (uint32_t)level }));
+}
+
+void FrameCapture::Viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    std::lock_guard<std::mutex> lock(mLock);
+    // the window is the largest viewport drawn to it
+    if (mDrawFramebuffer == 0) {
+        mWidth = std::max(mWidth, static_cast<uint32_t>(x + width));
+        mHeight = std::max(mHeight, static_cast<uint32_t>(y + height));
+    }
+    Bind(Key(kViewport), Add(Make(Op::Viewport,
+            { (uint32_t)x, (uint32_t)y, (uint32_t)width, (uint32_t)height })));
+}
+
+void FrameCapture::PixelStorei(GLenum pname, GLint param) {
+    std::lock_guard<std::mutex> lock(mLock);
+    switch (pname) {
+        case GL_UNPACK_ALIGNMENT:
+            mUnpackAlignment = param;
+            break;
+        case GL_UNPACK_ROW_LENGTH:
+            mUnpackRowLength = param;
+            break;
+        case GL_UNPACK_SKIP_ROWS:
+            mUnpackSkipRows = param;
+            break;
+        case GL_UNPACK_SKIP_PIXELS:
+            mUnpackSkipPixels = param;
+            break;
+        default:
+            break;
+    }
+    Bind(Key(kPixelStore, 0, pname), Add(Make(Op::PixelStorei, { pname, (uint32_t)param })));
+}
+
+void FrameCapture::VertexAttribPointer(GLuint index, GLint size, GLenum type,
+        GLboolean normalized, GLsizei stride, const void *pointer) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Consume(Key(kVertexArray));
+    Consume(Key(kBuffer, 0, GL_ARRAY_BUFFER));
+    Add(Make(Op::VertexAttribPointer, { index, (uint32_t)size, type, normalized,
+            (uint32_t)stride, Word(pointer) }));
+}
+
+void FrameCapture::EnableVertexAttribArray(GLuint index) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Consume(Key(kVertexArray));
+    Add(Make(Op::EnableVertexAttribArray, { index }));
+}
+
+void FrameCapture::VertexAttribDivisor(GLuint index, GLuint divisor) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Consume(Key(kVertexArray));
+    Add(Make(Op::VertexAttribDivisor, { index, divisor }));
+}
+
+void FrameCapture::Enable(GLenum cap) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Bind(Key(kCapability, 0, cap), Add(Make(Op::Enable, { cap })));
+}
+
+void FrameCapture::Disable(GLenum cap) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Bind(Key(kCapability, 0, cap), Add(Make(Op::Disable, { cap })));
+}
+
+void FrameCapture::BlendFuncSeparate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha,
+        GLenum dstAlpha) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Bind(Key(kBlendFunc), Add(Make(Op::BlendFuncSeparate,
+            { srcRGB, dstRGB, srcAlpha, dstAlpha })));
+}
+
+void FrameCapture::Uniform1f(GLint location, GLfloat v0) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Consume(Key(kProgram));
+    Replace(Key(kUniform, location, mProgram),
+            Add(Make(Op::Uniform1f, { (uint32_t)location, Word(v0) })));
+}
+
+void FrameCapture::Uniform1i(GLint location, GLint v0) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Consume(Key(kProgram));
+    Replace(Key(kUniform, location, mProgram),
+            Add(Make(Op::Uniform1i, { (uint32_t)location, (uint32_t)v0 })));
+}
+
+void FrameCapture::Uniform2f(GLint location, GLfloat v0, GLfloat v1) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Consume(Key(kProgram));
+    Replace(Key(kUniform, location, mProgram),
+            Add(Make(Op::Uniform2f, { (uint32_t)location, Word(v0), Word(v1) })));
+}
+
+void FrameCapture::Uniform3fv(GLint location, GLsizei count, const GLfloat *value) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Command cmd = Make(Op::Uniform3fv, { (uint32_t)location, (uint32_t)count });
+    for (GLsizei i = 0; i < count * 3; i++)
+        cmd.mArgs.push_back(Word(value[i]));
+    Consume(Key(kProgram));
+    Replace(Key(kUniform, location, mProgram), Add(std::move(cmd)));
+}
+
+void FrameCapture::UniformMatrix3fv(GLint location, GLsizei count, GLboolean transpose,
+        const GLfloat *value) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Command cmd = Make(Op::UniformMatrix3fv, { (uint32_t)location, (uint32_t)count, transpose });
+    for (GLsizei i = 0; i < count * 9; i++)
+        cmd.mArgs.push_back(Word(value[i]));
+    Consume(Key(kProgram));
+    Replace(Key(kUniform, location, mProgram), Add(std::move(cmd)));
+}
+
+static void AddNames(std::vector<uint32_t> &args, GLsizei n, const GLuint *names) {
+    args.insert(args.end(), names, names + n);
+}
+
+void FrameCapture::GenTextures(GLsizei n, GLuint *textures) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Command cmd = Make(Op::GenTextures, {});
+    AddNames(cmd.mArgs, n, textures);
+    Add(std::move(cmd));
+}
+
+void FrameCapture::GenBuffers(GLsizei n, GLuint *buffers) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Command cmd = Make(Op::GenBuffers, {});
+    AddNames(cmd.mArgs, n, buffers);
+    Add(std::move(cmd));
+}
+
+void FrameCapture::GenVertexArrays(GLsizei n, GLuint *vaos) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Command cmd = Make(Op::GenVertexArrays, {});
+    AddNames(cmd.mArgs, n, vaos);
+    Add(std::move(cmd));
+}
+
+void FrameCapture::GenFramebuffers(GLsizei n, GLuint *framebuffers) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Command cmd = Make(Op::GenFramebuffers, {});
+    AddNames(cmd.mArgs, n, framebuffers);
+    Add(std::move(cmd));
+}
+
+void FrameCapture::DeleteTextures(GLsizei n, const GLuint *textures) {
+    std::lock_guard<std::mutex> lock(mLock);
+    for (GLsizei i = 0; i < n; i++) {
+        // the pixels are gone with it, no need to keep them for the setup
+        for (uint32_t level = 0; level < 16; level++)
+            Drop(Key(kTexLevel, level, textures[i]));
+        mTextureSizes.erase(textures[i]);
+        for (auto &it : mTextures) {
+            if (it.second == textures[i])
+                it.second = 0;
+        }
+    }
+    Command cmd = Make(Op::DeleteTextures, {});
+    AddNames(cmd.mArgs, n, textures);
+    Add(std::move(cmd));
+}
+
+void FrameCapture::DeleteBuffers(GLsizei n, const GLuint *buffers) {
+    std::lock_guard<std::mutex> lock(mLock);
+    for (GLsizei i = 0; i < n; i++) {
+        Drop(Key(kBufferData, 0, buffers[i]));
+        mBufferSizes.erase(buffers[i]);
+        for (auto &it : mBuffers) {
+            if (it.second == buffers[i])
+                it.second = 0;
+        }
+    }
+    Command cmd = Make(Op::DeleteBuffers, {});
+    AddNames(cmd.mArgs, n, buffers);
+    Add(std::move(cmd));
+}
+
+void FrameCapture::DeleteVertexArrays(GLsizei n, const GLuint *vaos) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Command cmd = Make(Op::DeleteVertexArrays, {});
+    AddNames(cmd.mArgs, n, vaos);
+    Add(std::move(cmd));
+}
+
+void FrameCapture::DeleteFramebuffers(GLsizei n, const GLuint *framebuffers) {
+    std::lock_guard<std::mutex> lock(mLock);
+    for (GLsizei i = 0; i < n; i++) {
+        if (mDrawFramebuffer == framebuffers[i])
+            mDrawFramebuffer = 0;
+    }
+    Command cmd = Make(Op::DeleteFramebuffers, {});
+    AddNames(cmd.mArgs, n, framebuffers);
+    Add(std::move(cmd));
+}
+
+void FrameCapture::CreateShader(GLuint shader, GLenum type) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Add(Make(Op::CreateShader, { shader, type }));
+}
+
+void FrameCapture::ShaderSource(GLuint shader, GLsizei count, const GLchar *const *string,
+        const GLint *length) {
+    std::lock_guard<std::mutex> lock(mLock);
+    std::string source;
+    for (GLsizei i = 0; i < count; i++) {
+        if (length && length[i] >= 0)
+            source.append(string[i], length[i]);
+        else
+            source.append(string[i]);
+    }
+    Command cmd = Make(Op::ShaderSource, { shader });
+    SetPayload(cmd, source.data(), source.size());
+    Add(std::move(cmd));
+}
+
+void FrameCapture::CompileShader(GLuint shader) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Add(Make(Op::CompileShader, { shader }));
+}
+
+void FrameCapture::DeleteShader(GLuint shader) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Add(Make(Op::DeleteShader, { shader }));
+}
+
+void FrameCapture::CreateProgram(GLuint program) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Add(Make(Op::CreateProgram, { program }));
+}
+
+void FrameCapture::AttachShader(GLuint program, GLuint shader) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Add(Make(Op::AttachShader, { program, shader }));
+}
+
+void FrameCapture::LinkProgram(GLuint program) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Add(Make(Op::LinkProgram, { program }));
+}
+
+void FrameCapture::DeleteProgram(GLuint program) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Add(Make(Op::DeleteProgram, { program }));
+}
+
+void FrameCapture::GetUniformLocation(GLint location, GLuint program, const GLchar *name) {
+    std::lock_guard<std::mutex> lock(mLock);
+    // replay looks the name up on its own program to translate the location
+    Command cmd = Make(Op::GetUniformLocation, { program, (uint32_t)location });
+    SetPayload(cmd, name, strlen(name) + 1);
+    Add(std::move(cmd));
+}
+
+}
@@ -0,0 +1,319 @@
+#pragma once
+
+#include "config.h"
+#if HAVE_GLES
+#   include <GLES3/gl3.h>
+#else
+#   define GLFW_INCLUDE_GLCOREARB
+#   define GL_GLEXT_PROTOTYPES
+#   define GLFW_INCLUDE_GLEXT
+#   include <GLFW/glfw3.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <initializer_list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace quink {
+
+/* Records the GL commands issued through gl-hooks.h for a range of frames,
+ * to be re-executed by FrameReplay.
+ *
+ * Recording starts when armed, which has to happen before the first GL
+ * object is created. Until the first captured frame only what is needed to
+ * rebuild the state goes into memory: object creation, programs, the latest
+ * contents of each texture level and buffer, the latest binding, uniform
+ * and parameter values. Draws are dropped. At the start of the range that
+ * setup is written out, the frames follow call by call.
+ *
+ * File layout, native byte order:
+ *   FileHeader
+ *   records up to SetupEnd, then records of each frame up to FrameEnd
+ * A record is a RecordHeader followed by mArgs 32 bit words. Payloads are
+ * Blob records, written once and referenced by id from later records, so
+ * an image uploaded every frame is stored once. Payloads are matched by
+ * hash and then compared with the bytes in the file.
+ *
+ * Only calls on the thread that armed the capture are recorded, so the
+ * context current there is followed; work on ContextPool workers and GL
+ * calls outside gl-hooks.h are not seen. Vertex and index data have to come
+ * from buffers.
+ */
+class FrameCapture {
+public:
+    enum class Op : uint16_t {
+        Blob,
+        SetupEnd,
+        FrameEnd,
+        DrawArrays,
+        DrawElements,
+        DrawArraysInstanced,
+        DrawElementsInstanced,
+        BlitFramebuffer,
+        Clear,
+        ClearColor,
+        TexImage2D,
+        TexSubImage2D,
+        CompressedTexImage2D,
+        CompressedTexSubImage2D,
+        TexStorage2D,
+        TexParameteri,
+        BufferData,
+        BufferSubData,
+        UseProgram,
+        BindVertexArray,
+        BindBuffer,
+        BindTexture,
+        ActiveTexture,
+        BindFramebuffer,
+        FramebufferTexture2D,
+        Viewport,
+        PixelStorei,
+        VertexAttribPointer,
+        EnableVertexAttribArray,
+        Uniform1f,
+        Uniform1i,
+        Uniform3fv,
+        UniformMatrix3fv,
+        GenTextures,
+        GenBuffers,
+        GenVertexArrays,
+        GenFramebuffers,
+        DeleteTextures,
+        DeleteBuffers,
+        DeleteVertexArrays,
+        DeleteFramebuffers,
+        CreateShader,
+        ShaderSource,
+        CompileShader,
+        DeleteShader,
+        CreateProgram,
+        AttachShader,
+        LinkProgram,
+        DeleteProgram,
+        GetUniformLocation,
+        Uniform2f,
+        VertexAttribDivisor,
+        Enable,
+        Disable,
+        BlendFuncSeparate,
+        Count,
+    };
+
+    struct FileHeader {
+        char mMagic[4];
+        uint32_t mVersion;
+        // of the default framebuffer
+        uint32_t mWidth;
+        uint32_t mHeight;
+        uint32_t mFrames;
+        uint32_t mReserved;
+    };
+
+    struct RecordHeader {
+        uint16_t mOp;
+        uint16_t mArgs;
+        // id of the payload, 0 for none
+        uint32_t mBlob;
+    };
+
+    static const char kMagic[4];
+    static const uint32_t kVersion = 1;
+
+    static FrameCapture &Instance();
+
+    // "<path>[:<first>[:<count>]]", frame numbers start from arming
+    static int ParseSpec(const std::string &spec, std::string &path, uint64_t &first,
+            uint64_t &count);
+    static const char *OpName(Op op);
+
+    // checked by every hook, keep it cheap; false on other threads
+    static bool IsRecording() {
+        return sRecording.load(std::memory_order_relaxed) &&
+                sThread.load(std::memory_order_relaxed) == std::this_thread::get_id();
+    }
+
+    int Arm(const std::string &path, uint64_t first, uint64_t count);
+    // after the last GL call of a frame
+    void EndFrame();
+    // writes out what was captured so far
+    void Stop();
+
+    // called by gl-hooks.h after the real call
+    void DrawArrays(GLenum mode, GLint first, GLsizei count);
+    void DrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices);
+    void DrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances);
+    void DrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void *indices,
+            GLsizei instances);
+    void BlitFramebuffer(GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1,
+            GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter);
+    void Clear(GLbitfield mask);
+    void ClearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a);
+    void TexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width,
+            GLsizei height, GLint border, GLenum format, GLenum type, const void *pixels);
+    void TexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width,
+            GLsizei height, GLenum format, GLenum type, const void *pixels);
+    void CompressedTexImage2D(GLenum target, GLint level, GLenum internalFormat, GLsizei width,
+            GLsizei height, GLint border, GLsizei imageSize, const void *data);
+    void CompressedTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset,
+            GLsizei width, GLsizei height, GLenum format, GLsizei imageSize, const void *data);
+    void TexStorage2D(GLenum target, GLsizei levels, GLenum internalFormat, GLsizei width,
+            GLsizei height);
+    void TexParameteri(GLenum target, GLenum pname, GLint param);
+    void BufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage);
+    void BufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data);
+    // what was written through a mapping is recorded as BufferSubData at unmap
+    void MapBufferRange(void *pointer, GLenum target, GLintptr offset, GLsizeiptr length,
+            GLbitfield access);
+    void UnmapBuffer(GLenum target);
+    void UseProgram(GLuint program);
+    void BindVertexArray(GLuint vao);
+    void BindBuffer(GLenum target, GLuint buffer);
+    void BindTexture(GLenum target, GLuint texture);
+    void ActiveTexture(GLenum unit);
+    void BindFramebuffer(GLenum target, GLuint framebuffer);
+    void FramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget,
+            GLuint texture, GLint level);
+    void Viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    void PixelStorei(GLenum pname, GLint param);
+    void VertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized,
+            GLsizei stride, const void *pointer);
+    void EnableVertexAttribArray(GLuint index);
+    void VertexAttribDivisor(GLuint index, GLuint divisor);
+    void Enable(GLenum cap);
+    void Disable(GLenum cap);
+    void BlendFuncSeparate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha);
+    void Uniform1f(GLint location, GLfloat v0);
+    void Uniform1i(GLint location, GLint v0);
+    void Uniform2f(GLint location, GLfloat v0, GLfloat v1);
+    void Uniform3fv(GLint location, GLsizei count, const GLfloat *value);
+    void UniformMatrix3fv(GLint location, GLsizei count, GLboolean transpose,
+            const GLfloat *value);
+    void GenTextures(GLsizei n, GLuint *textures);
+    void GenBuffers(GLsizei n, GLuint *buffers);
+    void GenVertexArrays(GLsizei n, GLuint *vaos);
+    void GenFramebuffers(GLsizei n, GLuint *framebuffers);
+    void DeleteTextures(GLsizei n, const GLuint *textures);
+    void DeleteBuffers(GLsizei n, const GLuint *buffers);
+    void DeleteVertexArrays(GLsizei n, const GLuint *vaos);
+    void DeleteFramebuffers(GLsizei n, const GLuint *framebuffers);
+    void CreateShader(GLuint shader, GLenum type);
+    void ShaderSource(GLuint shader, GLsizei count, const GLchar *const *string,
+            const GLint *length);
+    void CompileShader(GLuint shader);
+    void DeleteShader(GLuint shader);
+    void CreateProgram(GLuint program);
+    void AttachShader(GLuint program, GLuint shader);
+    void LinkProgram(GLuint program);
+    void DeleteProgram(GLuint program);
+    void GetUniformLocation(GLint location, GLuint program, const GLchar *name);
+
+private:
+    struct Command {
+        Op mOp;
+        std::vector<uint32_t> mArgs;
+        // copied while the setup is kept in memory, borrowed when written
+        // straight away
+        std::vector<uint8_t> mCopy;
+        const void *mPayload = nullptr;
+        size_t mSize = 0;
+    };
+
+    struct Mapping {
+        const void *mPointer;
+        GLintptr mOffset;
+        GLsizeiptr mLength;
+    };
+
+    struct Binding {
+        uint64_t mSeq = 0;
+        bool mConsumed = false;
+    };
+
+    struct Blob {
+        uint32_t mId;
+        size_t mSize;
+        // of the payload in the file
+        long mOffset;
+    };
+
+    FrameCapture() = default;
+
+    // all below with mLock held
+    Command Make(Op op, std::initializer_list<uint32_t> args);
+    void SetPayload(Command &cmd, const void *data, size_t size);
+    // the sequence number of the setup command, 0 once it is written
+    uint64_t Add(Command &&cmd);
+    // a state setting superseding the previous one of the same key, unless
+    // something in between depended on it
+    void Bind(uint64_t key, uint64_t seq);
+    void Consume(uint64_t key);
+    // a value superseding the previous one of the same key
+    void Replace(uint64_t key, uint64_t seq);
+    // contents of a texture level or buffer; a full update supersedes the
+    // updates before it
+    void Update(uint64_t key, uint64_t seq, bool full);
+    void Drop(uint64_t key);
+    void ConsumeUpload(GLenum target);
+    size_t UnpackSize(GLsizei width, GLsizei height, GLenum format, GLenum type) const;
+    GLuint BoundTexture(GLenum target) const;
+
+    void Begin();
+    void Write(const Command &cmd);
+    // whether the payload of blob has the same bytes
+    bool IsWritten(const Blob &blob, const uint8_t *data, size_t size);
+    void WriteRecord(Op op, const uint32_t *args, size_t count, uint32_t blob);
+    void Finish();
+
+    static std::atomic<bool> sRecording;
+    // the thread that armed
+    static std::atomic<std::thread::id> sThread;
+
+    std::mutex mLock;
+    std::string mPath;
+    uint64_t mFirst = 0;
+    uint64_t mCount = 0;
+    uint64_t mFrame = 0;
+    uint64_t mWritten = 0;
+
+    // the setup before the range
+    std::map<uint64_t, Command> mSetup;
+    uint64_t mNextSeq = 1;
+    std::unordered_map<uint64_t, Binding> mBindings;
+    std::unordered_map<uint64_t, uint64_t> mValues;
+    std::unordered_map<uint64_t, std::vector<uint64_t>> mContents;
+
+    // the range
+    FILE *mFile = nullptr;
+    // by hash of the payload
+    std::unordered_multimap<uint64_t, Blob> mBlobs;
+    uint32_t mNextBlob = 1;
+    size_t mBlobBytes = 0;
+
+    // what the context has bound, to know which object a call works on
+    GLuint mActiveUnit = 0;
+    std::map<std::pair<GLuint, GLenum>, GLuint> mTextures;
+    std::map<GLenum, GLuint> mBuffers;
+    GLuint mProgram = 0;
+    GLuint mDrawFramebuffer = 0;
+    std::map<GLuint, std::pair<GLsizei, GLsizei>> mTextureSizes;
+    std::map<GLuint, GLsizeiptr> mBufferSizes;
+    std::map<GLenum, Mapping> mMappings;
+    GLint mUnpackAlignment = 4;
+    GLint mUnpackRowLength = 0;
+    GLint mUnpackSkipRows = 0;
+    GLint mUnpackSkipPixels = 0;
+    uint32_t mWidth = 0;
+    uint32_t mHeight = 0;
+};
+
+}
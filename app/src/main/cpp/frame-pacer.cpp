@@ -0,0 +1,173 @@
+#include "frame-pacer.h"
+
+#include <algorithm>
+
+#include "log.h"
+#include "trace.h"
+
+namespace quink {
+
+// a frame that takes longer has hung the GPU, it is dropped with a message
+static const GLuint64 kWaitTimeoutNs = 2000000000ull;
+
+static float Ms(FramePacer::Clock::duration d) {
+    return std::chrono::duration<float, std::milli>(d).count();
+}
+
+static void Smooth(float &value, float sample) {
+    value = value < 0.0f ? sample : value + (sample - value) * 0.1f;
+}
+
+// a spike moves the GPU time by at most 4 times the estimate, and the
+// estimate restarts once frames are that much faster than it again
+static void SmoothGpu(float &value, float sample) {
+    if (value < 0.0f || sample < value * 0.25f)
+        value = sample;
+    else
+        Smooth(value, std::min(sample, value * 4.0f));
+}
+
+FramePacer::FramePacer() : FramePacer(Config()) {
+}
+
+FramePacer::FramePacer(const Config &config) :
+    mConfig(config) {
+    mInFlight.reserve(std::max(mConfig.mMaxInFlight, 0));
+}
+
+FramePacer::~FramePacer() {
+    for (const Frame &frame : mInFlight)
+        glDeleteSync(frame.mFence);
+}
+
+void FramePacer::BeginFrame() {
+    if (mConfig.mMaxInFlight <= 0) {
+        mBegin = Clock::now();
+        return;
+    }
+
+    Poll(false);
+    if (GetInFlight() >= mConfig.mMaxInFlight) {
+        TRACE_SCOPE("FramePacer::Wait");
+        auto begin = Clock::now();
+        while (GetInFlight() >= mConfig.mMaxInFlight)
+            Poll(true);
+        mStats.mWaits++;
+        mStats.mWaitMs += Ms(Clock::now() - begin);
+    }
+
+    if (mConfig.mPredictStart && !mInFlight.empty() && mGpuMs >= 0.0f && mCpuMs >= 0.0f) {
+        /* The sleep waits on the oldest fence, so a frame completing
+         * meanwhile is timed exactly and the start predicted again. Once
+         * nothing is in flight the GPU is idle and there is no point in
+         * sleeping longer.
+         */
+        const auto lead = std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<float, std::milli>(mCpuMs + mConfig.mMarginMs));
+        const auto begin = Clock::now();
+        while (!mInFlight.empty()) {
+            auto now = Clock::now();
+            auto start = PredictIdle() - lead;
+            if (start <= now)
+                break;
+            TRACE_SCOPE("FramePacer::Sleep");
+            auto timeout = std::chrono::duration_cast<std::chrono::nanoseconds>(start - now);
+            if (!Retire(timeout.count()))
+                break;
+            Poll(false);
+        }
+        mStats.mSleepMs += Ms(Clock::now() - begin);
+    }
+    mBegin = Clock::now();
+}
+
+void FramePacer::EndFrame() {
+    if (mConfig.mMaxInFlight <= 0)
+        return;
+
+    Frame frame;
+    frame.mNumber = mNextFrame++;
+    frame.mFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // the fence has to reach the GPU before anyone waits for it
+    glFlush();
+    frame.mSubmit = Clock::now();
+    Smooth(mCpuMs, Ms(frame.mSubmit - mBegin));
+    if (!frame.mFence) {
+        ALOGE("glFenceSync failed, 0x%x", glGetError());
+        return;
+    }
+    mInFlight.push_back(frame);
+    Poll(false);
+}
+
+void FramePacer::Drain() {
+    while (!mInFlight.empty())
+        Poll(true);
+}
+
+void FramePacer::Abandon() {
+    mInFlight.clear();
+    mLastComplete = Clock::time_point();
+    mLastExact = false;
+}
+
+void FramePacer::Poll(bool wait) {
+    // only the oldest is waited for
+    if (wait && !mInFlight.empty())
+        Retire(kWaitTimeoutNs);
+    while (!mInFlight.empty() && Retire(0)) {
+    }
+}
+
+bool FramePacer::Retire(GLuint64 timeoutNs) {
+    const Frame &frame = mInFlight.front();
+    GLenum status = timeoutNs ?
+            glClientWaitSync(frame.mFence, GL_SYNC_FLUSH_COMMANDS_BIT, timeoutNs) :
+            glClientWaitSync(frame.mFence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED && timeoutNs < kWaitTimeoutNs)
+        return false;
+    if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+        // only a wait returning on the signal sees the completion as it happens
+        Complete(frame, Clock::now(), status == GL_CONDITION_SATISFIED);
+    } else {
+        ALOGE("fence of frame %llu %s, dropped", (unsigned long long)frame.mNumber,
+                status == GL_TIMEOUT_EXPIRED ? "timed out" : "failed");
+    }
+    glDeleteSync(frame.mFence);
+    mInFlight.erase(mInFlight.begin());
+    return true;
+}
+
+void FramePacer::Complete(const Frame &frame, Clock::time_point when, bool exact) {
+    /* The GPU time is exact when the completion is, and the frame started
+     * at its submission or at an exact completion of the one before. Seen
+     * late, it is an upper bound and may only bring the estimate down.
+     */
+    const float gpuMs = Ms(when - std::max(frame.mSubmit, mLastComplete));
+    if (exact && (mLastExact || frame.mSubmit >= mLastComplete))
+        SmoothGpu(mGpuMs, gpuMs);
+    else if (mGpuMs >= 0.0f && gpuMs < mGpuMs)
+        SmoothGpu(mGpuMs, gpuMs);
+    mLastComplete = when;
+    mLastExact = exact;
+
+    const float latency = Ms(when - frame.mSubmit);
+    Smooth(mLatencyMs, latency);
+    mStats.mFrames++;
+    mStats.mLatencyMs += latency;
+    mStats.mMaxLatencyMs = std::max(mStats.mMaxLatencyMs, (double)latency);
+    if (mCallback)
+        mCallback(frame.mNumber, latency);
+}
+
+FramePacer::Clock::time_point FramePacer::PredictIdle() const {
+    // each frame starts once both it is submitted and the one before is done
+    const auto gpu = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<float, std::milli>(mGpuMs));
+    Clock::time_point idle = mLastComplete;
+    for (const Frame &frame : mInFlight)
+        idle = std::max(idle, frame.mSubmit) + gpu;
+    return idle;
+}
+
+}
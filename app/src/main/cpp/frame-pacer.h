@@ -0,0 +1,120 @@
+#pragma once
+
+#include "config.h"
+#if HAVE_GLES
+#   include <GLES3/gl3.h>
+#else
+#   define GLFW_INCLUDE_GLCOREARB
+#   define GL_GLEXT_PROTOTYPES
+#   define GLFW_INCLUDE_GLEXT
+#   include <GLFW/glfw3.h>
+#endif
+
+#include <stdint.h>
+
+#include <chrono>
+#include <functional>
+#include <vector>
+
+namespace quink {
+
+/* Keeps the CPU from running ahead of the GPU with a fence per frame.
+ *
+ * BeginFrame() blocks until fewer than mMaxInFlight frames are queued. It
+ * then sleeps until the predicted moment the frame has to start to be
+ * submitted just as the GPU runs out of work: the queued frames at the
+ * measured GPU time per frame, less the CPU time of a frame and a margin.
+ * Input sampled right after BeginFrame() is then as fresh as it can be
+ * without leaving the GPU idle. The sleep is a wait on the oldest fence,
+ * it ends early when the GPU runs out of work before the prediction.
+ *
+ * The GPU time of a frame runs from the later of its submission and the
+ * completion of the frame before to its own completion. Only a wait that
+ * returns on the fence sees the completion as it happens, so only frames
+ * timed that way feed the estimate. A completion found by a later poll
+ * errs long and would keep a too long estimate, and the sleep it causes,
+ * alive; it is used only when it is shorter than the estimate. Outliers
+ * are clamped and the estimate restarts when frames are much faster. The
+ * submit to complete latency of every frame goes to the latency callback.
+ *
+ * Must be used on the thread with the context current.
+ */
+class FramePacer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Config {
+        int mMaxInFlight = 2;       // submitted and not complete, 0 for off
+        float mMarginMs = 1.0f;     // earlier than predicted, for wake up jitter
+        bool mPredictStart = true;  // otherwise only the limit applies
+    };
+
+    struct Stats {
+        uint64_t mFrames = 0;       // completed
+        uint64_t mWaits = 0;        // BeginFrame() blocked on a fence
+        double mWaitMs = 0.0;
+        double mSleepMs = 0.0;
+        double mLatencyMs = 0.0;    // sum over mFrames
+        double mMaxLatencyMs = 0.0;
+    };
+
+    FramePacer();
+    explicit FramePacer(const Config &config);
+    ~FramePacer();
+
+    FramePacer(const FramePacer &) = delete;
+    FramePacer &operator=(const FramePacer &) = delete;
+
+    // before the input of the frame is sampled
+    void BeginFrame();
+    // after the last GL call of the frame, before the swap
+    void EndFrame();
+    // waits for every frame in flight
+    void Drain();
+    // the context is gone with its fences, forget them
+    void Abandon();
+
+    // frames are numbered from 0 in EndFrame() order
+    void SetLatencyCallback(std::function<void(uint64_t frame, float latencyMs)> callback) {
+        mCallback = callback;
+    }
+
+    int GetInFlight() const { return static_cast<int>(mInFlight.size()); }
+    // smoothed, negative until measured
+    float GetGpuMs() const { return mGpuMs; }
+    float GetLatencyMs() const { return mLatencyMs; }
+    const Stats &GetStats() const { return mStats; }
+
+private:
+    struct Frame {
+        uint64_t mNumber;
+        GLsync mFence;
+        Clock::time_point mSubmit;
+    };
+
+    // completes the signaled frames in order, waiting for the oldest one
+    // first when wait is set
+    void Poll(bool wait);
+    // completes the oldest frame once it signals within timeoutNs, false if
+    // it doesn't; after kWaitTimeoutNs it is dropped as hung
+    bool Retire(GLuint64 timeoutNs);
+    // exact when seen by a wait returning on the signal
+    void Complete(const Frame &frame, Clock::time_point when, bool exact);
+    // when the GPU is expected to be done with everything in flight
+    Clock::time_point PredictIdle() const;
+
+    const Config mConfig;
+    std::function<void(uint64_t, float)> mCallback;
+    // oldest first, reserved up front so a frame doesn't allocate
+    std::vector<Frame> mInFlight;
+    uint64_t mNextFrame = 0;
+    Clock::time_point mBegin;
+    Clock::time_point mLastComplete;
+    bool mLastExact = false;
+    float mGpuMs = -1.0f;
+    float mCpuMs = -1.0f;
+    float mLatencyMs = -1.0f;
+    Stats mStats;
+};
+
+}
@@ -0,0 +1,592 @@
+#include "frame-replay.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "log.h"
+
+namespace quink {
+
+using Clock = std::chrono::steady_clock;
+
+// words a record of the op carries, -1 when it depends on the call
+static int ArgCount(FrameCapture::Op op) {
+    using Op = FrameCapture::Op;
+    switch (op) {
+        case Op::SetupEnd:
+        case Op::FrameEnd:
+            return 0;
+        case Op::Clear:
+        case Op::UseProgram:
+        case Op::BindVertexArray:
+        case Op::ActiveTexture:
+        case Op::EnableVertexAttribArray:
+        case Op::Enable:
+        case Op::Disable:
+        case Op::ShaderSource:
+        case Op::CompileShader:
+        case Op::DeleteShader:
+        case Op::CreateProgram:
+        case Op::LinkProgram:
+        case Op::DeleteProgram:
+            return 1;
+        case Op::BindBuffer:
+        case Op::BindTexture:
+        case Op::BindFramebuffer:
+        case Op::PixelStorei:
+        case Op::Uniform1f:
+        case Op::Uniform1i:
+        case Op::CreateShader:
+        case Op::AttachShader:
+        case Op::GetUniformLocation:
+        case Op::VertexAttribDivisor:
+        case Op::Blob:
+            return 2;
+        case Op::DrawArrays:
+        case Op::TexParameteri:
+        case Op::BufferData:
+        case Op::BufferSubData:
+        case Op::Uniform2f:
+            return 3;
+        case Op::DrawElements:
+        case Op::DrawArraysInstanced:
+        case Op::ClearColor:
+        case Op::Viewport:
+        case Op::BlendFuncSeparate:
+            return 4;
+        case Op::DrawElementsInstanced:
+        case Op::TexStorage2D:
+        case Op::FramebufferTexture2D:
+            return 5;
+        case Op::VertexAttribPointer:
+            return 6;
+        case Op::CompressedTexImage2D:
+            return 8;
+        case Op::TexImage2D:
+        case Op::TexSubImage2D:
+        case Op::CompressedTexSubImage2D:
+            return 9;
+        case Op::BlitFramebuffer:
+            return 10;
+        default:
+            return -1;
+    }
+}
+
+static bool IsValid(FrameCapture::Op op, const uint32_t *args, uint32_t count,
+        const uint8_t *blob, uint32_t blobSize) {
+    using Op = FrameCapture::Op;
+    int expected = ArgCount(op);
+    if (expected >= 0)
+        return (uint32_t)expected == count &&
+                ((op != Op::ShaderSource && op != Op::GetUniformLocation) || blob) &&
+                (op != Op::GetUniformLocation || blob[blobSize - 1] == '\0');
+    if (op == Op::Uniform3fv)
+        return count >= 2 && count == 2 + args[1] * 3;
+    if (op == Op::UniformMatrix3fv)
+        return count >= 3 && count == 3 + args[1] * 9;
+    // names of Gen and Delete
+    return true;
+}
+
+static float Float(uint32_t word) {
+    float f;
+    memcpy(&f, &word, sizeof(f));
+    return f;
+}
+
+static GLuint Map(const std::unordered_map<GLuint, GLuint> &names, GLuint name) {
+    if (!name)
+        return 0;
+    auto it = names.find(name);
+    return it == names.end() ? 0 : it->second;
+}
+
+// client memory was recorded as a payload, anything else is a buffer offset
+static const void *Pointer(const uint8_t *blob, uint32_t offset) {
+    return blob ? static_cast<const void *>(blob) : reinterpret_cast<const void *>(
+            static_cast<uintptr_t>(offset));
+}
+
+int FrameReplay::Load(const std::string &path) {
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        ALOGE("open %s failed", path.c_str());
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    mData.resize(size > 0 ? size : 0);
+    size_t n = fread(mData.data(), 1, mData.size(), fp);
+    fclose(fp);
+    if (n != mData.size() || mData.size() < sizeof(mHeader)) {
+        ALOGE("read %s failed", path.c_str());
+        return -1;
+    }
+    memcpy(&mHeader, mData.data(), sizeof(mHeader));
+    if (memcmp(mHeader.mMagic, FrameCapture::kMagic, sizeof(mHeader.mMagic)) != 0 ||
+            mHeader.mVersion != FrameCapture::kVersion) {
+        ALOGE("%s is not a version %u frame capture", path.c_str(), FrameCapture::kVersion);
+        return -1;
+    }
+
+    std::vector<std::pair<const uint8_t *, uint32_t>> blobs;
+    bool setup = true;
+    size_t frameBegin = 0;
+    size_t pos = sizeof(mHeader);
+    while (pos + sizeof(FrameCapture::RecordHeader) <= mData.size()) {
+        FrameCapture::RecordHeader header;
+        memcpy(&header, mData.data() + pos, sizeof(header));
+        pos += sizeof(header);
+        size_t argBytes = header.mArgs * sizeof(uint32_t);
+        if (header.mOp >= static_cast<uint16_t>(Op::Count) || pos + argBytes > mData.size())
+            break;
+        // records and payloads are padded to whole words
+        const uint32_t *args = reinterpret_cast<const uint32_t *>(mData.data() + pos);
+        pos += argBytes;
+
+        Op op = static_cast<Op>(header.mOp);
+        if (op == Op::Blob) {
+            if (header.mArgs != 2 || args[0] != blobs.size() + 1 || pos + args[1] > mData.size())
+                break;
+            blobs.emplace_back(mData.data() + pos, args[1]);
+            pos += (args[1] + 3) / 4 * 4;
+            continue;
+        }
+
+        Record r = { op, args, header.mArgs, nullptr, 0 };
+        if (header.mBlob) {
+            if (header.mBlob > blobs.size())
+                break;
+            r.mBlob = blobs[header.mBlob - 1].first;
+            r.mBlobSize = blobs[header.mBlob - 1].second;
+        }
+        if (!IsValid(op, args, r.mCount, r.mBlob, r.mBlobSize)) {
+            ALOGE("malformed %s record at %zu", FrameCapture::OpName(op), pos);
+            return -1;
+        }
+        mRecords.push_back(r);
+
+        if (op == Op::SetupEnd && setup) {
+            setup = false;
+            mSetupEnd = mRecords.size() - 1;
+            frameBegin = mRecords.size();
+        } else if (op == Op::FrameEnd && !setup) {
+            mFrames.emplace_back(frameBegin, mRecords.size() - 1);
+            frameBegin = mRecords.size();
+        }
+    }
+
+    if (setup) {
+        ALOGE("%s has no complete setup", path.c_str());
+        return -1;
+    }
+    // a capture cut short still replays the frames it completed
+    if (pos != mData.size() || mFrames.size() != mHeader.mFrames)
+        ALOGE("%s is truncated, %zu of %u frames", path.c_str(), mFrames.size(), mHeader.mFrames);
+    ALOGD("loaded %s: %zu frames of %ux%u, %zu records, %zu payloads", path.c_str(),
+            mFrames.size(), mHeader.mWidth, mHeader.mHeight, mRecords.size(), blobs.size());
+    return mFrames.empty() ? -1 : 0;
+}
+
+int FrameReplay::Run(const Options &options) {
+    auto begin = Clock::now();
+    Execute(0, mSetupEnd, options);
+    glFinish();
+    ALOGD("setup, %zu calls, takes %.1f ms", mSetupEnd,
+            std::chrono::duration<double, std::milli>(Clock::now() - begin).count());
+    mCallStats = decltype(mCallStats)();
+
+    std::vector<double> frameMs(mFrames.size());
+    std::vector<double> all;
+    for (int loop = 0; loop < options.mLoops; loop++) {
+        for (size_t i = 0; i < mFrames.size(); i++) {
+            auto t1 = Clock::now();
+            Execute(mFrames[i].first, mFrames[i].second, options);
+            glFinish();
+            double ms = std::chrono::duration<double, std::milli>(Clock::now() - t1).count();
+            frameMs[i] += ms;
+            all.push_back(ms);
+        }
+    }
+
+    for (size_t i = 0; i < mFrames.size(); i++)
+        ALOGD("frame %zu, %zu calls, takes %.3f ms", i, mFrames[i].second - mFrames[i].first,
+                frameMs[i] / options.mLoops);
+    if (!all.empty()) {
+        double total = 0.0;
+        for (double ms : all)
+            total += ms;
+        std::sort(all.begin(), all.end());
+        ALOGD("%zu frames: mean %.3f ms, min %.3f ms, median %.3f ms, max %.3f ms", all.size(),
+                total / all.size(), all.front(), all[all.size() / 2], all.back());
+    }
+    if (options.mTiming)
+        ReportTiming();
+
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR) {
+        ALOGE("replay ends with GL error 0x%x", error);
+        return -1;
+    }
+    return 0;
+}
+
+void FrameReplay::Execute(size_t begin, size_t end, const Options &options) {
+    for (size_t i = begin; i < end; i++) {
+        const Record &r = mRecords[i];
+        if (!options.mTiming) {
+            Execute(r);
+            if (options.mFinishEachCall)
+                glFinish();
+            continue;
+        }
+        auto t1 = Clock::now();
+        Execute(r);
+        if (options.mFinishEachCall)
+            glFinish();
+        CallStats &stats = mCallStats[static_cast<size_t>(r.mOp)];
+        stats.mCalls++;
+        stats.mMs += std::chrono::duration<double, std::milli>(Clock::now() - t1).count();
+    }
+}
+
+void FrameReplay::Execute(const Record &r) {
+    const uint32_t *a = r.mArgs;
+    switch (r.mOp) {
+        case Op::DrawArrays:
+            glDrawArrays(a[0], a[1], a[2]);
+            break;
+        case Op::DrawElements:
+            glDrawElements(a[0], a[1], a[2], Pointer(nullptr, a[3]));
+            break;
+        case Op::DrawArraysInstanced:
+            glDrawArraysInstanced(a[0], a[1], a[2], a[3]);
+            break;
+        case Op::DrawElementsInstanced:
+            glDrawElementsInstanced(a[0], a[1], a[2], Pointer(nullptr, a[3]), a[4]);
+            break;
+        case Op::BlitFramebuffer:
+            glBlitFramebuffer(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8], a[9]);
+            break;
+        case Op::Clear:
+            glClear(a[0]);
+            break;
+        case Op::ClearColor:
+            glClearColor(Float(a[0]), Float(a[1]), Float(a[2]), Float(a[3]));
+            break;
+        case Op::TexImage2D:
+            glTexImage2D(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], Pointer(r.mBlob, a[8]));
+            break;
+        case Op::TexSubImage2D:
+            glTexSubImage2D(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], Pointer(r.mBlob, a[8]));
+            break;
+        case Op::CompressedTexImage2D:
+            glCompressedTexImage2D(a[0], a[1], a[2], a[3], a[4], a[5], a[6],
+                    Pointer(r.mBlob, a[7]));
+            break;
+        case Op::CompressedTexSubImage2D:
+            glCompressedTexSubImage2D(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7],
+                    Pointer(r.mBlob, a[8]));
+            break;
+        case Op::TexStorage2D:
+            glTexStorage2D(a[0], a[1], a[2], a[3], a[4]);
+            break;
+        case Op::TexParameteri:
+            glTexParameteri(a[0], a[1], a[2]);
+            break;
+        case Op::BufferData:
+            glBufferData(a[0], a[1], r.mBlob, a[2]);
+            break;
+        case Op::BufferSubData:
+            glBufferSubData(a[0], a[1], a[2], r.mBlob);
+            break;
+        case Op::UseProgram:
+            mProgram = Map(mPrograms, a[0]);
+            glUseProgram(mProgram);
+            break;
+        case Op::BindVertexArray:
+            glBindVertexArray(Map(mVertexArrays, a[0]));
+            break;
+        case Op::BindBuffer:
+            glBindBuffer(a[0], Map(mBuffers, a[1]));
+            break;
+        case Op::BindTexture:
+            glBindTexture(a[0], Map(mTextures, a[1]));
+            break;
+        case Op::ActiveTexture:
+            glActiveTexture(a[0]);
+            break;
+        case Op::BindFramebuffer:
+            glBindFramebuffer(a[0], Map(mFramebuffers, a[1]));
+            break;
+        case Op::FramebufferTexture2D:
+            glFramebufferTexture2D(a[0], a[1], a[2], Map(mTextures, a[3]), a[4]);
+            break;
+        case Op::Viewport:
+            glViewport(a[0], a[1], a[2], a[3]);
+            break;
+        case Op::PixelStorei:
+            glPixelStorei(a[0], a[1]);
+            break;
+        case Op::VertexAttribPointer:
+            glVertexAttribPointer(a[0], a[1], a[2], a[3], a[4], Pointer(nullptr, a[5]));
+            break;
+        case Op::EnableVertexAttribArray:
+            glEnableVertexAttribArray(a[0]);
+            break;
+        case Op::VertexAttribDivisor:
+            glVertexAttribDivisor(a[0], a[1]);
+            break;
+        case Op::Enable:
+            glEnable(a[0]);
+            break;
+        case Op::Disable:
+            glDisable(a[0]);
+            break;
+        case Op::BlendFuncSeparate:
+            glBlendFuncSeparate(a[0], a[1], a[2], a[3]);
+            break;
+        case Op::Uniform1f:
+        case Op::Uniform1i:
+        case Op::Uniform2f:
+        case Op::Uniform3fv:
+        case Op::UniformMatrix3fv: {
+            const auto &locations = mLocations[mProgram];
+            auto it = locations.find(static_cast<GLint>(a[0]));
+            GLint location = it == locations.end() ? -1 : it->second;
+            if (r.mOp == Op::Uniform1f)
+                glUniform1f(location, Float(a[1]));
+            else if (r.mOp == Op::Uniform1i)
+                glUniform1i(location, a[1]);
+            else if (r.mOp == Op::Uniform2f)
+                glUniform2f(location, Float(a[1]), Float(a[2]));
+            else if (r.mOp == Op::Uniform3fv)
+                glUniform3fv(location, a[1], reinterpret_cast<const GLfloat *>(a + 2));
+            else
+                glUniformMatrix3fv(location, a[1], a[2], reinterpret_cast<const GLfloat *>(a + 3));
+            break;
+        }
+        case Op::GenTextures:
+        case Op::GenBuffers:
+        case Op::GenVertexArrays:
+        case Op::GenFramebuffers: {
+            std::vector<GLuint> names(r.mCount);
+            std::unordered_map<GLuint, GLuint> *map;
+            if (r.mOp == Op::GenTextures) {
+                glGenTextures(r.mCount, names.data());
+                map = &mTextures;
+            } else if (r.mOp == Op::GenBuffers) {
+                glGenBuffers(r.mCount, names.data());
+                map = &mBuffers;
+            } else if (r.mOp == Op::GenVertexArrays) {
+                glGenVertexArrays(r.mCount, names.data());
+                map = &mVertexArrays;
+            } else {
+                glGenFramebuffers(r.mCount, names.data());
+                map = &mFramebuffers;
+            }
+            for (uint32_t i = 0; i < r.mCount; i++)
+                (*map)[a[i]] = names[i];
+            break;
+        }
+        case Op::DeleteTextures:
+        case Op::DeleteBuffers:
+        case Op::DeleteVertexArrays:
+        case Op::DeleteFramebuffers: {
+            std::unordered_map<GLuint, GLuint> *map =
+                    r.mOp == Op::DeleteTextures ? &mTextures :
+                    r.mOp == Op::DeleteBuffers ? &mBuffers :
+                    r.mOp == Op::DeleteVertexArrays ? &mVertexArrays : &mFramebuffers;
+            std::vector<GLuint> names(r.mCount);
+            for (uint32_t i = 0; i < r.mCount; i++) {
+                names[i] = Map(*map, a[i]);
+                map->erase(a[i]);
+            }
+            if (r.mOp == Op::DeleteTextures)
+                glDeleteTextures(r.mCount, names.data());
+            else if (r.mOp == Op::DeleteBuffers)
+                glDeleteBuffers(r.mCount, names.data());
+            else if (r.mOp == Op::DeleteVertexArrays)
+                glDeleteVertexArrays(r.mCount, names.data());
+            else
+                glDeleteFramebuffers(r.mCount, names.data());
+            break;
+        }
+        case Op::CreateShader:
+            mShaders[a[0]] = glCreateShader(a[1]);
+            break;
+        case Op::ShaderSource: {
+            const GLchar *source = reinterpret_cast<const GLchar *>(r.mBlob);
+            GLint length = static_cast<GLint>(r.mBlobSize);
+            glShaderSource(Map(mShaders, a[0]), 1, &source, &length);
+            break;
+        }
+        case Op::CompileShader:
+            glCompileShader(Map(mShaders, a[0]));
+            break;
+        case Op::DeleteShader:
+            glDeleteShader(Map(mShaders, a[0]));
+            mShaders.erase(a[0]);
+            break;
+        case Op::CreateProgram:
+            mPrograms[a[0]] = glCreateProgram();
+            break;
+        case Op::AttachShader:
+            glAttachShader(Map(mPrograms, a[0]), Map(mShaders, a[1]));
+            break;
+        case Op::LinkProgram:
+            glLinkProgram(Map(mPrograms, a[0]));
+            break;
+        case Op::DeleteProgram: {
+            GLuint program = Map(mPrograms, a[0]);
+            glDeleteProgram(program);
+            mLocations.erase(program);
+            mPrograms.erase(a[0]);
+            break;
+        }
+        case Op::GetUniformLocation: {
+            GLuint program = Map(mPrograms, a[0]);
+            mLocations[program][static_cast<GLint>(a[1])] =
+                    glGetUniformLocation(program, reinterpret_cast<const GLchar *>(r.mBlob));
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void FrameReplay::ReportTiming() const {
+    std::vector<size_t> order;
+    for (size_t i = 0; i < mCallStats.size(); i++) {
+        if (mCallStats[i].mCalls)
+            order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(),
+            [this](size_t a, size_t b) { return mCallStats[a].mMs > mCallStats[b].mMs; });
+    ALOGD("%-24s %10s %12s %10s", "call", "count", "total ms", "us/call");
+    for (size_t i : order) {
+        const CallStats &stats = mCallStats[i];
+        ALOGD("%-24s %10llu %12.3f %10.2f", FrameCapture::OpName(static_cast<Op>(i)),
+                (unsigned long long)stats.mCalls, stats.mMs, stats.mMs * 1000.0 / stats.mCalls);
+    }
+}
+
+}
+
+#ifdef TEST_FRAME_CAPTURE
+/* Captures a few frames of the Plain render and checks that replaying them
+ * draws what was read back at capture:
+ *   g++ -DTEST_FRAME_CAPTURE frame-replay.cpp frame-capture.cpp render.cpp
+ *       opengl-helper.cpp gl-state.cpp gl-stats.cpp gl-caps.cpp texture-pool.cpp
+ *       texture-cache.cpp buffer-pool.cpp pixel-convert.cpp etc2-encoder.cpp
+ *       trace.cpp -lEGL -lGLESv2 -lpthread
+ */
+#include <stdlib.h>
+
+#include <memory>
+#include <thread>
+
+#include "gl-hooks.h"
+#include "opengl-helper.h"
+#include "render.h"
+
+using namespace quink;
+
+// the same size every time, so uploads of equal and of different bytes
+// both go through the payload matching
+static std::shared_ptr<Image<uint8_t>> CreateImage(int width, int height, int seed) {
+    auto img = std::make_shared<Image<uint8_t>>(width, height);
+    srand(seed);
+    for (size_t i = 0; i < (size_t)width * height * 3; i++)
+        img->mData[i] = (uint8_t)(i * 7 + rand() % 16);
+    return img;
+}
+
+static std::vector<uint8_t> ReadPixels(int width, int height) {
+    std::vector<uint8_t> pixels((size_t)width * height * 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    return pixels;
+}
+
+int main()
+{
+    const int width = 96;
+    const int height = 64;
+    const char *path = "/tmp/frame-capture-test.qglc";
+    if (OpenGL_Helper::CreatePbufferContext(width, height)) {
+        printf("no GL context\n");
+        return 1;
+    }
+
+    // frame 0 only builds the setup, frames 1 and 2 are written
+    if (FrameCapture::Instance().Arm(path, 1, 2)) {
+        printf("FAIL: arm\n");
+        return 1;
+    }
+    bool otherThread = true;
+    std::thread([&otherThread]() { otherThread = FrameCapture::IsRecording(); }).join();
+    if (otherThread) {
+        printf("FAIL: recording on a thread that didn't arm\n");
+        return 1;
+    }
+
+    glViewport(0, 0, width, height);
+    // the image covers the middle, the clear color shows around it
+    const Render::ImageCoord coord = {
+        { -0.5f, 0.75f }, { -0.5f, -0.75f }, { 0.5f, -0.75f }, { 0.5f, 0.75f }
+    };
+    std::unique_ptr<Render> render(Render::Create("Plain"));
+    if (render->Init(coord)) {
+        printf("FAIL: init\n");
+        return 1;
+    }
+    std::vector<uint8_t> expected;
+    for (int frame = 0; frame < 3; frame++) {
+        // the last frame uploads different pixels
+        if (render->UploadTexture(CreateImage(width / 2, height / 2, frame == 2 ? 2 : 1))) {
+            printf("FAIL: upload\n");
+            return 1;
+        }
+        glClearColor(0.25f * frame, 0.5f, 1.0f - 0.25f * frame, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        render->Draw();
+        if (frame == 2)
+            expected = ReadPixels(width, height);
+        FrameCapture::Instance().EndFrame();
+    }
+    if (FrameCapture::IsRecording()) {
+        printf("FAIL: still recording after the range\n");
+        return 1;
+    }
+    render.reset();
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    FrameReplay replay;
+    if (replay.Load(path) || replay.GetFrameCount() != 2) {
+        printf("FAIL: load, %zu frames\n", replay.GetFrameCount());
+        return 1;
+    }
+    if (replay.Run(FrameReplay::Options())) {
+        printf("FAIL: replay\n");
+        return 1;
+    }
+    const std::vector<uint8_t> replayed = ReadPixels(width, height);
+    size_t differ = 0;
+    for (size_t i = 0; i < expected.size(); i++)
+        differ += expected[i] != replayed[i];
+    remove(path);
+    if (differ) {
+        printf("FAIL: %zu of %zu bytes differ from the capture\n", differ, expected.size());
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
+
+#endif
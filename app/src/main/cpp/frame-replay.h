@@ -0,0 +1,91 @@
+#pragma once
+
+#include "config.h"
+#if HAVE_GLES
+#   include <GLES3/gl3.h>
+#else
+#   define GLFW_INCLUDE_GLCOREARB
+#   define GL_GLEXT_PROTOTYPES
+#   define GLFW_INCLUDE_GLEXT
+#   include <GLFW/glfw3.h>
+#endif
+
+#include <stdint.h>
+
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "frame-capture.h"
+
+namespace quink {
+
+/* Re-executes a file written by FrameCapture on the current context.
+ *
+ * Object names and uniform locations are translated to the ones this
+ * context hands out. The setup runs once, the frames as many times as asked,
+ * each followed by glFinish so a frame time covers its GPU work too.
+ */
+class FrameReplay {
+public:
+    struct Options {
+        int mLoops = 1;
+        // CPU time of every call, by entry point
+        bool mTiming = false;
+        // glFinish after every call, the timing then includes the GPU work
+        bool mFinishEachCall = false;
+    };
+
+    int Load(const std::string &path);
+    // the size of the default framebuffer at capture
+    uint32_t GetWidth() const { return mHeader.mWidth; }
+    uint32_t GetHeight() const { return mHeader.mHeight; }
+    size_t GetFrameCount() const { return mFrames.size(); }
+
+    int Run(const Options &options);
+
+private:
+    using Op = FrameCapture::Op;
+
+    struct Record {
+        Op mOp;
+        const uint32_t *mArgs;
+        uint32_t mCount;
+        const uint8_t *mBlob;
+        uint32_t mBlobSize;
+    };
+
+    struct CallStats {
+        uint64_t mCalls = 0;
+        double mMs = 0.0;
+    };
+
+    // runs records [begin, end)
+    void Execute(size_t begin, size_t end, const Options &options);
+    void Execute(const Record &r);
+    void ReportTiming() const;
+
+    std::vector<uint8_t> mData;
+    FrameCapture::FileHeader mHeader = {};
+    std::vector<Record> mRecords;
+    size_t mSetupEnd = 0;
+    // records of each frame, up to its FrameEnd
+    std::vector<std::pair<size_t, size_t>> mFrames;
+
+    // captured name to ours
+    std::unordered_map<GLuint, GLuint> mTextures;
+    std::unordered_map<GLuint, GLuint> mBuffers;
+    std::unordered_map<GLuint, GLuint> mVertexArrays;
+    std::unordered_map<GLuint, GLuint> mFramebuffers;
+    std::unordered_map<GLuint, GLuint> mShaders;
+    std::unordered_map<GLuint, GLuint> mPrograms;
+    // captured location to ours, by our program
+    std::unordered_map<GLuint, std::unordered_map<GLint, GLint>> mLocations;
+    GLuint mProgram = 0;
+
+    std::array<CallStats, static_cast<size_t>(Op::Count)> mCallStats;
+};
+
+}
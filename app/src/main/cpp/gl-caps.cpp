@@ -0,0 +1,347 @@
+#include "gl-caps.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+#include "buffer-pool.h"
+#include "gl-hooks.h"
+#include "gl-state.h"
+#include "log.h"
+#include "opengl-helper.h"
+#include "pixel-convert.h"
+#include "texture-cache.h"
+#include "trace.h"
+
+#if HAVE_GLES
+#define HEADER_VERSION  "#version 300 es\n"
+#else
+#define HEADER_VERSION  "#version 330 core\n"
+#endif
+
+namespace quink {
+
+// bump when the candidates or the benchmark change, old decisions are ignored
+static const uint32_t kProbeVersion = 1;
+static const int kProbeSize = 256;
+static const int kProbeRounds = 4;
+
+GLCaps &GLCaps::Instance() {
+    static GLCaps caps;
+    return caps;
+}
+
+void GLCaps::Reset() {
+    std::lock_guard<std::mutex> lock(mLock);
+    mLoaded = false;
+    mExtensions.clear();
+    mHdrFormat = nullptr;
+}
+
+void GLCaps::LoadExtensionsLocked() {
+    if (mLoaded)
+        return;
+    mLoaded = true;
+
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++) {
+        const char *name = (const char *)glGetStringi(GL_EXTENSIONS, i);
+        if (name)
+            mExtensions.insert(name);
+    }
+    if (count > 0)
+        return;
+
+    // contexts before 3.0 have the space separated string only
+    const char *names = (const char *)glGetString(GL_EXTENSIONS);
+    while (names && *names) {
+        const char *end = strchr(names, ' ');
+        if (!end)
+            end = names + strlen(names);
+        if (end != names)
+            mExtensions.insert(std::string(names, end - names));
+        names = *end ? end + 1 : end;
+    }
+}
+
+bool GLCaps::HasExtension(const char *name) {
+    std::lock_guard<std::mutex> lock(mLock);
+    LoadExtensionsLocked();
+    return mExtensions.count(name) != 0;
+}
+
+size_t GLCaps::ExtensionCount() {
+    std::lock_guard<std::mutex> lock(mLock);
+    LoadExtensionsLocked();
+    return mExtensions.size();
+}
+
+std::string GLCaps::GetRendererString() {
+    std::string renderer;
+    const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    for (GLenum name : names) {
+        const char *value = (const char *)glGetString(name);
+        if (!renderer.empty())
+            renderer += " | ";
+        renderer += value ? value : "";
+    }
+    return renderer;
+}
+
+const std::vector<GLCaps::HdrFormat> &GLCaps::HdrFormats() {
+    // the first one is the fallback, it needs no conversion
+    static const std::vector<HdrFormat> formats = {
+        { "RGB32F",         GL_RGB32F,          GL_RGB,     GL_FLOAT,                       12, 23 },
+        { "RGBA16F",        GL_RGBA16F,         GL_RGBA,    GL_HALF_FLOAT,                  8,  10 },
+        { "RGB16F",         GL_RGB16F,          GL_RGB,     GL_HALF_FLOAT,                  6,  10 },
+        { "RGB9_E5",        GL_RGB9_E5,         GL_RGB,     GL_UNSIGNED_INT_5_9_9_9_REV,    4,  9 },
+        { "R11F_G11F_B10F", GL_R11F_G11F_B10F,  GL_RGB,     GL_UNSIGNED_INT_10F_11F_11F_REV, 4, 5 },
+    };
+    return formats;
+}
+
+void GLCaps::Convert(const HdrFormat &format, const float *src, void *dst, size_t pixels) {
+    switch (format.mInternalFormat) {
+        case GL_RGBA16F:
+            PixelConvert::RGBFloatToRGBAHalf(src, static_cast<uint16_t *>(dst), pixels);
+            break;
+        case GL_RGB16F:
+            PixelConvert::FloatToHalf(src, static_cast<uint16_t *>(dst), pixels * 3);
+            break;
+        case GL_RGB9_E5:
+            PixelConvert::RGBFloatToRGB9E5(src, static_cast<uint32_t *>(dst), pixels);
+            break;
+        case GL_R11F_G11F_B10F:
+            PixelConvert::RGBFloatToR11G11B10F(src, static_cast<uint32_t *>(dst), pixels);
+            break;
+        default:
+            memcpy(dst, src, pixels * format.mPixelSize);
+            break;
+    }
+}
+
+// objects shared by the probes of all formats
+struct ProbeTarget {
+    GLuint mProgram = 0;
+    GLuint mVAO = 0;
+    GLuint mTexture = 0;
+    GLuint mFbo = 0;
+
+    int Init() {
+        const char *vertexSrc = HEADER_VERSION
+R"(out vec2 o_uv;
+void main()
+{
+    // one triangle covering the target
+    vec2 p = vec2(float((gl_VertexID & 1) << 2) - 1.0, float((gl_VertexID & 2) << 1) - 1.0);
+    o_uv = p * 0.5 + 0.5;
+    gl_Position = vec4(p, 0.0, 1.0);
+}
+)";
+        const char *fragSrc = HEADER_VERSION
+R"(precision mediump float;
+uniform sampler2D source;
+in vec2 o_uv;
+out vec4 out_color;
+void main()
+{
+    vec3 color = texture(source, o_uv).rgb;
+    out_color = vec4(color / (color + 1.0), 1.0);
+}
+)";
+        mProgram = OpenGL_Helper::CreateProgram(vertexSrc, fragSrc);
+        if (!mProgram)
+            return -1;
+        GLState &state = GLState::Current();
+        state.UseProgram(mProgram);
+        glUniform1i(glGetUniformLocation(mProgram, "source"), 0);
+        glGenVertexArrays(1, &mVAO);
+
+        glGenTextures(1, &mTexture);
+        state.BindTexture(GL_TEXTURE0, GL_TEXTURE_2D, mTexture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, kProbeSize, kProbeSize);
+        glGenFramebuffers(1, &mFbo);
+        state.BindFramebuffer(GL_FRAMEBUFFER, mFbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mTexture, 0);
+        return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE ? 0 : -1;
+    }
+
+    ~ProbeTarget() {
+        GLState &state = GLState::Current();
+        state.DeleteFramebuffers(1, &mFbo);
+        state.DeleteTextures(1, &mTexture);
+        state.DeleteVertexArrays(1, &mVAO);
+        state.DeleteProgram(mProgram);
+    }
+};
+
+template <typename F>
+static double BestMs(F f) {
+    double best = 0.0;
+    for (int i = 0; i < kProbeRounds; i++) {
+        auto t1 = std::chrono::high_resolution_clock::now();
+        f();
+        glFinish();
+        auto t2 = std::chrono::high_resolution_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+        best = i ? std::min(best, ms) : ms;
+    }
+    return best;
+}
+
+static GLCaps::Probe ProbeFormat(const GLCaps::HdrFormat &format,
+        ProbeTarget &target, const std::vector<float> &image) {
+    TRACE_GL_SCOPE("GLCaps::ProbeFormat");
+    GLCaps::Probe probe;
+    GLState &state = GLState::Current();
+    const size_t pixels = (size_t)kProbeSize * kProbeSize;
+    BufferPool::Buffer buffer = BufferPool::Instance().Acquire(pixels * format.mPixelSize);
+    if (buffer.Empty())
+        return probe;
+
+    // errors left over from before would be taken for ours
+    while (glGetError() != GL_NO_ERROR)
+        ;
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    state.BindTexture(GL_TEXTURE0, GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, format.mInternalFormat, kProbeSize, kProbeSize);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    state.PixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    state.PixelStorei(GL_UNPACK_ALIGNMENT, format.mPixelSize % 4 ? 2 : 4);
+    auto upload = [&]() {
+        const void *data = image.data();
+        if (GLCaps::NeedsConversion(format)) {
+            GLCaps::Convert(format, image.data(), buffer.Data(), pixels);
+            data = buffer.Data();
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, kProbeSize, kProbeSize, format.mFormat,
+                format.mType, data);
+    };
+    upload();
+    probe.mUploadable = glGetError() == GL_NO_ERROR;
+    if (probe.mUploadable) {
+        probe.mUploadMs = BestMs(upload);
+        state.BindFramebuffer(GL_FRAMEBUFFER, target.mFbo);
+        state.UseProgram(target.mProgram);
+        state.BindVertexArray(target.mVAO);
+        probe.mSampleMs = BestMs([]() { glDrawArrays(GL_TRIANGLES, 0, 3); });
+    }
+    state.DeleteTextures(1, &texture);
+    return probe;
+}
+
+const GLCaps::HdrFormat &GLCaps::SelectHdrFormat(const std::string &dir) {
+    TRACE_GL_SCOPE("GLCaps::SelectHdrFormat");
+    const auto &formats = HdrFormats();
+    std::string path;
+    if (!dir.empty()) {
+        const std::string renderer = GetRendererString();
+        uint64_t key = TextureCache::Hash(&kProbeVersion, sizeof(kProbeVersion));
+        key = TextureCache::Hash(renderer.data(), renderer.size(), key);
+        char name[64];
+        snprintf(name, sizeof(name), "/glcaps-%016llx.txt", (unsigned long long)key);
+        path = dir + name;
+        if (!LoadDecision(path)) {
+            ALOGD("HDR format %s, saved for this renderer", mHdrFormat->mName);
+            return *mHdrFormat;
+        }
+    }
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    GLState &state = GLState::Current();
+    GLint viewport[4];
+    state.GetViewport(viewport);
+    const GLuint framebuffer = state.GetDrawFramebuffer();
+
+    // HDR content up to a few stops over white, with some texture to it
+    std::vector<float> image((size_t)kProbeSize * kProbeSize * 3);
+    for (size_t i = 0; i < image.size(); i++)
+        image[i] = (float)((i * 2654435761u) >> 20 & 0xfff) / 256.0f;
+
+    std::vector<Probe> probes(formats.size());
+    {
+        ProbeTarget target;
+        if (!target.Init()) {
+            state.Viewport(0, 0, kProbeSize, kProbeSize);
+            for (size_t i = 0; i < formats.size(); i++)
+                probes[i] = ProbeFormat(formats[i], target, image);
+        }
+    }
+    state.BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    state.Viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    mHdrFormat = nullptr;
+    double best = 0.0;
+    for (size_t i = 0; i < formats.size(); i++) {
+        const Probe &probe = probes[i];
+        ALOGD("HDR format %s: upload %s, upload %.3f ms, sample %.3f ms",
+                formats[i].mName, probe.mUploadable ? "yes" : "no",
+                probe.mUploadMs, probe.mSampleMs);
+        if (!probe.mUploadable || formats[i].mMantissaBits < kMinMantissaBits)
+            continue;
+        double cost = probe.mUploadMs + probe.mSampleMs;
+        if (!mHdrFormat || cost < best) {
+            mHdrFormat = &formats[i];
+            best = cost;
+        }
+    }
+    if (!mHdrFormat)
+        mHdrFormat = &formats[0];
+    auto t2 = std::chrono::high_resolution_clock::now();
+    ALOGD("HDR format %s, probing takes %lld ms", mHdrFormat->mName,
+            (long long)std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count());
+
+    if (!path.empty())
+        SaveDecision(path, probes);
+    return *mHdrFormat;
+}
+
+const GLCaps::HdrFormat &GLCaps::GetHdrFormat() {
+    return mHdrFormat ? *mHdrFormat : HdrFormats()[0];
+}
+
+int GLCaps::LoadDecision(const std::string &path) {
+    std::ifstream file(path);
+    std::string name;
+    if (!std::getline(file, name))
+        return -1;
+    for (const auto &format : HdrFormats()) {
+        if (name == format.mName && format.mMantissaBits >= kMinMantissaBits) {
+            mHdrFormat = &format;
+            return 0;
+        }
+    }
+    ALOGE("unknown HDR format %s in %s", name.c_str(), path.c_str());
+    return -1;
+}
+
+void GLCaps::SaveDecision(const std::string &path, const std::vector<Probe> &probes) {
+    // the first line is the decision, the rest is for whoever looks at it
+    std::string tmp = path + ".tmp";
+    FILE *file = fopen(tmp.c_str(), "w");
+    if (!file) {
+        ALOGE("cannot create %s", tmp.c_str());
+        return;
+    }
+    fprintf(file, "%s\n# %s\n", mHdrFormat->mName, GetRendererString().c_str());
+    fprintf(file, "# format upload upload_ms sample_ms\n");
+    const auto &formats = HdrFormats();
+    for (size_t i = 0; i < formats.size(); i++) {
+        fprintf(file, "# %s %d %.3f %.3f\n", formats[i].mName, probes[i].mUploadable,
+                probes[i].mUploadMs, probes[i].mSampleMs);
+    }
+    bool failed = ferror(file) != 0;
+    failed |= fclose(file) != 0;
+    if (failed || rename(tmp.c_str(), path.c_str())) {
+        ALOGE("cannot write %s", path.c_str());
+        remove(tmp.c_str());
+    }
+}
+
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "config.h"
+#if HAVE_GLES
+#   include <GLES3/gl3.h>
+#else
+#   define GLFW_INCLUDE_GLCOREARB
+#   define GL_GLEXT_PROTOTYPES
+#   define GLFW_INCLUDE_GLEXT
+#   include <GLFW/glfw3.h>
+#endif
+
+#include <stddef.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace quink {
+
+/* What the current context can do, learned once per context.
+ *
+ * The extension list is parsed into a hash set on first use. For HDR
+ * images the candidate internal formats are probed for upload, and a short
+ * upload plus sample benchmark decides which one float images are uploaded
+ * as. The renders sample them with nearest filtering and never draw into
+ * them, so neither filtering nor rendering support is required. The decision is saved per renderer string,
+ * so later starts on the same device skip the benchmark.
+ *
+ * Must be used on a thread with the context current; Reset() after the
+ * context has been replaced.
+ */
+class GLCaps {
+public:
+    struct HdrFormat {
+        const char *mName;
+        GLenum mInternalFormat;
+        GLenum mFormat;
+        GLenum mType;
+        int mPixelSize;         // bytes per uploaded texel
+        int mMantissaBits;      // precision of the stored color
+    };
+
+    struct Probe {
+        bool mUploadable = false;
+        double mUploadMs = 0.0;     // conversion and upload of the benchmark image
+        double mSampleMs = 0.0;     // drawing it once
+    };
+
+    // formats coarser than this lose visible precision after tonemapping
+    static const int kMinMantissaBits = 9;
+
+    static GLCaps &Instance();
+
+    void Reset();
+
+    bool HasExtension(const char *name);
+    size_t ExtensionCount();
+    // vendor, renderer and version, the key of the saved decision
+    std::string GetRendererString();
+
+    /* Pick the HDR format, from the decision saved in dir when there is
+     * one, otherwise by probing every candidate. An empty dir neither loads
+     * nor saves.
+     */
+    const HdrFormat &SelectHdrFormat(const std::string &dir);
+    // the selected format, RGB32F until SelectHdrFormat() is called
+    const HdrFormat &GetHdrFormat();
+
+    static const std::vector<HdrFormat> &HdrFormats();
+    // RGB32F takes the float pixels as they are
+    static bool NeedsConversion(const HdrFormat &format) { return format.mType != GL_FLOAT; }
+    // RGB float pixels to the upload layout, dst holds pixels * mPixelSize bytes
+    static void Convert(const HdrFormat &format, const float *src, void *dst, size_t pixels);
+
+private:
+    GLCaps() = default;
+
+    void LoadExtensionsLocked();
+    int LoadDecision(const std::string &path);
+    void SaveDecision(const std::string &path, const std::vector<Probe> &probes);
+
+    std::mutex mLock;
+    bool mLoaded = false;
+    std::unordered_set<std::string> mExtensions;
+    const HdrFormat *mHdrFormat = nullptr;
+};
+
+}
@@ -0,0 +1,340 @@
+#pragma once
+
+#include "config.h"
+#if HAVE_GLES
+#   include <GLES3/gl3.h>
+#else
+#   define GLFW_INCLUDE_GLCOREARB
+#   define GL_GLEXT_PROTOTYPES
+#   define GLFW_INCLUDE_GLEXT
+#   include <GLFW/glfw3.h>
+#endif
+
+#include "frame-capture.h"
+#include "gl-stats.h"
+
+/* Instrumented versions of the GL entry points used by the renders.
+ *
+ * Including this header redirects those entry points to wrappers which feed
+ * GLStats and run the per-call error check, see gl-stats.h, and hand the call
+ * to FrameCapture while it records. Entry points not listed here are called
+ * directly, are not accounted and are missing from captures.
+ */
+
+namespace quink {
+namespace glhook {
+
+#define GL_HOOK(name, params, args, account)    \
+    inline void name params {                   \
+        GLStats::OnCall();                      \
+        account;                                \
+        ::gl##name args;                        \
+        GLStats::AfterCall("gl" #name);         \
+        if (FrameCapture::IsRecording())        \
+            FrameCapture::Instance().name args; \
+    }
+
+// the capture gets the result as its first argument
+#define GL_HOOK_RETURN(type, name, params, args, capture)   \
+    inline type name params {                               \
+        GLStats::OnCall();                                  \
+        type ret = ::gl##name args;                         \
+        GLStats::AfterCall("gl" #name);                     \
+        if (FrameCapture::IsRecording())                    \
+            FrameCapture::Instance().name capture;          \
+        return ret;                                         \
+    }
+
+GL_HOOK(DrawArrays,
+        (GLenum mode, GLint first, GLsizei count),
+        (mode, first, count),
+        GLStats::OnDraw())
+GL_HOOK(DrawElements,
+        (GLenum mode, GLsizei count, GLenum type, const void *indices),
+        (mode, count, type, indices),
+        GLStats::OnDraw())
+GL_HOOK(DrawArraysInstanced,
+        (GLenum mode, GLint first, GLsizei count, GLsizei instances),
+        (mode, first, count, instances),
+        GLStats::OnDraw())
+GL_HOOK(DrawElementsInstanced,
+        (GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei instances),
+        (mode, count, type, indices, instances),
+        GLStats::OnDraw())
+GL_HOOK(BlitFramebuffer,
+        (GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1,
+         GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter),
+        (srcX0, srcY0, srcX1, srcY1, dstX0, dstY0, dstX1, dstY1, mask, filter),
+        GLStats::OnDraw())
+GL_HOOK(Clear,
+        (GLbitfield mask),
+        (mask),
+        (void)0)
+GL_HOOK(ClearColor,
+        (GLfloat r, GLfloat g, GLfloat b, GLfloat a),
+        (r, g, b, a),
+        (void)0)
+
+GL_HOOK(TexImage2D,
+        (GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height,
+         GLint border, GLenum format, GLenum type, const void *pixels),
+        (target, level, internalFormat, width, height, border, format, type, pixels),
+        if (pixels) GLStats::OnUpload((size_t)width * height * GLStats::PixelSize(format, type)))
+GL_HOOK(TexSubImage2D,
+        (GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height,
+         GLenum format, GLenum type, const void *pixels),
+        (target, level, xoffset, yoffset, width, height, format, type, pixels),
+        GLStats::OnUpload((size_t)width * height * GLStats::PixelSize(format, type)))
+GL_HOOK(CompressedTexImage2D,
+        (GLenum target, GLint level, GLenum internalFormat, GLsizei width, GLsizei height,
+         GLint border, GLsizei imageSize, const void *data),
+        (target, level, internalFormat, width, height, border, imageSize, data),
+        GLStats::OnUpload(imageSize))
+GL_HOOK(CompressedTexSubImage2D,
+        (GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height,
+         GLenum format, GLsizei imageSize, const void *data),
+        (target, level, xoffset, yoffset, width, height, format, imageSize, data),
+        GLStats::OnUpload(imageSize))
+GL_HOOK(TexStorage2D,
+        (GLenum target, GLsizei levels, GLenum internalFormat, GLsizei width, GLsizei height),
+        (target, levels, internalFormat, width, height),
+        (void)0)
+GL_HOOK(TexParameteri,
+        (GLenum target, GLenum pname, GLint param),
+        (target, pname, param),
+        (void)0)
+GL_HOOK(BufferData,
+        (GLenum target, GLsizeiptr size, const void *data, GLenum usage),
+        (target, size, data, usage),
+        if (data) GLStats::OnUpload(size))
+GL_HOOK(BufferSubData,
+        (GLenum target, GLintptr offset, GLsizeiptr size, const void *data),
+        (target, offset, size, data),
+        GLStats::OnUpload(size))
+GL_HOOK_RETURN(void *, MapBufferRange,
+        (GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access),
+        (target, offset, length, access),
+        (ret, target, offset, length, access))
+
+// captured before the call, the mapping is gone after it
+inline GLboolean UnmapBuffer(GLenum target) {
+    if (FrameCapture::IsRecording())
+        FrameCapture::Instance().UnmapBuffer(target);
+    GLStats::OnCall();
+    GLboolean ret = ::glUnmapBuffer(target);
+    GLStats::AfterCall("glUnmapBuffer");
+    return ret;
+}
+
+GL_HOOK(UseProgram,
+        (GLuint program),
+        (program),
+        (void)0)
+GL_HOOK(BindVertexArray,
+        (GLuint vao),
+        (vao),
+        (void)0)
+GL_HOOK(BindBuffer,
+        (GLenum target, GLuint buffer),
+        (target, buffer),
+        (void)0)
+GL_HOOK(BindTexture,
+        (GLenum target, GLuint texture),
+        (target, texture),
+        (void)0)
+GL_HOOK(ActiveTexture,
+        (GLenum unit),
+        (unit),
+        (void)0)
+GL_HOOK(BindFramebuffer,
+        (GLenum target, GLuint framebuffer),
+        (target, framebuffer),
+        (void)0)
+GL_HOOK(FramebufferTexture2D,
+        (GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level),
+        (target, attachment, textarget, texture, level),
+        (void)0)
+GL_HOOK(Viewport,
+        (GLint x, GLint y, GLsizei width, GLsizei height),
+        (x, y, width, height),
+        (void)0)
+GL_HOOK(PixelStorei,
+        (GLenum pname, GLint param),
+        (pname, param),
+        (void)0)
+GL_HOOK(VertexAttribPointer,
+        (GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride,
+         const void *pointer),
+        (index, size, type, normalized, stride, pointer),
+        (void)0)
+GL_HOOK(EnableVertexAttribArray,
+        (GLuint index),
+        (index),
+        (void)0)
+GL_HOOK(VertexAttribDivisor,
+        (GLuint index, GLuint divisor),
+        (index, divisor),
+        (void)0)
+GL_HOOK(Enable,
+        (GLenum cap),
+        (cap),
+        (void)0)
+GL_HOOK(Disable,
+        (GLenum cap),
+        (cap),
+        (void)0)
+GL_HOOK(BlendFuncSeparate,
+        (GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha),
+        (srcRGB, dstRGB, srcAlpha, dstAlpha),
+        (void)0)
+GL_HOOK(Uniform1f,
+        (GLint location, GLfloat v0),
+        (location, v0),
+        (void)0)
+GL_HOOK(Uniform1i,
+        (GLint location, GLint v0),
+        (location, v0),
+        (void)0)
+GL_HOOK(Uniform2f,
+        (GLint location, GLfloat v0, GLfloat v1),
+        (location, v0, v1),
+        (void)0)
+GL_HOOK(Uniform3fv,
+        (GLint location, GLsizei count, const GLfloat *value),
+        (location, count, value),
+        (void)0)
+GL_HOOK(UniformMatrix3fv,
+        (GLint location, GLsizei count, GLboolean transpose, const GLfloat *value),
+        (location, count, transpose, value),
+        (void)0)
+GL_HOOK_RETURN(GLint, GetUniformLocation,
+        (GLuint program, const GLchar *name),
+        (program, name),
+        (ret, program, name))
+
+GL_HOOK_RETURN(GLuint, CreateShader,
+        (GLenum type),
+        (type),
+        (ret, type))
+GL_HOOK(ShaderSource,
+        (GLuint shader, GLsizei count, const GLchar *const *string, const GLint *length),
+        (shader, count, string, length),
+        (void)0)
+GL_HOOK(CompileShader,
+        (GLuint shader),
+        (shader),
+        (void)0)
+GL_HOOK(DeleteShader,
+        (GLuint shader),
+        (shader),
+        (void)0)
+GL_HOOK_RETURN(GLuint, CreateProgram,
+        (),
+        (),
+        (ret))
+GL_HOOK(AttachShader,
+        (GLuint program, GLuint shader),
+        (program, shader),
+        (void)0)
+GL_HOOK(LinkProgram,
+        (GLuint program),
+        (program),
+        (void)0)
+
+GL_HOOK(GenTextures,
+        (GLsizei n, GLuint *textures),
+        (n, textures),
+        (void)0)
+GL_HOOK(GenBuffers,
+        (GLsizei n, GLuint *buffers),
+        (n, buffers),
+        (void)0)
+GL_HOOK(GenVertexArrays,
+        (GLsizei n, GLuint *vaos),
+        (n, vaos),
+        (void)0)
+GL_HOOK(GenFramebuffers,
+        (GLsizei n, GLuint *framebuffers),
+        (n, framebuffers),
+        (void)0)
+GL_HOOK(DeleteTextures,
+        (GLsizei n, const GLuint *textures),
+        (n, textures),
+        (void)0)
+GL_HOOK(DeleteBuffers,
+        (GLsizei n, const GLuint *buffers),
+        (n, buffers),
+        (void)0)
+GL_HOOK(DeleteVertexArrays,
+        (GLsizei n, const GLuint *vaos),
+        (n, vaos),
+        (void)0)
+GL_HOOK(DeleteFramebuffers,
+        (GLsizei n, const GLuint *framebuffers),
+        (n, framebuffers),
+        (void)0)
+GL_HOOK(DeleteProgram,
+        (GLuint program),
+        (program),
+        (void)0)
+
+#undef GL_HOOK
+#undef GL_HOOK_RETURN
+
+}
+}
+
+#define glDrawArrays                quink::glhook::DrawArrays
+#define glDrawElements              quink::glhook::DrawElements
+#define glDrawArraysInstanced       quink::glhook::DrawArraysInstanced
+#define glDrawElementsInstanced     quink::glhook::DrawElementsInstanced
+#define glBlitFramebuffer           quink::glhook::BlitFramebuffer
+#define glClear                     quink::glhook::Clear
+#define glClearColor                quink::glhook::ClearColor
+#define glTexImage2D                quink::glhook::TexImage2D
+#define glTexSubImage2D             quink::glhook::TexSubImage2D
+#define glCompressedTexImage2D      quink::glhook::CompressedTexImage2D
+#define glCompressedTexSubImage2D   quink::glhook::CompressedTexSubImage2D
+#define glTexStorage2D              quink::glhook::TexStorage2D
+#define glTexParameteri             quink::glhook::TexParameteri
+#define glBufferData                quink::glhook::BufferData
+#define glBufferSubData             quink::glhook::BufferSubData
+#define glMapBufferRange            quink::glhook::MapBufferRange
+#define glUnmapBuffer               quink::glhook::UnmapBuffer
+#define glUseProgram                quink::glhook::UseProgram
+#define glBindVertexArray           quink::glhook::BindVertexArray
+#define glBindBuffer                quink::glhook::BindBuffer
+#define glBindTexture               quink::glhook::BindTexture
+#define glActiveTexture             quink::glhook::ActiveTexture
+#define glBindFramebuffer           quink::glhook::BindFramebuffer
+#define glFramebufferTexture2D      quink::glhook::FramebufferTexture2D
+#define glViewport                  quink::glhook::Viewport
+#define glPixelStorei               quink::glhook::PixelStorei
+#define glVertexAttribPointer       quink::glhook::VertexAttribPointer
+#define glEnableVertexAttribArray   quink::glhook::EnableVertexAttribArray
+#define glVertexAttribDivisor       quink::glhook::VertexAttribDivisor
+#define glEnable                    quink::glhook::Enable
+#define glDisable                   quink::glhook::Disable
+#define glBlendFuncSeparate         quink::glhook::BlendFuncSeparate
+#define glUniform1f                 quink::glhook::Uniform1f
+#define glUniform1i                 quink::glhook::Uniform1i
+#define glUniform2f                 quink::glhook::Uniform2f
+#define glUniform3fv                quink::glhook::Uniform3fv
+#define glUniformMatrix3fv          quink::glhook::UniformMatrix3fv
+#define glGetUniformLocation        quink::glhook::GetUniformLocation
+#define glCreateShader              quink::glhook::CreateShader
+#define glShaderSource              quink::glhook::ShaderSource
+#define glCompileShader             quink::glhook::CompileShader
+#define glDeleteShader              quink::glhook::DeleteShader
+#define glCreateProgram             quink::glhook::CreateProgram
+#define glAttachShader              quink::glhook::AttachShader
+#define glLinkProgram               quink::glhook::LinkProgram
+#define glGenTextures               quink::glhook::GenTextures
+#define glGenBuffers                quink::glhook::GenBuffers
+#define glGenVertexArrays           quink::glhook::GenVertexArrays
+#define glGenFramebuffers           quink::glhook::GenFramebuffers
+#define glDeleteTextures            quink::glhook::DeleteTextures
+#define glDeleteBuffers             quink::glhook::DeleteBuffers
+#define glDeleteVertexArrays        quink::glhook::DeleteVertexArrays
+#define glDeleteFramebuffers        quink::glhook::DeleteFramebuffers
+#define glDeleteProgram             quink::glhook::DeleteProgram
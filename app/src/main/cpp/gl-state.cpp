@@ -0,0 +1,292 @@
+#include "gl-state.h"
+
+#include "gl-hooks.h"
+#include "log.h"
+
+namespace quink {
+
+static bool sValidate = false;
+
+GLState &GLState::Current() {
+    static thread_local GLState state;
+    return state;
+}
+
+void GLState::SetValidate(bool validate) {
+    sValidate = validate;
+}
+
+GLState::GLState() {
+    Invalidate();
+}
+
+void GLState::Invalidate() {
+    mProgram = kUnknown;
+    mVAO = kUnknown;
+    mActiveUnit = kUnknown;
+    for (int i = 0; i < kMaxUnits; i++)
+        mTexture2D[i] = kUnknown;
+    mArrayBuffer = kUnknown;
+    mElementBuffer = kUnknown;
+    mPixelUnpackBuffer = kUnknown;
+    for (int i = 0; i < 4; i++)
+        mViewport[i] = kUnknown;
+    mDrawFramebuffer = kUnknown;
+    mReadFramebuffer = kUnknown;
+    mUnpackRowLength = kUnknown;
+    mUnpackAlignment = kUnknown;
+}
+
+bool GLState::Filter(int64_t &shadow, int64_t value) {
+    if (shadow == value) {
+        mStats.mAvoided++;
+        return false;
+    }
+    shadow = value;
+    mStats.mIssued++;
+    return true;
+}
+
+void GLState::UseProgram(GLuint program) {
+    if (Filter(mProgram, program))
+        glUseProgram(program);
+    if (sValidate)
+        Validate(__func__);
+}
+
+void GLState::BindVertexArray(GLuint vao) {
+    if (Filter(mVAO, vao)) {
+        glBindVertexArray(vao);
+        // element array binding is part of the VAO
+        mElementBuffer = kUnknown;
+    }
+    if (sValidate)
+        Validate(__func__);
+}
+
+void GLState::ActiveTexture(GLenum unit) {
+    if (Filter(mActiveUnit, unit))
+        glActiveTexture(unit);
+    if (sValidate)
+        Validate(__func__);
+}
+
+void GLState::BindTexture(GLenum target, GLuint texture) {
+    int index = static_cast<int>(mActiveUnit - GL_TEXTURE0);
+    if (target != GL_TEXTURE_2D || mActiveUnit == kUnknown || index >= kMaxUnits) {
+        mStats.mIssued++;
+        glBindTexture(target, texture);
+        return;
+    }
+    if (Filter(mTexture2D[index], texture))
+        glBindTexture(target, texture);
+    if (sValidate)
+        Validate(__func__);
+}
+
+void GLState::BindTexture(GLenum unit, GLenum target, GLuint texture) {
+    ActiveTexture(unit);
+    BindTexture(target, texture);
+}
+
+void GLState::BindBuffer(GLenum target, GLuint buffer) {
+    int64_t *shadow = nullptr;
+    switch (target) {
+        case GL_ARRAY_BUFFER:
+            shadow = &mArrayBuffer;
+            break;
+        case GL_ELEMENT_ARRAY_BUFFER:
+            shadow = &mElementBuffer;
+            break;
+        case GL_PIXEL_UNPACK_BUFFER:
+            shadow = &mPixelUnpackBuffer;
+            break;
+        default:
+            break;
+    }
+    if (!shadow) {
+        mStats.mIssued++;
+        glBindBuffer(target, buffer);
+        return;
+    }
+    if (Filter(*shadow, buffer))
+        glBindBuffer(target, buffer);
+    if (sValidate)
+        Validate(__func__);
+}
+
+void GLState::Viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    if (mViewport[0] == x && mViewport[1] == y &&
+            mViewport[2] == width && mViewport[3] == height) {
+        mStats.mAvoided++;
+    } else {
+        mViewport[0] = x;
+        mViewport[1] = y;
+        mViewport[2] = width;
+        mViewport[3] = height;
+        mStats.mIssued++;
+        glViewport(x, y, width, height);
+    }
+    if (sValidate)
+        Validate(__func__);
+}
+
+void GLState::BindFramebuffer(GLenum target, GLuint framebuffer) {
+    bool draw = false;
+    bool read = false;
+    if (target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER)
+        draw = Filter(mDrawFramebuffer, framebuffer);
+    if (target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER)
+        read = Filter(mReadFramebuffer, framebuffer);
+    if (draw && read)
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    else if (draw)
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+    else if (read)
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    if (sValidate)
+        Validate(__func__);
+}
+
+void GLState::PixelStorei(GLenum pname, GLint param) {
+    int64_t *shadow = nullptr;
+    if (pname == GL_UNPACK_ROW_LENGTH)
+        shadow = &mUnpackRowLength;
+    else if (pname == GL_UNPACK_ALIGNMENT)
+        shadow = &mUnpackAlignment;
+    if (!shadow) {
+        mStats.mIssued++;
+        glPixelStorei(pname, param);
+        return;
+    }
+    if (Filter(*shadow, param))
+        glPixelStorei(pname, param);
+    if (sValidate)
+        Validate(__func__);
+}
+
+void GLState::DeleteProgram(GLuint program) {
+    // a program in use stays valid until it is replaced, but the name may
+    // be reused by the next glCreateProgram
+    if (program && mProgram == program)
+        mProgram = kUnknown;
+    glDeleteProgram(program);
+}
+
+void GLState::DeleteVertexArrays(GLsizei n, const GLuint *vaos) {
+    for (GLsizei i = 0; i < n; i++) {
+        if (vaos[i] && mVAO == vaos[i]) {
+            mVAO = 0;
+            mElementBuffer = kUnknown;
+        }
+    }
+    glDeleteVertexArrays(n, vaos);
+}
+
+void GLState::DeleteTextures(GLsizei n, const GLuint *textures) {
+    for (GLsizei i = 0; i < n; i++) {
+        if (!textures[i])
+            continue;
+        for (int unit = 0; unit < kMaxUnits; unit++) {
+            if (mTexture2D[unit] == textures[i])
+                mTexture2D[unit] = 0;
+        }
+    }
+    glDeleteTextures(n, textures);
+}
+
+void GLState::DeleteBuffers(GLsizei n, const GLuint *buffers) {
+    for (GLsizei i = 0; i < n; i++) {
+        if (!buffers[i])
+            continue;
+        if (mArrayBuffer == buffers[i])
+            mArrayBuffer = 0;
+        if (mElementBuffer == buffers[i])
+            mElementBuffer = 0;
+        if (mPixelUnpackBuffer == buffers[i])
+            mPixelUnpackBuffer = 0;
+    }
+    glDeleteBuffers(n, buffers);
+}
+
+void GLState::DeleteFramebuffers(GLsizei n, const GLuint *framebuffers) {
+    // deleting a bound framebuffer reverts the binding to the default one
+    for (GLsizei i = 0; i < n; i++) {
+        if (!framebuffers[i])
+            continue;
+        if (mDrawFramebuffer == framebuffers[i])
+            mDrawFramebuffer = 0;
+        if (mReadFramebuffer == framebuffers[i])
+            mReadFramebuffer = 0;
+    }
+    glDeleteFramebuffers(n, framebuffers);
+}
+
+void GLState::GetViewport(GLint viewport[4]) {
+    if (mViewport[0] == kUnknown) {
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        for (int i = 0; i < 4; i++)
+            mViewport[i] = viewport[i];
+        return;
+    }
+    for (int i = 0; i < 4; i++)
+        viewport[i] = (GLint)mViewport[i];
+}
+
+GLuint GLState::GetDrawFramebuffer() {
+    if (mDrawFramebuffer == kUnknown) {
+        GLint framebuffer = 0;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+        mDrawFramebuffer = framebuffer;
+    }
+    return (GLuint)mDrawFramebuffer;
+}
+
+GLuint GLState::GetProgram() {
+    if (mProgram == kUnknown) {
+        GLint program = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+        mProgram = program;
+    }
+    return (GLuint)mProgram;
+}
+
+void GLState::Validate(const char *func) {
+    auto check = [func](const char *name, GLenum pname, int64_t shadow) {
+        if (shadow == kUnknown)
+            return;
+        GLint value = 0;
+        glGetIntegerv(pname, &value);
+        if (value != shadow)
+            ALOGE("GLState::%s: %s is %d, shadow %lld", func, name, value, (long long)shadow);
+    };
+
+    check("program", GL_CURRENT_PROGRAM, mProgram);
+    check("vertex array", GL_VERTEX_ARRAY_BINDING, mVAO);
+    check("active texture", GL_ACTIVE_TEXTURE, mActiveUnit);
+    check("array buffer", GL_ARRAY_BUFFER_BINDING, mArrayBuffer);
+    check("element buffer", GL_ELEMENT_ARRAY_BUFFER_BINDING, mElementBuffer);
+    check("pixel unpack buffer", GL_PIXEL_UNPACK_BUFFER_BINDING, mPixelUnpackBuffer);
+    check("draw framebuffer", GL_DRAW_FRAMEBUFFER_BINDING, mDrawFramebuffer);
+    check("read framebuffer", GL_READ_FRAMEBUFFER_BINDING, mReadFramebuffer);
+    check("unpack row length", GL_UNPACK_ROW_LENGTH, mUnpackRowLength);
+    check("unpack alignment", GL_UNPACK_ALIGNMENT, mUnpackAlignment);
+    if (mActiveUnit != kUnknown && mActiveUnit - GL_TEXTURE0 < kMaxUnits)
+        check("texture 2d", GL_TEXTURE_BINDING_2D, mTexture2D[mActiveUnit - GL_TEXTURE0]);
+
+    if (mViewport[0] != kUnknown) {
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        for (int i = 0; i < 4; i++) {
+            if (viewport[i] != mViewport[i]) {
+                ALOGE("GLState::%s: viewport is (%d %d %d %d), shadow (%lld %lld %lld %lld)",
+                        func, viewport[0], viewport[1], viewport[2], viewport[3],
+                        (long long)mViewport[0], (long long)mViewport[1],
+                        (long long)mViewport[2], (long long)mViewport[3]);
+                break;
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "config.h"
+#if HAVE_GLES
+#   include <GLES3/gl3.h>
+#else
+#   define GLFW_INCLUDE_GLCOREARB
+#   define GL_GLEXT_PROTOTYPES
+#   define GLFW_INCLUDE_GLEXT
+#   include <GLFW/glfw3.h>
+#endif
+
+#include <stdint.h>
+
+namespace quink {
+
+/* Shadow of the binding state of the context current on this thread.
+ *
+ * Bind calls that would not change anything are dropped. Everything starts
+ * as unknown, so the first call always reaches the driver. GL code that
+ * bypasses this class must call Invalidate() afterwards, and objects have
+ * to be deleted through it since deletion implicitly unbinds them.
+ *
+ * One context per thread is assumed, matching both the GLFW/JNI render
+ * threads and the ContextPool workers.
+ */
+class GLState {
+public:
+    struct Stats {
+        uint64_t mIssued = 0;
+        uint64_t mAvoided = 0;
+    };
+
+    static GLState &Current();
+
+    // compare the shadow against glGet* after every call, log mismatches
+    static void SetValidate(bool validate);
+
+    void Invalidate();
+
+    void UseProgram(GLuint program);
+    void BindVertexArray(GLuint vao);
+    void ActiveTexture(GLenum unit);
+    void BindTexture(GLenum target, GLuint texture);
+    // make unit active and bind texture on it
+    void BindTexture(GLenum unit, GLenum target, GLuint texture);
+    void BindBuffer(GLenum target, GLuint buffer);
+    void Viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    // GL_FRAMEBUFFER binds both the draw and the read framebuffer
+    void BindFramebuffer(GLenum target, GLuint framebuffer);
+    void PixelStorei(GLenum pname, GLint param);
+
+    void DeleteProgram(GLuint program);
+    void DeleteVertexArrays(GLsizei n, const GLuint *vaos);
+    void DeleteTextures(GLsizei n, const GLuint *textures);
+    void DeleteBuffers(GLsizei n, const GLuint *buffers);
+    void DeleteFramebuffers(GLsizei n, const GLuint *framebuffers);
+
+    // from the shadow, queried only when it is unknown
+    void GetViewport(GLint viewport[4]);
+    GLuint GetDrawFramebuffer();
+    GLuint GetProgram();
+
+    const Stats &GetStats() const { return mStats; }
+
+private:
+    static const int kMaxUnits = 16;
+    static const int64_t kUnknown = -1;
+
+    GLState();
+
+    bool Filter(int64_t &shadow, int64_t value);
+    void Validate(const char *func);
+
+    int64_t mProgram;
+    int64_t mVAO;
+    int64_t mActiveUnit;
+    int64_t mTexture2D[kMaxUnits];
+    int64_t mArrayBuffer;
+    int64_t mElementBuffer;
+    int64_t mPixelUnpackBuffer;
+    int64_t mViewport[4];
+    int64_t mDrawFramebuffer;
+    int64_t mReadFramebuffer;
+    int64_t mUnpackRowLength;
+    int64_t mUnpackAlignment;
+
+    Stats mStats;
+};
+
+}
@@ -0,0 +1,113 @@
+#include "gl-hooks.h"
+
+#include "log.h"
+
+namespace quink {
+
+std::atomic<int> GLStats::sErrorCheck(GL_ERROR_CHECK);
+std::atomic<int> GLStats::sInterval(60);
+thread_local GLStats::Counters GLStats::tFrame;
+thread_local GLStats::Counters *GLStats::tTarget = nullptr;
+thread_local uint64_t GLStats::tFrameCount = 0;
+
+GLStats::Counters &GLStats::Counters::operator+=(const Counters &other) {
+    mCalls += other.mCalls;
+    mDraws += other.mDraws;
+    mUploadBytes += other.mUploadBytes;
+    return *this;
+}
+
+GLStats::Counters GLStats::Counters::operator-(const Counters &other) const {
+    Counters result;
+    result.mCalls = mCalls - other.mCalls;
+    result.mDraws = mDraws - other.mDraws;
+    result.mUploadBytes = mUploadBytes - other.mUploadBytes;
+    return result;
+}
+
+GLStats::Scope::Scope(Counters &counters) :
+    mPrevious(tTarget) {
+    tTarget = &counters;
+}
+
+GLStats::Scope::~Scope() {
+    tTarget = mPrevious;
+}
+
+void GLStats::SetErrorCheck(ErrorCheck policy, int interval) {
+    sErrorCheck.store(static_cast<int>(policy), std::memory_order_relaxed);
+    sInterval.store(interval > 0 ? interval : 1, std::memory_order_relaxed);
+}
+
+GLStats::Counters GLStats::EndFrame() {
+    Counters frame = tFrame;
+    tFrame = Counters();
+
+    ErrorCheck policy = GetErrorCheck();
+    if (policy == ErrorCheck::PerFrame ||
+            (policy == ErrorCheck::Sampled &&
+             tFrameCount % sInterval.load(std::memory_order_relaxed) == 0)) {
+        CheckError("frame");
+    }
+    tFrameCount++;
+    return frame;
+}
+
+bool GLStats::CheckError(const char *where) {
+    bool ret = false;
+    GLenum err;
+    // errors are sticky flags, collect all of them
+    while ((err = glGetError()) != GL_NO_ERROR) {
+        ALOGE("GL error 0x%x in %s (frame %llu)", err, where,
+                (unsigned long long)tFrameCount);
+        ret = true;
+    }
+    return ret;
+}
+
+size_t GLStats::PixelSize(unsigned int format, unsigned int type) {
+    size_t channels;
+    switch (format) {
+        case GL_RED:
+        case GL_RED_INTEGER:
+        case GL_ALPHA:
+        case GL_LUMINANCE:
+            channels = 1;
+            break;
+        case GL_RG:
+        case GL_RG_INTEGER:
+        case GL_LUMINANCE_ALPHA:
+            channels = 2;
+            break;
+        case GL_RGB:
+        case GL_RGB_INTEGER:
+            channels = 3;
+            break;
+        default:
+            channels = 4;
+            break;
+    }
+
+    switch (type) {
+        case GL_UNSIGNED_SHORT_5_6_5:
+        case GL_UNSIGNED_SHORT_4_4_4_4:
+        case GL_UNSIGNED_SHORT_5_5_5_1:
+            return 2;
+        case GL_UNSIGNED_INT_2_10_10_10_REV:
+        case GL_UNSIGNED_INT_10F_11F_11F_REV:
+        case GL_UNSIGNED_INT_5_9_9_9_REV:
+            return 4;
+        case GL_UNSIGNED_SHORT:
+        case GL_SHORT:
+        case GL_HALF_FLOAT:
+            return channels * 2;
+        case GL_UNSIGNED_INT:
+        case GL_INT:
+        case GL_FLOAT:
+            return channels * 4;
+        default:
+            return channels;
+    }
+}
+
+}
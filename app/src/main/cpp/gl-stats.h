@@ -0,0 +1,100 @@
+#pragma once
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#ifndef GL_ERROR_CHECK
+#define GL_ERROR_CHECK  2
+#endif
+
+namespace quink {
+
+/* Accounting of the GL calls made through gl-hooks.h, and the policy for
+ * glGetError checks.
+ *
+ * Counters are kept per thread for the current frame. A render can open a
+ * Scope on its own Counters to have the calls it issues attributed to it as
+ * well. glGetError may stall the pipeline on some drivers, so it only runs
+ * as often as the error check policy asks for:
+ *   Off        never
+ *   Sampled    once every N frames, from EndFrame()
+ *   PerFrame   once per frame, from EndFrame()
+ *   PerCall    after every hooked call and every CheckGLError()
+ * The default comes from GL_ERROR_CHECK in config.h, using the same order.
+ */
+class GLStats {
+public:
+    enum class ErrorCheck {
+        Off = 0,
+        Sampled = 1,
+        PerFrame = 2,
+        PerCall = 3,
+    };
+
+    struct Counters {
+        uint64_t mCalls = 0;
+        uint64_t mDraws = 0;
+        uint64_t mUploadBytes = 0;
+
+        Counters &operator+=(const Counters &other);
+        Counters operator-(const Counters &other) const;
+    };
+
+    class Scope {
+    public:
+        explicit Scope(Counters &counters);
+        ~Scope();
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        Counters *mPrevious;
+    };
+
+    static void SetErrorCheck(ErrorCheck policy, int interval = 60);
+    static ErrorCheck GetErrorCheck() {
+        return static_cast<ErrorCheck>(sErrorCheck.load(std::memory_order_relaxed));
+    }
+    static bool CheckPerCall() { return GetErrorCheck() == ErrorCheck::PerCall; }
+
+    static void OnCall() {
+        tFrame.mCalls++;
+        if (tTarget)
+            tTarget->mCalls++;
+    }
+    static void OnDraw() {
+        tFrame.mDraws++;
+        if (tTarget)
+            tTarget->mDraws++;
+    }
+    static void OnUpload(size_t bytes) {
+        tFrame.mUploadBytes += bytes;
+        if (tTarget)
+            tTarget->mUploadBytes += bytes;
+    }
+    static void AfterCall(const char *func) {
+        if (CheckPerCall())
+            CheckError(func);
+    }
+
+    // returns the counters of the frame issued on this thread and resets
+    // them, runs the frame level error check
+    static Counters EndFrame();
+
+    static bool CheckError(const char *where);
+    static size_t PixelSize(unsigned int format, unsigned int type);
+
+private:
+    static std::atomic<int> sErrorCheck;
+    static std::atomic<int> sInterval;
+    static thread_local Counters tFrame;
+    static thread_local Counters *tTarget;
+    static thread_local uint64_t tFrameCount;
+};
+
+}
@@ -18,24 +18,63 @@
 #include <jni.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/system_properties.h>
 #include <time.h>
 
+#include <algorithm>
 #include <array>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <memory>
 #include <string>
 
+#include "buffer-pool.h"
+#include "etc2-encoder.h"
+#include "frame-capture.h"
+#include "frame-pacer.h"
+#include "gl-caps.h"
+#include "gl-hooks.h"
+#include "gl-state.h"
+#include "hud.h"
 #include "image_decoder.h"
 #include "image_merge.h"
+#include "jpeg-decoder.h"
 #include "tonemapper.h"
 #include "log.h"
 #include "opengl-helper.h"
 #include "perf-monitor.h"
 #include "render.h"
+#include "residency.h"
+#include "resolution-controller.h"
+#include "scaled-render.h"
+#include "startup-profiler.h"
+#include "texture-cache.h"
+#include "texture-pool.h"
+#include "trace.h"
 
 using namespace quink;
 
 static std::array<Render*, 2> g_Renders;
+// drops the render resolution when the device can't keep up
+static std::shared_ptr<ResolutionController> g_Controller;
+// the pixels live on the GPU, host copies are reloaded after context loss
+static std::array<std::unique_ptr<ResidentImage>, 2> g_Images;
+// the first images, loaded while the context comes up; unless the texture
+// cache has them a DCT scaled preview comes ahead
+static std::future<std::array<HostImage, 2>> g_Loading;
+static std::future<std::array<HostImage, 2>> g_Preview;
+// after a new context the released host copies come back through g_Loading
+// as well, rather than from the loaders on the GL thread
+static bool g_Reloading;
+static const int kPreviewScale = 8;
+// created at the first init, see CreatePacer()
+static std::unique_ptr<FramePacer> g_Pacer;
+// setprop debug.tonemap.hud 1 draws the performance overlay
+static std::unique_ptr<Hud> g_Hud;
+static std::array<int, 4> g_HudStages;
+static int g_Width;
+static int g_Height;
 
 extern "C" {
     JNIEXPORT void JNICALL Java_com_android_gles3jni_GLES3JNILib_init(JNIEnv* env, jobject obj);
@@ -73,63 +112,284 @@ static std::string getLibDirectory() {
     return path;
 }
 
+// the app private cache directory, /data/data/<package>/cache
+static std::string getCacheDirectory() {
+    std::string package;
+    std::ifstream cmdline("/proc/self/cmdline");
+    std::getline(cmdline, package, '\0');
+    return "/data/data/" + package + "/cache";
+}
+
 using ImageGroup = std::pair<std::shared_ptr<Image<uint8_t>>, std::shared_ptr<Image<float>>>;
-static ImageGroup GetImage() {
-    static ImageGroup imageGroup;
+static std::shared_ptr<Image<uint8_t>> DecodeImage(const std::string &file) {
+    StartupProfiler::Phase phase("decode");
+    auto t1 = std::chrono::high_resolution_clock::now();
+    auto imgWrapper = ImageLoader::LoadImage(file);
+    if (imgWrapper.Empty()) {
+        ALOGE("cannot decode %s", file.c_str());
+        return nullptr;
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    ALOGD("decode %s takes %lld ms", file.c_str(),
+            (long long)std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count());
+    return imgWrapper.GetImg<uint8_t>();
+}
 
-    if (imageGroup.first == nullptr || imageGroup.second == nullptr) {
-        std::shared_ptr<Image<uint8_t>> imgs[2];
+// decodes and merges every time, the result is owned by the resident images
+static ImageGroup GetImage() {
+    TRACE_SCOPE("GetImage");
+    std::string path = getLibDirectory();
+
+    // the decodes are independent, the second one runs on a worker
+    auto decoding = std::async(std::launch::async, DecodeImage, path + "/libhigh.so");
+    auto low = DecodeImage(path + "/liblow.so");
+    auto high = decoding.get();
+    if (!low || !high)
+        return ImageGroup();
+
+    StartupProfiler::Phase phase("merge");
+    auto t1 = std::chrono::high_resolution_clock::now();
+    auto imgNew = ImageMerge::Merge<float>(low, high);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    ALOGD("merge two picture takes %lld ms",
+            (long long)std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count());
+    return ImageGroup(low, imgNew);
+}
 
-        std::string path = getLibDirectory();
+// the 8-bit image comes from the first file, the merged one from both
+static int GetCacheKeys(const std::string &path, uint64_t keys[2]) {
+    uint64_t low = TextureCache::Hash(&Etc2Encoder::kVersion, sizeof(Etc2Encoder::kVersion));
+    uint64_t high = low;
+    if (TextureCache::HashFile(path + "/liblow.so", low) ||
+            TextureCache::HashFile(path + "/libhigh.so", high))
+        return -1;
+    keys[0] = low;
+    keys[1] = TextureCache::Hash(&high, sizeof(high), low);
+    return 0;
+}
 
-        auto t1 = std::chrono::high_resolution_clock::now();
-        std::string file = path + "/liblow.so";
-        auto imgWrapper = ImageLoader::LoadImage(file);
-        if (imgWrapper.Empty()) {
-            ALOGE("cannot decode %s", file.c_str());
-            return ImageGroup();
+using CompressedGroup = std::pair<std::shared_ptr<CompressedImage>, std::shared_ptr<CompressedImage>>;
+// ETC2 versions of GetImage(), decoded and encoded on the first launch only,
+// onMiss is called before that
+static CompressedGroup GetCompressedImage(const std::function<void()> &onMiss) {
+    CompressedGroup compressedGroup;
+    TRACE_SCOPE("GetCompressedImage");
+    StartupProfiler::Phase phase("texture cache");
+    std::string path = getLibDirectory();
+    uint64_t keys[2];
+    if (GetCacheKeys(path, keys))
+        return CompressedGroup();
+
+    TextureCache cache(getCacheDirectory());
+    auto t1 = std::chrono::high_resolution_clock::now();
+    compressedGroup.first = cache.Load(keys[0]);
+    compressedGroup.second = cache.Load(keys[1]);
+    if (compressedGroup.first == nullptr || compressedGroup.second == nullptr) {
+        onMiss();
+        const auto imgs = GetImage();
+        if (imgs.first == nullptr || imgs.second == nullptr)
+            return CompressedGroup();
+        if (compressedGroup.first == nullptr) {
+            compressedGroup.first = Etc2Encoder::Encode(*imgs.first);
+            cache.Store(keys[0], *compressedGroup.first);
         }
-        imgs[0] = imgWrapper.GetImg<uint8_t>();
-        auto t2 = std::chrono::high_resolution_clock::now();
-        ALOGD("decode %s takes %lld ms", file.c_str(),
-                (long long)std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count());
-
-        t1 = std::chrono::high_resolution_clock::now();
-        file = path + "/libhigh.so";
-        imgWrapper = ImageLoader::LoadImage(file);
-        if (imgWrapper.Empty()) {
-            ALOGE("cannot decode %s", file.c_str());
-            return ImageGroup();
+        if (compressedGroup.second == nullptr) {
+            compressedGroup.second = Etc2Encoder::EncodeRGBM(*imgs.second);
+            cache.Store(keys[1], *compressedGroup.second);
         }
-        imgs[1] = imgWrapper.GetImg<uint8_t>();
-        t2 = std::chrono::high_resolution_clock::now();
-        ALOGD("decode %s takes %lld ms", file.c_str(),
-                (long long)std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count());
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    ALOGD("get compressed images takes %lld ms",
+            (long long)std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count());
 
-        t1 = std::chrono::high_resolution_clock::now();
-        auto imgNew = ImageMerge::Merge<float>(imgs[0], imgs[1]);
-        t2 = std::chrono::high_resolution_clock::now();
-        ALOGD("merge two picture takes %lld ms",
-                (long long)std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count());
+    return compressedGroup;
+}
+
+// the JPEG sources decoded at 1/kPreviewScale, empty for anything else
+static std::array<HostImage, 2> GetPreview() {
+    std::array<HostImage, 2> hosts;
+    std::string path = getLibDirectory();
+    const std::string files[2] = { path + "/liblow.so", path + "/libhigh.so" };
+    if (!JpegDecoder::IsJpeg(files[0]) || !JpegDecoder::IsJpeg(files[1]))
+        return hosts;
+
+    StartupProfiler::Phase phase("preview");
+    auto t1 = std::chrono::high_resolution_clock::now();
+    auto decoding = std::async(std::launch::async, JpegDecoder::Decode, files[1], kPreviewScale);
+    auto low = JpegDecoder::Decode(files[0], kPreviewScale);
+    auto high = decoding.get();
+    if (!low || !high)
+        return hosts;
+    hosts[0].mImage8 = low;
+    hosts[1].mImageFloat = ImageMerge::Merge<float>(low, high);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    ALOGD("preview %dx%d takes %lld ms", low->mWidth, low->mHeight,
+            (long long)std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count());
+    return hosts;
+}
+
+// setprop debug.tonemap.texture_cache 1 draws ETC2 encoded images, cached
+// across launches; the HDR one becomes lossy RGBM, so it is off by default
+static bool UseTextureCache() {
+    char value[PROP_VALUE_MAX] = {};
+    return __system_property_get("debug.tonemap.texture_cache", value) > 0 && atoi(value) != 0;
+}
+
+/* Uncompressed images unless the texture cache is on and can be used. A
+ * preview promise is always fulfilled, with an empty preview when the
+ * cache has the images.
+ */
+static std::array<HostImage, 2> LoadHostImages(std::promise<std::array<HostImage, 2>> *preview) {
+    auto sendPreview = [&preview]() {
+        if (preview)
+            preview->set_value(GetPreview());
+        preview = nullptr;
+    };
+    std::array<HostImage, 2> hosts;
+    const auto compressed = UseTextureCache() ? GetCompressedImage(sendPreview) : CompressedGroup();
+    if (compressed.first && compressed.second) {
+        if (preview)
+            preview->set_value(hosts);
+        hosts[0].mCompressed = compressed.first;
+        hosts[1].mCompressed = compressed.second;
+        return hosts;
+    }
+    sendPreview();
+    const auto imgs = GetImage();
+    hosts[0].mImage8 = imgs.first;
+    hosts[1].mImageFloat = imgs.second;
+    return hosts;
+}
+
+// one image back after it was released, from the texture cache when it is
+// on, decoded again otherwise; only the merged one needs both files
+static HostImage ReloadHostImage(size_t i) {
+    HostImage host;
+    std::string path = getLibDirectory();
+    uint64_t keys[2];
+    if (UseTextureCache() && !GetCacheKeys(path, keys)) {
+        host.mCompressed = TextureCache(getCacheDirectory()).Load(keys[i]);
+        if (host.mCompressed)
+            return host;
+    }
+    if (i == 0)
+        host.mImage8 = DecodeImage(path + "/liblow.so");
+    else
+        host.mImageFloat = GetImage().second;
+    return host;
+}
+
+template <typename T>
+static bool IsReady(std::future<T> &future) {
+    return future.valid() && future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+static void CreateImages(std::array<HostImage, 2> hosts) {
+    Residency::Instance().SetPolicy(Residency::Policy::Release);
+    const char *names[] = { "low", "merged" };
+    for (size_t i = 0; i < g_Images.size(); i++) {
+        auto loader = [i]() { return ReloadHostImage(i); };
+        g_Images[i].reset(new ResidentImage(names[i], loader, std::move(hosts[i])));
+    }
+}
 
-        imageGroup.first = imgs[0];
-        imageGroup.second = imgNew;
+// setprop debug.tonemap.capture <first>:<count> records those frames to
+// the cache directory, for tonemap-replay
+static void ArmCapture() {
+    char value[PROP_VALUE_MAX] = {};
+    if (__system_property_get("debug.tonemap.capture", value) <= 0)
+        return;
+    std::string path;
+    uint64_t first, count;
+    std::string spec = getCacheDirectory() + "/frames.qglc:" + value;
+    if (FrameCapture::ParseSpec(spec, path, first, count) < 0) {
+        ALOGE("bad capture %s", value);
+        return;
     }
+    FrameCapture::Instance().Arm(path, first, count);
+}
+
+// setprop debug.tonemap.pace <frames> caps the frames queued to the GPU and
+// starts each as late as the GPU allows; off by default, the driver decides
+static void CreatePacer() {
+    FramePacer::Config config;
+    config.mMaxInFlight = 0;
+    char value[PROP_VALUE_MAX] = {};
+    if (__system_property_get("debug.tonemap.pace", value) > 0)
+        config.mMaxInFlight = std::min(std::max(atoi(value), 0), 16);
+    if (config.mMaxInFlight)
+        ALOGD("frame pacing with %d frames in flight", config.mMaxInFlight);
+    g_Pacer.reset(new FramePacer(config));
+}
 
-    return imageGroup;
+static void CreateHud() {
+    char value[PROP_VALUE_MAX] = {};
+    if (__system_property_get("debug.tonemap.hud", value) <= 0 || atoi(value) == 0)
+        return;
+    g_Hud.reset(new Hud());
+    if (g_Hud->Init()) {
+        g_Hud.reset();
+        return;
+    }
+    g_HudStages[0] = g_Hud->AddStage("[1] update");
+    g_HudStages[1] = g_Hud->AddStage("[1] draw");
+    g_HudStages[2] = g_Hud->AddStage("[2] update");
+    g_HudStages[3] = g_Hud->AddStage("[2] draw");
 }
 
 JNIEXPORT void JNICALL
 Java_com_android_gles3jni_GLES3JNILib_init(JNIEnv* env, jobject obj) {
+    // a capture follows one context, a new one ends it
+    FrameCapture::Instance().Stop();
+    const bool firstStart = !g_Images[0] && !g_Loading.valid();
+    if (firstStart) {
+        // first start, the images load while the context is set up
+        StartupProfiler::Instance().Start();
+        auto preview = std::make_shared<std::promise<std::array<HostImage, 2>>>();
+        g_Preview = preview->get_future();
+        g_Loading = std::async(std::launch::async, [preview]() {
+            return LoadHostImages(preview.get());
+        });
+    } else if (g_Images[0]) {
+        // the textures went with the old context and the host copies were
+        // released after the upload. Decoding and merging again takes far
+        // too long for a frame, so it happens on a worker. When the first
+        // load is still running its images are as good
+        if (!g_Loading.valid()) {
+            g_Loading = std::async(std::launch::async, []() {
+                return LoadHostImages(nullptr);
+            });
+        }
+        g_Reloading = true;
+    }
+
     for (int i = 0; i < g_Renders.size(); i++) {
         delete g_Renders[i];
         g_Renders[i] = nullptr;
     }
+    // a new context may have been created, the shadow state, the pooled
+    // textures and the objects of the pacer and the hud belong to the old one
+    GLState::Current().Invalidate();
+    TexturePool::Instance().Abandon();
+    if (g_Pacer)
+        g_Pacer->Abandon();
+    else
+        CreatePacer();
+    if (g_Hud)
+        g_Hud->Abandon();
+    g_Hud.reset();
+    GLCaps::Instance().Reset();
+    Residency::Instance().Invalidate();
+    if (firstStart)
+        ArmCapture();
+
+#if ENABLE_TRACE
+    Trace::SetEnabled(true);
+#endif
 
     OpenGL_Helper::PrintGLString("Version", GL_VERSION);
     OpenGL_Helper::PrintGLString("Vendor", GL_VENDOR);
     OpenGL_Helper::PrintGLString("Renderer", GL_RENDERER);
-    OpenGL_Helper::PrintGLExtension();
     OpenGL_Helper::SetupDebugCallback();
 
     const char* versionStr = (const char*)glGetString(GL_VERSION);
@@ -138,6 +398,13 @@ Java_com_android_gles3jni_GLES3JNILib_init(JNIEnv* env, jobject obj) {
         return;
     }
 
+    {
+        StartupProfiler::Phase phase("gl caps");
+        ALOGD("parallel shader compile %s", OpenGL_Helper::EnableParallelCompile() ? "on" : "off");
+        // benchmarked on the first launch only, saved per renderer
+        GLCaps::Instance().SelectHdrFormat(getCacheDirectory());
+    }
+
     Render::ImageCoord coordA = {
         {-1.0f, 1.0f},
         {-1.0f, -1.0f},
@@ -151,55 +418,140 @@ Java_com_android_gles3jni_GLES3JNILib_init(JNIEnv* env, jobject obj) {
         {1.0f, 1.0f},
     };
 
-    g_Renders[0] = Render::Create("Plain");
+    // only issues the compiles, they finish while the images load
+    StartupProfiler::Phase phase("start shaders");
+    g_Controller = std::make_shared<ResolutionController>();
+    g_Renders[0] = new ScaledRender(Render::Create("Plain"), g_Controller);
     g_Renders[0]->Init(coordA);
-    g_Renders[1] = Render::Create("Hable");
+    g_Renders[1] = new ScaledRender(Render::Create("Hable"), g_Controller);
     g_Renders[1]->Init(coordB);
- 
-    return;
+    CreateHud();
 }
 
 JNIEXPORT void JNICALL
 Java_com_android_gles3jni_GLES3JNILib_resize(JNIEnv* env, jobject obj, jint width, jint height) {
-    glViewport(0, 0, width, height);
+    GLState::Current().Viewport(0, 0, width, height);
+    g_Width = width;
+    g_Height = height;
 }
 
 JNIEXPORT void JNICALL
 Java_com_android_gles3jni_GLES3JNILib_render(JNIEnv* env, jobject obj) {
+    TRACE_SCOPE("render");
     glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    const auto imgs = GetImage();
+    if (!g_Images[0] && IsReady(g_Preview)) {
+        auto preview = g_Preview.get();
+        if (!preview[0].Empty())
+            CreateImages(std::move(preview));
+    }
+    if (IsReady(g_Loading)) {
+        auto hosts = g_Loading.get();
+        if (!g_Images[0]) {
+            CreateImages(std::move(hosts));
+        } else if (!hosts[0].Empty() && !hosts[1].Empty()) {
+            for (size_t i = 0; i < g_Images.size(); i++)
+                g_Images[i]->Replace(std::move(hosts[i]));
+            // the staging buffers of the preview sizes aren't needed again
+            BufferPool::Instance().Trim();
+            ALOGD(g_Reloading ? "images reloaded for the new context" :
+                    "full resolution images replace the preview");
+        }
+        // on failure the loaders of the images try again
+        g_Reloading = false;
+    }
+    if (!g_Images[0] || g_Reloading) {
+        // don't hold up the UI thread, present empty frames until the images
+        // are there
+        for (auto render : g_Renders) {
+            if (render)
+                render->Poll();
+        }
+        return;
+    }
 
-    static PerfMonitor perf[4] = {
-        PerfMonitor(30, [](long long dura) { ALOGD("[1] update takes %f ms", dura/1000.0); }),
-        PerfMonitor(30, [](long long dura) { ALOGD("[1] draw takes %f ms", dura/1000.0); }),
-        PerfMonitor(30, [](long long dura) { ALOGD("[2] update takes %f ms", dura/1000.0); }),
-        PerfMonitor(30, [](long long dura) { ALOGD("[2] draw takes %f ms", dura/1000.0); }),
+    static PerfMonitor perf[8] = {
+        { 30, [](long long dura) { ALOGD("[1] update takes %f ms", dura/1000.0); } },
+        { 30, [](long long dura) { ALOGD("[1] draw takes %f ms", dura/1000.0); } },
+        { 30, [](long long dura) { ALOGD("[2] update takes %f ms", dura/1000.0); } },
+        { 30, [](long long dura) { ALOGD("[2] draw takes %f ms", dura/1000.0); } },
+        { 30, [](long long n) { ALOGD("render scale %lld%%", n); } },
+        { 30, [](long long n) { ALOGD("host image memory %lld KB", n / 1024); } },
+        { 30, [](long long n) { ALOGD("gpu image memory %lld KB", n / 1024); } },
+        { 30, [](long long t) { ALOGD("frame latency %f ms", t/1000.0); } },
     };
+    static bool latencyReported = [] {
+        g_Pacer->SetLatencyCallback([](uint64_t, float ms) {
+            perf[7].Update((long long)(ms * 1000.0f + 0.5f));
+        });
+        return true;
+    }();
+    (void)latencyReported;
+
+    g_Pacer->BeginFrame();
+
+    // render() runs once per frame, the time between calls is the frame time
+    static std::chrono::high_resolution_clock::time_point lastFrame;
+    auto now = std::chrono::high_resolution_clock::now();
+    const bool firstFrame = lastFrame == std::chrono::high_resolution_clock::time_point();
+    const float frameMs = std::chrono::duration<float, std::milli>(now - lastFrame).count();
+    if (g_Controller) {
+        if (!firstFrame)
+            g_Controller->Update(now - lastFrame);
+        perf[4].Update((long long)(g_Controller->GetScale() * 100.0f + 0.5f));
+    }
+    lastFrame = now;
 
     std::chrono::high_resolution_clock::time_point t1, t2, t3;
-    if (imgs.first) {
+    for (size_t i = 0; i < g_Images.size(); i++) {
         t1 = std::chrono::high_resolution_clock::now();
-        g_Renders[0]->UploadTexture(imgs.first);
+        {
+            Hud::Scope scope(g_Hud.get(), g_HudStages[i * 2]);
+            // a no-op once the render has the pixels
+            if (g_Images[i]->Upload(*g_Renders[i]) < 0)
+                continue;
+        }
         t2 = std::chrono::high_resolution_clock::now();
 
-        g_Renders[0]->Draw();
+        {
+            Hud::Scope scope(g_Hud.get(), g_HudStages[i * 2 + 1]);
+            g_Renders[i]->Draw();
+        }
         t3 = std::chrono::high_resolution_clock::now();
 
-        perf[0].Update(t2 - t1);
-        perf[1].Update(t3 - t2);
+        perf[i * 2].Update(t2 - t1);
+        perf[i * 2 + 1].Update(t3 - t2);
     }
 
-    if (imgs.second) {
-        t1 = std::chrono::high_resolution_clock::now();
-        g_Renders[1]->UploadTexture(imgs.second);
-        t2 = std::chrono::high_resolution_clock::now();
-
-        g_Renders[1]->Draw();
-        t3 = std::chrono::high_resolution_clock::now();
+    const auto residency = Residency::Instance().GetStats();
+    perf[5].Update((long long)residency.mHostBytes);
+    perf[6].Update((long long)residency.mGpuBytes);
+
+    if (g_Hud)
+        g_Hud->Draw(g_Width, g_Height);
+    // GLSurfaceView swaps right after render() returns
+    g_Pacer->EndFrame();
+
+    const auto frameCounters = GLStats::EndFrame();
+    FrameCapture::Instance().EndFrame();
+
+    if (g_Hud) {
+        if (!firstFrame)
+            g_Hud->EndFrame(frameMs);
+        g_Hud->SetCounter("GL CALLS", frameCounters.mCalls);
+        g_Hud->SetCounter("DRAWS", frameCounters.mDraws);
+        g_Hud->SetCounter("HOST IMAGES", residency.mHostBytes / 1024, "KB");
+        g_Hud->SetCounter("GPU IMAGES", residency.mGpuBytes / 1024, "KB");
+        if (g_Controller)
+            g_Hud->SetCounter("RENDER SCALE", g_Controller->GetScale() * 100.0f, "%");
+        g_Hud->SetCounter("LATENCY", std::max(g_Pacer->GetLatencyMs(), 0.0f), "MS", 2);
+    }
 
-        perf[2].Update(t2 - t1);
-        perf[3].Update(t3 - t2);
+    // presented by the swap after render() returns, close enough
+    if (!StartupProfiler::Instance().IsDone()) {
+        StartupProfiler::Instance().FirstFrame();
+        // long and rarely needed, kept off the startup path
+        OpenGL_Helper::PrintGLExtension();
     }
 }
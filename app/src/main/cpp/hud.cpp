@@ -0,0 +1,553 @@
+#include "hud.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "gl-caps.h"
+#include "gl-hooks.h"
+#include "gl-state.h"
+#include "log.h"
+#include "opengl-helper.h"
+#include "trace.h"
+
+#if HAVE_GLES
+#define HEADER_VERSION  "#version 300 es\n"
+#else
+#define HEADER_VERSION  "#version 330 core\n"
+#endif
+
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED         0x88BF
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT     0x8FBB
+#endif
+
+namespace quink {
+
+// std::min() takes them by reference
+const int Hud::kHistory;
+const int Hud::kQueryLatency;
+const int Hud::kSegments;
+const int Hud::kMaxInstances;
+
+// 8x8 cells of 5x7 glyphs, cell 0 is solid for panels and bars
+static const int kCellSize = 8;
+static const int kGlyphWidth = 5;
+static const int kGlyphHeight = 7;
+static const int kAtlasSize = 64;
+
+// lower case is drawn as upper case, anything else not listed as a space
+static const char kGlyphChars[] = " 0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ.:%/-+()[]=_,";
+
+// a row per byte, the leftmost pixel in bit 4
+static const uint8_t kGlyphs[][kGlyphHeight] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // space
+    { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E },   // 0
+    { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E },   // 1
+    { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F },   // 2
+    { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E },   // 3
+    { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 },   // 4
+    { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E },   // 5
+    { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E },   // 6
+    { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },   // 7
+    { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E },   // 8
+    { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C },   // 9
+    { 0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },   // A
+    { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E },   // B
+    { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E },   // C
+    { 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C },   // D
+    { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F },   // E
+    { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 },   // F
+    { 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F },   // G
+    { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },   // H
+    { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E },   // I
+    { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C },   // J
+    { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 },   // K
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F },   // L
+    { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 },   // M
+    { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 },   // N
+    { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },   // O
+    { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 },   // P
+    { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D },   // Q
+    { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 },   // R
+    { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E },   // S
+    { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 },   // T
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },   // U
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 },   // V
+    { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A },   // W
+    { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 },   // X
+    { 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04 },   // Y
+    { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F },   // Z
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C },   // .
+    { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 },   // :
+    { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 },   // %
+    { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 },   // /
+    { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 },   // -
+    { 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00 },   // +
+    { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 },   // (
+    { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 },   // )
+    { 0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E },   // [
+    { 0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E },   // ]
+    { 0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00 },   // =
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F },   // _
+    { 0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08 },   // ,
+};
+
+static_assert(sizeof(kGlyphs) / sizeof(kGlyphs[0]) == sizeof(kGlyphChars) - 1,
+        "glyphs out of date");
+static_assert(sizeof(kGlyphChars) <= (kAtlasSize / kCellSize) * (kAtlasSize / kCellSize),
+        "atlas too small");
+
+// colors are 0xRRGGBBAA
+static const uint32_t kPanelColor = 0x000000B0;
+static const uint32_t kGraphColor = 0x303030C0;
+static const uint32_t kTextColor = 0xFFFFFFFF;
+static const uint32_t kBudgetColor = 0xFFFFFF80;
+static const uint32_t kFastColor = 0x40E040FF;
+static const uint32_t kSlowColor = 0xE0E040FF;
+static const uint32_t kMissColor = 0xE04040FF;
+
+// a second, the fence of kSegments frames ago is normally long signaled
+static const GLuint64 kFenceTimeoutNs = 1000000000ull;
+
+static const char kVertexSrc[] = HEADER_VERSION
+R"(layout(location = 0) in vec4 rect;
+layout(location = 1) in vec2 cell;
+layout(location = 2) in vec4 color;
+uniform vec2 viewSize;
+out vec2 o_uv;
+out vec4 o_color;
+void main()
+{
+    vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+    vec2 pos = (rect.xy + corner * rect.zw) / viewSize;
+    gl_Position = vec4(pos.x * 2.0 - 1.0, 1.0 - pos.y * 2.0, 0.0, 1.0);
+    o_uv = (cell * 8.0 + corner * vec2(5.0, 7.0)) / 64.0;
+    o_color = color;
+}
+)";
+
+static const char kFragSrc[] = HEADER_VERSION
+R"(precision mediump float;
+uniform sampler2D atlas;
+in vec2 o_uv;
+in vec4 o_color;
+out vec4 fragColor;
+void main()
+{
+    fragColor = vec4(o_color.rgb, o_color.a * texture(atlas, o_uv).r);
+}
+)";
+
+static int GlyphCell(char c) {
+    static int cells[128];
+    static bool initialized = [] {
+        for (size_t i = 0; i + 1 < sizeof(kGlyphChars); i++)
+            cells[(int)kGlyphChars[i]] = i + 1;
+        return true;
+    }();
+    (void)initialized;
+    int upper = toupper((unsigned char)c);
+    return upper < 128 ? cells[upper] : 0;
+}
+
+static void BakeAtlas(uint8_t *atlas) {
+    const int cellsPerRow = kAtlasSize / kCellSize;
+    memset(atlas, 0, kAtlasSize * kAtlasSize);
+    for (int y = 0; y < kCellSize; y++)
+        memset(atlas + y * kAtlasSize, 0xFF, kCellSize);
+    for (size_t i = 0; i + 1 < sizeof(kGlyphChars); i++) {
+        int cell = i + 1;
+        uint8_t *origin = atlas + (cell / cellsPerRow) * kCellSize * kAtlasSize +
+                (cell % cellsPerRow) * kCellSize;
+        for (int y = 0; y < kGlyphHeight; y++) {
+            for (int x = 0; x < kGlyphWidth; x++) {
+                if (kGlyphs[i][y] & (0x10 >> x))
+                    origin[y * kAtlasSize + x] = 0xFF;
+            }
+        }
+    }
+}
+
+static void Smooth(float &value, float sample) {
+    value = value < 0.0f ? sample : value + (sample - value) * 0.1f;
+}
+
+Hud::Hud() {
+    mSelf.mName = "HUD";
+}
+
+Hud::~Hud() {
+    GLState &state = GLState::Current();
+    state.DeleteProgram(mProgram);
+    state.DeleteTextures(1, &mAtlas);
+    state.DeleteBuffers(1, &mBuffer);
+    state.DeleteVertexArrays(kSegments, mVAOs.data());
+    for (GLsync fence : mFences) {
+        if (fence)
+            glDeleteSync(fence);
+    }
+    // unused names are zero, which is skipped
+    for (Stage &stage : mStages)
+        glDeleteQueries(kQueryLatency, stage.mQueries.data());
+    glDeleteQueries(kQueryLatency, mSelf.mQueries.data());
+}
+
+void Hud::Abandon() {
+    mProgram = 0;
+    mLinked = false;
+    mAtlas = 0;
+    mBuffer = 0;
+    mVAOs = {};
+    mFences = {};
+    for (Stage &stage : mStages) {
+        stage.mQueries = {};
+        stage.mPending = {};
+        stage.mTiming = false;
+    }
+    mSelf.mQueries = {};
+    mSelf.mPending = {};
+    mSelf.mTiming = false;
+}
+
+int Hud::Init() {
+    TRACE_GL_SCOPE("Hud::Init");
+    // linked in the background, the first Draw() waits if it has to
+    mProgram = OpenGL_Helper::StartProgram(kVertexSrc, kFragSrc);
+    if (!mProgram)
+        return -1;
+
+    GLState &state = GLState::Current();
+    std::vector<uint8_t> atlas(kAtlasSize * kAtlasSize);
+    BakeAtlas(atlas.data());
+    glGenTextures(1, &mAtlas);
+    state.BindTexture(GL_TEXTURE0, GL_TEXTURE_2D, mAtlas);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8, kAtlasSize, kAtlasSize);
+    state.PixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    state.PixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, kAtlasSize, kAtlasSize, GL_RED, GL_UNSIGNED_BYTE,
+            atlas.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    CheckGLError();
+
+    glGenBuffers(1, &mBuffer);
+    state.BindBuffer(GL_ARRAY_BUFFER, mBuffer);
+    glBufferData(GL_ARRAY_BUFFER, kSegments * kMaxInstances * sizeof(Instance), nullptr,
+            GL_STREAM_DRAW);
+    glGenVertexArrays(kSegments, mVAOs.data());
+    for (int i = 0; i < kSegments; i++) {
+        const size_t base = i * kMaxInstances * sizeof(Instance);
+        state.BindVertexArray(mVAOs[i]);
+        glVertexAttribPointer(0, 4, GL_SHORT, GL_FALSE, sizeof(Instance),
+                (const void *)(base + offsetof(Instance, mRect)));
+        glVertexAttribPointer(1, 2, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(Instance),
+                (const void *)(base + offsetof(Instance, mCell)));
+        glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Instance),
+                (const void *)(base + offsetof(Instance, mColor)));
+        for (GLuint attrib = 0; attrib < 3; attrib++) {
+            glEnableVertexAttribArray(attrib);
+            glVertexAttribDivisor(attrib, 1);
+        }
+    }
+    CheckGLError();
+
+#if HAVE_GLES
+    mTimerQueries = GLCaps::Instance().HasExtension("GL_EXT_disjoint_timer_query");
+#else
+    mTimerQueries = true;
+#endif
+    if (!mTimerQueries)
+        ALOGD("no timer queries, the HUD shows CPU times only");
+    mInstances.reserve(kMaxInstances);
+    return 0;
+}
+
+int Hud::AddStage(const char *name) {
+    Stage stage;
+    stage.mName = name;
+    mStages.push_back(stage);
+    return mStages.size() - 1;
+}
+
+void Hud::BeginStage(int stage) {
+    Begin(mStages[stage]);
+}
+
+void Hud::EndStage(int stage) {
+    End(mStages[stage]);
+}
+
+void Hud::SetCounter(const char *name, double value, const char *unit, int decimals) {
+    for (Counter &counter : mCounters) {
+        if (counter.mName == name || !strcmp(counter.mName, name)) {
+            counter.mValue = value;
+            counter.mUnit = unit;
+            counter.mDecimals = decimals;
+            return;
+        }
+    }
+    Counter counter = { name, unit, value, decimals };
+    mCounters.push_back(counter);
+}
+
+void Hud::Begin(Stage &stage) {
+    stage.mBegin = Clock::now();
+    stage.mTiming = false;
+    if (!mTimerQueries)
+        return;
+    // a query still in flight after kQueryLatency frames skips a sample
+    const int slot = mFrame % kQueryLatency;
+    if (stage.mPending[slot])
+        return;
+    if (!stage.mQueries[slot])
+        glGenQueries(1, &stage.mQueries[slot]);
+    glBeginQuery(GL_TIME_ELAPSED, stage.mQueries[slot]);
+    stage.mTiming = true;
+}
+
+void Hud::End(Stage &stage) {
+    if (stage.mTiming) {
+        glEndQuery(GL_TIME_ELAPSED);
+        stage.mPending[mFrame % kQueryLatency] = true;
+        stage.mTiming = false;
+    }
+    Smooth(stage.mCpuMs, std::chrono::duration<float, std::milli>(
+            Clock::now() - stage.mBegin).count());
+}
+
+void Hud::Collect(Stage &stage, bool disjoint) {
+    for (int slot = 0; slot < kQueryLatency; slot++) {
+        if (!stage.mPending[slot])
+            continue;
+        GLuint available = 0;
+        glGetQueryObjectuiv(stage.mQueries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            continue;
+        // 32 bits of nanoseconds are four seconds, plenty for a stage
+        GLuint ns = 0;
+        glGetQueryObjectuiv(stage.mQueries[slot], GL_QUERY_RESULT, &ns);
+        stage.mPending[slot] = false;
+        if (!disjoint)
+            Smooth(stage.mGpuMs, ns / 1000000.0f);
+    }
+}
+
+void Hud::EndFrame(float frameMs) {
+    mHistory[mHistoryHead] = frameMs;
+    mHistoryHead = (mHistoryHead + 1) % kHistory;
+    mHistoryCount = std::min(mHistoryCount + 1, kHistory);
+    Smooth(mFrameMs, frameMs);
+
+    if (mTimerQueries) {
+        bool disjoint = false;
+#if HAVE_GLES
+        // a frequency change or the like, every result in flight is garbage
+        GLint value = 0;
+        glGetIntegerv(GL_GPU_DISJOINT_EXT, &value);
+        disjoint = value != 0;
+#endif
+        for (Stage &stage : mStages)
+            Collect(stage, disjoint);
+        Collect(mSelf, disjoint);
+    }
+    mFrame++;
+}
+
+void Hud::AddQuad(int x, int y, int w, int h, int cell, uint32_t color) {
+    if (mInstances.size() >= kMaxInstances)
+        return;
+    const int cellsPerRow = kAtlasSize / kCellSize;
+    Instance instance;
+    instance.mRect[0] = x;
+    instance.mRect[1] = y;
+    instance.mRect[2] = w;
+    instance.mRect[3] = h;
+    instance.mCell[0] = cell % cellsPerRow;
+    instance.mCell[1] = cell / cellsPerRow;
+    instance.mPad[0] = instance.mPad[1] = 0;
+    instance.mColor[0] = color >> 24;
+    instance.mColor[1] = color >> 16;
+    instance.mColor[2] = color >> 8;
+    instance.mColor[3] = color;
+    mInstances.push_back(instance);
+}
+
+int Hud::AddText(int x, int y, const char *text, uint32_t color) {
+    for (; *text; text++) {
+        int cell = GlyphCell(*text);
+        // cell 1 is the space
+        if (cell > 1)
+            AddQuad(x, y, kGlyphWidth * mScale, kGlyphHeight * mScale, cell, color);
+        x += (kGlyphWidth + 1) * mScale;
+    }
+    return x;
+}
+
+int Hud::AddLine(int x, int y, uint32_t color, const char *format, ...) {
+    char line[96];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    return AddText(x, y, line, color);
+}
+
+static void FormatMs(char *buf, size_t size, float ms) {
+    if (ms < 0.0f)
+        snprintf(buf, size, "    -");
+    else
+        snprintf(buf, size, "%5.2f", ms);
+}
+
+void Hud::Layout(int width, int height) {
+    mInstances.clear();
+    mScale = std::max(1, std::min(width, height) / 360);
+    const int margin = 4 * mScale;
+    const int lineHeight = (kGlyphHeight + 3) * mScale;
+    const int left = 2 * margin;
+    int right = left;
+    int y = 2 * margin;
+
+    // sized once everything else is in
+    AddQuad(0, 0, 0, 0, 0, kPanelColor);
+
+    const float frameMs = std::max(mFrameMs, 0.0f);
+    right = std::max(right, AddLine(left, y, kTextColor, "FRAME %5.2f MS %5.1f FPS",
+            frameMs, frameMs > 0.0f ? 1000.0f / frameMs : 0.0f));
+    y += lineHeight;
+
+    // newest on the right, scaled to twice the budget
+    const int barWidth = mScale;
+    const int graphWidth = kHistory * barWidth;
+    const int graphHeight = 32 * mScale;
+    const float graphMs = 2.0f * mBudgetMs;
+    AddQuad(left, y, graphWidth, graphHeight, 0, kGraphColor);
+    for (int i = 0; i < mHistoryCount; i++) {
+        float ms = mHistory[(mHistoryHead - mHistoryCount + i + kHistory) % kHistory];
+        int h = std::min(graphHeight, (int)(ms / graphMs * graphHeight + 0.5f));
+        uint32_t color = ms <= mBudgetMs ? kFastColor :
+                ms <= graphMs ? kSlowColor : kMissColor;
+        AddQuad(left + (kHistory - mHistoryCount + i) * barWidth, y + graphHeight - h,
+                barWidth, h, 0, color);
+    }
+    AddQuad(left, y + graphHeight / 2, graphWidth, mScale, 0, kBudgetColor);
+    right = std::max(right, left + graphWidth);
+    y += graphHeight + margin;
+
+    right = std::max(right, AddLine(left, y, kTextColor, "%-10s %7s %7s", "", "CPU MS",
+            mTimerQueries ? "GPU MS" : ""));
+    y += lineHeight;
+    char cpu[16], gpu[16];
+    for (const Stage &stage : mStages) {
+        FormatMs(cpu, sizeof(cpu), stage.mCpuMs);
+        FormatMs(gpu, sizeof(gpu), stage.mGpuMs);
+        right = std::max(right, AddLine(left, y, kTextColor, "%-10.10s   %s   %s", stage.mName,
+                cpu, mTimerQueries ? gpu : ""));
+        y += lineHeight;
+    }
+    FormatMs(cpu, sizeof(cpu), mSelf.mCpuMs);
+    FormatMs(gpu, sizeof(gpu), mSelf.mGpuMs);
+    right = std::max(right, AddLine(left, y, kTextColor, "%-10.10s   %s   %s", mSelf.mName,
+            cpu, mTimerQueries ? gpu : ""));
+    y += lineHeight;
+
+    for (const Counter &counter : mCounters) {
+        right = std::max(right, AddLine(left, y, kTextColor, "%s %.*f %s", counter.mName,
+                counter.mDecimals, counter.mValue, counter.mUnit));
+        y += lineHeight;
+    }
+
+    Instance &panel = mInstances[0];
+    panel.mRect[0] = margin;
+    panel.mRect[1] = margin;
+    panel.mRect[2] = right;
+    panel.mRect[3] = y - margin;
+}
+
+bool Hud::Upload() {
+    GLsync &fence = mFences[mSegment];
+    if (fence) {
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            // the GPU is more than kSegments frames behind
+            mStalls++;
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, kFenceTimeoutNs);
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    const size_t bytes = mInstances.size() * sizeof(Instance);
+    GLState::Current().BindBuffer(GL_ARRAY_BUFFER, mBuffer);
+    // the fence says nobody reads the segment, the driver need not check
+    void *data = glMapBufferRange(GL_ARRAY_BUFFER, mSegment * kMaxInstances * sizeof(Instance),
+            bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (!data) {
+        CheckGLError();
+        return false;
+    }
+    memcpy(data, mInstances.data(), bytes);
+    return glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE;
+}
+
+void Hud::Draw(int width, int height) {
+    if (!mProgram || width <= 0 || height <= 0)
+        return;
+    TRACE_GL_SCOPE("Hud::Draw");
+    Begin(mSelf);
+
+    GLState &state = GLState::Current();
+    if (!mLinked) {
+        if (OpenGL_Helper::FinishProgram(mProgram, true)) {
+            mProgram = 0;
+            End(mSelf);
+            return;
+        }
+        state.UseProgram(mProgram);
+        glUniform1i(glGetUniformLocation(mProgram, "atlas"), 0);
+        mViewSizeLocation = glGetUniformLocation(mProgram, "viewSize");
+        mLinked = true;
+    }
+
+    Layout(width, height);
+    const bool uploaded = Upload();
+    if (uploaded) {
+        GLint viewport[4];
+        state.GetViewport(viewport);
+        state.BindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        state.Viewport(0, 0, width, height);
+        state.UseProgram(mProgram);
+        if (mViewWidth != width || mViewHeight != height) {
+            mViewWidth = width;
+            mViewHeight = height;
+            glUniform2f(mViewSizeLocation, mViewWidth, mViewHeight);
+        }
+        state.BindVertexArray(mVAOs[mSegment]);
+        state.BindTexture(GL_TEXTURE0, GL_TEXTURE_2D, mAtlas);
+        glEnable(GL_BLEND);
+        // the window stays opaque where it has alpha
+        glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO, GL_ONE);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, mInstances.size());
+        glDisable(GL_BLEND);
+        state.Viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        CheckGLError();
+    }
+    End(mSelf);
+
+    // left out of our own time, drivers like llvmpipe flush the whole frame
+    // on a fence, which the swap would have done anyway
+    if (uploaded) {
+        mFences[mSegment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        mSegment = (mSegment + 1) % kSegments;
+    }
+}
+
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "config.h"
+#if HAVE_GLES
+#   include <GLES3/gl3.h>
+#else
+#   define GLFW_INCLUDE_GLCOREARB
+#   define GL_GLEXT_PROTOTYPES
+#   define GLFW_INCLUDE_GLEXT
+#   include <GLFW/glfw3.h>
+#endif
+
+#include <stdint.h>
+
+#include <array>
+#include <chrono>
+#include <vector>
+
+namespace quink {
+
+/* On-screen performance overlay: a frame time graph, CPU and GPU time of
+ * the stages of a frame and a few counters, drawn over the default
+ * framebuffer after everything else.
+ *
+ * Text and bars are quads into a 5x7 pixel font baked into one small
+ * texture at Init(), and the whole overlay is a single instanced draw.
+ * The per-quad data streams through a ring of buffer segments written with
+ * unsynchronized maps, a fence per segment keeps the CPU from overwriting
+ * what the GPU still reads.
+ *
+ * GPU times come from timer queries (GL_EXT_disjoint_timer_query on ES),
+ * read back a few frames later without blocking. Stages must not overlap
+ * as only one timer query can run at a time. The cost of Draw() itself is
+ * measured the same way and shown on the last line.
+ *
+ * Stage and counter names are stored by pointer and must be string
+ * literals.
+ */
+class Hud {
+public:
+    class Scope {
+    public:
+        // a null hud measures nothing
+        Scope(Hud *hud, int stage) : mHud(hud), mStage(stage) {
+            if (mHud)
+                mHud->BeginStage(mStage);
+        }
+        ~Scope() {
+            if (mHud)
+                mHud->EndStage(mStage);
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        Hud *mHud;
+        int mStage;
+    };
+
+    // frames in the graph
+    static const int kHistory = 120;
+
+    Hud();
+    ~Hud();
+
+    Hud(const Hud &) = delete;
+    Hud &operator=(const Hud &) = delete;
+
+    int Init();
+    // the context is gone with the objects, forget them so the destructor
+    // doesn't delete names of a new context
+    void Abandon();
+
+    // a line of its own, in the order added
+    int AddStage(const char *name);
+    void BeginStage(int stage);
+    void EndStage(int stage);
+
+    // shown as "<name> <value> <unit>" from now on
+    void SetCounter(const char *name, double value, const char *unit = "", int decimals = 0);
+
+    // the frame time graph is scaled to twice the budget
+    void SetBudgetMs(float ms) { mBudgetMs = ms; }
+
+    // over whatever the frame drew, before the swap
+    void Draw(int width, int height);
+    // once per frame, frameMs the time since the previous one
+    void EndFrame(float frameMs);
+
+    // smoothed cost of Draw(), negative until known
+    float GetCpuMs() const { return mSelf.mCpuMs; }
+    float GetGpuMs() const { return mSelf.mGpuMs; }
+    uint64_t GetStalls() const { return mStalls; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // frames a query result may take
+    static const int kQueryLatency = 4;
+    // buffer segments, one more than the frames the GPU usually lags behind
+    static const int kSegments = 3;
+    static const int kMaxInstances = 2048;
+
+    struct Stage {
+        const char *mName = nullptr;
+        Clock::time_point mBegin;
+        std::array<GLuint, kQueryLatency> mQueries = {};
+        std::array<bool, kQueryLatency> mPending = {};
+        bool mTiming = false;
+        // smoothed, negative until known
+        float mCpuMs = -1.0f;
+        float mGpuMs = -1.0f;
+    };
+
+    struct Counter {
+        const char *mName;
+        const char *mUnit;
+        double mValue;
+        int mDecimals;
+    };
+
+    // one quad, pixels from the top left
+    struct Instance {
+        GLshort mRect[4];
+        GLubyte mCell[2];
+        GLubyte mPad[2];
+        GLubyte mColor[4];
+    };
+
+    void Begin(Stage &stage);
+    void End(Stage &stage);
+    void Collect(Stage &stage, bool disjoint);
+
+    void AddQuad(int x, int y, int w, int h, int cell, uint32_t color);
+    // returns the x after the last character
+    int AddText(int x, int y, const char *text, uint32_t color);
+    int AddLine(int x, int y, uint32_t color, const char *format, ...);
+    void Layout(int width, int height);
+    // into the next segment, false when it could not be mapped
+    bool Upload();
+
+    bool mTimerQueries = false;
+    std::vector<Stage> mStages;
+    Stage mSelf;
+    std::vector<Counter> mCounters;
+
+    std::array<float, kHistory> mHistory = {};
+    int mHistoryCount = 0;
+    int mHistoryHead = 0;
+    float mFrameMs = -1.0f;
+    float mBudgetMs = 1000.0f / 60.0f;
+    uint64_t mFrame = 0;
+
+    GLuint mProgram = 0;
+    bool mLinked = false;
+    GLint mViewSizeLocation = -1;
+    float mViewWidth = 0.0f;
+    float mViewHeight = 0.0f;
+    GLuint mAtlas = 0;
+    GLuint mBuffer = 0;
+    // one per segment, so the attribute offsets never change
+    std::array<GLuint, kSegments> mVAOs = {};
+    std::array<GLsync, kSegments> mFences = {};
+    int mSegment = 0;
+    uint64_t mStalls = 0;
+
+    std::vector<Instance> mInstances;
+    int mScale = 1;
+};
+
+}
@@ -0,0 +1,127 @@
+#include "jpeg-decoder.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+
+#include <jpeglib.h>
+
+#include "log.h"
+#include "trace.h"
+
+namespace quink {
+
+namespace {
+
+struct ErrorManager {
+    jpeg_error_mgr mPub;
+    jmp_buf mJump;
+};
+
+/* libjpeg reports errors by longjmp, so the functions calling into it
+ * setjmp themselves and hold nothing with a destructor.
+ */
+struct Reader {
+    jpeg_decompress_struct mInfo;
+    ErrorManager mError;
+    FILE *mFile;
+    bool mCreated;
+};
+
+}
+
+static void OnError(j_common_ptr info) {
+    char msg[JMSG_LENGTH_MAX];
+    (*info->err->format_message)(info, msg);
+    ALOGE("jpeg: %s", msg);
+    longjmp(reinterpret_cast<ErrorManager *>(info->err)->mJump, 1);
+}
+
+static int Open(Reader &r, const char *path, int scale) {
+    r.mFile = fopen(path, "rb");
+    if (!r.mFile) {
+        ALOGE("open %s failed", path);
+        return -1;
+    }
+    r.mInfo.err = jpeg_std_error(&r.mError.mPub);
+    r.mError.mPub.error_exit = OnError;
+    if (setjmp(r.mError.mJump))
+        return -1;
+    jpeg_create_decompress(&r.mInfo);
+    r.mCreated = true;
+    jpeg_stdio_src(&r.mInfo, r.mFile);
+    jpeg_read_header(&r.mInfo, TRUE);
+
+    r.mInfo.out_color_space = JCS_RGB;
+    r.mInfo.scale_num = 1;
+    r.mInfo.scale_denom = scale;
+    if (scale > 1) {
+        // a preview, speed over the last bit of accuracy
+        r.mInfo.dct_method = JDCT_IFAST;
+        r.mInfo.do_fancy_upsampling = FALSE;
+    }
+    jpeg_calc_output_dimensions(&r.mInfo);
+    return 0;
+}
+
+static int Read(Reader &r, uint8_t *dst) {
+    if (setjmp(r.mError.mJump))
+        return -1;
+    jpeg_start_decompress(&r.mInfo);
+    const size_t stride = (size_t)r.mInfo.output_width * r.mInfo.output_components;
+    while (r.mInfo.output_scanline < r.mInfo.output_height) {
+        JSAMPROW row = dst + stride * r.mInfo.output_scanline;
+        jpeg_read_scanlines(&r.mInfo, &row, 1);
+    }
+    jpeg_finish_decompress(&r.mInfo);
+    return 0;
+}
+
+static void Close(Reader &r) {
+    if (r.mCreated)
+        jpeg_destroy_decompress(&r.mInfo);
+    if (r.mFile)
+        fclose(r.mFile);
+}
+
+bool JpegDecoder::IsJpeg(const std::string &file) {
+    FILE *fp = fopen(file.c_str(), "rb");
+    if (!fp)
+        return false;
+    uint8_t magic[3] = {};
+    size_t n = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+    return n == sizeof(magic) && magic[0] == 0xFF && magic[1] == 0xD8 && magic[2] == 0xFF;
+}
+
+int JpegDecoder::ReadSize(const std::string &file, int &width, int &height) {
+    Reader r = {};
+    int ret = Open(r, file.c_str(), 1);
+    if (!ret) {
+        width = r.mInfo.image_width;
+        height = r.mInfo.image_height;
+    }
+    Close(r);
+    return ret;
+}
+
+std::shared_ptr<Image<uint8_t>> JpegDecoder::Decode(const std::string &file, int scale) {
+    TRACE_SCOPE("JpegDecoder::Decode");
+    if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+        ALOGE("unsupported jpeg scale 1/%d", scale);
+        return nullptr;
+    }
+
+    Reader r = {};
+    std::shared_ptr<Image<uint8_t>> img;
+    if (!Open(r, file.c_str(), scale)) {
+        img = std::make_shared<Image<uint8_t>>(r.mInfo.output_width, r.mInfo.output_height);
+        if (Read(r, img->mData.get())) {
+            ALOGE("decode %s failed", file.c_str());
+            img.reset();
+        }
+    }
+    Close(r);
+    return img;
+}
+
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+
+#include "image.h"
+
+namespace quink {
+
+/* JPEG decoding through libjpeg-turbo with DCT domain scaling.
+ *
+ * At 1/2, 1/4 or 1/8 scale only the low frequency coefficients are
+ * transformed, so a preview costs a small fraction of a full decode: most of
+ * what is left is entropy decoding.
+ */
+class JpegDecoder {
+public:
+    // by the signature, not the file name
+    static bool IsJpeg(const std::string &file);
+    // size at full scale, from the header only
+    static int ReadSize(const std::string &file, int &width, int &height);
+    // RGB at 1/scale, scale is 1, 2, 4 or 8; null on failure
+    static std::shared_ptr<Image<uint8_t>> Decode(const std::string &file, int scale = 1);
+};
+
+}
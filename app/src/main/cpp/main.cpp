@@ -9,16 +9,42 @@
 #include <GLFW/glfw3.h>
 #include <GLFW/glfw3native.h>
 
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+
 #include <algorithm>
 #include <array>
+#include <future>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <vector>
 
+#include "buffer-pool.h"
+#include "etc2-encoder.h"
+#include "frame-capture.h"
+#include "frame-pacer.h"
+#include "gl-caps.h"
+#include "gl-hooks.h"
+#include "gl-state.h"
+#include "hud.h"
 #include "image_decoder.h"
 #include "image_merge.h"
+#include "jpeg-decoder.h"
 #include "tonemapper.h"
 #include "log.h"
 #include "perf-monitor.h"
 #include "opengl-helper.h"
 #include "render.h"
+#include "residency.h"
+#include "resolution-controller.h"
+#include "scaled-render.h"
+#include "startup-profiler.h"
+#include "texture-cache.h"
+#include "texture-pool.h"
+#include "trace.h"
 
 #define WINDOW_WIDTH    1280
 #define WINDOW_HEIGHT   720
@@ -59,13 +85,252 @@ static std::vector<Render::ImageCoord> GetCoord(int n, bool sideByside = true) {
     return coords;
 }
 
+// positional arguments go to files, --key=value to options
+static void ParseArgs(int argc, char *argv[], std::vector<std::string> &files,
+        std::map<std::string, std::string> &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0) {
+            files.push_back(arg);
+            continue;
+        }
+        auto pos = arg.find('=');
+        if (pos == std::string::npos)
+            options[arg.substr(2)] = "";
+        else
+            options[arg.substr(2, pos - 2)] = arg.substr(pos + 1);
+    }
+}
+
+// -1 with a message unless text is a number of type T in [min, max]
+template <typename T>
+static int ParseNumber(const char *name, const std::string &text, T min, T max, T &value) {
+    char *end = nullptr;
+    errno = 0;
+    const double number = strtod(text.c_str(), &end);
+    if (text.empty() || *end || errno || !(number >= min && number <= max) ||
+            (std::is_integral<T>::value && number != floor(number))) {
+        ALOGE("bad %s '%s', expect a%s number in [%g, %g]", name, text.c_str(),
+                std::is_integral<T>::value ? "n integer" : "", (double)min, (double)max);
+        return -1;
+    }
+    value = static_cast<T>(number);
+    return 0;
+}
+
+// leaves value alone when the option is not given
+template <typename T>
+static int GetOption(const std::map<std::string, std::string> &options, const char *name,
+        T min, T max, T &value) {
+    auto it = options.find(name);
+    return it == options.end() ? 0 :
+            ParseNumber(("--" + it->first).c_str(), it->second, min, max, value);
+}
+
+static std::shared_ptr<Image<uint8_t>> DecodeImage(const std::string &file) {
+    TRACE_SCOPE("LoadImage");
+    StartupProfiler::Phase phase("decode");
+    auto imgWrapper = ImageLoader::LoadImage(file);
+    if (imgWrapper.Empty()) {
+        ALOGE("cannot decode %s", file.c_str());
+        return nullptr;
+    }
+    return imgWrapper.GetImg<uint8_t>();
+}
+
+static std::shared_ptr<Image<float>> MergeImages(std::shared_ptr<Image<uint8_t>> low,
+        std::shared_ptr<Image<uint8_t>> high) {
+    TRACE_SCOPE("Merge");
+    StartupProfiler::Phase phase("merge");
+    return ImageMerge::Merge<float>(low, high);
+}
+
+// the second file is decoded on a worker while this thread does the first
+static int DecodeImages(const std::vector<std::string> &files,
+        std::array<std::shared_ptr<Image<uint8_t>>, 2> &imgs) {
+    auto second = std::async(std::launch::async, DecodeImage, files[1]);
+    imgs[0] = DecodeImage(files[0]);
+    imgs[1] = second.get();
+    return imgs[0] && imgs[1] ? 0 : -1;
+}
+
+struct ImageSources {
+    std::vector<std::string> mFiles;
+    // --texture-cache=<dir>: draw ETC2 encoded images, reused across runs
+    std::unique_ptr<TextureCache> mCache;
+    std::array<uint64_t, 2> mCacheKeys;
+};
+
+// shown until the full images are in
+struct Preview {
+    std::array<HostImage, 2> mHosts;    // empty when there is no preview
+    int mWidth = 0;                     // of the full images
+    int mHeight = 0;
+};
+
+// DCT scaled decode and merge, only JPEG sources can be previewed
+static Preview LoadPreview(const std::vector<std::string> &files, int scale) {
+    Preview preview;
+    if (!JpegDecoder::IsJpeg(files[0]) || !JpegDecoder::IsJpeg(files[1]) ||
+            JpegDecoder::ReadSize(files[0], preview.mWidth, preview.mHeight))
+        return preview;
+
+    StartupProfiler::Phase phase("preview");
+    auto second = std::async(std::launch::async, JpegDecoder::Decode, files[1], scale);
+    auto low = JpegDecoder::Decode(files[0], scale);
+    auto high = second.get();
+    if (!low || !high)
+        return preview;
+    preview.mHosts[0].mImage8 = low;
+    preview.mHosts[1].mImageFloat = ImageMerge::Merge<float>(low, high);
+    ALOGD("preview %dx%d at 1/%d", low->mWidth, low->mHeight, scale);
+    return preview;
+}
+
+/* Everything before upload, none of it needs the context: the texture
+ * cache lookup, decoding and merging, and on a cache miss the encoding.
+ * preview is set before the full decode starts, an empty one when
+ * previewScale is 0 or the cache has the images.
+ */
+static int LoadImages(ImageSources &sources, const std::string &cacheDir, int previewScale,
+        std::promise<Preview> &preview, std::array<HostImage, 2> &hosts) {
+    TRACE_THREAD_NAME("loader");
+    const auto &files = sources.mFiles;
+    std::array<std::shared_ptr<CompressedImage>, 2> compressed;
+    if (!cacheDir.empty()) {
+        StartupProfiler::Phase phase("texture cache");
+        sources.mCache.reset(new TextureCache(cacheDir));
+        uint64_t low = TextureCache::Hash(&Etc2Encoder::kVersion, sizeof(Etc2Encoder::kVersion));
+        uint64_t high = low;
+        if (!TextureCache::HashFile(files[0], low) && !TextureCache::HashFile(files[1], high)) {
+            // the 8-bit image comes from the first file, the merged one from both
+            sources.mCacheKeys[0] = low;
+            sources.mCacheKeys[1] = TextureCache::Hash(&high, sizeof(high), low);
+            for (size_t i = 0; i < compressed.size(); i++)
+                compressed[i] = sources.mCache->Load(sources.mCacheKeys[i]);
+        } else {
+            sources.mCache.reset();
+        }
+    }
+
+    const bool miss = !compressed[0] || !compressed[1];
+    preview.set_value(miss && previewScale > 1 ? LoadPreview(files, previewScale) : Preview());
+
+    std::shared_ptr<Image<uint8_t>> image8;
+    std::shared_ptr<Image<float>> imageFloat;
+    if (miss) {
+        std::array<std::shared_ptr<Image<uint8_t>>, 2> imgs;
+        if (DecodeImages(files, imgs))
+            return -1;
+        image8 = imgs[0];
+        imageFloat = MergeImages(imgs[0], imgs[1]);
+    }
+    if (sources.mCache && !compressed[0]) {
+        StartupProfiler::Phase phase("encode");
+        compressed[0] = Etc2Encoder::Encode(*image8);
+        sources.mCache->Store(sources.mCacheKeys[0], *compressed[0]);
+    }
+    if (sources.mCache && !compressed[1]) {
+        StartupProfiler::Phase phase("encode");
+        compressed[1] = Etc2Encoder::EncodeRGBM(*imageFloat);
+        sources.mCache->Store(sources.mCacheKeys[1], *compressed[1]);
+    }
+
+    hosts[0].mCompressed = compressed[0];
+    hosts[1].mCompressed = compressed[1];
+    if (!compressed[0])
+        hosts[0].mImage8 = image8;
+    if (!compressed[1])
+        hosts[1].mImageFloat = imageFloat;
+    return 0;
+}
+
+// reloads from the texture cache, or decodes the sources again
+static HostImage ReloadImage(const ImageSources &sources, size_t i) {
+    HostImage host;
+    if (sources.mCache) {
+        host.mCompressed = sources.mCache->Load(sources.mCacheKeys[i]);
+        if (host.mCompressed)
+            return host;
+    }
+    if (i == 0) {
+        host.mImage8 = DecodeImage(sources.mFiles[0]);
+        return host;
+    }
+    std::array<std::shared_ptr<Image<uint8_t>>, 2> imgs;
+    if (!DecodeImages(sources.mFiles, imgs))
+        host.mImageFloat = MergeImages(imgs[0], imgs[1]);
+    return host;
+}
+
+// --gl-error-check=off|sampled[:N]|frame|call
+static int SetErrorCheck(const std::string &value) {
+    if (value == "off") {
+        GLStats::SetErrorCheck(GLStats::ErrorCheck::Off);
+    } else if (value == "sampled" || value.compare(0, 8, "sampled:") == 0) {
+        int interval = 60;
+        if (value.size() > 7 &&
+                ParseNumber("--gl-error-check interval", value.substr(8), 1, INT_MAX, interval))
+            return -1;
+        GLStats::SetErrorCheck(GLStats::ErrorCheck::Sampled, interval);
+    } else if (value == "frame") {
+        GLStats::SetErrorCheck(GLStats::ErrorCheck::PerFrame);
+    } else if (value == "call") {
+        GLStats::SetErrorCheck(GLStats::ErrorCheck::PerCall);
+    } else {
+        ALOGE("unknown error check policy %s", value.c_str());
+        return -1;
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
-    (void)argc;
+    StartupProfiler::Instance().Start();
+    const auto launch = StartupProfiler::Clock::now();
+    std::vector<std::string> files;
+    std::map<std::string, std::string> options;
+    ParseArgs(argc, argv, files, options);
+    if (options.count("gl-error-check") && SetErrorCheck(options["gl-error-check"]))
+        return 1;
+    // --texture-budget=<MB>
+    int textureBudget = 0;
+    if (GetOption(options, "texture-budget", 1, 1 << 20, textureBudget))
+        return 1;
+    if (textureBudget)
+        TexturePool::Instance().SetBudget((size_t)textureBudget << 20);
+
+    if (files.size() != 2)
+        return 1;
+
+#if ENABLE_TRACE
+    Trace::SetEnabled(true);
+    TRACE_THREAD_NAME("main");
+#endif
+
+    // images load while the context is created and the shaders compile
+    ImageSources sources;
+    sources.mFiles = files;
+    std::array<HostImage, 2> hosts;
+    std::string cacheDir = options.count("texture-cache") ? options["texture-cache"] : "";
+    // --preview-scale=2|4|8 shows JPEG sources decoded at that fraction first
+    int previewScale = 0;
+    if (GetOption(options, "preview-scale", 0, 8, previewScale))
+        return 1;
+    if (previewScale & (previewScale - 1)) {
+        ALOGE("bad --preview-scale %d, expect 2, 4 or 8", previewScale);
+        return 1;
+    }
+    std::promise<Preview> previewPromise;
+    std::future<Preview> previewLoading = previewPromise.get_future();
+    std::future<int> loading = std::async(std::launch::async, LoadImages, std::ref(sources),
+            cacheDir, previewScale, std::ref(previewPromise), std::ref(hosts));
+
     glfwSetErrorCallback(
             [](int error, const char* description)
             { ALOGE("error: %d, %s\n", error, description); });
 
+    auto contextBegin = StartupProfiler::Clock::now();
     if (!glfwInit())
         return 1;
 
@@ -98,78 +363,189 @@ int main(int argc, char *argv[])
             });
     glfwSetWindowSizeCallback(window,
             [](GLFWwindow *, int w, int h) {
-                glViewport(0, 0, w, h);
+                GLState::Current().Viewport(0, 0, w, h);
             });
     glfwMakeContextCurrent(window);
-    glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+    StartupProfiler::Instance().Record("create context", contextBegin,
+            StartupProfiler::Clock::now());
+    // --capture=<file>[:<first>[:<count>]] records the GL commands of frames
+    // [first, first + count) for tonemap-replay; armed before any GL object
+    // exists, the setup of the range needs all of them
+    if (options.count("capture")) {
+        std::string path;
+        uint64_t first, count;
+        if (FrameCapture::ParseSpec(options["capture"], path, first, count) < 0)
+            ALOGE("bad capture %s", options["capture"].c_str());
+        else
+            FrameCapture::Instance().Arm(path, first, count);
+    }
+#ifndef NDEBUG
+    GLState::SetValidate(true);
+#endif
+    GLState::Current().Viewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
 
     OpenGL_Helper::PrintGLString("Version", GL_VERSION);
     OpenGL_Helper::PrintGLString("Vendor", GL_VENDOR);
     OpenGL_Helper::PrintGLString("Renderer", GL_RENDERER);
-    OpenGL_Helper::PrintGLExtension();
     OpenGL_Helper::SetupDebugCallback();
 
-    std::string texDataType = "float";
-#if 0
-    bool hasFloatExt = OpenGL_Helper::CheckGLExtension("GL_OES_texture_float");
-    if (!hasFloatExt)
-        texDataType = "uint16_t";
-#endif
-    ALOGD("texture data type %s", texDataType.c_str());
+    {
+        StartupProfiler::Phase phase("gl caps");
+        // --caps-cache=<dir> keeps the HDR format decision, defaults to the
+        // texture cache directory
+        std::string capsCache = options.count("caps-cache") ? options["caps-cache"] : cacheDir;
+        ALOGD("%zu GL extensions, parallel shader compile %s", GLCaps::Instance().ExtensionCount(),
+                OpenGL_Helper::EnableParallelCompile() ? "on" : "off");
+        GLCaps::Instance().SelectHdrFormat(capsCache);
+    }
 
-    if (argc != 3)
-        return 1;
+    bool sideByside = true;
+    const auto coords = GetCoord(2, sideByside);
+
+    // --target-frame-ms=<ms> scales the render resolution to hold the frame
+    // time, --render-scale=<scale> pins it
+    std::shared_ptr<ResolutionController> controller;
+    if (options.count("target-frame-ms") || options.count("render-scale")) {
+        ResolutionController::Config config;
+        float renderScale = 0.0f;
+        if (GetOption(options, "target-frame-ms", 1.0f, 1000.0f, config.mTargetMs) ||
+                GetOption(options, "render-scale", 0.1f, 1.0f, renderScale))
+            return 1;
+        controller = std::make_shared<ResolutionController>(config);
+        if (renderScale > 0.0f)
+            controller->Pin(renderScale);
+    }
 
-    std::string files[2] = {argv[1], argv[2]};
-    using ImageGroup = std::pair<std::shared_ptr<Image<uint8_t>>, std::shared_ptr<Image<float>>>;
-    ImageGroup imageGroup;
+    const char *names[] = { "Plain", "Hable" };
+    std::array<std::shared_ptr<Render>, 2> renders;
     {
-        std::array<std::shared_ptr<Image<uint8_t>>, 2> imgs;
-        for (size_t i = 0; i < imgs.size(); i++) {
-            auto imgWrapper = ImageLoader::LoadImage(files[i]);
-            if (imgWrapper.Empty()) {
-                ALOGE("cannot decode %s", files[i].c_str());
-                return 1;
-            }
-            imgs[i] = imgWrapper.GetImg<uint8_t>();
+        // only issues the compiles, the first Draw() waits for what is left
+        StartupProfiler::Phase phase("start shaders");
+        for (size_t i = 0; i < renders.size(); i++) {
+            Render *render = Render::Create(names[i]);
+            if (controller)
+                render = new ScaledRender(render, controller);
+            renders[i] = std::shared_ptr<Render>(render);
+            renders[i]->Init(coords[i]);
         }
-        auto imgNew = ImageMerge::Merge<float>(imgs[0], imgs[1]);
-        imageGroup.first = imgs[0];
-        imageGroup.second = imgNew;
     }
 
-    bool sideByside = true;
+    // --hud draws frame times, stage times and counters over the images
+    std::unique_ptr<Hud> hud;
+    std::array<int, 4> hudStages = {};
+    if (options.count("hud")) {
+        hud.reset(new Hud());
+        if (hud->Init()) {
+            hud.reset();
+        } else {
+            hudStages[0] = hud->AddStage("[1] upload");
+            hudStages[1] = hud->AddStage("[1] draw");
+            hudStages[2] = hud->AddStage("[2] upload");
+            hudStages[3] = hud->AddStage("[2] draw");
+        }
+    }
+
+    Preview preview;
+    {
+        StartupProfiler::Phase phase("wait images");
+        preview = previewLoading.get();
+        if (preview.mHosts[0].Empty() && loading.get())
+            return 1;
+    }
+    // the full images replace the preview once they are in
+    bool refining = !preview.mHosts[0].Empty();
+    int imageWidth = preview.mWidth;
+    int imageHeight = preview.mHeight;
+    if (!refining) {
+        imageWidth = hosts[0].mCompressed ? hosts[0].mCompressed->mWidth : hosts[0].mImage8->mWidth;
+        imageHeight = hosts[0].mCompressed ? hosts[0].mCompressed->mHeight : hosts[0].mImage8->mHeight;
+    }
 #ifndef __APPLE__
     if (sideByside)
-        glfwSetWindowSize(window, imageGroup.first->mWidth * 2, imageGroup.first->mHeight);
+        glfwSetWindowSize(window, imageWidth * 2, imageHeight);
     else
-        glfwSetWindowSize(window, imageGroup.first->mWidth, imageGroup.first->mHeight * 2);
+        glfwSetWindowSize(window, imageWidth, imageHeight * 2);
 #endif
-    const auto coords = GetCoord(2, sideByside);
 
-    std::array<std::shared_ptr<Render>, 2> renders;
-    renders[0] = std::shared_ptr<Render>(Render::Create("Plain"));
-    renders[1] = std::shared_ptr<Render>(Render::Create("Hable"));
-    renders[0]->Init(coords[0]);
-    renders[1]->Init(coords[1]);
+    // --residency=stream|keep|release, what happens to the host copies once
+    // the GPU has the pixels
+    Residency::Policy policy = Residency::Policy::Stream;
+    if (options.count("residency") && Residency::ParsePolicy(options["residency"], policy) < 0)
+        ALOGE("unknown residency policy %s", options["residency"].c_str());
+    Residency::Instance().SetPolicy(policy);
+    std::array<std::unique_ptr<ResidentImage>, 2> images;
+    for (size_t i = 0; i < images.size(); i++) {
+        images[i].reset(new ResidentImage(i == 0 ? "low" : "merged",
+                [&sources, i]() { return ReloadImage(sources, i); },
+                std::move(refining ? preview.mHosts[i] : hosts[i])));
+    }
+    preview = Preview();
 
     PerfMonitor perf[] = {
-        PerfMonitor(100, [](long long t) { ALOGD("[1] upload takes %f ms", t/1000.0); }),
-        PerfMonitor(100, [](long long t) { ALOGD("[1] draw takes %f ms", t/1000.0); }),
-        PerfMonitor(100, [](long long t) { ALOGD("[2] upload takes %f ms", t/1000.0); }),
-        PerfMonitor(100, [](long long t) { ALOGD("[2] draw takes %f ms", t/1000.0); }),
-        PerfMonitor(100, [](long long t) { ALOGD("fps %f", 1000000.0 / t); }),
+        { 100, [](long long t) { ALOGD("[1] upload takes %f ms", t/1000.0); } },
+        { 100, [](long long t) { ALOGD("[1] draw takes %f ms", t/1000.0); } },
+        { 100, [](long long t) { ALOGD("[2] upload takes %f ms", t/1000.0); } },
+        { 100, [](long long t) { ALOGD("[2] draw takes %f ms", t/1000.0); } },
+        { 100, [](long long t) { ALOGD("fps %f", 1000000.0 / t); } },
+        { 100, [](long long n) { ALOGD("[1] gl calls %lld", n); } },
+        { 100, [](long long n) { ALOGD("[1] upload %lld KB", n / 1024); } },
+        { 100, [](long long n) { ALOGD("[2] gl calls %lld", n); } },
+        { 100, [](long long n) { ALOGD("[2] upload %lld KB", n / 1024); } },
+        { 100, [](long long n) { ALOGD("frame gl calls %lld", n); } },
+        { 100, [](long long n) { ALOGD("frame draw calls %lld", n); } },
+        { 100, [](long long n) { ALOGD("texture memory %lld KB", n / 1024); } },
+        { 100, [](long long n) { ALOGD("render scale %lld%%", n); } },
+        { 100, [](long long n) { ALOGD("host image memory %lld KB", n / 1024); } },
+        { 100, [](long long t) { ALOGD("hud takes %f ms", t/1000.0); } },
+        { 100, [](long long t) { ALOGD("frame latency %f ms", t/1000.0); } },
     };
 
+    // --max-frames-in-flight=N caps the frames queued to the GPU, 0 leaves it
+    // to the driver; --pace-margin-ms=<ms> starts frames that much earlier
+    // than the GPU needs them
+    FramePacer::Config pacerConfig;
+    if (GetOption(options, "max-frames-in-flight", 0, 16, pacerConfig.mMaxInFlight) ||
+            GetOption(options, "pace-margin-ms", 0.0f, 100.0f, pacerConfig.mMarginMs))
+        return 1;
+    FramePacer pacer(pacerConfig);
+    pacer.SetLatencyCallback([&perf](uint64_t, float ms) {
+        perf[15].Update((long long)lroundf(ms * 1000.0f));
+    });
+    std::array<GLStats::Counters, 2> renderCounters;
+    std::chrono::high_resolution_clock::time_point frameStart;
+    std::chrono::high_resolution_clock::time_point hudFrameEnd;
+
     while (!glfwWindowShouldClose(window)) {
+        TRACE_SCOPE("frame");
+        const auto frameBegin = StartupProfiler::Clock::now();
+        // the events are taken once the GPU is about to need the frame
+        pacer.BeginFrame();
+        glfwPollEvents();
+        if (refining && loading.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            refining = false;
+            if (!loading.get()) {
+                for (size_t i = 0; i < images.size(); i++)
+                    images[i]->Replace(std::move(hosts[i]));
+                // the staging buffers of the preview sizes aren't needed again
+                BufferPool::Instance().Trim();
+                ALOGD("full resolution images after %.1f ms", std::chrono::duration<double,
+                        std::milli>(StartupProfiler::Clock::now() - launch).count());
+            }
+        }
         glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         {
             auto t1 = std::chrono::high_resolution_clock::now();
-            renders[0]->UploadTexture(imageGroup.first);
+            {
+                Hud::Scope scope(hud.get(), hudStages[0]);
+                images[0]->Upload(*renders[0]);
+            }
             auto t2 = std::chrono::high_resolution_clock::now();
-            renders[0]->Draw();
+            {
+                Hud::Scope scope(hud.get(), hudStages[1]);
+                renders[0]->Draw();
+            }
             auto t3 = std::chrono::high_resolution_clock::now();
             perf[0].Update(t2 - t1);
             perf[1].Update(t3 - t2);
@@ -177,19 +553,122 @@ int main(int argc, char *argv[])
 
         {
             auto t1 = std::chrono::high_resolution_clock::now();
-            renders[1]->UploadTexture(imageGroup.second);
+            {
+                Hud::Scope scope(hud.get(), hudStages[2]);
+                images[1]->Upload(*renders[1]);
+            }
             auto t2 = std::chrono::high_resolution_clock::now();
-            renders[1]->Draw();
+            {
+                Hud::Scope scope(hud.get(), hudStages[3]);
+                renders[1]->Draw();
+            }
             auto t3 = std::chrono::high_resolution_clock::now();
             perf[2].Update(t2 - t1);
             perf[3].Update(t3 - t2);
         }
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
-        perf[4].Update(std::chrono::high_resolution_clock::now());
+        if (hud) {
+            int width = 0;
+            int height = 0;
+            glfwGetFramebufferSize(window, &width, &height);
+            auto t1 = std::chrono::high_resolution_clock::now();
+            hud->Draw(width, height);
+            perf[14].Update(std::chrono::high_resolution_clock::now() - t1);
+        }
+
+        pacer.EndFrame();
+        {
+            TRACE_GL_SCOPE("SwapBuffers");
+            glfwSwapBuffers(window);
+        }
+        if (!StartupProfiler::Instance().IsDone()) {
+            StartupProfiler::Instance().Record("first frame", frameBegin,
+                    StartupProfiler::Clock::now());
+            StartupProfiler::Instance().FirstFrame();
+            // long and rarely needed, kept off the startup path
+            OpenGL_Helper::PrintGLExtension();
+        }
+        auto frameEnd = std::chrono::high_resolution_clock::now();
+        perf[4].Update(frameEnd);
+        if (controller) {
+            if (frameStart != std::chrono::high_resolution_clock::time_point())
+                controller->Update(frameEnd - frameStart);
+            frameStart = frameEnd;
+            perf[12].Update((long long)lroundf(controller->GetScale() * 100.0f));
+        }
+
+        for (size_t i = 0; i < renders.size(); i++) {
+            auto counters = renders[i]->GetGLCounters();
+            auto frame = counters - renderCounters[i];
+            renderCounters[i] = counters;
+            perf[5 + i * 2].Update((long long)frame.mCalls);
+            perf[6 + i * 2].Update((long long)frame.mUploadBytes);
+        }
+        auto frameCounters = GLStats::EndFrame();
+        FrameCapture::Instance().EndFrame();
+        perf[9].Update((long long)frameCounters.mCalls);
+        perf[10].Update((long long)frameCounters.mDraws);
+        perf[11].Update((long long)TexturePool::Instance().GetStats().mCurrentBytes);
+        perf[13].Update((long long)Residency::Instance().GetStats().mHostBytes);
+
+        if (hud) {
+            if (hudFrameEnd != std::chrono::high_resolution_clock::time_point()) {
+                hud->EndFrame(std::chrono::duration<float, std::milli>(
+                        frameEnd - hudFrameEnd).count());
+            }
+            hudFrameEnd = frameEnd;
+            hud->SetCounter("GL CALLS", frameCounters.mCalls);
+            hud->SetCounter("DRAWS", frameCounters.mDraws);
+            hud->SetCounter("TEXTURES",
+                    TexturePool::Instance().GetStats().mCurrentBytes / 1024, "KB");
+            hud->SetCounter("HOST IMAGES",
+                    Residency::Instance().GetStats().mHostBytes / 1024, "KB");
+            if (controller)
+                hud->SetCounter("RENDER SCALE", controller->GetScale() * 100.0f, "%");
+            hud->SetCounter("LATENCY", std::max(pacer.GetLatencyMs(), 0.0f), "MS", 2);
+            hud->SetCounter("IN FLIGHT", pacer.GetInFlight());
+        }
     }
 
+    pacer.Drain();
+    const auto &pacerStats = pacer.GetStats();
+    if (pacerStats.mFrames) {
+        ALOGD("frame latency mean %.2f ms, max %.2f ms, waited %llu times for %.1f ms, "
+                "slept %.1f ms", pacerStats.mLatencyMs / pacerStats.mFrames,
+                pacerStats.mMaxLatencyMs, (unsigned long long)pacerStats.mWaits,
+                pacerStats.mWaitMs, pacerStats.mSleepMs);
+    }
+
+    const auto poolStats = TexturePool::Instance().GetStats();
+    ALOGD("texture pool peak %zu KB, allocations %llu, reuses %llu, evictions %llu",
+            poolStats.mPeakBytes / 1024, (unsigned long long)poolStats.mAllocations,
+            (unsigned long long)poolStats.mReuses, (unsigned long long)poolStats.mEvictions);
+    const auto bufferStats = BufferPool::Instance().GetStats();
+    ALOGD("buffer pool peak %zu KB, allocations %llu, reuses %llu, failures %llu",
+            bufferStats.mPeakBytes / 1024, (unsigned long long)bufferStats.mAllocations,
+            (unsigned long long)bufferStats.mReuses, (unsigned long long)bufferStats.mFailures);
+    if (controller) {
+        const auto &scaleStats = controller->GetStats();
+        ALOGD("render scale %.2f, increases %llu, decreases %llu over %llu frames",
+                scaleStats.mScale, (unsigned long long)scaleStats.mIncreases,
+                (unsigned long long)scaleStats.mDecreases, (unsigned long long)scaleStats.mFrames);
+    }
+    Residency::Instance().Report();
+    FrameCapture::Instance().Stop();
+    if (hud) {
+        ALOGD("hud takes %.3f ms CPU, %.3f ms GPU, %llu buffer stalls", hud->GetCpuMs(),
+                hud->GetGpuMs(), (unsigned long long)hud->GetStalls());
+        hud.reset();
+    }
+    const auto &stateStats = GLState::Current().GetStats();
+    ALOGD("GL state changes issued %llu, avoided %llu",
+            (unsigned long long)stateStats.mIssued, (unsigned long long)stateStats.mAvoided);
+
+#if ENABLE_TRACE
+    Trace::SetEnabled(false);
+    Trace::Dump("tonemap-trace.json");
+#endif
+
     glfwDestroyWindow(window);
     glfwTerminate();
     return 0;
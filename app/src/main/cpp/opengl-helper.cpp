@@ -3,6 +3,7 @@
 #include "config.h"
 #if HAVE_EGL
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #endif
 
 #if HAVE_GLES
@@ -18,12 +19,24 @@
 
 #include <vector>
 
+#include "gl-caps.h"
+#include "gl-hooks.h"
 #include "log.h"
+#include "trace.h"
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA   0x31DD
+#endif
 
 #ifndef GL_DEBUG_OUTPUT
 #define GL_DEBUG_OUTPUT 0x92E0
 #endif
 
+// same value for the KHR and ARB parallel_shader_compile
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR          0x91B1
+#endif
+
 #ifndef GL_DEBUG_SOURCE_API
 #define GL_DEBUG_SOURCE_API               0x8246
 #endif
@@ -191,82 +204,175 @@ bool (OpenGL_Helper::CheckGLError)(const char *file, const char *func, int line)
 }
 
 bool OpenGL_Helper::CheckGLExtension(const char *api) {
-    const char *apis = (const char *)glGetString(GL_EXTENSIONS);
-    size_t apilen = strlen(api);
-    while (apis) {
-        while (*apis == ' ')
-            apis++;
-        if (!strncmp(apis, api, apilen) && memchr(" ", apis[apilen], 2))
-            return true;
-        apis = strchr(apis, ' ');
-    }
-    return false;
+    return quink::GLCaps::Instance().HasExtension(api);
 }
 
 unsigned int OpenGL_Helper::CreateShader(int shaderType, const char *src) {
+    TRACE_GL_SCOPE("CreateShader");
     GLuint shader = glCreateShader(shaderType);
     if (!shader) {
         CheckGLError();
         return 0;
     }
     glShaderSource(shader, 1, &src, nullptr);
+    // the status is checked with the program's, a query here would wait for
+    // the compiler
+    glCompileShader(shader);
+    return shader;
+}
 
+static void PrintShaderLog(GLuint shader) {
     GLint compiled = GL_FALSE;
-    glCompileShader(shader);
     glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
     if (compiled)
-        return shader;
-    // something going wrong
+        return;
+    GLint type = 0;
+    glGetShaderiv(shader, GL_SHADER_TYPE, &type);
     GLint infoLogLen = 0;
     glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLogLen);
     if (infoLogLen > 0) {
         std::vector<GLchar> infoLog(infoLogLen);
         glGetShaderInfoLog(shader, infoLogLen, nullptr, infoLog.data());
-        const char *type = shaderType == GL_VERTEX_SHADER ? "vertex" : "fragment";
-        ALOGE("could not compile %s shader:\n%s", type, infoLog.data());
+        const char *name = type == GL_VERTEX_SHADER ? "vertex" : "fragment";
+        ALOGE("could not compile %s shader:\n%s", name, infoLog.data());
     }
-    glDeleteShader(shader);
-    return 0;
 }
 
-unsigned int OpenGL_Helper::CreateProgram(const char *vtxSrc, const char *fragSrc) {
-    GLuint vtxShader = 0;
-    GLuint fragShader = 0;
-    GLuint program = 0;
-    GLint linked = GL_FALSE;
-
-    vtxShader = CreateShader(GL_VERTEX_SHADER, vtxSrc);
-    if (!vtxShader)
-        goto exit;
-    fragShader = CreateShader(GL_FRAGMENT_SHADER, fragSrc);
-    if (!fragShader)
-        goto exit;
+bool OpenGL_Helper::EnableParallelCompile(void) {
+    quink::GLCaps &caps = quink::GLCaps::Instance();
+    if (!caps.HasExtension("GL_KHR_parallel_shader_compile") &&
+            !caps.HasExtension("GL_ARB_parallel_shader_compile"))
+        return false;
+#if HAVE_EGL
+    // the default thread count is up to the driver, ask for all it has
+    typedef void (*MaxShaderCompilerThreads)(GLuint count);
+    auto maxThreads = (MaxShaderCompilerThreads)eglGetProcAddress(
+            "glMaxShaderCompilerThreadsKHR");
+    if (maxThreads)
+        maxThreads(0xFFFFFFFF);
+#endif
+    return true;
+}
 
-    program = glCreateProgram();
-    if (!program) {
+unsigned int OpenGL_Helper::StartProgram(const char *vtxSrc, const char *fragSrc) {
+    TRACE_GL_SCOPE("StartProgram");
+    GLuint program = 0;
+    GLuint vtxShader = CreateShader(GL_VERTEX_SHADER, vtxSrc);
+    GLuint fragShader = CreateShader(GL_FRAGMENT_SHADER, fragSrc);
+    if (vtxShader && fragShader)
+        program = glCreateProgram();
+    if (program) {
+        glAttachShader(program, vtxShader);
+        glAttachShader(program, fragShader);
+        glLinkProgram(program);
+    } else {
         CheckGLError();
-        goto exit;
     }
-    glAttachShader(program, vtxShader);
-    glAttachShader(program, fragShader);
+    // attached shaders live until the program is deleted, so their logs
+    // can still be read on failure
+    glDeleteShader(vtxShader);
+    glDeleteShader(fragShader);
+    return program;
+}
+
+int OpenGL_Helper::FinishProgram(unsigned int program, bool wait) {
+    if (!program)
+        return -1;
+    quink::GLCaps &caps = quink::GLCaps::Instance();
+    if (!wait) {
+        // without the extension any status query may block
+        if (!caps.HasExtension("GL_KHR_parallel_shader_compile") &&
+                !caps.HasExtension("GL_ARB_parallel_shader_compile"))
+            return 1;
+        GLint completed = GL_FALSE;
+        glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &completed);
+        if (!completed)
+            return 1;
+    }
 
-    glLinkProgram(program);
+    TRACE_GL_SCOPE("FinishProgram");
+    GLint linked = GL_FALSE;
     glGetProgramiv(program, GL_LINK_STATUS, &linked);
-    if (!linked) {
-        ALOGE("could not link program");
-        GLint infoLogLen = 0;
-        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLogLen);
-        if (infoLogLen) {
-            std::vector<GLchar> infoLog(infoLogLen);
-            glGetProgramInfoLog(program, infoLogLen, nullptr, infoLog.data());
-            ALOGE("%s", infoLog.data());
-        }
-        glDeleteProgram(program);
-        program = 0;
+    if (linked)
+        return 0;
+
+    GLuint shaders[2] = {};
+    GLsizei count = 0;
+    glGetAttachedShaders(program, 2, &count, shaders);
+    for (GLsizei i = 0; i < count; i++)
+        PrintShaderLog(shaders[i]);
+    ALOGE("could not link program");
+    GLint infoLogLen = 0;
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLogLen);
+    if (infoLogLen) {
+        std::vector<GLchar> infoLog(infoLogLen);
+        glGetProgramInfoLog(program, infoLogLen, nullptr, infoLog.data());
+        ALOGE("%s", infoLog.data());
     }
+    glDeleteProgram(program);
+    return -1;
+}
 
-exit:
-    glDeleteShader(vtxShader);
-    glDeleteShader(fragShader);
+unsigned int OpenGL_Helper::CreateProgram(const char *vtxSrc, const char *fragSrc) {
+    TRACE_GL_SCOPE("CreateProgram");
+    GLuint program = StartProgram(vtxSrc, fragSrc);
+    if (FinishProgram(program, true))
+        return 0;
     return program;
 }
+
+#if HAVE_EGL
+int OpenGL_Helper::CreatePbufferContext(int width, int height) {
+    EGLDisplay display = EGL_NO_DISPLAY;
+    auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+            eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if (getPlatformDisplay)
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (!eglInitialize(display, nullptr, nullptr)) {
+            ALOGE("eglInitialize failed");
+            return -1;
+        }
+    }
+
+#if HAVE_GLES
+    eglBindAPI(EGL_OPENGL_ES_API);
+    const EGLint renderable = EGL_OPENGL_ES3_BIT_KHR;
+    const EGLint contextAttribs[] = { EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE };
+#else
+    eglBindAPI(EGL_OPENGL_API);
+    const EGLint renderable = EGL_OPENGL_BIT;
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+        EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+        EGL_NONE
+    };
+#endif
+    const EGLint configAttribs[] = {
+        EGL_RENDERABLE_TYPE, renderable,
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint n = 0;
+    if (!eglChooseConfig(display, configAttribs, &config, 1, &n) || n == 0) {
+        ALOGE("no pbuffer config");
+        return -1;
+    }
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+    const EGLint surfaceAttribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+    EGLSurface surface = eglCreatePbufferSurface(display, config, surfaceAttribs);
+    if (context == EGL_NO_CONTEXT || surface == EGL_NO_SURFACE ||
+            !eglMakeCurrent(display, surface, surface, context)) {
+        ALOGE("create pbuffer context failed, 0x%x", eglGetError());
+        return -1;
+    }
+    return 0;
+}
+#endif
@@ -1,6 +1,9 @@
 #ifndef TONEMAP_OPENGL_HELPER_H
 #define TONEMAP_OPENGL_HELPER_H
 
+#include "config.h"
+#include "gl-stats.h"
+
 class OpenGL_Helper {
 public:
     static bool CheckGLError(const char *file, const char *fun, int line);
@@ -9,9 +12,31 @@ public:
     static void PrintGLExtension(void);
     static bool SetupDebugCallback(void);
 
+    // compile is issued, the status is checked along with the program's
     static unsigned int CreateShader(int shaderType, const char *src);
+    // compiles and links, blocking until done
     static unsigned int CreateProgram(const char *vtxSrc, const char *fragSrc);
+
+    // let the driver compile on its own threads, false when it can't
+    static bool EnableParallelCompile(void);
+    // issues compile and link without waiting, 0 on immediate failure
+    static unsigned int StartProgram(const char *vtxSrc, const char *fragSrc);
+    /* 0 once linked, -1 on failure with the program deleted. Without wait
+     * it returns 1 while the driver is still busy, which without
+     * KHR_parallel_shader_compile is always: only wait can tell then.
+     */
+    static int FinishProgram(unsigned int program, bool wait);
+
+#if HAVE_EGL
+    /* Makes a pbuffer context current, on the surfaceless platform when
+     * there is one so no display server is needed. For the tools and the
+     * tests, 0 on success.
+     */
+    static int CreatePbufferContext(int width, int height);
+#endif
 };
-#define CheckGLError()  OpenGL_Helper::CheckGLError(__FILE__, __func__, __LINE__)
+// only queries glGetError when the error check policy is per call
+#define CheckGLError()  (quink::GLStats::CheckPerCall() && \
+        OpenGL_Helper::CheckGLError(__FILE__, __func__, __LINE__))
 
 #endif
@@ -1,46 +1,326 @@
 #include "perf-monitor.h"
 
 #include <algorithm>
-#include <numeric>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
 
 namespace quink {
 
+// written by one thread only, read by the aggregator under the sequence
+struct PerfMonitor::Slot {
+    // keep slots of different threads off each other's cache lines
+    char mPadding[64];
+
+    std::atomic<uint32_t> mSequence{0};
+    std::atomic<uint64_t> mCount{0};
+    std::atomic<int64_t> mSum{0};
+    std::atomic<int64_t> mMin{std::numeric_limits<int64_t>::max()};
+    std::atomic<int64_t> mMax{std::numeric_limits<int64_t>::min()};
+
+    // writer only
+    std::thread::id mOwner;
+    std::chrono::high_resolution_clock::time_point mLastTime;
+
+    // aggregator only
+    int mThread = 0;
+    uint64_t mSeenCount = 0;
+    int64_t mSeenSum = 0;
+    uint64_t mWindowCount = 0;
+    int64_t mWindowSum = 0;
+
+    Slot *mNext = nullptr;
+    char mTailPadding[64];
+
+    struct Totals {
+        uint64_t mCount;
+        int64_t mSum;
+        int64_t mMin;
+        int64_t mMax;
+    };
+
+    Totals Read() const {
+        Totals totals;
+        for (;;) {
+            uint32_t before = mSequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            totals.mCount = mCount.load(std::memory_order_relaxed);
+            totals.mSum = mSum.load(std::memory_order_relaxed);
+            totals.mMin = mMin.load(std::memory_order_relaxed);
+            totals.mMax = mMax.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (mSequence.load(std::memory_order_relaxed) == before)
+                return totals;
+        }
+    }
+};
+
+/* Owns the thread which runs the callbacks. Monitors register on
+ * construction; the lock only guards the list and the aggregator side of
+ * the monitors, the recording threads never take it.
+ */
+class PerfAggregator {
+public:
+    static PerfAggregator &Instance() {
+        static PerfAggregator aggregator;
+        return aggregator;
+    }
+
+    // returns the index of the monitor, the smallest one free
+    int Register(PerfMonitor *monitor) {
+        std::lock_guard<std::mutex> lock(mLock);
+        mMonitors.push_back(monitor);
+        if (!mThread.joinable())
+            mThread = std::thread(&PerfAggregator::Loop, this);
+        auto free = std::min_element(mFreeIndexes.begin(), mFreeIndexes.end());
+        if (free == mFreeIndexes.end())
+            return mNextIndex++;
+        int index = *free;
+        mFreeIndexes.erase(free);
+        return index;
+    }
+
+    void Unregister(PerfMonitor *monitor) {
+        std::lock_guard<std::mutex> lock(mLock);
+        mMonitors.erase(std::remove(mMonitors.begin(), mMonitors.end(), monitor), mMonitors.end());
+        mFreeIndexes.push_back(monitor->mIndex);
+    }
+
+    std::mutex &Lock() { return mLock; }
+
+private:
+    static constexpr std::chrono::milliseconds kInterval{10};
+
+    PerfAggregator() = default;
+
+    ~PerfAggregator() {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mStop = true;
+        }
+        mCondition.notify_one();
+        if (mThread.joinable())
+            mThread.join();
+    }
+
+    void Loop() {
+        std::unique_lock<std::mutex> lock(mLock);
+        while (!mStop) {
+            mCondition.wait_for(lock, kInterval);
+            for (auto monitor : mMonitors)
+                monitor->Collect();
+        }
+    }
+
+    std::mutex mLock;
+    std::condition_variable mCondition;
+    std::vector<PerfMonitor *> mMonitors;
+    std::vector<int> mFreeIndexes;
+    int mNextIndex = 0;
+    std::thread mThread;
+    bool mStop = false;
+};
+
+constexpr std::chrono::milliseconds PerfAggregator::kInterval;
+
+static std::atomic<uint64_t> sNextId(1);
+
 PerfMonitor::PerfMonitor(int averageOver,
         std::function<void(long long)> outputResult) :
-    mData(averageOver),
+    mId(sNextId.fetch_add(1, std::memory_order_relaxed)),
+    mAverageOver(averageOver > 0 ? averageOver : 1),
     mCallback(outputResult),
-    mIndex(0)
+    mDuration(false),
+    mSlots(nullptr),
+    mThreads(0)
 {
+    mIndex = PerfAggregator::Instance().Register(this);
 }
 
-void PerfMonitor::Update(const std::chrono::high_resolution_clock::duration &d)
+PerfMonitor::~PerfMonitor()
+{
+    PerfAggregator::Instance().Unregister(this);
+    // threads may still have this monitor in their tables, but ids are never
+    // reused so the stale entries never match
+    Slot *slot = mSlots.load(std::memory_order_acquire);
+    while (slot) {
+        Slot *next = slot->mNext;
+        delete slot;
+        slot = next;
+    }
+}
+
+void PerfMonitor::SetThreadCallback(std::function<void(int thread, long long)> callback)
+{
+    std::lock_guard<std::mutex> lock(PerfAggregator::Instance().Lock());
+    mThreadCallback = callback;
+}
+
+PerfMonitor::Slot *PerfMonitor::GetSlot()
 {
-    mData[mIndex++] = d;
-    if (mIndex == mData.size()) {
-        mIndex = 0;
-        auto dura = std::accumulate(mData.begin(), mData.end(), std::chrono::high_resolution_clock::duration()) / mData.size();
-        long long result = std::chrono::duration_cast<std::chrono::microseconds>(dura).count();
-        mCallback(result);
+    struct Entry {
+        uint64_t mId;
+        Slot *mSlot;
+    };
+    // one entry per monitor index, so any number of monitors per thread hit
+    static thread_local std::vector<Entry> tSlots;
+
+    if ((size_t)mIndex < tSlots.size() && tSlots[mIndex].mId == mId)
+        return tSlots[mIndex].mSlot;
+
+    // first use on this thread, or of a monitor which took over the index
+    const auto self = std::this_thread::get_id();
+    Slot *slot = mSlots.load(std::memory_order_acquire);
+    while (slot && slot->mOwner != self)
+        slot = slot->mNext;
+    if (!slot) {
+        slot = new Slot();
+        slot->mOwner = self;
+        slot->mThread = mThreads.fetch_add(1, std::memory_order_relaxed);
+        slot->mNext = mSlots.load(std::memory_order_relaxed);
+        while (!mSlots.compare_exchange_weak(slot->mNext, slot,
+                    std::memory_order_release, std::memory_order_relaxed))
+            ;
     }
+    if ((size_t)mIndex >= tSlots.size())
+        tSlots.resize(mIndex + 1, Entry{0, nullptr});
+    tSlots[mIndex] = { mId, slot };
+    return slot;
+}
+
+void PerfMonitor::Record(Slot *slot, int64_t value)
+{
+    // single writer, so plain loads and stores bracketed by the sequence
+    const uint32_t sequence = slot->mSequence.load(std::memory_order_relaxed);
+    slot->mSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->mCount.store(slot->mCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    slot->mSum.store(slot->mSum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    if (value < slot->mMin.load(std::memory_order_relaxed))
+        slot->mMin.store(value, std::memory_order_relaxed);
+    if (value > slot->mMax.load(std::memory_order_relaxed))
+        slot->mMax.store(value, std::memory_order_relaxed);
+    slot->mSequence.store(sequence + 2, std::memory_order_release);
+}
+
+void PerfMonitor::Update(const std::chrono::high_resolution_clock::duration &d)
+{
+    if (!mDuration.load(std::memory_order_relaxed))
+        mDuration.store(true, std::memory_order_relaxed);
+    Record(GetSlot(), std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
 }
 
 void PerfMonitor::Update(const std::chrono::high_resolution_clock::time_point &t)
 {
-    if (mLastTime == std::chrono::high_resolution_clock::time_point()) {
-        mLastTime = t;
+    Slot *slot = GetSlot();
+    if (slot->mLastTime == std::chrono::high_resolution_clock::time_point()) {
+        slot->mLastTime = t;
         return;
     }
-    auto d = t - mLastTime;
-    mLastTime = t;
-    Update(d);
+    auto d = t - slot->mLastTime;
+    slot->mLastTime = t;
+    if (!mDuration.load(std::memory_order_relaxed))
+        mDuration.store(true, std::memory_order_relaxed);
+    Record(slot, std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+}
+
+void PerfMonitor::Update(long long value)
+{
+    Record(GetSlot(), value);
+}
+
+long long PerfMonitor::ToUnit(int64_t value) const
+{
+    return mDuration.load(std::memory_order_relaxed) ? value / 1000 : value;
+}
+
+void PerfMonitor::Collect()
+{
+    for (Slot *slot = mSlots.load(std::memory_order_acquire); slot; slot = slot->mNext) {
+        const auto totals = slot->Read();
+        const uint64_t count = totals.mCount - slot->mSeenCount;
+        const int64_t sum = totals.mSum - slot->mSeenSum;
+        slot->mSeenCount = totals.mCount;
+        slot->mSeenSum = totals.mSum;
+        if (!count)
+            continue;
+
+        slot->mWindowCount += count;
+        slot->mWindowSum += sum;
+        if (slot->mWindowCount >= mAverageOver) {
+            if (mThreadCallback)
+                mThreadCallback(slot->mThread, ToUnit(slot->mWindowSum / (int64_t)slot->mWindowCount));
+            slot->mWindowCount = 0;
+            slot->mWindowSum = 0;
+        }
+
+        mWindowCount += count;
+        mWindowSum += sum;
+    }
+
+    if (mWindowCount >= mAverageOver) {
+        if (mCallback)
+            mCallback(ToUnit(mWindowSum / (int64_t)mWindowCount));
+        mWindowCount = 0;
+        mWindowSum = 0;
+    }
+}
+
+void PerfMonitor::Flush()
+{
+    std::lock_guard<std::mutex> lock(PerfAggregator::Instance().Lock());
+    Collect();
+}
+
+std::vector<PerfMonitor::View> PerfMonitor::GetViews()
+{
+    std::vector<View> views;
+    View combined;
+    int64_t combinedSum = 0;
+    int64_t combinedMin = std::numeric_limits<int64_t>::max();
+    int64_t combinedMax = std::numeric_limits<int64_t>::min();
+    for (Slot *slot = mSlots.load(std::memory_order_acquire); slot; slot = slot->mNext) {
+        const auto totals = slot->Read();
+        if (!totals.mCount)
+            continue;
+        View view;
+        view.mThread = slot->mThread;
+        view.mCount = totals.mCount;
+        view.mMean = ToUnit(totals.mSum / (int64_t)totals.mCount);
+        view.mMin = ToUnit(totals.mMin);
+        view.mMax = ToUnit(totals.mMax);
+        views.push_back(view);
+
+        combined.mCount += totals.mCount;
+        combinedSum += totals.mSum;
+        combinedMin = std::min(combinedMin, totals.mMin);
+        combinedMax = std::max(combinedMax, totals.mMax);
+    }
+    std::sort(views.begin(), views.end(),
+            [](const View &a, const View &b) { return a.mThread < b.mThread; });
+    if (combined.mCount) {
+        combined.mMean = ToUnit(combinedSum / (int64_t)combined.mCount);
+        combined.mMin = ToUnit(combinedMin);
+        combined.mMax = ToUnit(combinedMax);
+    }
+    views.push_back(combined);
+    return views;
 }
 
 }
 
 #ifdef TEST_PERF
+/* g++ -std=c++11 -O2 -DTEST_PERF -I. perf-monitor.cpp -lpthread
+ */
 #include <stdio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <memory>
+
 int main()
 {
     quink::PerfMonitor perfA(100, [](long long dura) { printf("perfA %lld\n", dura); });
@@ -53,8 +333,70 @@ int main()
         perfA.Update(b - a);
         perfB.Update(b);
     }
+    perfA.Flush();
+    perfB.Flush();
+
+    // stress: every thread hammers the same monitors, more of them than the
+    // tonemap loop updates per frame. The totals must add up and recording
+    // has to stay cheap while the aggregator runs
+    const int kThreads = 8;
+    const int kTimings = 20;
+    const long long kUpdates = 200000;
+    // per update, optimized build
+    const double kMaxNs = 50.0;
+    std::atomic<long long> calls(0);
+    quink::PerfMonitor counter(100000, [&calls](long long) { calls++; });
+    std::vector<std::unique_ptr<quink::PerfMonitor>> timings;
+    for (int i = 0; i < kTimings; i++)
+        timings.emplace_back(new quink::PerfMonitor(100000, [](long long) { }));
+    std::atomic<int> threadCalls(0);
+    counter.SetThreadCallback([&threadCalls](int, long long) { threadCalls++; });
+    std::vector<std::thread> threads;
+    std::vector<double> nsPerUpdate(kThreads);
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([&, t]() {
+            // CPU time of the thread, the threads may outnumber the cores
+            struct timespec start, end;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+            for (long long i = 0; i < kUpdates; i++) {
+                // every pair of samples adds up to kUpdates
+                counter.Update(i & 1 ? kUpdates - (i - 1) : i);
+                for (auto &timing : timings)
+                    timing->Update(std::chrono::nanoseconds(i & 1023));
+            }
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+            nsPerUpdate[t] = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) /
+                (kUpdates * (1 + kTimings));
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    counter.Flush();
 
-    return 0;
+    int failures = 0;
+    auto views = counter.GetViews();
+    const auto &combined = views.back();
+    if ((int)views.size() != kThreads + 1 || combined.mCount != (uint64_t)(kThreads * kUpdates)) {
+        printf("FAIL: %zu views, %llu samples\n", views.size(), (unsigned long long)combined.mCount);
+        failures++;
+    }
+    if (combined.mMean != kUpdates / 2 || combined.mMin != 0 || combined.mMax != kUpdates) {
+        printf("FAIL: mean %lld min %lld max %lld\n", combined.mMean, combined.mMin, combined.mMax);
+        failures++;
+    }
+    if (calls.load() == 0 || threadCalls.load() < kThreads) {
+        printf("FAIL: callbacks did not run\n");
+        failures++;
+    }
+    for (int t = 0; t < kThreads; t++) {
+        printf("thread %d: %.1f ns per update\n", t, nsPerUpdate[t]);
+        if (nsPerUpdate[t] > kMaxNs) {
+            printf("FAIL: over %.0f ns per update\n", kMaxNs);
+            failures++;
+        }
+    }
+    printf("%d combined callbacks, %s\n", (int)calls.load(), failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
 }
 
 #endif
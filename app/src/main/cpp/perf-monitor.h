@@ -1,23 +1,80 @@
 #pragma once
 
+#include <stdint.h>
+
+#include <atomic>
 #include <chrono>
 #include <functional>
+#include <thread>
 #include <vector>
 
 namespace quink {
 
+/* Averages of timings or counters, recorded from any number of threads.
+ *
+ * Every thread calling Update() gets its own slot with a single writer, so
+ * recording is wait-free: a thread local table indexed by the monitor finds
+ * the slot, then a few relaxed stores under a per-slot sequence counter. A background aggregator
+ * collects the slots every few milliseconds and invokes the callbacks on its
+ * own thread: the combined callback once at least averageOver samples came
+ * in from all threads together, the per-thread callback once a thread has
+ * recorded averageOver samples by itself. Durations are reported in
+ * microseconds, plain counters in their own unit.
+ *
+ * Callbacks must not create or destroy monitors.
+ */
 class PerfMonitor {
 public:
+    struct View {
+        int mThread = -1;       // order of the first Update(), -1 for combined
+        uint64_t mCount = 0;
+        long long mMean = 0;
+        long long mMin = 0;
+        long long mMax = 0;
+    };
+
     PerfMonitor(int averageOver, std::function<void(long long)> callback);
+    ~PerfMonitor();
+
+    PerfMonitor(const PerfMonitor &) = delete;
+    PerfMonitor &operator=(const PerfMonitor &) = delete;
 
     void Update(const std::chrono::high_resolution_clock::duration &d);
+    // interval since the previous time point recorded by the same thread
     void Update(const std::chrono::high_resolution_clock::time_point &t);
+    // plain counter sample, the callback gets the average in the same unit
+    void Update(long long value);
+
+    void SetThreadCallback(std::function<void(int thread, long long)> callback);
+    // collect now and run due callbacks on the calling thread
+    void Flush();
+    // totals since construction, one per thread and the combined one last
+    std::vector<View> GetViews();
 
 private:
-    std::vector<std::chrono::high_resolution_clock::duration> mData;
+    struct Slot;
+
+    Slot *GetSlot();
+    void Record(Slot *slot, int64_t value);
+    // called with the aggregator lock held
+    void Collect();
+    long long ToUnit(int64_t value) const;
+
+    friend class PerfAggregator;
+
+    const uint64_t mId;
+    // into the thread local slot tables, reused once the monitor is gone
+    int mIndex;
+    const uint64_t mAverageOver;
     std::function<void(long long)> mCallback;
-    std::chrono::high_resolution_clock::time_point mLastTime;
-    std::size_t mIndex;
+    std::function<void(int, long long)> mThreadCallback;
+    std::atomic<bool> mDuration;
+    std::atomic<Slot *> mSlots;
+    std::atomic<int> mThreads;
+
+    // owned by the aggregator
+    uint64_t mWindowCount = 0;
+    int64_t mWindowSum = 0;
 };
 
 }
@@ -0,0 +1,468 @@
+#include "pixel-convert.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAVE_NEON_CONVERT 1
+#if defined(__aarch64__)
+// float16 conversion is part of ARMv8, optional before
+#define HAVE_NEON_HALF_CONVERT 1
+#endif
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+// compiled for SSSE3 and F16C regardless of -m flags and picked at run time
+#define HAVE_SSSE3_CONVERT 1
+#define HAVE_F16C_CONVERT 1
+#endif
+
+namespace quink {
+
+// largest finite half float
+static const float kHalfMax = 65504.0f;
+
+/* Unsigned float with a 5-bit exponent (bias 15) and mantissaBits of
+ * mantissa, rounded to nearest even: half floats without the sign, and the
+ * 11 and 10 bit floats of R11F_G11F_B10F. x is the bit pattern of a
+ * non-negative float.
+ */
+static uint32_t ToSmallFloat(uint32_t x, int mantissaBits) {
+    const uint32_t maxCode = (30u << mantissaBits) | ((1u << mantissaBits) - 1);
+    if (x >= 0x7f800000)    // inf, nan
+        return x == 0x7f800000 ? maxCode : 0;
+    const int shift = 23 - mantissaBits;
+    if (x >= 0x38800000) {  // normal, 2^-14 and up
+        x += (1u << (shift - 1)) - 1 + ((x >> shift) & 1);
+        // rebias the exponent from 127 to 15
+        return std::min((x - 0x38000000) >> shift, maxCode);
+    }
+    const int exponent = x >> 23;
+    const int subShift = 136 - mantissaBits - exponent;
+    if (subShift > 24)
+        return 0;
+    const uint32_t mantissa = (x & 0x7fffff) | 0x800000;
+    uint32_t code = mantissa >> subShift;
+    const uint32_t rest = mantissa & ((1u << subShift) - 1);
+    const uint32_t half = 1u << (subShift - 1);
+    if (rest > half || (rest == half && (code & 1)))
+        code++;
+    return code;
+}
+
+static inline uint32_t FloatBits(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    return x;
+}
+
+static inline uint16_t ToHalf(float f) {
+    const uint32_t x = FloatBits(f);
+    return (uint16_t)(((x >> 16) & 0x8000) | ToSmallFloat(x & 0x7fffffff, 10));
+}
+
+// negative and nan as 0
+static inline uint32_t ToUnsignedSmallFloat(float f, int mantissaBits) {
+    return f > 0.0f ? ToSmallFloat(FloatBits(f), mantissaBits) : 0;
+}
+
+#if HAVE_F16C_CONVERT
+__attribute__((target("f16c")))
+static size_t FloatToHalfF16C(const float *src, uint16_t *dst, size_t count) {
+    const __m128 high = _mm_set1_ps(kHalfMax);
+    const __m128 low = _mm_set1_ps(-kHalfMax);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128 a = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(src + i), high), low);
+        __m128 b = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(src + i + 4), high), low);
+        __m128i h = _mm_unpacklo_epi64(_mm_cvtps_ph(a, _MM_FROUND_TO_NEAREST_INT),
+                _mm_cvtps_ph(b, _MM_FROUND_TO_NEAREST_INT));
+        _mm_storeu_si128((__m128i *)(dst + i), h);
+    }
+    return i;
+}
+
+__attribute__((target("f16c")))
+static size_t RGBFloatToRGBAHalfF16C(const float *src, uint16_t *dst, size_t pixels) {
+    const __m128 high = _mm_set1_ps(kHalfMax);
+    const __m128 low = _mm_set1_ps(-kHalfMax);
+    const __m128 one = _mm_set1_ps(1.0f);
+    size_t i = 0;
+    // every load reads one float of the next pixel, leave the last one out
+    for (; i + 1 < pixels; i++) {
+        __m128 v = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(src), high), low);
+        v = _mm_blend_ps(v, one, 0x8);
+        _mm_storel_epi64((__m128i *)dst, _mm_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+        src += 3;
+        dst += 4;
+    }
+    return i;
+}
+#endif
+
+#if HAVE_SSSE3_CONVERT
+__attribute__((target("ssse3")))
+static size_t RGBToRGBASSSE3(const uint8_t *src, uint8_t *dst, size_t pixels, uint8_t alpha) {
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alphaMask = _mm_set1_epi32((int)((uint32_t)alpha << 24));
+    size_t i = 0;
+    // every load reads 16 bytes for 4 pixels, so the last one reads 4 bytes
+    // into pixel 17 and 18 pixels have to be left
+    for (; i + 18 <= pixels; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)src);
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + 12));
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + 24));
+        __m128i d = _mm_loadu_si128((const __m128i *)(src + 36));
+        _mm_storeu_si128((__m128i *)dst, _mm_or_si128(_mm_shuffle_epi8(a, shuffle), alphaMask));
+        _mm_storeu_si128((__m128i *)(dst + 16), _mm_or_si128(_mm_shuffle_epi8(b, shuffle), alphaMask));
+        _mm_storeu_si128((__m128i *)(dst + 32), _mm_or_si128(_mm_shuffle_epi8(c, shuffle), alphaMask));
+        _mm_storeu_si128((__m128i *)(dst + 48), _mm_or_si128(_mm_shuffle_epi8(d, shuffle), alphaMask));
+        src += 48;
+        dst += 64;
+    }
+    return i;
+}
+#endif
+
+void PixelConvert::RGBToRGBAScalar(const uint8_t *src, uint8_t *dst, size_t pixels, uint8_t alpha) {
+    for (size_t i = 0; i < pixels; i++) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst[3] = alpha;
+        src += 3;
+        dst += 4;
+    }
+}
+
+void PixelConvert::RGBToRGBA(const uint8_t *src, uint8_t *dst, size_t pixels, uint8_t alpha) {
+    size_t i = 0;
+#if HAVE_NEON_CONVERT
+    uint8x16x4_t rgba;
+    rgba.val[3] = vdupq_n_u8(alpha);
+    for (; i + 16 <= pixels; i += 16) {
+        uint8x16x3_t rgb = vld3q_u8(src);
+        rgba.val[0] = rgb.val[0];
+        rgba.val[1] = rgb.val[1];
+        rgba.val[2] = rgb.val[2];
+        vst4q_u8(dst, rgba);
+        src += 48;
+        dst += 64;
+    }
+#elif HAVE_SSSE3_CONVERT
+    static const bool hasSSSE3 = __builtin_cpu_supports("ssse3");
+    if (hasSSSE3) {
+        i = RGBToRGBASSSE3(src, dst, pixels, alpha);
+        src += i * 3;
+        dst += i * 4;
+    }
+#endif
+    RGBToRGBAScalar(src, dst, pixels - i, alpha);
+}
+
+void PixelConvert::FloatToHalfScalar(const float *src, uint16_t *dst, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        dst[i] = ToHalf(src[i]);
+}
+
+void PixelConvert::FloatToHalf(const float *src, uint16_t *dst, size_t count) {
+    size_t i = 0;
+#if HAVE_NEON_HALF_CONVERT
+    const float32x4_t high = vdupq_n_f32(kHalfMax);
+    const float32x4_t low = vdupq_n_f32(-kHalfMax);
+    for (; i + 8 <= count; i += 8) {
+        float32x4_t a = vmaxq_f32(vminq_f32(vld1q_f32(src + i), high), low);
+        float32x4_t b = vmaxq_f32(vminq_f32(vld1q_f32(src + i + 4), high), low);
+        float16x8_t h = vcombine_f16(vcvt_f16_f32(a), vcvt_f16_f32(b));
+        vst1q_u16(dst + i, vreinterpretq_u16_f16(h));
+    }
+#elif HAVE_F16C_CONVERT
+    static const bool hasF16C = __builtin_cpu_supports("f16c");
+    if (hasF16C)
+        i = FloatToHalfF16C(src, dst, count);
+#endif
+    FloatToHalfScalar(src + i, dst + i, count - i);
+}
+
+void PixelConvert::RGBFloatToRGBAHalfScalar(const float *src, uint16_t *dst, size_t pixels) {
+    for (size_t i = 0; i < pixels; i++) {
+        dst[0] = ToHalf(src[0]);
+        dst[1] = ToHalf(src[1]);
+        dst[2] = ToHalf(src[2]);
+        dst[3] = 0x3c00;
+        src += 3;
+        dst += 4;
+    }
+}
+
+void PixelConvert::RGBFloatToRGBAHalf(const float *src, uint16_t *dst, size_t pixels) {
+    size_t i = 0;
+#if HAVE_NEON_HALF_CONVERT
+    const float32x4_t high = vdupq_n_f32(kHalfMax);
+    const float32x4_t low = vdupq_n_f32(-kHalfMax);
+    for (; i + 4 <= pixels; i += 4) {
+        float32x4x3_t rgb = vld3q_f32(src);
+        uint16x4x4_t rgba;
+        for (int c = 0; c < 3; c++) {
+            float32x4_t v = vmaxq_f32(vminq_f32(rgb.val[c], high), low);
+            rgba.val[c] = vreinterpret_u16_f16(vcvt_f16_f32(v));
+        }
+        rgba.val[3] = vdup_n_u16(0x3c00);
+        vst4_u16(dst, rgba);
+        src += 12;
+        dst += 16;
+    }
+#elif HAVE_F16C_CONVERT
+    static const bool hasF16C = __builtin_cpu_supports("f16c");
+    if (hasF16C) {
+        i = RGBFloatToRGBAHalfF16C(src, dst, pixels);
+        src += i * 3;
+        dst += i * 4;
+    }
+#endif
+    RGBFloatToRGBAHalfScalar(src, dst, pixels - i);
+}
+
+void PixelConvert::RGBFloatToR11G11B10F(const float *src, uint32_t *dst, size_t pixels) {
+    for (size_t i = 0; i < pixels; i++) {
+        dst[i] = ToUnsignedSmallFloat(src[0], 6) |
+            (ToUnsignedSmallFloat(src[1], 6) << 11) |
+            (ToUnsignedSmallFloat(src[2], 5) << 22);
+        src += 3;
+    }
+}
+
+// shared exponent packing from the EXT_texture_shared_exponent spec
+static uint32_t ToRGB9E5(float r, float g, float b) {
+    const int kBias = 15;
+    const int kMantissaBits = 9;
+    // (2^9 - 1) / 2^9 * 2^(31 - 15)
+    const float kMax = 65408.0f;
+    r = r > 0.0f ? std::min(r, kMax) : 0.0f;
+    g = g > 0.0f ? std::min(g, kMax) : 0.0f;
+    b = b > 0.0f ? std::min(b, kMax) : 0.0f;
+    const float maxc = std::max(r, std::max(g, b));
+    if (maxc == 0.0f)
+        return 0;
+
+    int exponent;
+    frexpf(maxc, &exponent);
+    // frexp gives floor(log2(maxc)) + 1
+    int shared = std::max(-kBias - 1, exponent - 1) + 1 + kBias;
+    float denom = ldexpf(1.0f, shared - kBias - kMantissaBits);
+    if ((int)floorf(maxc / denom + 0.5f) == 1 << kMantissaBits) {
+        denom *= 2.0f;
+        shared++;
+    }
+    const uint32_t rm = (uint32_t)floorf(r / denom + 0.5f);
+    const uint32_t gm = (uint32_t)floorf(g / denom + 0.5f);
+    const uint32_t bm = (uint32_t)floorf(b / denom + 0.5f);
+    return rm | (gm << 9) | (bm << 18) | ((uint32_t)shared << 27);
+}
+
+void PixelConvert::RGBFloatToRGB9E5(const float *src, uint32_t *dst, size_t pixels) {
+    for (size_t i = 0; i < pixels; i++) {
+        dst[i] = ToRGB9E5(src[0], src[1], src[2]);
+        src += 3;
+    }
+}
+
+}
+
+#ifdef TEST_PIXEL_CONVERT
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "config.h"
+#if HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES3/gl3.h>
+#endif
+
+#include "buffer-pool.h"
+
+using Clock = std::chrono::high_resolution_clock;
+
+template <typename F>
+static double TimeMs(int rounds, F f) {
+    f();
+    auto t1 = Clock::now();
+    for (int i = 0; i < rounds; i++)
+        f();
+    auto t2 = Clock::now();
+    return std::chrono::duration<double, std::milli>(t2 - t1).count() / rounds;
+}
+
+#if HAVE_EGL
+static bool SetupContext() {
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+        eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLDisplay display = EGL_NO_DISPLAY;
+    if (getPlatformDisplay)
+        display = getPlatformDisplay(0x31DD /* surfaceless */, EGL_DEFAULT_DISPLAY, nullptr);
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (!eglInitialize(display, nullptr, nullptr))
+            return false;
+    }
+    eglBindAPI(EGL_OPENGL_ES_API);
+    const EGLint configAttribs[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT, EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || numConfigs < 1)
+        return false;
+    const EGLint contextAttribs[] = { EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE };
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+    const EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+    EGLSurface surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+    return eglMakeCurrent(display, surface, surface, context);
+}
+#endif
+
+int main()
+{
+    const int width = 4000;
+    const int height = 3000;
+    const size_t pixels = (size_t)width * height;
+
+    std::vector<uint8_t> rgb(pixels * 3);
+    for (size_t i = 0; i < rgb.size(); i++)
+        rgb[i] = (uint8_t)(i * 7);
+    auto rgba = quink::BufferPool::Instance().Acquire(pixels * 4);
+    std::vector<uint8_t> ref(pixels * 4);
+
+    quink::PixelConvert::RGBToRGBAScalar(rgb.data(), ref.data(), pixels);
+    quink::PixelConvert::RGBToRGBA(rgb.data(), rgba.As<uint8_t>(), pixels);
+    if (memcmp(ref.data(), rgba.Data(), ref.size())) {
+        printf("FAIL: SIMD output differs from scalar\n");
+        return 1;
+    }
+
+    // half floats against known codes, then SIMD against scalar
+    const float values[] = { 0.0f, 1.0f, -2.0f, 65504.0f, 1e6f, 5.9604645e-08f, 6.1035156e-05f, 0.33333334f };
+    const uint16_t codes[] = { 0x0000, 0x3c00, 0xc000, 0x7bff, 0x7bff, 0x0001, 0x0400, 0x3555 };
+    uint16_t halves[8];
+    quink::PixelConvert::FloatToHalfScalar(values, halves, 8);
+    for (int i = 0; i < 8; i++) {
+        if (halves[i] != codes[i]) {
+            printf("FAIL: half of %g is 0x%04x, expected 0x%04x\n", values[i], halves[i], codes[i]);
+            return 1;
+        }
+    }
+    std::vector<float> hdr(pixels * 3);
+    for (size_t i = 0; i < hdr.size(); i++)
+        hdr[i] = (float)((i * 2654435761u) % 100000) / 1000.0f * ((i % 7) ? 1.0f : -0.01f);
+    std::vector<uint16_t> halfRef(pixels * 4), half(pixels * 4);
+    quink::PixelConvert::FloatToHalfScalar(hdr.data(), halfRef.data(), hdr.size());
+    quink::PixelConvert::FloatToHalf(hdr.data(), half.data(), hdr.size());
+    if (memcmp(halfRef.data(), half.data(), hdr.size() * 2)) {
+        printf("FAIL: SIMD half differs from scalar\n");
+        return 1;
+    }
+    quink::PixelConvert::RGBFloatToRGBAHalfScalar(hdr.data(), halfRef.data(), pixels);
+    quink::PixelConvert::RGBFloatToRGBAHalf(hdr.data(), half.data(), pixels);
+    if (memcmp(halfRef.data(), half.data(), half.size() * 2)) {
+        printf("FAIL: SIMD RGBA half differs from scalar\n");
+        return 1;
+    }
+
+    // packed formats decoded back, relative error within half a mantissa step
+    auto decodeSmall = [](uint32_t code, int mantissaBits) {
+        int e = code >> mantissaBits;
+        float m = (float)(code & ((1u << mantissaBits) - 1));
+        if (e == 0)
+            return ldexpf(m, -14 - mantissaBits);
+        return ldexpf(1.0f + m / (1 << mantissaBits), e - 15);
+    };
+    std::vector<uint32_t> packed(pixels);
+    double worst[2] = {};
+    quink::PixelConvert::RGBFloatToR11G11B10F(hdr.data(), packed.data(), pixels);
+    for (size_t i = 0; i < pixels; i++) {
+        const int bits[3] = { 6, 6, 5 };
+        const int shifts[3] = { 0, 11, 22 };
+        for (int c = 0; c < 3; c++) {
+            float v = std::max(hdr[i * 3 + c], 0.0f);
+            float d = decodeSmall((packed[i] >> shifts[c]) & ((1u << (bits[c] + 5)) - 1), bits[c]);
+            if (v > 1e-3f)
+                worst[0] = std::max(worst[0], (double)fabsf(d - v) / v * (1 << (bits[c] + 1)));
+        }
+    }
+    quink::PixelConvert::RGBFloatToRGB9E5(hdr.data(), packed.data(), pixels);
+    for (size_t i = 0; i < pixels; i++) {
+        float scale = ldexpf(1.0f, (int)(packed[i] >> 27) - 15 - 9);
+        float maxc = 0.0f;
+        for (int c = 0; c < 3; c++)
+            maxc = std::max(maxc, hdr[i * 3 + c]);
+        for (int c = 0; c < 3; c++) {
+            float v = std::max(hdr[i * 3 + c], 0.0f);
+            float d = ((packed[i] >> (9 * c)) & 0x1ff) * scale;
+            // every channel is rounded to a step of the shared exponent
+            if (maxc > 1e-3f)
+                worst[1] = std::max(worst[1], (double)fabsf(d - v) / scale * 2);
+        }
+    }
+    if (worst[0] > 1.0 || worst[1] > 1.0) {
+        printf("FAIL: packed error %.3f %.3f steps\n", worst[0], worst[1]);
+        return 1;
+    }
+
+    double halfScalar = TimeMs(10, [&]() {
+        quink::PixelConvert::RGBFloatToRGBAHalfScalar(hdr.data(), half.data(), pixels);
+    });
+    double halfSimd = TimeMs(10, [&]() {
+        quink::PixelConvert::RGBFloatToRGBAHalf(hdr.data(), half.data(), pixels);
+    });
+    printf("RGB float to RGBA half %dx%d: scalar %.2f ms, simd %.2f ms\n",
+            width, height, halfScalar, halfSimd);
+
+    double scalar = TimeMs(10, [&]() {
+        quink::PixelConvert::RGBToRGBAScalar(rgb.data(), rgba.As<uint8_t>(), pixels);
+    });
+    double simd = TimeMs(10, [&]() {
+        quink::PixelConvert::RGBToRGBA(rgb.data(), rgba.As<uint8_t>(), pixels);
+    });
+    printf("repack %dx%d: scalar %.2f ms, simd %.2f ms (%.0f MP/s)\n",
+            width, height, scalar, simd, pixels / simd / 1000.0);
+
+#if HAVE_EGL
+    if (!SetupContext()) {
+        printf("no GL context, skip upload benchmark\n");
+        return 0;
+    }
+    printf("GL renderer: %s\n", glGetString(GL_RENDERER));
+    GLuint textures[2];
+    glGenTextures(2, textures);
+    glBindTexture(GL_TEXTURE_2D, textures[0]);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGB8, width, height);
+    glBindTexture(GL_TEXTURE_2D, textures[1]);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_SRGB8_ALPHA8, width, height);
+
+    double rgbUpload = TimeMs(10, [&]() {
+        glBindTexture(GL_TEXTURE_2D, textures[0]);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, rgb.data());
+        glFinish();
+    });
+    double rgbaUpload = TimeMs(10, [&]() {
+        quink::PixelConvert::RGBToRGBA(rgb.data(), rgba.As<uint8_t>(), pixels);
+        glBindTexture(GL_TEXTURE_2D, textures[1]);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba.Data());
+        glFinish();
+    });
+    printf("upload: RGB8 %.2f ms, repack + SRGB8_ALPHA8 %.2f ms\n", rgbUpload, rgbaUpload);
+#endif
+    return 0;
+}
+
+#endif
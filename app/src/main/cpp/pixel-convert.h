@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace quink {
+
+class PixelConvert {
+public:
+    // RGB888 to RGBA8888 with constant alpha, NEON or SSSE3 when available
+    static void RGBToRGBA(const uint8_t *src, uint8_t *dst, size_t pixels, uint8_t alpha = 0xff);
+    static void RGBToRGBAScalar(const uint8_t *src, uint8_t *dst, size_t pixels, uint8_t alpha = 0xff);
+
+    /* Float to the compact HDR upload layouts. Out of range values are
+     * clamped to the largest finite value of the target, the packed formats
+     * have no sign and take negative values as zero.
+     */
+    // half floats, count values, NEON or F16C when available
+    static void FloatToHalf(const float *src, uint16_t *dst, size_t count);
+    static void FloatToHalfScalar(const float *src, uint16_t *dst, size_t count);
+    // RGB float to RGBA half with alpha 1.0
+    static void RGBFloatToRGBAHalf(const float *src, uint16_t *dst, size_t pixels);
+    static void RGBFloatToRGBAHalfScalar(const float *src, uint16_t *dst, size_t pixels);
+    // GL_UNSIGNED_INT_10F_11F_11F_REV
+    static void RGBFloatToR11G11B10F(const float *src, uint32_t *dst, size_t pixels);
+    // GL_UNSIGNED_INT_5_9_9_9_REV
+    static void RGBFloatToRGB9E5(const float *src, uint32_t *dst, size_t pixels);
+};
+
+}
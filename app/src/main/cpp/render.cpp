@@ -13,8 +13,16 @@
 #include <memory>
 #include <string>
 
+#include "buffer-pool.h"
+#include "etc2-encoder.h"
+#include "gl-caps.h"
+#include "gl-hooks.h"
+#include "gl-state.h"
 #include "log.h"
 #include "opengl-helper.h"
+#include "pixel-convert.h"
+#include "texture-pool.h"
+#include "trace.h"
 
 #if HAVE_GLES
 #define HEADER_VERSION  "#version 300 es\n"
@@ -32,32 +40,85 @@ public:
     int Init(const ImageCoord &coord) override;
     int UploadTexture(std::shared_ptr<Image<uint8_t>> img) override;
     int UploadTexture(std::shared_ptr<Image<float>> img) override;
+    int UploadTexture(std::shared_ptr<CompressedImage> img) override;
+    int UploadTexture(std::shared_ptr<YuvImage> img) override;
     int Draw() override;
+    int Poll() override;
+    GLStats::Counters GetGLCounters() const override { return mCounters; }
 
     virtual std::string GetVertexSrc();
     virtual std::string GetFragSrc();
+    // the shader wants linear light, 8-bit sources are decoded by the texture unit
+    virtual bool LinearInput() const { return false; }
 
 protected:
-    GLuint mProgram;
+    // texture layout of the source, each one gets its own program
+    enum Source {
+        kSourceRGB,     // one RGB(A) texture, optionally RGBM
+        kSourceYUV,     // 8-bit Y and U, V or UV planes
+        kSourceYUV16,   // 16-bit integer Y and UV planes
+        kSourceCount,
+    };
+
+    struct Program {
+        GLuint mId = 0;
+        bool mLinked = false;   // compile and link done, uniforms set
+        bool mFailed = false;   // not tried again, the sources won't change
+        GLint mGammaLocation = -1;
+        GLint mRangeLocation = -1;
+        float mGamma = 0.0f;
+        float mRange = 0.0f;
+        int mYuvKey = -1;       // conversion the YUV uniforms are set for
+        float mChromaScale[2] = {};
+    };
+
+    struct Plane {
+        GLuint mTexture = 0;
+        GLsizei mWidth = 0;
+        GLsizei mHeight = 0;
+        GLenum mFormat = 0;
+    };
+
+    // precision, samplers and sampleSource() for mSource
+    std::string GetSourceSrc();
+    // issue compile and link of a source's program without waiting
+    int StartProgram(Source source);
+    // check the link and set the uniforms, 1 while pending without wait
+    int FinishProgram(Source source, bool wait);
+    // build the program of a source on first use and make it current
+    int PrepareProgram(Source source);
+    // constant uniforms, called once for every program with it in use
+    virtual void SetUniforms(GLuint program);
+    // make a plane a pooled immutable texture of the given size and format
+    int PrepareTexture(int plane, GLsizei width, GLsizei height, GLenum internalFormat);
+    // give the planes from first on back to the pool
+    void ReleasePlanes(int first);
+    int SetYuvUniforms(const YuvImage &img);
+
+    Source mSource = kSourceRGB;
+    Program mPrograms[kSourceCount];
     GLuint mVAO, mVBO, mEBO;
-    GLuint mTexture;
+    Plane mPlanes[3];
     float mGamma = 2.2f;
+    // RGBM scale of the texture, 0 for plain color
+    float mRange = 0.0f;
+    GLStats::Counters mCounters;
 };
 
 Plain::Plain() :
-    mProgram(0),
     mVAO(0),
     mVBO(0),
-    mEBO(0),
-    mTexture(0) {
+    mEBO(0) {
 }
 
 Plain::~Plain() {
-    glDeleteTextures(1, &mTexture);
-    glDeleteBuffers(1, &mVBO);
-    glDeleteBuffers(1, &mEBO);
-    glDeleteVertexArrays(1, &mVAO);
-    glDeleteProgram(mProgram);
+    ReleasePlanes(0);
+    GLState &state = GLState::Current();
+    state.DeleteBuffers(1, &mVBO);
+    state.DeleteBuffers(1, &mEBO);
+    state.DeleteVertexArrays(1, &mVAO);
+    for (auto &program : mPrograms)
+        state.DeleteProgram(program.mId);
 }
 
 int Plain::Init(){
@@ -85,12 +146,108 @@ void main()
     return vertexSrc;
 }
 
+std::string Plain::GetSourceSrc() {
+    if (mSource == kSourceRGB) {
+        return
+R"(precision mediump float;
+uniform sampler2D source;
+uniform float rgbmRange;
+
+vec4 sampleSource(vec2 uv)
+{
+    vec4 color = texture(source, uv);
+    if (rgbmRange > 0.0)
+        color.rgb *= color.a * rgbmRange;
+    return color;
+}
+)";
+    }
+
+    std::string src;
+    if (mSource == kSourceYUV) {
+        src =
+R"(precision highp float;
+uniform sampler2D source;
+uniform sampler2D source1;
+uniform sampler2D source2;
+uniform bool planarUV;
+uniform vec2 chromaScale;
+
+vec3 fetchYUV(vec2 uv)
+{
+    vec2 cuv = uv * chromaScale;
+    vec2 c = planarUV ? vec2(texture(source1, cuv).r, texture(source2, cuv).r) :
+            texture(source1, cuv).rg;
+    return vec3(texture(source, uv).r, c);
+}
+)";
+    } else {
+        src =
+R"(precision highp float;
+uniform highp usampler2D source;
+uniform highp usampler2D source1;
+uniform vec2 chromaScale;
+
+vec3 fetchYUV(vec2 uv)
+{
+    // 10 bits in the high bits of each sample
+    uvec3 yuv = uvec3(texture(source, uv).r, texture(source1, uv * chromaScale).rg) >> 6u;
+    return vec3(yuv) / 1023.0;
+}
+)";
+    }
+    src +=
+R"(uniform mat3 yuvToRgb;
+uniform vec3 yuvOffset;
+uniform mat3 gamutToOutput;
+uniform int transfer;
+
+vec3 pqToLinear(vec3 e)
+{
+    // SMPTE ST 2084, 1.0 is the 203 nits reference white
+    const float m1 = 0.1593017578125;
+    const float m2 = 78.84375;
+    const float c1 = 0.8359375;
+    const float c2 = 18.8515625;
+    const float c3 = 18.6875;
+    vec3 p = pow(clamp(e, 0.0, 1.0), vec3(1.0 / m2));
+    return pow(max(p - c1, 0.0) / (c2 - c3 * p), vec3(1.0 / m1)) * (10000.0 / 203.0);
+}
+
+vec3 hlgToLinear(vec3 e)
+{
+    // inverse OETF, then the BT.2100 OOTF of a 1000 nits display
+    const float a = 0.17883277;
+    const float b = 0.28466892;
+    const float c = 0.55991073;
+    e = clamp(e, 0.0, 1.0);
+    vec3 scene = mix(e * e / 3.0, (exp((e - c) / a) + b) / 12.0, step(0.5, e));
+    float luma = dot(scene, vec3(0.2627, 0.6780, 0.0593));
+    return scene * pow(max(luma, 1e-6), 0.2) * (1000.0 / 203.0);
+}
+
+vec4 sampleSource(vec2 uv)
+{
+    vec3 rgb = yuvToRgb * (fetchYUV(uv) - yuvOffset);
+    if (transfer == 0)
+        return vec4(rgb, 1.0);
+    if (transfer == 1)
+        rgb = pow(max(rgb, 0.0), vec3(2.2));
+    else if (transfer == 2)
+        rgb = pqToLinear(rgb);
+    else
+        rgb = hlgToLinear(rgb);
+    return vec4(max(gamutToOutput * rgb, 0.0), 1.0);
+}
+)";
+    return src;
+}
+
 std::string Plain::GetFragSrc() {
     std::string src(HEADER_VERSION);
+    src += GetSourceSrc();
     src +=
-R"(precision mediump float;
-uniform sampler2D source;
-uniform float gamma;
+R"(uniform float gamma;
 in vec2 o_uv;
 out vec4 out_color;
 
@@ -107,28 +264,105 @@ vec4 gammaCorrect(vec4 color)
 
 void main()
 {
-    vec4 color = texture(source, o_uv);
+    vec4 color = sampleSource(o_uv);
     color = clampedValue(color);
-    out_color = gammaCorrect(color);
+    out_color = gamma != 1.0 ? gammaCorrect(color) : color;
 })";
     return src;
 }
 
-int Plain::Init(const ImageCoord &coord) {
+int Plain::StartProgram(Source source) {
+    Program &program = mPrograms[source];
+    if (program.mFailed)
+        return -1;
+    if (program.mId)
+        return 0;
+
+    TRACE_GL_SCOPE("Plain::StartProgram");
+    const Source current = mSource;
+    mSource = source;
     std::string vertexSrc = GetVertexSrc();
     std::string fragSrc = GetFragSrc();
+    mSource = current;
 
-    mProgram = OpenGL_Helper::CreateProgram(vertexSrc.c_str(),
-            fragSrc.c_str());
-    if (!mProgram)
-        return -1;
+    program.mId = OpenGL_Helper::StartProgram(vertexSrc.c_str(), fragSrc.c_str());
+    program.mLinked = false;
+    program.mFailed = !program.mId;
+    return program.mId ? 0 : -1;
+}
 
-    glUseProgram(mProgram);
-    glUniform1f(glGetUniformLocation(mProgram, "gamma"), mGamma);
+int Plain::FinishProgram(Source source, bool wait) {
+    Program &program = mPrograms[source];
+    if (program.mLinked)
+        return 0;
+    int ret = OpenGL_Helper::FinishProgram(program.mId, wait);
+    if (ret) {
+        if (ret < 0) {
+            program.mId = 0;
+            program.mFailed = true;
+        }
+        return ret;
+    }
+    program.mLinked = true;
+
+    GLState &state = GLState::Current();
+    GLuint previous = state.GetProgram();
+    state.UseProgram(program.mId);
+    program.mGammaLocation = glGetUniformLocation(program.mId, "gamma");
+    glUniform1f(program.mGammaLocation, mGamma);
+    program.mGamma = mGamma;
+    program.mRangeLocation = glGetUniformLocation(program.mId, "rgbmRange");
+    glUniform1f(program.mRangeLocation, mRange);
+    program.mRange = mRange;
+    glUniform1i(glGetUniformLocation(program.mId, "source"), 0);
+    glUniform1i(glGetUniformLocation(program.mId, "source1"), 1);
+    glUniform1i(glGetUniformLocation(program.mId, "source2"), 2);
+    SetUniforms(program.mId);
     CheckGLError();
+    // polling must not change what is bound
+    state.UseProgram(previous);
+    return 0;
+}
+
+int Plain::PrepareProgram(Source source) {
+    Program &program = mPrograms[source];
+    GLState &state = GLState::Current();
+    if (!program.mLinked) {
+        TRACE_GL_SCOPE("Plain::PrepareProgram");
+        if (StartProgram(source) || FinishProgram(source, true))
+            return -1;
+    }
+    state.UseProgram(program.mId);
+    return 0;
+}
+
+int Plain::Poll() {
+    int ret = 0;
+    for (int i = 0; i < kSourceCount; i++) {
+        if (!mPrograms[i].mId || mPrograms[i].mLinked)
+            continue;
+        int status = FinishProgram(static_cast<Source>(i), false);
+        if (status < 0)
+            return -1;
+        ret |= status;
+    }
+    return ret;
+}
+
+void Plain::SetUniforms(GLuint program) {
+    (void)program;
+}
 
+int Plain::Init(const ImageCoord &coord) {
+    TRACE_GL_SCOPE("Plain::Init");
+    GLStats::Scope stats(mCounters);
+    // linked in the background, the first Draw() waits if it has to
+    if (StartProgram(kSourceRGB))
+        return -1;
+
+    GLState &state = GLState::Current();
     glGenVertexArrays(1, &mVAO);
-    glBindVertexArray(mVAO);
+    state.BindVertexArray(mVAO);
     CheckGLError();
 
     float vbo[] = {
@@ -138,7 +372,7 @@ int Plain::Init(const ImageCoord &coord) {
         coord.mTopRight.mX, coord.mTopRight.mY,         1.0f, 0.0f,
     };
     glGenBuffers(1, &mVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+    state.BindBuffer(GL_ARRAY_BUFFER, mVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vbo), vbo, GL_STATIC_DRAW);
     CheckGLError();
 
@@ -147,7 +381,7 @@ int Plain::Init(const ImageCoord &coord) {
         0, 2, 3,
     };
     glGenBuffers(1, &mEBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO);
+    state.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(ebo), ebo, GL_STATIC_DRAW);
     CheckGLError();
 
@@ -158,49 +392,296 @@ int Plain::Init(const ImageCoord &coord) {
     glEnableVertexAttribArray(1);
     CheckGLError();
 
-    glGenTextures(1, &mTexture);
-    glBindTexture(GL_TEXTURE_2D, mTexture);
+    return 0;
+}
+
+int Plain::PrepareTexture(int plane, GLsizei width, GLsizei height, GLenum internalFormat) {
+    Plane &p = mPlanes[plane];
+    if (p.mTexture && p.mWidth == width && p.mHeight == height && p.mFormat == internalFormat)
+        return 0;
+
+    TexturePool &pool = TexturePool::Instance();
+    pool.Release(p.mTexture);
+    p.mTexture = pool.Acquire(width, height, internalFormat);
+    if (!p.mTexture) {
+        p = Plane();
+        return -1;
+    }
+    p.mWidth = width;
+    p.mHeight = height;
+    p.mFormat = internalFormat;
+
+    // a recycled texture keeps the parameters of its previous user
+    GLState::Current().BindTexture(GL_TEXTURE0 + plane, GL_TEXTURE_2D, p.mTexture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
     return 0;
 }
 
+void Plain::ReleasePlanes(int first) {
+    for (int i = first; i < 3; i++) {
+        TexturePool::Instance().Release(mPlanes[i].mTexture);
+        mPlanes[i] = Plane();
+    }
+}
+
 int Plain::UploadTexture(std::shared_ptr<Image<uint8_t>> img) {
+    TRACE_GL_SCOPE("Plain::UploadTexture uint8");
+    GLStats::Scope stats(mCounters);
     CheckGLError();
 
+    /* 3 byte texels are a slow path on most drivers, repack to RGBA8. For a
+     * render working in linear light a gamma encoded source is stored as
+     * sRGB so sampling linearizes it, otherwise the bytes are used as they
+     * are and the shader skips pow() when no correction is left to do.
+     */
+    const size_t pixels = (size_t)img->mWidth * img->mHeight;
+    BufferPool::Buffer rgba = BufferPool::Instance().Acquire(pixels * 4);
+    if (rgba.Empty())
+        return -1;
+    {
+        TRACE_SCOPE("PixelConvert::RGBToRGBA");
+        PixelConvert::RGBToRGBA(img->mData.get(), rgba.As<uint8_t>(), pixels);
+    }
+
+    GLenum internalFormat = GL_RGBA8;
     mGamma = 2.2 / img->mGamma;
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, mTexture);
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, img->mWidth);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, img->mWidth, img->mHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, img->mData.get());
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    mRange = 0.0f;
+    if (LinearInput() && img->mGamma > 1.0f) {
+        internalFormat = GL_SRGB8_ALPHA8;
+        mGamma = 2.2f;
+    }
+    mSource = kSourceRGB;
+    ReleasePlanes(1);
+    if (PrepareTexture(0, img->mWidth, img->mHeight, internalFormat))
+        return -1;
+    GLState &state = GLState::Current();
+    state.BindTexture(GL_TEXTURE0, GL_TEXTURE_2D, mPlanes[0].mTexture);
+    state.PixelStorei(GL_UNPACK_ROW_LENGTH, img->mWidth);
+    state.PixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, img->mWidth, img->mHeight, GL_RGBA, GL_UNSIGNED_BYTE, rgba.Data());
     CheckGLError();
 
     return 0;
 }
 
 int Plain::UploadTexture(std::shared_ptr<Image<float>> img) {
+    TRACE_GL_SCOPE("Plain::UploadTexture float");
+    GLStats::Scope stats(mCounters);
     CheckGLError();
 
     mGamma = 2.2 / img->mGamma;
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, mTexture);
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, img->mWidth);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, img->mWidth, img->mHeight, 0, GL_RGB, GL_FLOAT, img->mData.get());
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    mRange = 0.0f;
+    mSource = kSourceRGB;
+    ReleasePlanes(1);
+    // the format GLCaps found fastest on this device, converted on the CPU
+    const GLCaps::HdrFormat &format = GLCaps::Instance().GetHdrFormat();
+    if (PrepareTexture(0, img->mWidth, img->mHeight, format.mInternalFormat))
+        return -1;
+    const void *data = img->mData.get();
+    BufferPool::Buffer converted;
+    if (GLCaps::NeedsConversion(format)) {
+        TRACE_SCOPE("GLCaps::Convert");
+        const size_t pixels = (size_t)img->mWidth * img->mHeight;
+        converted = BufferPool::Instance().Acquire(pixels * format.mPixelSize);
+        if (converted.Empty())
+            return -1;
+        GLCaps::Convert(format, img->mData.get(), converted.Data(), pixels);
+        data = converted.Data();
+    }
+    GLState &state = GLState::Current();
+    state.BindTexture(GL_TEXTURE0, GL_TEXTURE_2D, mPlanes[0].mTexture);
+    state.PixelStorei(GL_UNPACK_ROW_LENGTH, img->mWidth);
+    state.PixelStorei(GL_UNPACK_ALIGNMENT, format.mPixelSize % 4 ? 2 : 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, img->mWidth, img->mHeight, format.mFormat,
+            format.mType, data);
     CheckGLError();
 
     return 0;
 }
 
-int Plain::Draw() {
-    glUseProgram(mProgram);
-    glUniform1f(glGetUniformLocation(mProgram, "gamma"), mGamma);
+int Plain::UploadTexture(std::shared_ptr<CompressedImage> img) {
+    TRACE_GL_SCOPE("Plain::UploadTexture compressed");
+    GLStats::Scope stats(mCounters);
+    CheckGLError();
+
+    // same rules as the 8-bit path, RGBM data is linear already
+    GLenum internalFormat = img->mFormat;
+    mGamma = 2.2 / img->mGamma;
+    mRange = img->mRange;
+    if (internalFormat == Etc2Encoder::kFormatRGB8 && LinearInput() && img->mGamma > 1.0f) {
+        internalFormat = Etc2Encoder::kFormatSRGB8;
+        mGamma = 2.2f;
+    }
+    mSource = kSourceRGB;
+    ReleasePlanes(1);
+    if (PrepareTexture(0, img->mWidth, img->mHeight, internalFormat))
+        return -1;
+    GLState::Current().BindTexture(GL_TEXTURE0, GL_TEXTURE_2D, mPlanes[0].mTexture);
+    glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, img->mWidth, img->mHeight, internalFormat,
+            (GLsizei)img->mData.size(), img->mData.data());
+    CheckGLError();
+
+    return 0;
+}
 
-    glBindVertexArray(mVAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, mTexture);
+int Plain::UploadTexture(std::shared_ptr<YuvImage> img) {
+    TRACE_GL_SCOPE("Plain::UploadTexture yuv");
+    GLStats::Scope stats(mCounters);
+    CheckGLError();
+
+    struct Layout {
+        GLenum mInternalFormat;
+        GLenum mFormat;
+        GLenum mType;
+        int mPixelSize;
+    };
+    static const Layout kR8 = { GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1 };
+    static const Layout kRG8 = { GL_RG8, GL_RG, GL_UNSIGNED_BYTE, 2 };
+    static const Layout kR16 = { GL_R16UI, GL_RED_INTEGER, GL_UNSIGNED_SHORT, 2 };
+    static const Layout kRG16 = { GL_RG16UI, GL_RG_INTEGER, GL_UNSIGNED_SHORT, 4 };
+
+    const Layout *layout[3] = {};
+    switch (img->mFormat) {
+        case YuvImage::Format::I420:
+            layout[0] = layout[1] = layout[2] = &kR8;
+            break;
+        case YuvImage::Format::NV12:
+            layout[0] = &kR8;
+            layout[1] = &kRG8;
+            break;
+        case YuvImage::Format::P010:
+            layout[0] = &kR16;
+            layout[1] = &kRG16;
+            break;
+        default:
+            ALOGE("unknown YUV format %d", static_cast<int>(img->mFormat));
+            return -1;
+    }
+
+    // rows are given to GL in samples, a stride has to be whole samples
+    const int planes = img->Planes();
+    for (int i = 0; i < planes; i++) {
+        const int width = i ? (img->mWidth + 1) / 2 : img->mWidth;
+        if (img->mStride[i] % layout[i]->mPixelSize ||
+                img->mStride[i] < width * layout[i]->mPixelSize) {
+            ALOGE("plane %d stride %d is not whole samples of %d bytes for width %d", i,
+                    img->mStride[i], layout[i]->mPixelSize, width);
+            return -1;
+        }
+    }
+
+    // SDR stays gamma encoded unless the render wants linear light
+    mGamma = img->mTransfer == YuvImage::Transfer::SDR && !LinearInput() ? 1.0f : 2.2f;
+    mRange = 0.0f;
+    mSource = img->mFormat == YuvImage::Format::P010 ? kSourceYUV16 : kSourceYUV;
+    if (PrepareProgram(mSource) || SetYuvUniforms(*img))
+        return -1;
+
+    ReleasePlanes(planes);
+    GLState &state = GLState::Current();
+    state.PixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int i = 0; i < planes; i++) {
+        const GLsizei width = i ? (img->mWidth + 1) / 2 : img->mWidth;
+        const GLsizei height = i ? (img->mHeight + 1) / 2 : img->mHeight;
+        if (PrepareTexture(i, width, height, layout[i]->mInternalFormat))
+            return -1;
+        state.BindTexture(GL_TEXTURE0 + i, GL_TEXTURE_2D, mPlanes[i].mTexture);
+        state.PixelStorei(GL_UNPACK_ROW_LENGTH, img->mStride[i] / layout[i]->mPixelSize);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, layout[i]->mFormat,
+                layout[i]->mType, img->mPlane[i]);
+    }
+    CheckGLError();
+
+    return 0;
+}
+
+int Plain::SetYuvUniforms(const YuvImage &img) {
+    const bool deep = img.mFormat == YuvImage::Format::P010;
+    const bool bt2020 = img.mMatrix == YuvImage::Matrix::BT2020;
+    int transfer = 0;
+    switch (img.mTransfer) {
+        case YuvImage::Transfer::SDR:
+            transfer = LinearInput() ? 1 : 0;
+            break;
+        case YuvImage::Transfer::PQ:
+            transfer = 2;
+            break;
+        case YuvImage::Transfer::HLG:
+            transfer = 3;
+            break;
+    }
+    const int key = transfer << 3 | (int)bt2020 << 2 | (int)img.mFullRange << 1 |
+        (int)(img.mFormat == YuvImage::Format::I420);
+
+    Program &program = mPrograms[mSource];
+    // a chroma plane of an odd size reaches half a sample past the image
+    const float chromaScale[2] = {
+        img.mWidth / (float)((img.mWidth + 1) / 2 * 2),
+        img.mHeight / (float)((img.mHeight + 1) / 2 * 2),
+    };
+    if (program.mChromaScale[0] != chromaScale[0] || program.mChromaScale[1] != chromaScale[1]) {
+        glUniform2f(glGetUniformLocation(program.mId, "chromaScale"), chromaScale[0],
+                chromaScale[1]);
+        program.mChromaScale[0] = chromaScale[0];
+        program.mChromaScale[1] = chromaScale[1];
+    }
+    if (program.mYuvKey == key)
+        return 0;
+
+    // Y'CbCr to R'G'B' with the range expansion folded in, column major
+    const float kr = bt2020 ? 0.2627f : 0.2126f;
+    const float kb = bt2020 ? 0.0593f : 0.0722f;
+    const float kg = 1.0f - kr - kb;
+    const float maxCode = deep ? 1023.0f : 255.0f;
+    const float unit = deep ? 4.0f : 1.0f;
+    const float yScale = img.mFullRange ? 1.0f : maxCode / (219.0f * unit);
+    const float cScale = img.mFullRange ? 1.0f : maxCode / (224.0f * unit);
+    const float matrix[9] = {
+        yScale, yScale, yScale,
+        0.0f, -2.0f * kb * (1.0f - kb) / kg * cScale, 2.0f * (1.0f - kb) * cScale,
+        2.0f * (1.0f - kr) * cScale, -2.0f * kr * (1.0f - kr) / kg * cScale, 0.0f,
+    };
+    const float chroma = 128.0f * unit / maxCode;
+    const float offset[3] = { img.mFullRange ? 0.0f : 16.0f * unit / maxCode, chroma, chroma };
+    // BT.2020 primaries to the BT.709 output, in linear light
+    const float gamut2020[9] = {
+        1.6605f, -0.1246f, -0.0182f,
+        -0.5876f, 1.1329f, -0.1006f,
+        -0.0728f, -0.0083f, 1.1187f,
+    };
+    const float identity[9] = { 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f };
+
+    glUniformMatrix3fv(glGetUniformLocation(program.mId, "yuvToRgb"), 1, GL_FALSE, matrix);
+    glUniform3fv(glGetUniformLocation(program.mId, "yuvOffset"), 1, offset);
+    glUniformMatrix3fv(glGetUniformLocation(program.mId, "gamutToOutput"), 1, GL_FALSE,
+            bt2020 ? gamut2020 : identity);
+    glUniform1i(glGetUniformLocation(program.mId, "transfer"), transfer);
+    glUniform1i(glGetUniformLocation(program.mId, "planarUV"),
+            img.mFormat == YuvImage::Format::I420);
+    program.mYuvKey = key;
+    return 0;
+}
+
+int Plain::Draw() {
+    TRACE_GL_SCOPE("Plain::Draw");
+    GLStats::Scope stats(mCounters);
+    GLState &state = GLState::Current();
+    if (PrepareProgram(mSource))
+        return -1;
+    Program &program = mPrograms[mSource];
+    if (program.mGamma != mGamma) {
+        glUniform1f(program.mGammaLocation, mGamma);
+        program.mGamma = mGamma;
+    }
+    if (program.mRange != mRange) {
+        glUniform1f(program.mRangeLocation, mRange);
+        program.mRange = mRange;
+    }
+
+    state.BindVertexArray(mVAO);
+    for (int i = 0; i < 3 && mPlanes[i].mTexture; i++)
+        state.BindTexture(GL_TEXTURE0 + i, GL_TEXTURE_2D, mPlanes[i].mTexture);
 
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
     CheckGLError();
@@ -211,9 +692,12 @@ class Hable : public Plain {
 public:
     Hable();
     virtual ~Hable();
-    int Init(const ImageCoord &coord) override;
 
     std::string GetFragSrc() override;
+    bool LinearInput() const override { return true; }
+
+protected:
+    void SetUniforms(GLuint program) override;
 
 private:
     /* F(x) = ((x*(A*x + C*B) + D*E) / (x*(A*x + B) + D*F)) - E/F;
@@ -233,10 +717,9 @@ Hable::~Hable() { }
 
 std::string Hable::GetFragSrc() {
     std::string src(HEADER_VERSION);
+    src += GetSourceSrc();
     src +=
-R"(precision mediump float;
-uniform sampler2D source;
-uniform float gamma;
+R"(uniform float gamma;
 uniform float A;
 uniform float B;
 uniform float C;
@@ -265,32 +748,25 @@ vec4 tonemap(vec4 x)
 
 void main()
 {
-    vec4 color = texture(source, o_uv);
+    vec4 color = sampleSource(o_uv);
     float exposureBias = 2.0;
     vec4 curr = tonemap(exposureBias * color);
     vec4 whiteScale = 1.0 / tonemap(vec4(W));
     color = curr * whiteScale;
     color = clampedValue(color);
-    out_color = gammaCorrect(color);
+    out_color = gamma != 1.0 ? gammaCorrect(color) : color;
 })";
     return src;
 }
 
-int Hable::Init(const ImageCoord &coord) {
-    int ret = Plain::Init(coord);
-    if (ret)
-        return ret;
-
-    glUseProgram(mProgram);
-    glUniform1f(glGetUniformLocation(mProgram, "A"), mA);
-    glUniform1f(glGetUniformLocation(mProgram, "B"), mB);
-    glUniform1f(glGetUniformLocation(mProgram, "C"), mC);
-    glUniform1f(glGetUniformLocation(mProgram, "D"), mD);
-    glUniform1f(glGetUniformLocation(mProgram, "E"), mE);
-    glUniform1f(glGetUniformLocation(mProgram, "F"), mF);
-    glUniform1f(glGetUniformLocation(mProgram, "W"), mW);
-
-    return 0;
+void Hable::SetUniforms(GLuint program) {
+    glUniform1f(glGetUniformLocation(program, "A"), mA);
+    glUniform1f(glGetUniformLocation(program, "B"), mB);
+    glUniform1f(glGetUniformLocation(program, "C"), mC);
+    glUniform1f(glGetUniformLocation(program, "D"), mD);
+    glUniform1f(glGetUniformLocation(program, "E"), mE);
+    glUniform1f(glGetUniformLocation(program, "F"), mF);
+    glUniform1f(glGetUniformLocation(program, "W"), mW);
 }
 
 Render *Render::Create(const std::string &name) {
@@ -301,3 +777,191 @@ Render *Render::Create(const std::string &name) {
 }
 
 }
+
+#ifdef TEST_YUV_UPLOAD
+/* YUV frames through the Plain render against a CPU conversion of the same
+ * samples:
+ *   g++ -DTEST_YUV_UPLOAD render.cpp opengl-helper.cpp gl-state.cpp
+ *       gl-stats.cpp gl-caps.cpp texture-pool.cpp texture-cache.cpp
+ *       buffer-pool.cpp pixel-convert.cpp etc2-encoder.cpp frame-capture.cpp
+ *       trace.cpp -lEGL -lGLESv2 -lpthread
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace quink;
+
+// a frame with every row padded by pad samples, planes in one allocation
+static std::shared_ptr<YuvImage> CreateFrame(int width, int height, YuvImage::Format format,
+        int pad) {
+    auto img = std::make_shared<YuvImage>();
+    img->mWidth = width;
+    img->mHeight = height;
+    img->mFormat = format;
+    const int sampleSize = format == YuvImage::Format::P010 ? 2 : 1;
+    const int chromaWidth = (width + 1) / 2;
+    const int chromaHeight = (height + 1) / 2;
+    const int uvSamples = format == YuvImage::Format::I420 ? 1 : 2;
+    img->mStride[0] = (width + pad) * sampleSize;
+    img->mStride[1] = img->mStride[2] = (chromaWidth + pad) * uvSamples * sampleSize;
+    const size_t size = (size_t)img->mStride[0] * height +
+        (size_t)img->mStride[1] * chromaHeight * (img->Planes() - 1);
+    auto data = std::make_shared<std::vector<uint8_t>>(size);
+    img->mOwner = data;
+    img->mPlane[0] = data->data();
+    img->mPlane[1] = img->mPlane[0] + (size_t)img->mStride[0] * height;
+    img->mPlane[2] = img->mPlane[1] + (size_t)img->mStride[1] * chromaHeight;
+
+    // gradients with some noise, chroma over its whole legal range
+    const int maxCode = sampleSize == 2 ? 1023 : 255;
+    const int shift = sampleSize == 2 ? 6 : 0;
+    auto put = [&](uint8_t *row, int index, int value) {
+        if (sampleSize == 2)
+            reinterpret_cast<uint16_t *>(row)[index] = (uint16_t)(value << shift);
+        else
+            row[index] = (uint8_t)value;
+    };
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int v = (x * maxCode / width + y * 7 + rand() % 9) % (maxCode + 1);
+            put(img->mPlane[0] + (size_t)y * img->mStride[0], x, v);
+        }
+    }
+    for (int y = 0; y < chromaHeight; y++) {
+        for (int x = 0; x < chromaWidth; x++) {
+            int u = x * maxCode / chromaWidth;
+            int v = maxCode - y * maxCode / chromaHeight;
+            if (format == YuvImage::Format::I420) {
+                put(img->mPlane[1] + (size_t)y * img->mStride[1], x, u);
+                put(img->mPlane[2] + (size_t)y * img->mStride[2], x, v);
+            } else {
+                put(img->mPlane[1] + (size_t)y * img->mStride[1], x * 2, u);
+                put(img->mPlane[1] + (size_t)y * img->mStride[1], x * 2 + 1, v);
+            }
+        }
+    }
+    return img;
+}
+
+// BT.709 SDR to gamma encoded RGB8 as the Plain render draws it
+static std::vector<uint8_t> Convert(const YuvImage &img) {
+    const bool deep = img.mFormat == YuvImage::Format::P010;
+    const float maxCode = deep ? 1023.0f : 255.0f;
+    const float unit = deep ? 4.0f : 1.0f;
+    auto get = [&](int plane, int index, int y) {
+        const uint8_t *row = img.mPlane[plane] + (size_t)y * img.mStride[plane];
+        return deep ? (float)(reinterpret_cast<const uint16_t *>(row)[index] >> 6) :
+            (float)row[index];
+    };
+    const float kr = 0.2126f;
+    const float kb = 0.0722f;
+    const float kg = 1.0f - kr - kb;
+    std::vector<uint8_t> rgb((size_t)img.mWidth * img.mHeight * 3);
+    for (int y = 0; y < img.mHeight; y++) {
+        for (int x = 0; x < img.mWidth; x++) {
+            float luma = get(0, x, y);
+            float cb, cr;
+            if (img.mFormat == YuvImage::Format::I420) {
+                cb = get(1, x / 2, y / 2);
+                cr = get(2, x / 2, y / 2);
+            } else {
+                cb = get(1, x / 2 * 2, y / 2);
+                cr = get(1, x / 2 * 2 + 1, y / 2);
+            }
+            if (img.mFullRange) {
+                luma /= maxCode;
+                cb = (cb - 128.0f * unit) / maxCode;
+                cr = (cr - 128.0f * unit) / maxCode;
+            } else {
+                luma = (luma - 16.0f * unit) / (219.0f * unit);
+                cb = (cb - 128.0f * unit) / (224.0f * unit);
+                cr = (cr - 128.0f * unit) / (224.0f * unit);
+            }
+            const float out[3] = {
+                luma + 2.0f * (1.0f - kr) * cr,
+                luma - 2.0f * kb * (1.0f - kb) / kg * cb - 2.0f * kr * (1.0f - kr) / kg * cr,
+                luma + 2.0f * (1.0f - kb) * cb,
+            };
+            for (int c = 0; c < 3; c++) {
+                rgb[((size_t)y * img.mWidth + x) * 3 + c] =
+                    (uint8_t)lroundf(std::min(std::max(out[c], 0.0f), 1.0f) * 255.0f);
+            }
+        }
+    }
+    return rgb;
+}
+
+int main()
+{
+    // odd sizes, so the chroma planes round up
+    const int width = 125;
+    const int height = 67;
+    if (OpenGL_Helper::CreatePbufferContext(width, height)) {
+        printf("no GL context\n");
+        return 1;
+    }
+    std::unique_ptr<Render> render(Render::Create("Plain"));
+    if (render->Init()) {
+        printf("FAIL: init\n");
+        return 1;
+    }
+
+    struct Case {
+        const char *mName;
+        YuvImage::Format mFormat;
+        bool mFullRange;
+        int mPad;
+    };
+    const Case cases[] = {
+        { "NV12 limited", YuvImage::Format::NV12, false, 0 },
+        { "NV12 full, padded", YuvImage::Format::NV12, true, 5 },
+        { "I420 limited, padded", YuvImage::Format::I420, false, 3 },
+        { "P010 limited", YuvImage::Format::P010, false, 0 },
+        { "P010 full, padded", YuvImage::Format::P010, true, 2 },
+    };
+    int ret = 0;
+    srand(1);
+    for (const Case &c : cases) {
+        auto img = CreateFrame(width, height, c.mFormat, c.mPad);
+        img->mFullRange = c.mFullRange;
+        if (render->UploadTexture(img) || render->Draw()) {
+            printf("FAIL: %s upload or draw\n", c.mName);
+            return 1;
+        }
+        std::vector<uint8_t> pixels((size_t)width * height * 4);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        const std::vector<uint8_t> ref = Convert(*img);
+        int maxDiff = 0;
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                const uint8_t *gl = &pixels[((size_t)(height - 1 - y) * width + x) * 4];
+                const uint8_t *cpu = &ref[((size_t)y * width + x) * 3];
+                for (int i = 0; i < 3; i++)
+                    maxDiff = std::max(maxDiff, abs(gl[i] - cpu[i]));
+            }
+        }
+        printf("%-22s max difference %d\n", c.mName, maxDiff);
+        if (maxDiff > 2) {
+            printf("FAIL: %s differs from the reference\n", c.mName);
+            ret = 1;
+        }
+    }
+
+    // a stride that is not whole samples has to be refused, not skewed
+    auto odd = CreateFrame(width, height, YuvImage::Format::NV12, 0);
+    odd->mStride[1] += 1;
+    if (render->UploadTexture(odd) == 0) {
+        printf("FAIL: stride of %d bytes for 2 byte samples accepted\n", odd->mStride[1]);
+        ret = 1;
+    }
+
+    if (!ret)
+        printf("PASS\n");
+    return ret;
+}
+
+#endif
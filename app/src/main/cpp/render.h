@@ -1,7 +1,10 @@
 #pragma once
 
 #include <memory>
+#include "compressed-image.h"
+#include "gl-stats.h"
 #include "image.h"
+#include "yuv-image.h"
 
 namespace quink {
 
@@ -27,7 +30,16 @@ public:
     virtual int Init(const ImageCoord &coord) = 0;
     virtual int UploadTexture(std::shared_ptr<Image<uint8_t>> img) = 0;
     virtual int UploadTexture(std::shared_ptr<Image<float>> img) = 0;
+    virtual int UploadTexture(std::shared_ptr<CompressedImage> img) = 0;
+    // planes are uploaded unconverted, the shader does matrix and transfer
+    virtual int UploadTexture(std::shared_ptr<YuvImage> img) = 0;
     virtual int Draw() = 0;
+    // 0 when ready to draw, 1 while shaders still compile, -1 on failure;
+    // never blocks, Draw() waits for whatever is left
+    virtual int Poll() { return 0; }
+
+    // GL work issued by this render so far
+    virtual GLStats::Counters GetGLCounters() const { return GLStats::Counters(); }
 };
 
 }
@@ -0,0 +1,120 @@
+/* Replays a frame capture without a window.
+ *
+ *   tonemap-replay [options] <capture>
+ *     --loop=N              replay the captured frames N times
+ *     --timing              CPU time of every GL call, by entry point
+ *     --finish-each-call    glFinish after every call, so the timing covers
+ *                           the GPU work as well
+ *
+ * Record a capture with tonemap --capture=<file>:<first frame>:<frames>.
+ * The checksum of the last frame tells whether two builds drew the same.
+ */
+#include "config.h"
+
+// the GL headers come with frame-replay.h
+#include "frame-replay.h"
+#if !HAVE_EGL && HAVE_GLES
+#   define GLFW_INCLUDE_NONE
+#   include <GLFW/glfw3.h>
+#endif
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "log.h"
+#include "opengl-helper.h"
+
+using namespace quink;
+
+#if HAVE_EGL
+static int CreateContext(int width, int height) {
+    return OpenGL_Helper::CreatePbufferContext(width, height);
+}
+#else
+// a hidden window
+static int CreateContext(int width, int height) {
+    if (!glfwInit())
+        return -1;
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#if HAVE_GLES
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_ES_API);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+#else
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#endif
+#ifdef __APPLE__
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+    GLFWwindow *window = glfwCreateWindow(width, height, "tonemap-replay", nullptr, nullptr);
+    if (!window) {
+        ALOGE("create hidden window failed");
+        return -1;
+    }
+    glfwMakeContextCurrent(window);
+    return 0;
+}
+#endif
+
+static uint64_t Checksum(int width, int height) {
+    std::vector<uint8_t> pixels((size_t)width * height * 4);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (uint8_t v : pixels)
+        h = (h ^ v) * 0x100000001b3ull;
+    return h;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> files;
+    std::map<std::string, std::string> options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0) {
+            files.push_back(arg);
+            continue;
+        }
+        auto pos = arg.find('=');
+        if (pos == std::string::npos)
+            options[arg.substr(2)] = "";
+        else
+            options[arg.substr(2, pos - 2)] = arg.substr(pos + 1);
+    }
+    if (files.size() != 1) {
+        ALOGE("usage: %s [--loop=N] [--timing] [--finish-each-call] <capture>", argv[0]);
+        return 1;
+    }
+
+    FrameReplay replay;
+    if (replay.Load(files[0]))
+        return 1;
+    int width = replay.GetWidth();
+    int height = replay.GetHeight();
+    if (width == 0 || height == 0) {
+        // nothing was drawn to the window before the capture stopped
+        width = 1280;
+        height = 720;
+    }
+    if (CreateContext(width, height))
+        return 1;
+
+    FrameReplay::Options replayOptions;
+    if (options.count("loop"))
+        replayOptions.mLoops = std::max(1, atoi(options["loop"].c_str()));
+    replayOptions.mTiming = options.count("timing") > 0;
+    replayOptions.mFinishEachCall = options.count("finish-each-call") > 0;
+    if (replay.Run(replayOptions))
+        return 1;
+
+    ALOGD("framebuffer checksum %016llx", (unsigned long long)Checksum(width, height));
+    return 0;
+}
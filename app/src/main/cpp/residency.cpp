@@ -0,0 +1,226 @@
+#include "residency.h"
+
+#include <algorithm>
+
+#include "gl-caps.h"
+#include "log.h"
+#include "texture-pool.h"
+#include "trace.h"
+
+namespace quink {
+
+// a failed reload is retried after 100 ms, doubled for each further failure
+static const int kMaxRetryShift = 6;
+static const std::chrono::milliseconds kRetryDelay(100);
+
+static size_t YuvBytes(const YuvImage &img) {
+    size_t bytes = (size_t)img.mStride[0] * img.mHeight;
+    for (int i = 1; i < img.Planes(); i++)
+        bytes += (size_t)img.mStride[i] * ((img.mHeight + 1) / 2);
+    return bytes;
+}
+
+size_t HostImage::HostBytes() const {
+    size_t bytes = 0;
+    if (mImage8)
+        bytes += (size_t)mImage8->mWidth * mImage8->mHeight * mImage8->mChannel;
+    if (mImageFloat)
+        bytes += (size_t)mImageFloat->mWidth * mImageFloat->mHeight * mImageFloat->mChannel * sizeof(float);
+    if (mCompressed)
+        bytes += mCompressed->mData.size();
+    if (mYuv)
+        bytes += YuvBytes(*mYuv);
+    return bytes;
+}
+
+size_t HostImage::GpuBytes() const {
+    if (mCompressed)
+        return mCompressed->mData.size();
+    if (mImage8)
+        return TexturePool::TextureSize(mImage8->mWidth, mImage8->mHeight, GL_RGBA8, 1);
+    if (mImageFloat) {
+        GLenum format = GLCaps::Instance().GetHdrFormat().mInternalFormat;
+        return TexturePool::TextureSize(mImageFloat->mWidth, mImageFloat->mHeight, format, 1);
+    }
+    // R8/RG8 or R16/RG16 planes, the same size as on the host
+    if (mYuv)
+        return YuvBytes(*mYuv);
+    return 0;
+}
+
+int HostImage::Upload(Render &render) const {
+    if (mCompressed)
+        return render.UploadTexture(mCompressed);
+    if (mImageFloat)
+        return render.UploadTexture(mImageFloat);
+    if (mImage8)
+        return render.UploadTexture(mImage8);
+    if (mYuv)
+        return render.UploadTexture(mYuv);
+    return -1;
+}
+
+ResidentImage::ResidentImage(const std::string &name, Loader loader, HostImage initial) :
+        mName(name),
+        mLoader(std::move(loader)),
+        mHost(std::move(initial)) {
+    Residency::Instance().Register(this);
+}
+
+ResidentImage::~ResidentImage() {
+    Residency::Instance().Unregister(this);
+}
+
+int ResidentImage::Upload(Render &render) {
+    Residency &residency = Residency::Instance();
+    Residency::Policy policy = residency.GetPolicy();
+
+    std::unique_lock<std::mutex> lock(residency.mLock);
+    if (mRender == &render && policy != Residency::Policy::Stream) {
+        // the policy may have changed since the upload
+        if (policy == Residency::Policy::Release)
+            mHost = HostImage();
+        return 0;
+    }
+
+    /* Loading and uploading can take long and run without the lock, so
+     * Report() and GetStats() from other threads don't wait for them. A
+     * Replace() or Invalidate() meanwhile wins over what they produce.
+     */
+    const uint64_t generation = mGeneration;
+    if (mHost.Empty()) {
+        if (!mLoader) {
+            ALOGE("image %s was released and has no loader", mName.c_str());
+            return -1;
+        }
+        if (mLoadFailures && std::chrono::steady_clock::now() < mRetryAt)
+            return -1;
+        lock.unlock();
+        HostImage host;
+        {
+            TRACE_SCOPE("ResidentImage::Load");
+            host = mLoader();
+        }
+        lock.lock();
+        if (host.Empty()) {
+            const int shift = std::min(mLoadFailures, kMaxRetryShift);
+            mLoadFailures++;
+            mRetryAt = std::chrono::steady_clock::now() + kRetryDelay * (1 << shift);
+            ALOGE("reload image %s failed %d times, retry in %lld ms", mName.c_str(),
+                    mLoadFailures, (long long)(kRetryDelay * (1 << shift)).count());
+            return -1;
+        }
+        mLoadFailures = 0;
+        if (generation == mGeneration) {
+            mHost = std::move(host);
+            mReloads++;
+            ALOGD("reloaded image %s, %zu bytes", mName.c_str(), mHost.HostBytes());
+        }
+    }
+
+    // shares the pixels, the host copy stays accounted for until it is done
+    const HostImage host = mHost;
+    lock.unlock();
+    int ret = host.Upload(render);
+    lock.lock();
+    if (ret < 0) {
+        ALOGE("upload image %s failed", mName.c_str());
+        mRender = nullptr;
+        return ret;
+    }
+    if (generation != mGeneration)
+        return 0;
+    mRender = &render;
+    mGpuBytes = host.GpuBytes();
+    if (policy == Residency::Policy::Release)
+        mHost = HostImage();
+    return 0;
+}
+
+void ResidentImage::Replace(HostImage host) {
+    std::lock_guard<std::mutex> lock(Residency::Instance().mLock);
+    mHost = std::move(host);
+    mRender = nullptr;
+    mGeneration++;
+    mLoadFailures = 0;
+}
+
+Residency &Residency::Instance() {
+    static Residency residency;
+    return residency;
+}
+
+void Residency::SetPolicy(Policy policy) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mPolicy = policy;
+}
+
+Residency::Policy Residency::GetPolicy() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mPolicy;
+}
+
+int Residency::ParsePolicy(const std::string &name, Policy &policy) {
+    if (name == "stream")
+        policy = Policy::Stream;
+    else if (name == "keep")
+        policy = Policy::Keep;
+    else if (name == "release")
+        policy = Policy::Release;
+    else
+        return -1;
+    return 0;
+}
+
+void Residency::Invalidate() {
+    std::lock_guard<std::mutex> lock(mLock);
+    for (ResidentImage *image : mImages) {
+        image->mRender = nullptr;
+        image->mGpuBytes = 0;
+        image->mGeneration++;
+    }
+}
+
+Residency::Stats Residency::GetStats() {
+    std::lock_guard<std::mutex> lock(mLock);
+    Stats stats;
+    for (ResidentImage *image : mImages) {
+        stats.mHostBytes += image->mHost.HostBytes();
+        stats.mGpuBytes += image->mGpuBytes;
+        stats.mImages++;
+        if (image->mRender)
+            stats.mResident++;
+        stats.mReloads += image->mReloads;
+    }
+    return stats;
+}
+
+void Residency::Report() {
+    std::lock_guard<std::mutex> lock(mLock);
+    static const char *policies[] = { "stream", "keep", "release" };
+    size_t host = 0;
+    size_t gpu = 0;
+    for (ResidentImage *image : mImages) {
+        size_t bytes = image->mHost.HostBytes();
+        ALOGD("image %s: host %zu KB, gpu %zu KB, %s, reloads %llu",
+                image->mName.c_str(), bytes / 1024, image->mGpuBytes / 1024,
+                image->mRender ? "resident" : "not resident",
+                (unsigned long long)image->mReloads);
+        host += bytes;
+        gpu += image->mGpuBytes;
+    }
+    ALOGD("residency %s: %zu images, host %zu KB, gpu %zu KB",
+            policies[static_cast<int>(mPolicy)], mImages.size(), host / 1024, gpu / 1024);
+}
+
+void Residency::Register(ResidentImage *image) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mImages.push_back(image);
+}
+
+void Residency::Unregister(ResidentImage *image) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mImages.erase(std::remove(mImages.begin(), mImages.end(), image), mImages.end());
+}
+
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "compressed-image.h"
+#include "image.h"
+#include "render.h"
+#include "yuv-image.h"
+
+namespace quink {
+
+// host copy of an image in whichever form it was produced
+struct HostImage {
+    std::shared_ptr<Image<uint8_t>> mImage8;
+    std::shared_ptr<Image<float>> mImageFloat;
+    std::shared_ptr<CompressedImage> mCompressed;
+    std::shared_ptr<YuvImage> mYuv;
+
+    bool Empty() const { return !mImage8 && !mImageFloat && !mCompressed && !mYuv; }
+    size_t HostBytes() const;
+    // size of the texture Upload() creates
+    size_t GpuBytes() const;
+    // compressed first, it is the smallest upload
+    int Upload(Render &render) const;
+};
+
+/* An image shown by one render, with its host copy kept or dropped by the
+ * residency policy.
+ *
+ * Upload() gives the render the pixels when it doesn't have them, reloading
+ * the host copy with the loader first if it was released. After the context
+ * is lost, Residency::Invalidate() marks every image as not resident and the
+ * next Upload() restores it. A failed reload is retried after a delay that
+ * doubles up to a few seconds, Upload() fails without loading until then.
+ */
+class ResidentImage {
+public:
+    using Loader = std::function<HostImage()>;
+
+    // initial may be empty, then the first Upload() calls the loader
+    ResidentImage(const std::string &name, Loader loader, HostImage initial = HostImage());
+    ~ResidentImage();
+
+    ResidentImage(const ResidentImage &) = delete;
+    ResidentImage &operator=(const ResidentImage &) = delete;
+
+    int Upload(Render &render);
+    // new pixels, e.g. the full image after a preview; the next Upload() takes them
+    void Replace(HostImage host);
+
+    const std::string &GetName() const { return mName; }
+
+private:
+    friend class Residency;
+
+    const std::string mName;
+    Loader mLoader;
+    HostImage mHost;
+    // the render holding the pixels, null when not resident
+    Render *mRender = nullptr;
+    size_t mGpuBytes = 0;
+    uint64_t mReloads = 0;
+    // bumped by Replace() and Invalidate(), an upload started before is stale
+    uint64_t mGeneration = 0;
+    // reloads failed in a row and when the loader may run again
+    int mLoadFailures = 0;
+    std::chrono::steady_clock::time_point mRetryAt;
+};
+
+class Residency {
+public:
+    enum class Policy {
+        Stream,     // host copies stay, uploaded every frame
+        Keep,       // host copies stay, uploaded once
+        Release,    // host copies dropped once uploaded, reloaded when needed
+    };
+
+    struct Stats {
+        size_t mHostBytes = 0;
+        size_t mGpuBytes = 0;
+        int mImages = 0;
+        int mResident = 0;
+        uint64_t mReloads = 0;
+    };
+
+    static Residency &Instance();
+
+    void SetPolicy(Policy policy);
+    Policy GetPolicy();
+    // stream, keep or release, returns -1 for anything else
+    static int ParsePolicy(const std::string &name, Policy &policy);
+
+    // the GPU copies are gone, e.g. the context was recreated
+    void Invalidate();
+
+    Stats GetStats();
+    void Report();
+
+private:
+    friend class ResidentImage;
+
+    Residency() = default;
+
+    void Register(ResidentImage *image);
+    void Unregister(ResidentImage *image);
+
+    std::mutex mLock;
+    Policy mPolicy = Policy::Keep;
+    std::vector<ResidentImage *> mImages;
+};
+
+}
@@ -0,0 +1,261 @@
+#include "resolution-controller.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "log.h"
+
+namespace quink {
+
+// probing backs off to once every this many frames at most
+static const int kMaxProbeFrames = 4800;
+// below this the image is hardly recognizable
+static const float kMinScale = 0.1f;
+
+ResolutionController::ResolutionController() :
+    ResolutionController(Config())
+{
+}
+
+ResolutionController::ResolutionController(const Config &config) :
+    mConfig(config),
+    mProbeFrames(config.mProbeFrames)
+{
+    mConfig.mMinScale = std::max(mConfig.mMinScale, kMinScale);
+    mConfig.mMaxScale = std::max(mConfig.mMaxScale, mConfig.mMinScale);
+    mConfig.mWindow = std::max(mConfig.mWindow, 1);
+    mScale = mConfig.mMaxScale;
+    mStats.mScale = mScale;
+}
+
+void ResolutionController::Pin(float scale) {
+    mPinned = scale > 0.0f;
+    if (mPinned) {
+        // may be below the adaptive range, never above it. Not an increase
+        // or decrease of the adaptation, so SetScale is not the way
+        scale = std::min(std::max(scale, kMinScale), mConfig.mMaxScale);
+        if (scale != mScale)
+            ALOGD("render scale %.2f -> %.2f, pinned", mScale, scale);
+        mScale = scale;
+        mStats.mScale = scale;
+        // an increase before the pin says nothing about the pinned scale
+        mSinceIncrease = -1;
+    }
+    mSumMs = 0.0;
+    mCount = 0;
+    mStableFrames = 0;
+}
+
+float ResolutionController::Clamp(float scale) const {
+    // whole percents, so small corrections don't reallocate the target
+    scale = floorf(scale * 100.0f + 0.5f) / 100.0f;
+    return std::min(std::max(scale, mConfig.mMinScale), mConfig.mMaxScale);
+}
+
+void ResolutionController::SetScale(float scale, float averageMs) {
+    scale = Clamp(scale);
+    if (scale == mScale)
+        return;
+    ALOGD("render scale %.2f -> %.2f, frame time %.2f ms", mScale, scale, averageMs);
+    if (scale > mScale) {
+        mLastGoodScale = mScale;
+        mStats.mIncreases++;
+        mSinceIncrease = 0;
+    } else {
+        mStats.mDecreases++;
+    }
+    mScale = scale;
+    mStats.mScale = scale;
+}
+
+bool ResolutionController::Update(const std::chrono::high_resolution_clock::duration &frameTime) {
+    mStats.mFrames++;
+    if (mSinceIncrease >= 0)
+        mSinceIncrease++;
+
+    mSumMs += std::chrono::duration<double, std::milli>(frameTime).count();
+    if (++mCount < mConfig.mWindow)
+        return false;
+    const float averageMs = (float)(mSumMs / mCount);
+    mStats.mAverageMs = averageMs;
+    mSumMs = 0.0;
+    mCount = 0;
+    if (mPinned)
+        return false;
+
+    const float previous = mScale;
+    const float target = mConfig.mTargetMs;
+    if (averageMs > target * mConfig.mDownThreshold) {
+        // the cost is roughly proportional to the pixel count
+        float scale = std::min(mScale * sqrtf(target / averageMs), mScale - mConfig.mStep);
+        if (mSinceIncrease >= 0 && mSinceIncrease <= 2 * mConfig.mWindow) {
+            // the last increase didn't fit, the scale before it did
+            scale = std::max(scale, mLastGoodScale);
+            mProbeFrames = std::min(mProbeFrames * 2, kMaxProbeFrames);
+        }
+        mStableFrames = 0;
+        SetScale(scale, averageMs);
+    } else if (averageMs < target * mConfig.mUpThreshold) {
+        mStableFrames = 0;
+        SetScale(mScale + mConfig.mStep, averageMs);
+    } else {
+        mStableFrames += mConfig.mWindow;
+        if (mStableFrames >= mProbeFrames && mScale < mConfig.mMaxScale) {
+            mStableFrames = 0;
+            SetScale(mScale + mConfig.mStep, averageMs);
+        }
+    }
+    return mScale != previous;
+}
+
+}
+
+#ifdef TEST_RESOLUTION_CONTROLLER
+/* g++ -std=c++11 -DTEST_RESOLUTION_CONTROLLER -I. resolution-controller.cpp
+ */
+#include <stdio.h>
+
+#include <vector>
+
+namespace {
+
+using namespace quink;
+
+/* A renderer whose frame time is proportional to the pixel count plus a
+ * fixed overhead, optionally with vsync and per frame noise of +-noise.
+ */
+struct Load {
+    double mCostMs;
+    double mVsyncMs = 0.0;
+    double mNoise = 0.0;
+    uint32_t mState = 1;
+
+    explicit Load(double costMs) : mCostMs(costMs) { }
+
+    std::chrono::high_resolution_clock::duration FrameTime(float scale) {
+        double ms = 2.0 + mCostMs * scale * scale;
+        if (mNoise > 0.0) {
+            mState = mState * 1664525u + 1013904223u;
+            ms *= 1.0 + mNoise * ((mState >> 8) / double(1 << 24) * 2.0 - 1.0);
+        }
+        if (mVsyncMs > 0.0)
+            ms = ceil(ms / mVsyncMs) * mVsyncMs;
+        return std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+                std::chrono::duration<double, std::milli>(ms));
+    }
+};
+
+struct Run {
+    std::vector<int> mIncreases;    // frames the scale went up at
+};
+
+Run Drive(ResolutionController &controller, Load &load, int frames) {
+    Run run;
+    for (int i = 0; i < frames; i++) {
+        const float scale = controller.GetScale();
+        if (controller.Update(load.FrameTime(scale)) && controller.GetScale() > scale)
+            run.mIncreases.push_back(i);
+    }
+    return run;
+}
+
+int gFailures = 0;
+
+void Check(bool ok, const char *what) {
+    printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+    gFailures += !ok;
+}
+
+}
+
+int main()
+{
+    ResolutionController::Config config;
+
+    {
+        // far over the budget at full scale, fits at about 0.6
+        ResolutionController controller(config);
+        Load load(40.0);
+        Run run = Drive(controller, load, 10 * config.mWindow);
+        const float scale = controller.GetScale();
+        const double ms = 2.0 + 40.0 * scale * scale;
+        printf("over budget: scale %.2f, %.2f ms after %d frames\n", scale, ms,
+                10 * config.mWindow);
+        Check(ms <= config.mTargetMs * config.mDownThreshold, "converges under the budget");
+        Check(scale >= 0.5f, "doesn't drop further than needed");
+        Check(controller.GetStats().mDecreases <= 3, "converges within three decreases");
+
+        // probes above it fail and back off, the scale stays put otherwise
+        const uint64_t decreases = controller.GetStats().mDecreases;
+        run = Drive(controller, load, 6000);
+        printf("sustained: %zu probes, scale %.2f\n", run.mIncreases.size(),
+                controller.GetScale());
+        Check(controller.GetScale() == scale, "stays at the converged scale");
+        Check(controller.GetStats().mDecreases - decreases == run.mIncreases.size(),
+                "every probe is undone once");
+        bool backoff = true;
+        for (size_t i = 1; i < run.mIncreases.size(); i++)
+            backoff &= run.mIncreases[i] - run.mIncreases[i - 1] >= config.mProbeFrames * (1 << i);
+        Check(run.mIncreases.size() <= 5 && backoff, "probes back off exponentially");
+    }
+
+    {
+        // hovering around the budget with noisy frame times
+        ResolutionController controller(config);
+        Load load((config.mTargetMs - 2.0) / (0.8 * 0.8));
+        load.mNoise = 0.08;
+        Drive(controller, load, 20 * config.mWindow);
+        const float scale = controller.GetScale();
+        const uint64_t increases = controller.GetStats().mIncreases;
+        const uint64_t decreases = controller.GetStats().mDecreases;
+        Run run = Drive(controller, load, 6000);
+        const uint64_t changes = controller.GetStats().mIncreases - increases +
+                controller.GetStats().mDecreases - decreases;
+        printf("near budget: scale %.2f, %llu changes in 6000 frames\n", scale,
+                (unsigned long long)changes);
+        Check(controller.GetScale() == scale, "holds the scale near the budget");
+        Check(changes <= 2 * run.mIncreases.size() && run.mIncreases.size() <= 5,
+                "no oscillation besides backed off probes");
+    }
+
+    {
+        // vsync at 60 Hz hides the headroom, the probes find it
+        ResolutionController controller(config);
+        Load load(30.0);
+        load.mVsyncMs = 16.7;
+        Drive(controller, load, 3000);
+        const float scale = controller.GetScale();
+        printf("vsync: scale %.2f\n", scale);
+        Check(2.0 + 30.0 * scale * scale <= 16.7, "fits the refresh interval");
+        Check(2.0 + 30.0 * (scale + config.mStep) * (scale + config.mStep) > 16.7,
+                "one step up would not");
+    }
+
+    {
+        ResolutionController controller(config);
+        Load load(40.0);
+        Drive(controller, load, 10 * config.mWindow);
+        const auto stats = controller.GetStats();
+        controller.Pin(0.9f);
+        Check(controller.GetScale() == 0.9f, "pins the scale");
+        Check(controller.GetStats().mIncreases == stats.mIncreases,
+                "pinning above isn't an increase");
+        Drive(controller, load, 300);
+        Check(controller.GetScale() == 0.9f, "the pinned scale holds over budget");
+        controller.Pin(5.0f);
+        Check(controller.GetScale() == config.mMaxScale, "pins at most the max scale");
+
+        // back to adapting, from the pinned scale without a rollback
+        controller.Pin(0.0f);
+        Drive(controller, load, config.mWindow);
+        Check(controller.GetScale() < 0.9f &&
+                controller.GetScale() < config.mMaxScale - config.mStep,
+                "adapts again after unpinning");
+    }
+
+    printf("%s\n", gFailures ? "FAIL" : "PASS");
+    return gFailures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <chrono>
+
+namespace quink {
+
+/* Picks the render scale from measured frame times.
+ *
+ * Frame times are averaged over a window of frames. When the average is over
+ * the target by more than the down threshold the scale drops, by the amount
+ * the pixel count has to shrink to meet the target and at least one step.
+ * An average well under the target raises the scale one step right away.
+ * With vsync the frame time sticks to the refresh interval and never shows
+ * headroom, so after enough windows inside the band the scale is raised one
+ * step as a probe. An increase that misses the target within two windows is
+ * undone, back to the scale before it, and doubles the number of frames to
+ * wait before the next probe.
+ *
+ * The scale applies to width and height, 1.0 renders at full resolution.
+ * A pinned scale is never changed, e.g. for benchmarking.
+ */
+class ResolutionController {
+public:
+    struct Config {
+        float mTargetMs = 16.7f;
+        float mMinScale = 0.5f;
+        float mMaxScale = 1.0f;
+        float mStep = 0.1f;
+        int mWindow = 30;               // frames averaged per decision
+        float mDownThreshold = 1.1f;    // of the target
+        float mUpThreshold = 0.75f;     // of the target
+        int mProbeFrames = 300;         // inside the band before probing up
+    };
+
+    struct Stats {
+        float mScale = 1.0f;
+        float mAverageMs = 0.0f;        // of the last window
+        uint64_t mIncreases = 0;
+        uint64_t mDecreases = 0;
+        uint64_t mFrames = 0;
+    };
+
+    ResolutionController();
+    explicit ResolutionController(const Config &config);
+
+    // scale <= 0 unpins, others are clamped to [0.1, mMaxScale]
+    void Pin(float scale);
+    bool IsPinned() const { return mPinned; }
+
+    // returns true when the scale has changed
+    bool Update(const std::chrono::high_resolution_clock::duration &frameTime);
+
+    float GetScale() const { return mScale; }
+    const Stats &GetStats() const { return mStats; }
+
+private:
+    float Clamp(float scale) const;
+    void SetScale(float scale, float averageMs);
+
+    Config mConfig;
+    float mScale;
+    bool mPinned = false;
+
+    double mSumMs = 0.0;
+    int mCount = 0;
+    int mStableFrames = 0;
+    int mProbeFrames;
+    // frames since the scale was last raised, -1 before the first time
+    int64_t mSinceIncrease = -1;
+    float mLastGoodScale = 0.0f;
+
+    Stats mStats;
+};
+
+}
@@ -0,0 +1,180 @@
+#include "scaled-render.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "gl-hooks.h"
+#include "gl-state.h"
+#include "log.h"
+#include "opengl-helper.h"
+#include "texture-pool.h"
+#include "trace.h"
+
+namespace quink {
+
+ScaledRender::ScaledRender(Render *render, std::shared_ptr<ResolutionController> controller) :
+    mRender(render),
+    mController(controller),
+    mCoord()
+{
+}
+
+ScaledRender::~ScaledRender() {
+    ReleaseTarget();
+}
+
+int ScaledRender::Init() {
+    const ImageCoord coord = {
+        {-1.0f, 1.0f},
+        {-1.0f, -1.0f},
+        {1.0f, -1.0f},
+        {1.0f, 1.0f}
+    };
+    return Init(coord);
+}
+
+int ScaledRender::Init(const ImageCoord &coord) {
+    mCoord = coord;
+    return mRender->Init(coord);
+}
+
+int ScaledRender::UploadTexture(std::shared_ptr<Image<uint8_t>> img) {
+    return mRender->UploadTexture(img);
+}
+
+int ScaledRender::UploadTexture(std::shared_ptr<Image<float>> img) {
+    return mRender->UploadTexture(img);
+}
+
+int ScaledRender::UploadTexture(std::shared_ptr<CompressedImage> img) {
+    return mRender->UploadTexture(img);
+}
+
+int ScaledRender::UploadTexture(std::shared_ptr<YuvImage> img) {
+    return mRender->UploadTexture(img);
+}
+
+int ScaledRender::Poll() {
+    return mRender->Poll();
+}
+
+GLStats::Counters ScaledRender::GetGLCounters() const {
+    GLStats::Counters counters = mCounters;
+    counters += mRender->GetGLCounters();
+    return counters;
+}
+
+int ScaledRender::PrepareTarget(GLsizei width, GLsizei height) {
+    if (mTexture && mWidth == width && mHeight == height)
+        return 0;
+
+    GLStats::Scope stats(mCounters);
+    TexturePool &pool = TexturePool::Instance();
+    if (mTexture)
+        pool.Release(mTexture);
+    mTexture = pool.Acquire(width, height, GL_RGBA8);
+    if (!mTexture)
+        return -1;
+    mWidth = width;
+    mHeight = height;
+
+    GLState &state = GLState::Current();
+    if (!mFbo)
+        glGenFramebuffers(1, &mFbo);
+    state.BindFramebuffer(GL_DRAW_FRAMEBUFFER, mFbo);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mTexture, 0);
+    GLenum status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+    CheckGLError();
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        ALOGE("render target %dx%d incomplete, 0x%x", width, height, status);
+        return -1;
+    }
+    ALOGD("render target %dx%d", width, height);
+    return 0;
+}
+
+void ScaledRender::ReleaseTarget() {
+    if (mFbo) {
+        GLState::Current().DeleteFramebuffers(1, &mFbo);
+        mFbo = 0;
+    }
+    if (mTexture) {
+        TexturePool::Instance().Release(mTexture);
+        mTexture = 0;
+    }
+    mWidth = 0;
+    mHeight = 0;
+}
+
+int ScaledRender::Draw() {
+    const float scale = mController->GetScale();
+    if (scale >= 1.0f || mDisabled) {
+        if (mTexture)
+            ReleaseTarget();
+        return mRender->Draw();
+    }
+
+    TRACE_GL_SCOPE("ScaledRender::Draw");
+    GLStats::Scope stats(mCounters);
+    GLState &state = GLState::Current();
+    const GLuint output = state.GetDrawFramebuffer();
+    if (!mFbo) {
+        GLint sampleBuffers = 0;
+        glGetIntegerv(GL_SAMPLE_BUFFERS, &sampleBuffers);
+        if (sampleBuffers) {
+            ALOGE("multisampled output, render scale ignored");
+            mDisabled = true;
+            return mRender->Draw();
+        }
+    }
+
+    // area of the quad on the output, in pixels
+    GLint viewport[4];
+    state.GetViewport(viewport);
+    const Coordinate corners[] = {
+        mCoord.mTopLeft, mCoord.mBottomLeft, mCoord.mBottomRight, mCoord.mTopRight,
+    };
+    float left = corners[0].mX, right = left, bottom = corners[0].mY, top = bottom;
+    for (const auto &c : corners) {
+        left = std::min(left, c.mX);
+        right = std::max(right, c.mX);
+        bottom = std::min(bottom, c.mY);
+        top = std::max(top, c.mY);
+    }
+    const GLint x0 = viewport[0] + lroundf((left + 1.0f) * 0.5f * viewport[2]);
+    const GLint x1 = viewport[0] + lroundf((right + 1.0f) * 0.5f * viewport[2]);
+    const GLint y0 = viewport[1] + lroundf((bottom + 1.0f) * 0.5f * viewport[3]);
+    const GLint y1 = viewport[1] + lroundf((top + 1.0f) * 0.5f * viewport[3]);
+    if (x1 <= x0 || y1 <= y0)
+        return 0;
+
+    const GLsizei width = std::max(1L, lroundf((x1 - x0) * scale));
+    const GLsizei height = std::max(1L, lroundf((y1 - y0) * scale));
+    if (PrepareTarget(width, height)) {
+        ReleaseTarget();
+        mDisabled = true;
+        return mRender->Draw();
+    }
+
+    // the same viewport shrunk and moved so the quad covers the target
+    const float sx = (float)width / (x1 - x0);
+    const float sy = (float)height / (y1 - y0);
+    state.BindFramebuffer(GL_DRAW_FRAMEBUFFER, mFbo);
+    state.Viewport(lroundf((viewport[0] - x0) * sx), lroundf((viewport[1] - y0) * sy),
+            lroundf(viewport[2] * sx), lroundf(viewport[3] * sy));
+    // rounding may leave a border row uncovered, and clearing saves a
+    // tile load on tiled GPUs
+    glClear(GL_COLOR_BUFFER_BIT);
+    int ret = mRender->Draw();
+
+    state.BindFramebuffer(GL_DRAW_FRAMEBUFFER, output);
+    state.Viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    state.BindFramebuffer(GL_READ_FRAMEBUFFER, mFbo);
+    glBlitFramebuffer(0, 0, width, height, x0, y0, x1, y1, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    state.BindFramebuffer(GL_READ_FRAMEBUFFER, output);
+    CheckGLError();
+    return ret;
+}
+
+}
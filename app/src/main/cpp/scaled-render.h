@@ -0,0 +1,62 @@
+#pragma once
+
+#include "config.h"
+#if HAVE_GLES
+#   include <GLES3/gl3.h>
+#else
+#   define GLFW_INCLUDE_GLCOREARB
+#   define GL_GLEXT_PROTOTYPES
+#   define GLFW_INCLUDE_GLEXT
+#   include <GLFW/glfw3.h>
+#endif
+
+#include <memory>
+
+#include "render.h"
+#include "resolution-controller.h"
+
+namespace quink {
+
+/* Draws another render at a reduced resolution.
+ *
+ * The inner render draws into an offscreen target sized by the scale of the
+ * controller, which is then stretched onto the area of the ImageCoord with a
+ * linear filtered blit. At scale 1.0 the inner render draws directly and the
+ * target is given back to the TexturePool. Several renders can share one
+ * controller to scale the whole frame.
+ */
+class ScaledRender : public Render {
+public:
+    // takes ownership of render
+    ScaledRender(Render *render, std::shared_ptr<ResolutionController> controller);
+    ~ScaledRender() override;
+
+    int Init() override;
+    int Init(const ImageCoord &coord) override;
+    int UploadTexture(std::shared_ptr<Image<uint8_t>> img) override;
+    int UploadTexture(std::shared_ptr<Image<float>> img) override;
+    int UploadTexture(std::shared_ptr<CompressedImage> img) override;
+    int UploadTexture(std::shared_ptr<YuvImage> img) override;
+    int Draw() override;
+    int Poll() override;
+
+    GLStats::Counters GetGLCounters() const override;
+
+private:
+    int PrepareTarget(GLsizei width, GLsizei height);
+    void ReleaseTarget();
+
+    std::unique_ptr<Render> mRender;
+    std::shared_ptr<ResolutionController> mController;
+    ImageCoord mCoord;
+    // blitting into a multisampled window surface is not allowed
+    bool mDisabled = false;
+
+    GLuint mFbo = 0;
+    GLuint mTexture = 0;
+    GLsizei mWidth = 0;
+    GLsizei mHeight = 0;
+    GLStats::Counters mCounters;
+};
+
+}
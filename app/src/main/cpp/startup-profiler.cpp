@@ -0,0 +1,103 @@
+#include "startup-profiler.h"
+
+#include <algorithm>
+
+#include "log.h"
+
+namespace quink {
+
+StartupProfiler::Phase::Phase(const char *name) :
+        mName(name),
+        mBegin(Clock::now()) {
+}
+
+StartupProfiler::Phase::~Phase() {
+    StartupProfiler::Instance().Record(mName, mBegin, Clock::now());
+}
+
+StartupProfiler &StartupProfiler::Instance() {
+    static StartupProfiler profiler;
+    return profiler;
+}
+
+void StartupProfiler::Start() {
+    std::lock_guard<std::mutex> lock(mLock);
+    mStart = Clock::now();
+    mStarted = true;
+    mDone = false;
+    mEntries.clear();
+}
+
+void StartupProfiler::Record(const char *name, Clock::time_point begin, Clock::time_point end) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (!mStarted || mDone)
+        return;
+    mEntries.push_back({ name, std::this_thread::get_id(), begin, end });
+}
+
+void StartupProfiler::FirstFrame() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (!mStarted || mDone)
+        return;
+    mFirstFrame = Clock::now();
+    mCriticalThread = std::this_thread::get_id();
+    mDone = true;
+    ReportLocked();
+}
+
+bool StartupProfiler::IsDone() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mDone;
+}
+
+double StartupProfiler::GetTimeToFirstFrame() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mDone ? ToMs(mFirstFrame) : -1.0;
+}
+
+double StartupProfiler::ToMs(Clock::time_point t) const {
+    return std::chrono::duration<double, std::milli>(t - mStart).count();
+}
+
+void StartupProfiler::ReportLocked() {
+    std::stable_sort(mEntries.begin(), mEntries.end(),
+            [](const Entry &a, const Entry &b) { return a.mBegin < b.mBegin; });
+
+    ALOGD("time to first frame %.1f ms, critical path:", ToMs(mFirstFrame));
+    // nested phases are listed but counted once
+    Clock::time_point covered = mStart;
+    Clock::duration recorded(0);
+    for (const Entry &e : mEntries) {
+        if (e.mThread != mCriticalThread)
+            continue;
+        ALOGD("    %8.1f ms %8.1f ms  %s", ToMs(e.mBegin), ToMs(e.mEnd) - ToMs(e.mBegin), e.mName);
+        Clock::time_point begin = std::max(e.mBegin, covered);
+        Clock::time_point end = std::min(e.mEnd, mFirstFrame);
+        if (end > begin) {
+            recorded += end - begin;
+            covered = end;
+        }
+    }
+    ALOGD("    %8s    %8.1f ms  not in any phase", "",
+            std::chrono::duration<double, std::milli>(mFirstFrame - mStart - recorded).count());
+
+    std::vector<std::thread::id> threads;
+    Clock::duration overlapped(0);
+    for (const Entry &e : mEntries) {
+        if (e.mThread == mCriticalThread)
+            continue;
+        if (threads.empty())
+            ALOGD("off the critical path:");
+        auto it = std::find(threads.begin(), threads.end(), e.mThread);
+        if (it == threads.end())
+            it = threads.insert(threads.end(), e.mThread);
+        ALOGD("    %8.1f ms %8.1f ms  %s, worker %d", ToMs(e.mBegin),
+                ToMs(e.mEnd) - ToMs(e.mBegin), e.mName, (int)(it - threads.begin()));
+        overlapped += e.mEnd - e.mBegin;
+    }
+    if (!threads.empty())
+        ALOGD("    %.1f ms of work on %zu workers",
+                std::chrono::duration<double, std::milli>(overlapped).count(), threads.size());
+}
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace quink {
+
+/* Time to first frame and where it went.
+ *
+ * Phases are recorded from any thread between Start() and FirstFrame().
+ * Those of the thread presenting the first frame form the critical path,
+ * with a wait phase showing how long it sat on work from other threads.
+ * The phases of the other threads are the work taken off the path.
+ *
+ * Phase names are stored by pointer and must be string literals.
+ */
+class StartupProfiler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    class Phase {
+    public:
+        explicit Phase(const char *name);
+        ~Phase();
+
+        Phase(const Phase &) = delete;
+        Phase &operator=(const Phase &) = delete;
+
+    private:
+        const char *mName;
+        Clock::time_point mBegin;
+    };
+
+    static StartupProfiler &Instance();
+
+    // zero of the timeline, forgets earlier phases
+    void Start();
+    void Record(const char *name, Clock::time_point begin, Clock::time_point end);
+    // ends startup and logs the report, only the first call counts
+    void FirstFrame();
+    bool IsDone();
+    // milliseconds, negative before FirstFrame()
+    double GetTimeToFirstFrame();
+
+private:
+    struct Entry {
+        const char *mName;
+        std::thread::id mThread;
+        Clock::time_point mBegin;
+        Clock::time_point mEnd;
+    };
+
+    StartupProfiler() = default;
+
+    void ReportLocked();
+    double ToMs(Clock::time_point t) const;
+
+    std::mutex mLock;
+    Clock::time_point mStart;
+    Clock::time_point mFirstFrame;
+    std::thread::id mCriticalThread;
+    bool mStarted = false;
+    bool mDone = false;
+    std::vector<Entry> mEntries;
+};
+
+}
@@ -0,0 +1,152 @@
+#include "texture-cache.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "etc2-encoder.h"
+#include "log.h"
+#include "trace.h"
+
+namespace quink {
+
+namespace {
+
+const uint32_t kMagic = 0x31435451;     // "QTC1"
+// larger than any texture a GPU takes
+const int32_t kMaxSize = 1 << 15;
+
+struct Header {
+    uint32_t mMagic;
+    uint32_t mFormat;
+    int32_t mWidth;
+    int32_t mHeight;
+    float mGamma;
+    float mRange;
+    uint64_t mKey;
+    uint64_t mSize;
+};
+
+// bytes of the blocks of a width x height image, 0 for formats not cached
+uint64_t BlocksSize(uint32_t format, int32_t width, int32_t height) {
+    uint64_t blockSize;
+    switch (format) {
+        case Etc2Encoder::kFormatRGB8:
+        case Etc2Encoder::kFormatSRGB8:
+            blockSize = 8;
+            break;
+        case Etc2Encoder::kFormatRGBA8:
+            blockSize = 16;
+            break;
+        default:
+            return 0;
+    }
+    return (uint64_t)((width + 3) / 4) * ((height + 3) / 4) * blockSize;
+}
+
+}
+
+TextureCache::TextureCache(const std::string &dir) :
+    mDir(dir) {
+}
+
+uint64_t TextureCache::Hash(const void *data, size_t size, uint64_t hash) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+int TextureCache::HashFile(const std::string &path, uint64_t &hash) {
+    TRACE_SCOPE("TextureCache::HashFile");
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+        return -1;
+    uint8_t buf[64 * 1024];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+        hash = Hash(buf, n, hash);
+    bool failed = ferror(file);
+    fclose(file);
+    return failed ? -1 : 0;
+}
+
+std::string TextureCache::PathOf(uint64_t key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "/%016" PRIx64 ".etc", key);
+    return mDir + name;
+}
+
+std::shared_ptr<CompressedImage> TextureCache::Load(uint64_t key) {
+    TRACE_SCOPE("TextureCache::Load");
+    const std::string path = PathOf(key);
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+        return nullptr;
+
+    std::shared_ptr<CompressedImage> img;
+    Header header;
+    struct stat st;
+    // the size has to be the one of the blocks and of what is left in the
+    // file, before anything is allocated for it
+    if (fread(&header, sizeof(header), 1, file) == 1 && header.mMagic == kMagic &&
+            header.mKey == key && header.mWidth > 0 && header.mHeight > 0 &&
+            header.mWidth <= kMaxSize && header.mHeight <= kMaxSize &&
+            !fstat(fileno(file), &st) &&
+            header.mSize == BlocksSize(header.mFormat, header.mWidth, header.mHeight) &&
+            header.mSize == (uint64_t)st.st_size - sizeof(header)) {
+        img = std::make_shared<CompressedImage>();
+        img->mWidth = header.mWidth;
+        img->mHeight = header.mHeight;
+        img->mFormat = header.mFormat;
+        img->mGamma = header.mGamma;
+        img->mRange = header.mRange;
+        img->mData.resize(header.mSize);
+        if (fread(img->mData.data(), 1, header.mSize, file) != header.mSize)
+            img = nullptr;
+    }
+    fclose(file);
+    if (!img)
+        ALOGE("ignore corrupted cache entry %s", path.c_str());
+    return img;
+}
+
+int TextureCache::Store(uint64_t key, const CompressedImage &img) {
+    TRACE_SCOPE("TextureCache::Store");
+    if (mkdir(mDir.c_str(), 0755) && errno != EEXIST) {
+        ALOGE("cannot create cache directory %s", mDir.c_str());
+        return -1;
+    }
+
+    const std::string path = PathOf(key);
+    const std::string tmp = path + ".tmp";
+    FILE *file = fopen(tmp.c_str(), "wb");
+    if (!file) {
+        ALOGE("cannot open %s", tmp.c_str());
+        return -1;
+    }
+    Header header;
+    header.mMagic = kMagic;
+    header.mFormat = img.mFormat;
+    header.mWidth = img.mWidth;
+    header.mHeight = img.mHeight;
+    header.mGamma = img.mGamma;
+    header.mRange = img.mRange;
+    header.mKey = key;
+    header.mSize = img.mData.size();
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(img.mData.data(), 1, img.mData.size(), file) == img.mData.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str())) {
+        ALOGE("write cache entry %s failed", path.c_str());
+        remove(tmp.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+
+#include "compressed-image.h"
+
+namespace quink {
+
+/* On disk store of encoded textures keyed by a content hash.
+ *
+ * Keys are 64-bit FNV-1a hashes, chained over everything that affects the
+ * result: source bytes, encoder version and options. Each entry is one file
+ * named after its key, written to a temporary name and renamed so a crash
+ * never leaves a truncated entry behind. Entries failing the header check,
+ * which includes a data size matching the dimensions, the format and the
+ * file, are treated as misses.
+ */
+class TextureCache {
+public:
+    static const uint64_t kHashSeed = 0xcbf29ce484222325ull;
+
+    explicit TextureCache(const std::string &dir);
+
+    static uint64_t Hash(const void *data, size_t size, uint64_t hash = kHashSeed);
+    // hash of a whole file, -1 if it cannot be read
+    static int HashFile(const std::string &path, uint64_t &hash);
+
+    std::shared_ptr<CompressedImage> Load(uint64_t key);
+    int Store(uint64_t key, const CompressedImage &img);
+
+private:
+    std::string PathOf(uint64_t key) const;
+
+    std::string mDir;
+};
+
+}
@@ -0,0 +1,219 @@
+#include "texture-pool.h"
+
+#include "gl-hooks.h"
+#include "gl-state.h"
+#include "gl-stats.h"
+#include "log.h"
+#include "trace.h"
+
+#ifndef GL_COMPRESSED_R11_EAC
+#define GL_COMPRESSED_R11_EAC                           0x9270
+#define GL_COMPRESSED_SIGNED_R11_EAC                    0x9271
+#define GL_COMPRESSED_RG11_EAC                          0x9272
+#define GL_COMPRESSED_SIGNED_RG11_EAC                   0x9273
+#define GL_COMPRESSED_RGB8_ETC2                         0x9274
+#define GL_COMPRESSED_SRGB8_ETC2                        0x9275
+#define GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2     0x9276
+#define GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2    0x9277
+#define GL_COMPRESSED_RGBA8_ETC2_EAC                    0x9278
+#define GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC             0x9279
+#endif
+
+namespace quink {
+
+TexturePool &TexturePool::Instance() {
+    static TexturePool pool;
+    return pool;
+}
+
+void TexturePool::SetBudget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mBudget = bytes;
+    EvictLocked(0);
+}
+
+// bytes of a 4x4 block of the ETC2 and EAC formats, 0 for the others
+static size_t BlockSize(GLenum internalFormat) {
+    switch (internalFormat) {
+        case GL_COMPRESSED_R11_EAC:
+        case GL_COMPRESSED_SIGNED_R11_EAC:
+        case GL_COMPRESSED_RGB8_ETC2:
+        case GL_COMPRESSED_SRGB8_ETC2:
+        case GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+        case GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+            return 8;
+        case GL_COMPRESSED_RG11_EAC:
+        case GL_COMPRESSED_SIGNED_RG11_EAC:
+        case GL_COMPRESSED_RGBA8_ETC2_EAC:
+        case GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+size_t TexturePool::TextureSize(GLsizei width, GLsizei height, GLenum internalFormat,
+        GLsizei levels) {
+    // whole blocks, the same as the data CompressedTexImage2D takes
+    const size_t blockSize = BlockSize(internalFormat);
+    if (blockSize) {
+        size_t total = 0;
+        for (GLsizei i = 0; i < levels; i++) {
+            total += (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockSize;
+            width = width > 1 ? width / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+        }
+        return total;
+    }
+
+    // estimate of what the GPU allocates, 3 component formats are padded
+    double bytesPerPixel;
+    switch (internalFormat) {
+        case GL_R8:
+            bytesPerPixel = 1;
+            break;
+        case GL_RG8:
+        case GL_R16F:
+        case GL_R16UI:
+            bytesPerPixel = 2;
+            break;
+        case GL_RGB8:
+        case GL_SRGB8:
+        case GL_RGBA8:
+        case GL_SRGB8_ALPHA8:
+        case GL_RG16F:
+        case GL_RG16UI:
+        case GL_R32F:
+        case GL_R11F_G11F_B10F:
+        case GL_RGB9_E5:
+        case GL_RGB10_A2:
+            bytesPerPixel = 4;
+            break;
+        case GL_RGB16F:
+        case GL_RGBA16F:
+        case GL_RG32F:
+            bytesPerPixel = 8;
+            break;
+        case GL_RGB32F:
+        case GL_RGBA32F:
+            bytesPerPixel = 16;
+            break;
+        default:
+            bytesPerPixel = 4;
+            break;
+    }
+
+    size_t total = 0;
+    for (GLsizei i = 0; i < levels; i++) {
+        total += static_cast<size_t>(width * (double)height * bytesPerPixel);
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+    }
+    return total;
+}
+
+GLuint TexturePool::Acquire(GLsizei width, GLsizei height, GLenum internalFormat,
+        GLsizei levels) {
+    TRACE_GL_SCOPE("TexturePool::Acquire");
+    std::lock_guard<std::mutex> lock(mLock);
+    const Key key(width, height, internalFormat, levels);
+
+    for (auto it = mFree.rbegin(); it != mFree.rend(); ++it) {
+        if (it->mKey == key) {
+            Entry entry = *it;
+            mFree.erase(std::next(it).base());
+            mStats.mFreeBytes -= entry.mBytes;
+            mInUse[entry.mTexture] = entry;
+            mStats.mReuses++;
+            return entry.mTexture;
+        }
+    }
+
+    Entry entry;
+    entry.mKey = key;
+    entry.mBytes = TextureSize(width, height, internalFormat, levels);
+    EvictLocked(entry.mBytes);
+
+    // errors left over from earlier in the frame would be taken for ours,
+    // report them where they belong
+    GLStats::CheckError("frame before TexturePool::Acquire");
+    glGenTextures(1, &entry.mTexture);
+    GLState::Current().BindTexture(GL_TEXTURE_2D, entry.mTexture);
+    glTexStorage2D(GL_TEXTURE_2D, levels, internalFormat, width, height);
+    // the per call policy has taken the error already, the storage has not
+    // become immutable either way
+    GLint immutable = GL_FALSE;
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_IMMUTABLE_FORMAT, &immutable);
+    if (glGetError() != GL_NO_ERROR || !immutable) {
+        ALOGE("allocate texture %dx%d format 0x%x levels %d failed",
+                width, height, internalFormat, levels);
+        GLState::Current().DeleteTextures(1, &entry.mTexture);
+        return 0;
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    mInUse[entry.mTexture] = entry;
+    mStats.mAllocations++;
+    mStats.mCurrentBytes += entry.mBytes;
+    if (mStats.mCurrentBytes > mStats.mPeakBytes)
+        mStats.mPeakBytes = mStats.mCurrentBytes;
+    return entry.mTexture;
+}
+
+void TexturePool::Release(GLuint texture) {
+    if (!texture)
+        return;
+
+    std::lock_guard<std::mutex> lock(mLock);
+    auto it = mInUse.find(texture);
+    if (it == mInUse.end()) {
+        ALOGE("release texture %u not from the pool", texture);
+        return;
+    }
+    mFree.push_back(it->second);
+    mStats.mFreeBytes += it->second.mBytes;
+    mInUse.erase(it);
+    // the budget may have been exceeded while the texture was in use
+    EvictLocked(0);
+}
+
+void TexturePool::EvictLocked(size_t incoming) {
+    if (!mBudget)
+        return;
+    while (!mFree.empty() && mStats.mCurrentBytes + incoming > mBudget) {
+        Entry &entry = mFree.front();
+        GLState::Current().DeleteTextures(1, &entry.mTexture);
+        mStats.mCurrentBytes -= entry.mBytes;
+        mStats.mFreeBytes -= entry.mBytes;
+        mStats.mEvictions++;
+        mFree.pop_front();
+    }
+}
+
+void TexturePool::Trim() {
+    std::lock_guard<std::mutex> lock(mLock);
+    for (auto &entry : mFree) {
+        GLState::Current().DeleteTextures(1, &entry.mTexture);
+        mStats.mCurrentBytes -= entry.mBytes;
+    }
+    mStats.mFreeBytes = 0;
+    mFree.clear();
+}
+
+void TexturePool::Abandon() {
+    std::lock_guard<std::mutex> lock(mLock);
+    mFree.clear();
+    mInUse.clear();
+    mStats.mCurrentBytes = 0;
+    mStats.mFreeBytes = 0;
+}
+
+TexturePool::Stats TexturePool::GetStats() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mStats;
+}
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "config.h"
+#if HAVE_GLES
+#   include <GLES3/gl3.h>
+#else
+#   define GLFW_INCLUDE_GLCOREARB
+#   define GL_GLEXT_PROTOTYPES
+#   define GLFW_INCLUDE_GLEXT
+#   include <GLFW/glfw3.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+namespace quink {
+
+/* Recycler for immutable (glTexStorage2D) 2D textures.
+ *
+ * Textures are keyed by size, internal format and number of levels. A
+ * released texture goes to a free list and is handed out again by the next
+ * Acquire() with the same key, so switching between images of the same
+ * size never reallocates storage. Free textures are deleted least recently
+ * released first whenever the total size would exceed the budget; textures
+ * in use are never evicted, so the budget may be exceeded temporarily.
+ *
+ * Texture names are shared by the share group, the pool must be used with
+ * a context of the same group current.
+ */
+class TexturePool {
+public:
+    struct Stats {
+        size_t mCurrentBytes = 0;   // in use and free
+        size_t mPeakBytes = 0;
+        size_t mFreeBytes = 0;
+        uint64_t mAllocations = 0;
+        uint64_t mReuses = 0;
+        uint64_t mEvictions = 0;
+    };
+
+    static TexturePool &Instance();
+
+    // 0 disables the budget
+    void SetBudget(size_t bytes);
+
+    GLuint Acquire(GLsizei width, GLsizei height, GLenum internalFormat, GLsizei levels = 1);
+    void Release(GLuint texture);
+    // delete all free textures, e.g. before the context goes away
+    void Trim();
+    // forget every texture without deleting, after the context was lost
+    void Abandon();
+
+    Stats GetStats();
+
+    static size_t TextureSize(GLsizei width, GLsizei height, GLenum internalFormat, GLsizei levels);
+
+private:
+    using Key = std::tuple<GLsizei, GLsizei, GLenum, GLsizei>;
+
+    struct Entry {
+        GLuint mTexture;
+        Key mKey;
+        size_t mBytes;
+    };
+
+    TexturePool() = default;
+
+    void EvictLocked(size_t incoming);
+
+    std::mutex mLock;
+    size_t mBudget = 0;
+    std::map<GLuint, Entry> mInUse;
+    // least recently released first
+    std::list<Entry> mFree;
+    Stats mStats;
+};
+
+}
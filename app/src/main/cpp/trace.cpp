@@ -0,0 +1,340 @@
+#include "trace.h"
+
+#if ENABLE_TRACE
+
+#if HAVE_EGL
+#include <EGL/egl.h>
+#endif
+#if HAVE_GLES
+#   include <GLES3/gl3.h>
+#else
+#   define GLFW_INCLUDE_GLCOREARB
+#   define GL_GLEXT_PROTOTYPES
+#   define GLFW_INCLUDE_GLEXT
+#   include <GLFW/glfw3.h>
+#endif
+
+#ifdef __ANDROID__
+#include <dlfcn.h>
+#endif
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "log.h"
+
+#ifndef GL_DEBUG_SOURCE_APPLICATION
+#define GL_DEBUG_SOURCE_APPLICATION       0x824A
+#endif
+
+namespace quink {
+
+namespace {
+
+// 32 bytes an event, 512 KB a thread unless SetEventsPerThread() says
+// otherwise
+std::atomic<size_t> gEventsPerThread(1 << 14);
+// bumped by Reset(), each owner clears its buffer when it sees the change
+std::atomic<unsigned> gGeneration(0);
+
+struct Event {
+    const char *mName;
+    int64_t mTime;      // ns since trace epoch
+    int64_t mValue;     // counters only
+    char mPhase;        // 'B', 'E' or 'C'
+};
+
+// a thread that recorded into a buffer, from event mFirst on
+struct Owner {
+    int mTid;
+    std::string mName;
+    size_t mFirst;
+};
+
+struct ThreadBuffer {
+    ThreadBuffer(int tid, size_t events) : mEvents(events), mCount(0), mDropped(0) {
+        mOwners.push_back(Owner { tid, std::string(), 0 });
+    }
+
+    // guarded by gRegistryLock, the last one is the current owner
+    std::vector<Owner> mOwners;
+    bool mRetired = false;
+    std::vector<Event> mEvents;
+    // written by the owner thread only, published with release semantics
+    std::atomic<size_t> mCount;
+    std::atomic<size_t> mDropped;
+    // of the last Reset() the events are from
+    std::atomic<unsigned> mGeneration;
+    // owner thread only: scopes recorded and not ended yet, each one keeps
+    // a slot for its 'E', and scopes dropped for lack of room
+    size_t mOpen = 0;
+    size_t mSkipped = 0;
+};
+
+std::mutex gRegistryLock;
+std::vector<std::unique_ptr<ThreadBuffer>> gBuffers;
+int gNextTid = 1;
+const std::chrono::steady_clock::time_point gEpoch = std::chrono::steady_clock::now();
+
+// with gRegistryLock held, by the owner or for a retired buffer
+void Clear(ThreadBuffer *buffer, unsigned generation) {
+    Owner owner = buffer->mOwners.back();
+    owner.mFirst = 0;
+    buffer->mOwners.assign(1, owner);
+    buffer->mOpen = 0;
+    buffer->mSkipped = 0;
+    buffer->mCount.store(0, std::memory_order_relaxed);
+    buffer->mDropped.store(0, std::memory_order_relaxed);
+    buffer->mGeneration.store(generation, std::memory_order_release);
+}
+
+// hands the buffer over to the next new thread when its owner exits, so
+// short lived threads such as the image loaders don't add one each
+struct ThreadSlot {
+    ~ThreadSlot() {
+        if (mBuffer) {
+            std::lock_guard<std::mutex> lock(gRegistryLock);
+            mBuffer->mRetired = true;
+        }
+    }
+
+    ThreadBuffer *mBuffer = nullptr;
+};
+
+thread_local ThreadSlot tSlot;
+
+ThreadBuffer *GetThreadBuffer() {
+    if (!tSlot.mBuffer) {
+        std::lock_guard<std::mutex> lock(gRegistryLock);
+        const unsigned generation = gGeneration.load(std::memory_order_relaxed);
+        for (auto &buffer : gBuffers) {
+            if (buffer->mRetired) {
+                // what the old thread recorded stays under its tid and name
+                buffer->mRetired = false;
+                buffer->mOpen = 0;
+                buffer->mSkipped = 0;
+                const size_t count = buffer->mCount.load(std::memory_order_relaxed);
+                if (buffer->mOwners.back().mFirst == count)
+                    buffer->mOwners.pop_back();
+                buffer->mOwners.push_back(Owner { gNextTid++, std::string(), count });
+                tSlot.mBuffer = buffer.get();
+                if (buffer->mGeneration.load(std::memory_order_relaxed) != generation)
+                    Clear(tSlot.mBuffer, generation);
+                return tSlot.mBuffer;
+            }
+        }
+        gBuffers.emplace_back(new ThreadBuffer(gNextTid++,
+                gEventsPerThread.load(std::memory_order_relaxed)));
+        tSlot.mBuffer = gBuffers.back().get();
+        tSlot.mBuffer->mGeneration.store(generation, std::memory_order_relaxed);
+    }
+    return tSlot.mBuffer;
+}
+
+void Record(const char *name, char phase, int64_t value) {
+    ThreadBuffer *buffer = GetThreadBuffer();
+    const unsigned generation = gGeneration.load(std::memory_order_acquire);
+    if (buffer->mGeneration.load(std::memory_order_relaxed) != generation) {
+        std::lock_guard<std::mutex> lock(gRegistryLock);
+        Clear(buffer, generation);
+    }
+    if (phase == 'E' && buffer->mSkipped) {
+        // its 'B' was dropped
+        buffer->mSkipped--;
+        buffer->mDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    size_t n = buffer->mCount.load(std::memory_order_relaxed);
+    // an 'E' always has its slot, anything else leaves the slots of the
+    // open scopes alone
+    size_t needed = phase == 'E' ? 1 : buffer->mOpen + (phase == 'B' ? 2 : 1);
+    if (n + needed > buffer->mEvents.size()) {
+        if (phase == 'B')
+            buffer->mSkipped++;
+        buffer->mDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (phase == 'B')
+        buffer->mOpen++;
+    else if (phase == 'E' && buffer->mOpen)
+        buffer->mOpen--;
+
+    Event &e = buffer->mEvents[n];
+    e.mName = name;
+    e.mTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - gEpoch).count();
+    e.mValue = value;
+    e.mPhase = phase;
+    buffer->mCount.store(n + 1, std::memory_order_release);
+}
+
+#ifdef __ANDROID__
+struct ATrace {
+    ATrace() {
+        void *lib = dlopen("libandroid.so", RTLD_NOW | RTLD_LOCAL);
+        if (lib) {
+            mBegin = (void (*)(const char *))dlsym(lib, "ATrace_beginSection");
+            mEnd = (void (*)(void))dlsym(lib, "ATrace_endSection");
+        }
+        if (!mBegin || !mEnd)
+            mBegin = nullptr;
+    }
+    void (*mBegin)(const char *) = nullptr;
+    void (*mEnd)(void) = nullptr;
+};
+
+ATrace &GetATrace() {
+    static ATrace atrace;
+    return atrace;
+}
+#endif
+
+using PushDebugGroupFunc = void (*)(GLenum, GLuint, GLsizei, const char *);
+using PopDebugGroupFunc = void (*)(void);
+
+struct DebugGroup {
+    DebugGroup() {
+#if HAVE_EGL
+        mPush = (PushDebugGroupFunc)eglGetProcAddress("glPushDebugGroup");
+        mPop = (PopDebugGroupFunc)eglGetProcAddress("glPopDebugGroup");
+        if (!mPush || !mPop) {
+            mPush = (PushDebugGroupFunc)eglGetProcAddress("glPushDebugGroupKHR");
+            mPop = (PopDebugGroupFunc)eglGetProcAddress("glPopDebugGroupKHR");
+        }
+#endif
+        if (!mPush || !mPop)
+            mPush = nullptr;
+    }
+    PushDebugGroupFunc mPush = nullptr;
+    PopDebugGroupFunc mPop = nullptr;
+};
+
+DebugGroup &GetDebugGroup() {
+    static DebugGroup group;
+    return group;
+}
+
+}
+
+std::atomic<bool> Trace::sEnabled(false);
+
+void Trace::SetEnabled(bool enable) {
+    sEnabled.store(enable, std::memory_order_relaxed);
+}
+
+void Trace::Begin(const char *name, bool gpu) {
+    Record(name, 'B', 0);
+#ifdef __ANDROID__
+    ATrace &atrace = GetATrace();
+    if (atrace.mBegin)
+        atrace.mBegin(name);
+#endif
+    if (gpu) {
+        DebugGroup &group = GetDebugGroup();
+        if (group.mPush)
+            group.mPush(GL_DEBUG_SOURCE_APPLICATION, 0, -1, name);
+    }
+}
+
+void Trace::End(bool gpu) {
+    if (gpu) {
+        DebugGroup &group = GetDebugGroup();
+        if (group.mPush)
+            group.mPop();
+    }
+#ifdef __ANDROID__
+    ATrace &atrace = GetATrace();
+    if (atrace.mBegin)
+        atrace.mEnd();
+#endif
+    Record(nullptr, 'E', 0);
+}
+
+void Trace::Counter(const char *name, long long value) {
+    Record(name, 'C', value);
+}
+
+void Trace::SetThreadName(const char *name) {
+    ThreadBuffer *buffer = GetThreadBuffer();
+    std::lock_guard<std::mutex> lock(gRegistryLock);
+    buffer->mOwners.back().mName = name;
+}
+
+void Trace::SetEventsPerThread(size_t events) {
+    gEventsPerThread.store(std::max<size_t>(events, 16), std::memory_order_relaxed);
+}
+
+void Trace::Reset() {
+    std::lock_guard<std::mutex> lock(gRegistryLock);
+    const unsigned generation = gGeneration.load(std::memory_order_relaxed) + 1;
+    gGeneration.store(generation, std::memory_order_release);
+    // the buffers of running threads are cleared by their owners, the next
+    // time they record; nobody writes to a retired one
+    for (auto &buffer : gBuffers) {
+        if (buffer->mRetired)
+            Clear(buffer.get(), generation);
+    }
+}
+
+bool Trace::Dump(const std::string &path) {
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file) {
+        ALOGE("cannot open trace file %s", path.c_str());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(gRegistryLock);
+    size_t total = 0;
+    const char *sep = "";
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    const unsigned generation = gGeneration.load(std::memory_order_acquire);
+    for (auto &buffer : gBuffers) {
+        // not cleared by its owner since the last Reset()
+        if (buffer->mGeneration.load(std::memory_order_acquire) != generation)
+            continue;
+        size_t n = buffer->mCount.load(std::memory_order_acquire);
+        for (size_t o = 0; o < buffer->mOwners.size(); o++) {
+            const Owner &owner = buffer->mOwners[o];
+            if (!owner.mName.empty()) {
+                fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                        "\"args\":{\"name\":\"%s\"}}", sep, owner.mTid, owner.mName.c_str());
+                sep = ",";
+            }
+            size_t end = o + 1 < buffer->mOwners.size() ? buffer->mOwners[o + 1].mFirst : n;
+            for (size_t i = owner.mFirst; i < end; i++) {
+                const Event &e = buffer->mEvents[i];
+                double ts = e.mTime / 1000.0;
+                if (e.mPhase == 'B') {
+                    fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+                            sep, e.mName, ts, owner.mTid);
+                } else if (e.mPhase == 'E') {
+                    fprintf(file, "%s\n{\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+                            sep, ts, owner.mTid);
+                } else {
+                    fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,"
+                            "\"args\":{\"value\":%" PRId64 "}}", sep, e.mName, ts, owner.mTid, e.mValue);
+                }
+                sep = ",";
+            }
+        }
+        total += n;
+        size_t dropped = buffer->mDropped.load(std::memory_order_relaxed);
+        if (dropped)
+            ALOGD("trace thread %d dropped %zu events", buffer->mOwners.back().mTid, dropped);
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    ALOGD("write %zu trace events to %s", total, path.c_str());
+    return true;
+}
+
+}
+
+#endif
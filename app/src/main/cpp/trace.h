@@ -0,0 +1,90 @@
+#pragma once
+
+#include "config.h"
+
+/* Scoped trace instrumentation.
+ *
+ * With ENABLE_TRACE set to 0 the macros expand to nothing. When compiled in,
+ * a disabled tracer costs one relaxed atomic load per scope.
+ *
+ * Events go into a fixed size buffer owned by the recording thread, so the
+ * hot path takes no lock. The buffer of a thread that exits is taken over
+ * by the next new thread, which appends under a tid of its own, and a full
+ * buffer drops whole scopes, never just their ends. Reset() has every
+ * owner clear its buffer the next time it records. Trace::Dump() writes every buffer as Chrome trace-event JSON
+ * (chrome://tracing, ui.perfetto.dev). On Android the scopes are forwarded
+ * to ATrace as well, and TRACE_GL_SCOPE additionally pushes a GL debug
+ * group so GPU captures line up with the CPU trace.
+ *
+ * Event names are stored by pointer and must be string literals.
+ */
+
+#if ENABLE_TRACE
+
+#include <stddef.h>
+
+#include <atomic>
+#include <string>
+
+namespace quink {
+
+class Trace {
+public:
+    static void SetEnabled(bool enable);
+    static bool IsEnabled() { return sEnabled.load(std::memory_order_relaxed); }
+
+    static void Begin(const char *name, bool gpu);
+    static void End(bool gpu);
+    static void Counter(const char *name, long long value);
+    static void SetThreadName(const char *name);
+    // size of the buffers created from now on, 16K events by default
+    static void SetEventsPerThread(size_t events);
+
+    // should be called with tracing disabled
+    static bool Dump(const std::string &path);
+    static void Reset();
+
+private:
+    static std::atomic<bool> sEnabled;
+};
+
+class TraceScope {
+public:
+    TraceScope(const char *name, bool gpu) :
+        mActive(Trace::IsEnabled()),
+        mGpu(gpu) {
+        if (mActive)
+            Trace::Begin(name, mGpu);
+    }
+
+    ~TraceScope() {
+        if (mActive)
+            Trace::End(mGpu);
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    bool mActive;
+    bool mGpu;
+};
+
+}
+
+#define TRACE_CONCAT_(a, b)     a##b
+#define TRACE_CONCAT(a, b)      TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name)       quink::TraceScope TRACE_CONCAT(traceScope, __LINE__)(name, false)
+#define TRACE_GL_SCOPE(name)    quink::TraceScope TRACE_CONCAT(traceScope, __LINE__)(name, true)
+#define TRACE_COUNTER(name, value) \
+    do { if (quink::Trace::IsEnabled()) quink::Trace::Counter(name, value); } while (0)
+#define TRACE_THREAD_NAME(name) quink::Trace::SetThreadName(name)
+
+#else
+
+#define TRACE_SCOPE(name)           do {} while (0)
+#define TRACE_GL_SCOPE(name)        do {} while (0)
+#define TRACE_COUNTER(name, value)  do {} while (0)
+#define TRACE_THREAD_NAME(name)     do {} while (0)
+
+#endif
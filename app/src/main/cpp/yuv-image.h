@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+
+namespace quink {
+
+// a decoded video frame, planes are uploaded as they are and converted in the shader
+struct YuvImage {
+    enum class Format {
+        I420,   // 8-bit Y, U and V planes
+        NV12,   // 8-bit Y plane and interleaved UV plane
+        P010,   // 16-bit samples with 10 bits in the high bits, Y and UV planes
+    };
+    enum class Matrix {
+        BT709,
+        BT2020,
+    };
+    enum class Transfer {
+        SDR,    // gamma 2.2 encoded
+        PQ,     // SMPTE ST 2084
+        HLG,    // ARIB STD-B67
+    };
+
+    int mWidth = 0;
+    int mHeight = 0;
+    Format mFormat = Format::NV12;
+    Matrix mMatrix = Matrix::BT709;
+    Transfer mTransfer = Transfer::SDR;
+    bool mFullRange = false;
+    // Y, then U and V or UV; strides in bytes, whole samples, chroma is
+    // subsampled 2x2
+    uint8_t *mPlane[3] = {};
+    int mStride[3] = {};
+    // keeps the planes alive, may well be a decoder's buffer
+    std::shared_ptr<void> mOwner;
+
+    int Planes() const { return mFormat == Format::I420 ? 3 : 2; }
+
+    // tightly packed frame in one allocation
+    static std::shared_ptr<YuvImage> Create(int width, int height, Format format) {
+        auto img = std::make_shared<YuvImage>();
+        img->mWidth = width;
+        img->mHeight = height;
+        img->mFormat = format;
+
+        const int sampleSize = format == Format::P010 ? 2 : 1;
+        const int chromaWidth = (width + 1) / 2;
+        const int chromaHeight = (height + 1) / 2;
+        img->mStride[0] = width * sampleSize;
+        if (format == Format::I420)
+            img->mStride[1] = img->mStride[2] = chromaWidth;
+        else
+            img->mStride[1] = chromaWidth * 2 * sampleSize;
+
+        size_t size = (size_t)img->mStride[0] * height;
+        for (int i = 1; i < img->Planes(); i++)
+            size += (size_t)img->mStride[i] * chromaHeight;
+        uint8_t *data = new uint8_t[size];
+        img->mOwner = std::shared_ptr<void>(data, [](void *p) { delete[] static_cast<uint8_t *>(p); });
+        img->mPlane[0] = data;
+        for (int i = 1; i < img->Planes(); i++) {
+            int rows = i == 1 ? height : chromaHeight;
+            img->mPlane[i] = img->mPlane[i - 1] + (size_t)img->mStride[i - 1] * rows;
+        }
+        return img;
+    }
+};
+
+}